@@ -209,8 +209,31 @@ double ASObject::toNumber()
 	return 0;
 }
 
-obj_var* variables_map::findObjVar(const tiny_string& n, const nsNameAndKind& ns, bool create, bool borrowedMode)
+obj_var* variables_map::findObjVar(const tiny_string& name, const nsNameAndKind& ns, bool create, bool borrowedMode)
 {
+	//A name that is not in the table can't be in the map
+	const uint32_t n=(create)?Atoms::acquire(name):Atoms::find(name);
+	if(n==Atoms::INVALID)
+		return NULL;
+	//The reference taken by acquire is only needed during the lookup, the map takes its own
+	obj_var* ret=findObjVar(n,ns,create,borrowedMode);
+	if(create)
+		Atoms::decRef(n);
+	return ret;
+}
+
+obj_var* variables_map::findObjVar(uint32_t n, const nsNameAndKind& ns, bool create, bool borrowedMode)
+{
+	if(shape)
+	{
+		const int32_t index=shape->findTrait(n,ns,borrowedMode);
+		if(index>=0)
+			return &values[index];
+		if(!create)
+			return NULL;
+		unshare();
+	}
+
 	const var_iterator ret_begin=Variables.lower_bound(n);
 	//This actually look for the first different name, if we accept also previous levels
 	//Otherwise we are just doing equal_range
@@ -231,6 +254,11 @@ obj_var* variables_map::findObjVar(const tiny_string& n, const nsNameAndKind& ns
 	if(create)
 	{
 		//borrowedMode is used to create borrowed traits
+		if(borrowedMode)
+			ATOMIC_INCREMENT(Class_base::traitsVersion);
+		//The layout is not shared anymore and the indexes move
+		layoutChanged();
+		Atoms::incRef(n);
 		var_iterator inserted=Variables.insert(ret_begin,make_pair(n, variable(ns, (borrowedMode)?BORROWED_TRAIT:OWNED_TRAIT) ) );
 		return &inserted->second.var;
 	}
@@ -272,6 +300,8 @@ void ASObject::setMethodByQName(const tiny_string& name, const nsNameAndKind& ns
 		assert_and_throw(o==obj->var);
 		return;
 	}
+	if(isBorrowed)
+		ATOMIC_INCREMENT(Class_base::traitsVersion);
 	obj->var=o;
 }
 
@@ -294,6 +324,8 @@ void ASObject::setGetterByQName(const tiny_string& name, const nsNameAndKind& ns
 		assert_and_throw(o==obj->getter);
 		return;
 	}
+	if(isBorrowed)
+		ATOMIC_INCREMENT(Class_base::traitsVersion);
 	obj->getter=o;
 }
 
@@ -316,6 +348,8 @@ void ASObject::setSetterByQName(const tiny_string& name, const nsNameAndKind& ns
 		assert_and_throw(o==obj->setter);
 		return;
 	}
+	if(isBorrowed)
+		ATOMIC_INCREMENT(Class_base::traitsVersion);
 	obj->setter=o;
 }
 
@@ -456,23 +490,11 @@ void ASObject::setVariableByQName(const tiny_string& name, const tiny_string& ns
 
 void variables_map::killObjVar(const multiname& mname)
 {
-	tiny_string name;
-	switch(mname.name_type)
-	{
-		case multiname::NAME_INT:
-			name=tiny_string(mname.name_i);
-			break;
-		case multiname::NAME_NUMBER:
-			name=tiny_string(mname.name_d);
-			break;
-		case multiname::NAME_STRING:
-			name=mname.name_s;
-			break;
-		default:
-			assert_and_throw("Unexpected name kind" && false);
-	}
-
+	if(shape)
+		unshare();
 
+	assert_and_throw(mname.name_type!=multiname::NAME_OBJECT);
+	const uint32_t name=getNameAtom(mname,false);
 	const pair<var_iterator, var_iterator> ret=Variables.equal_range(name);
 	assert_and_throw(ret.first!=ret.second);
 
@@ -487,6 +509,8 @@ void variables_map::killObjVar(const multiname& mname)
 			if(start->second.ns==ns)
 			{
 				Variables.erase(start);
+				Atoms::decRef(name);
+				layoutChanged();
 				return;
 			}
 		}
@@ -495,8 +519,15 @@ void variables_map::killObjVar(const multiname& mname)
 	throw RunTimeException("Variable to kill not found");
 }
 
-obj_var* variables_map::findObjVar(const multiname& mname, bool create, bool borrowedMode)
+uint32_t variables_map::getNameAtom(const multiname& mname, bool create)
 {
+	if(mname.name_type==multiname::NAME_STRING && mname.name_atom!=Atoms::INVALID)
+	{
+		Atoms::lookupByAtom();
+		if(create)
+			Atoms::incRef(mname.name_atom);
+		return mname.name_atom;
+	}
 	tiny_string name;
 	switch(mname.name_type)
 	{
@@ -515,13 +546,40 @@ obj_var* variables_map::findObjVar(const multiname& mname, bool create, bool bor
 		default:
 			assert_and_throw("Unexpected name kind" && false);
 	}
+	return (create)?Atoms::acquire(name):Atoms::find(name);
+}
+
+obj_var* variables_map::findObjVar(const multiname& mname, bool create, bool borrowedMode)
+{
+	assert_and_throw(!mname.ns.empty());
+	const uint32_t name=getNameAtom(mname,create);
+	//A name that is not in the table can't be in the map
+	if(name==Atoms::INVALID)
+		return NULL;
+	//The reference taken by getNameAtom is only needed during the lookup, the map takes its own
+	obj_var* ret=findObjVar(name,mname.ns,create,borrowedMode);
+	if(create)
+		Atoms::decRef(name);
+	return ret;
+}
+
+obj_var* variables_map::findObjVar(uint32_t name, const std::vector<nsNameAndKind>& nsSet, bool create, bool borrowedMode)
+{
+	if(shape)
+	{
+		const int32_t index=shape->findTrait(name,nsSet,borrowedMode);
+		if(index>=0)
+			return &values[index];
+		if(!create)
+			return NULL;
+		unshare();
+	}
 
 	const var_iterator ret_begin=Variables.lower_bound(name);
 	//This actually look for the first different name, if we accept also previous levels
 	//Otherwise we are just doing equal_range
 	const var_iterator ret_end=Variables.upper_bound(name);
 
-	assert_and_throw(!mname.ns.empty());
 	var_iterator ret=ret_begin;
 	for(;ret!=ret_end;ret++)
 	{
@@ -531,7 +589,7 @@ obj_var* variables_map::findObjVar(const multiname& mname, bool create, bool bor
 			continue;
 		//Check if one the namespace is already present
 		//We can use binary search, as the namespace are ordered
-		if(binary_search(mname.ns.begin(),mname.ns.end(),ret->second.ns))
+		if(binary_search(nsSet.begin(),nsSet.end(),ret->second.ns))
 			return &ret->second.var;
 	}
 
@@ -539,7 +597,12 @@ obj_var* variables_map::findObjVar(const multiname& mname, bool create, bool bor
 	//TODO: HACK: this is needed if the property should be present but it's not
 	if(create)
 	{
-		if(mname.ns.size()>1)
+		if(borrowedMode)
+			ATOMIC_INCREMENT(Class_base::traitsVersion);
+		//The layout is not shared anymore and the indexes move
+		layoutChanged();
+		Atoms::incRef(name);
+		if(nsSet.size()>1)
 		{
 			//Hack, insert with empty name
 			//Here the object MUST exist
@@ -547,7 +610,7 @@ obj_var* variables_map::findObjVar(const multiname& mname, bool create, bool bor
 						variable(nsNameAndKind("",NAMESPACE), (borrowedMode)?BORROWED_TRAIT:OWNED_TRAIT)));
 			return &inserted->second.var;
 		}
-		var_iterator inserted=Variables.insert(ret,make_pair(name, variable(mname.ns[0], (borrowedMode)?BORROWED_TRAIT:OWNED_TRAIT)));
+		var_iterator inserted=Variables.insert(ret,make_pair(name, variable(nsSet[0], (borrowedMode)?BORROWED_TRAIT:OWNED_TRAIT)));
 		return &inserted->second.var;
 	}
 	else
@@ -610,7 +673,7 @@ void ASObject::initSlot(unsigned int n, const multiname& name)
 #ifndef NDEBUG
 	assert(!initialized);
 #endif
-	Variables.initSlot(n,name.name_s,name.ns[0]);
+	Variables.initSlot(n,name);
 }
 
 //In all the getter function we first ask the interface, so that special handling (e.g. Array)
@@ -709,7 +772,7 @@ void ASObject::check() const
 
 			if(it->second.var.var==NULL || next->second.var.var==NULL)
 			{
-				cout << it->first << endl;
+				cout << Atoms::getString(it->first) << endl;
 				cout << it->second.var.var << ' ' << it->second.var.setter << ' ' << it->second.var.getter << endl;
 				cout << next->second.var.var << ' ' << next->second.var.setter << ' ' << next->second.var.getter << endl;
 				abort();
@@ -717,7 +780,7 @@ void ASObject::check() const
 
 			if(it->second.var.var->getObjectType()!=T_FUNCTION || next->second.var.var->getObjectType()!=T_FUNCTION)
 			{
-				cout << it->first << endl;
+				cout << Atoms::getString(it->first) << endl;
 				abort();
 			}
 		}
@@ -728,9 +791,15 @@ void ASObject::check() const
 
 void variables_map::dumpVariables()
 {
+	for(unsigned int i=0;i<values.size();i++)
+	{
+		const instance_shape::trait& t=shape->traits[i];
+		LOG(LOG_NO_INFO, ((t.kind==OWNED_TRAIT)?"O: ":"B: ") <<  '[' << t.ns.name << "] "<< Atoms::getString(t.name) << ' ' <<
+			values[i].var << ' ' << values[i].setter << ' ' << values[i].getter);
+	}
 	var_iterator it=Variables.begin();
 	for(;it!=Variables.end();it++)
-		LOG(LOG_NO_INFO, ((it->second.kind==OWNED_TRAIT)?"O: ":"B: ") <<  '[' << it->second.ns.name << "] "<< it->first << ' ' << 
+		LOG(LOG_NO_INFO, ((it->second.kind==OWNED_TRAIT)?"O: ":"B: ") <<  '[' << it->second.ns.name << "] "<< Atoms::getString(it->first) << ' ' << 
 			it->second.var.var << ' ' << it->second.var.setter << ' ' << it->second.var.getter);
 }
 
@@ -753,7 +822,21 @@ void variables_map::destroyContents()
 		if(it->second.var.getter)
 			it->second.var.getter->decRef();
 	}
+	for(unsigned int i=0;i<values.size();i++)
+	{
+		if(values[i].var)
+			values[i].var->decRef();
+		if(values[i].setter)
+			values[i].setter->decRef();
+		if(values[i].getter)
+			values[i].getter->decRef();
+	}
+	releaseNames();
 	Variables.clear();
+	slots_vars.clear();
+	values.clear();
+	shape=NULL;
+	layoutChanged();
 }
 
 ASObject::ASObject(Manager* m):type(T_OBJECT),ref_count(1),manager(m),cur_level(0),prototype(NULL),implEnable(true)
@@ -779,6 +862,9 @@ ASObject::ASObject(const ASObject& o):type(o.type),ref_count(1),manager(NULL),cu
 
 void ASObject::setPrototype(Class_base* c)
 {
+	//The shape belongs to the class
+	if(Variables.shape)
+		Variables.unshare();
 	if(prototype)
 	{
 		prototype->abandonObject(this);
@@ -801,6 +887,36 @@ ASObject::~ASObject()
 	}
 }
 
+bool ASObject::enumerateRefs(std::vector<ASObject*>& refs)
+{
+	for(unsigned int i=0;i<Variables.values.size();i++)
+	{
+		const obj_var& v=Variables.values[i];
+		if(v.var)
+			refs.push_back(v.var);
+		if(v.setter)
+			refs.push_back(v.setter);
+		if(v.getter)
+			refs.push_back(v.getter);
+	}
+	variables_map::const_var_iterator it=Variables.Variables.begin();
+	for(;it!=Variables.Variables.end();++it)
+	{
+		if(it->second.var.var)
+			refs.push_back(it->second.var.var);
+		if(it->second.var.setter)
+			refs.push_back(it->second.var.setter);
+		if(it->second.var.getter)
+			refs.push_back(it->second.var.getter);
+	}
+	return true;
+}
+
+void ASObject::clearRefs()
+{
+	Variables.destroyContents();
+}
+
 int ASObject::_maxlevel()
 {
 	return (prototype)?(prototype->max_level):0;
@@ -828,12 +944,16 @@ Class_base* ASObject::getActualPrototype() const
 	return ret;
 }
 
-void variables_map::initSlot(unsigned int n, const tiny_string& name, const nsNameAndKind& ns)
+void variables_map::initSlot(unsigned int n, const multiname& name)
 {
+	if(shape)
+		unshare();
+
 	if(n>slots_vars.size())
 		slots_vars.resize(n,Variables.end());
 
-	pair<var_iterator, var_iterator> ret=Variables.equal_range(name);
+	const nsNameAndKind& ns=name.ns[0];
+	pair<var_iterator, var_iterator> ret=Variables.equal_range(getNameAtom(name,false));
 	if(ret.first!=ret.second)
 	{
 		//Check if this namespace is already present
@@ -854,7 +974,18 @@ void variables_map::initSlot(unsigned int n, const tiny_string& name, const nsNa
 
 void variables_map::setSlot(unsigned int n,ASObject* o)
 {
-	if(n-1<slots_vars.size())
+	if(shape)
+	{
+		if(n-1>=shape->slots.size())
+			throw RunTimeException("setSlot out of bounds");
+		assert_and_throw(shape->slots[n-1]!=instance_shape::NO_TRAIT);
+		obj_var& v=values[shape->slots[n-1]];
+		if(v.setter)
+			throw UnsupportedException("setSlot has setters");
+		v.var->decRef();
+		v.var=o;
+	}
+	else if(n-1<slots_vars.size())
 	{
 		assert_and_throw(slots_vars[n-1]!=Variables.end());
 		if(slots_vars[n-1]->second.var.setter)
@@ -866,18 +997,167 @@ void variables_map::setSlot(unsigned int n,ASObject* o)
 		throw RunTimeException("setSlot out of bounds");
 }
 
-obj_var* variables_map::getValueAt(unsigned int index)
+void variables_map::share(const instance_shape* s)
 {
-	//TODO: CHECK behaviour on overridden methods
-	if(index<Variables.size())
+	assert(s->matches(*this));
+	values.resize(Variables.size());
+	var_iterator it=Variables.begin();
+	for(unsigned int i=0;it!=Variables.end();++it,i++)
+		values[i]=it->second.var;
+	//The references are now owned by values, the names by the shape
+	releaseNames();
+	Variables.clear();
+	slots_vars.clear();
+	shape=s;
+	layoutChanged();
+}
+
+void variables_map::unshare()
+{
+	assert(Variables.empty());
+	vector<var_iterator> positions(values.size());
+	for(unsigned int i=0;i<values.size();i++)
+	{
+		const instance_shape::trait& t=shape->traits[i];
+		//Traits are sorted, so each one goes at the end
+		Atoms::incRef(t.name);
+		positions[i]=Variables.insert(Variables.end(),make_pair(t.name,variable(t.ns,t.kind)));
+		positions[i]->second.var=values[i];
+	}
+	slots_vars.resize(shape->slots.size(),Variables.end());
+	for(unsigned int i=0;i<shape->slots.size();i++)
 	{
-		var_iterator it=Variables.begin();
+		if(shape->slots[i]!=instance_shape::NO_TRAIT)
+			slots_vars[i]=positions[shape->slots[i]];
+	}
+	values.clear();
+	shape=NULL;
+	layoutChanged();
+}
+
+void variables_map::releaseNames()
+{
+	var_iterator it=Variables.begin();
+	for(;it!=Variables.end();++it)
+		Atoms::decRef(it->first);
+}
 
-		for(unsigned int i=0;i<index;i++)
-			it++;
+instance_shape::instance_shape(const variables_map& v)
+{
+	assert(v.shape==NULL);
+	traits.reserve(v.Variables.size());
+	variables_map::const_var_iterator it=v.Variables.begin();
+	for(;it!=v.Variables.end();++it)
+	{
+		Atoms::incRef(it->first);
+		traits.push_back(trait(it->first,it->second.ns,it->second.kind));
+	}
+	slots.resize(v.slots_vars.size(),NO_TRAIT);
+	for(unsigned int i=0;i<v.slots_vars.size();i++)
+	{
+		if(v.slots_vars[i]==v.Variables.end())
+			continue;
+		variables_map::const_var_iterator slot=v.slots_vars[i];
+		slots[i]=distance(v.Variables.begin(),slot);
+	}
+}
 
-		return &it->second.var;
+bool instance_shape::matches(const variables_map& v) const
+{
+	if(v.shape!=NULL || v.Variables.size()!=traits.size() || v.slots_vars.size()!=slots.size())
+		return false;
+	variables_map::const_var_iterator it=v.Variables.begin();
+	for(unsigned int i=0;it!=v.Variables.end();++it,i++)
+	{
+		const trait& t=traits[i];
+		if(it->second.kind!=t.kind || !(it->second.ns==t.ns) || it->first!=t.name)
+			return false;
+	}
+	//Each slot must refer to the same trait. Traits are unique by name, namespace and kind
+	for(unsigned int i=0;i<slots.size();i++)
+	{
+		if(v.slots_vars[i]==v.Variables.end())
+		{
+			if(slots[i]!=NO_TRAIT)
+				return false;
+			continue;
+		}
+		if(slots[i]==NO_TRAIT)
+			return false;
+		const trait& t=traits[slots[i]];
+		const variables_map::const_var_iterator slot=v.slots_vars[i];
+		if(slot->second.kind!=t.kind || !(slot->second.ns==t.ns) || slot->first!=t.name)
+			return false;
 	}
+	return true;
+}
+
+instance_shape::~instance_shape()
+{
+	for(uint32_t i=0;i<traits.size();i++)
+		Atoms::decRef(traits[i].name);
+}
+
+uint32_t instance_shape::firstTrait(uint32_t name) const
+{
+	//Binary search, traits are sorted by atom
+	uint32_t begin=0;
+	uint32_t end=traits.size();
+	while(begin<end)
+	{
+		const uint32_t mid=(begin+end)/2;
+		if(traits[mid].name<name)
+			begin=mid+1;
+		else
+			end=mid;
+	}
+	return begin;
+}
+
+int32_t instance_shape::findTrait(uint32_t name, const nsNameAndKind& ns, bool borrowedMode) const
+{
+	const TRAIT_KIND kind=(borrowedMode)?BORROWED_TRAIT:OWNED_TRAIT;
+	for(uint32_t i=firstTrait(name);i<traits.size() && traits[i].name==name;i++)
+	{
+		if(traits[i].kind==kind && traits[i].ns==ns)
+			return i;
+	}
+	return -1;
+}
+
+int32_t instance_shape::findTrait(uint32_t name, const std::vector<nsNameAndKind>& nsSet, bool borrowedMode) const
+{
+	const TRAIT_KIND kind=(borrowedMode)?BORROWED_TRAIT:OWNED_TRAIT;
+	for(uint32_t i=firstTrait(name);i<traits.size() && traits[i].name==name;i++)
+	{
+		//The namespaces are ordered, like in findObjVar
+		if(traits[i].kind==kind && binary_search(nsSet.begin(),nsSet.end(),traits[i].ns))
+			return i;
+	}
+	return -1;
+}
+
+variables_map::var_iterator variables_map::seek(unsigned int index)
+{
+	//for..in asks for the same index or the following one, so restart only when going back
+	if(!cursorValid || index<cursorIndex)
+	{
+		cursor=Variables.begin();
+		cursorIndex=0;
+		cursorValid=true;
+	}
+	for(;cursorIndex<index;cursorIndex++)
+		++cursor;
+	return cursor;
+}
+
+obj_var* variables_map::getValueAt(unsigned int index)
+{
+	//TODO: CHECK behaviour on overridden methods
+	if(shape && index<values.size())
+		return &values[index];
+	else if(index<Variables.size())
+		return &seek(index)->second.var;
 	else
 		throw RunTimeException("getValueAt out of bounds");
 }
@@ -906,15 +1186,10 @@ ASObject* ASObject::getValueAt(int index)
 tiny_string variables_map::getNameAt(unsigned int index)
 {
 	//TODO: CHECK behaviour on overridden methods
-	if(index<Variables.size())
-	{
-		var_iterator it=Variables.begin();
-
-		for(unsigned int i=0;i<index;i++)
-			it++;
-
-		return it->first;
-	}
+	if(shape && index<values.size())
+		return Atoms::getString(shape->traits[index].name);
+	else if(index<Variables.size())
+		return Atoms::getString(seek(index)->first);
 	else
 		throw RunTimeException("getNameAt out of bounds");
 }
@@ -22,6 +22,7 @@
 
 #include "compat.h"
 #include "swftypes.h"
+#include "threading.h"
 #include <map>
 
 #define ASFUNCTION(name) \
@@ -44,6 +45,7 @@ class Manager;
 template<class T> class Class;
 class Class_base;
 class ABCContext;
+class CycleCollector;
 
 struct obj_var
 {
@@ -65,6 +67,43 @@ struct variable
 	variable(const nsNameAndKind& _ns, TRAIT_KIND _k):ns(_ns),kind(_k){}
 };
 
+class variables_map;
+
+/*
+	Layout of the traits of the instances of a class, the equivalent of a hidden class.
+	Instances built by the same class get the same variables in the same order, so the names,
+	namespaces and slots are described once here and the instances only keep a flat array
+	of values. An instance goes back to its own map as soon as a variable is added or
+	removed, which is what happens with expando properties on dynamic classes
+*/
+struct instance_shape
+{
+	struct trait
+	{
+		//The atom of the name, the shape holds a reference to it
+		uint32_t name;
+		nsNameAndKind ns;
+		TRAIT_KIND kind;
+		trait(uint32_t n, const nsNameAndKind& _ns, TRAIT_KIND k):name(n),ns(_ns),kind(k){}
+	};
+	static const uint32_t NO_TRAIT=0xffffffff;
+private:
+	uint32_t firstTrait(uint32_t name) const;
+	instance_shape(const instance_shape&);
+public:
+	//In the order of the variables map, so sorted by atom
+	std::vector<trait> traits;
+	//Index in traits of each slot, NO_TRAIT if the slot has not been initialized
+	std::vector<uint32_t> slots;
+	instance_shape(const variables_map& v);
+	~instance_shape();
+	//The map has exactly the same traits and slots
+	bool matches(const variables_map& v) const;
+	//Index of the trait, or -1
+	int32_t findTrait(uint32_t name, const nsNameAndKind& ns, bool borrowedMode) const;
+	int32_t findTrait(uint32_t name, const std::vector<nsNameAndKind>& nsSet, bool borrowedMode) const;
+};
+
 class variables_map
 {
 //ASObject knows how to use its variable_map
@@ -75,27 +114,59 @@ friend class Class_base;
 friend class InterfaceClass;
 //ABCContext uses findObjVar when building and linking traits
 friend class ABCContext;
+//ABCVm uses findObjVar to fill the inline caches
+friend class ABCVm;
+//The shape describes the layout of the map
+friend struct instance_shape;
 private:
-	std::multimap<tiny_string,variable> Variables;
-	typedef std::multimap<tiny_string,variable>::iterator var_iterator;
-	typedef std::multimap<tiny_string,variable>::const_iterator const_var_iterator;
+	//Variables are keyed by the atom of their name, each key holds a reference to the atom
+	std::multimap<uint32_t,variable> Variables;
+	typedef std::multimap<uint32_t,variable>::iterator var_iterator;
+	typedef std::multimap<uint32_t,variable>::const_iterator const_var_iterator;
 	std::vector<var_iterator> slots_vars;
+	//When the layout is shared the variables are in values, in the order of the traits of the
+	//shape, and Variables and slots_vars are empty
+	const instance_shape* shape;
+	std::vector<obj_var> values;
+	//Position of the last access by index
+	var_iterator cursor;
+	unsigned int cursorIndex;
+	bool cursorValid;
+	var_iterator seek(unsigned int index);
+	void layoutChanged()
+	{
+		cursorValid=false;
+	}
+	//Moves the variables to the flat array of the shape, which must match
+	void share(const instance_shape* s);
+	//Moves the variables back to the map, before it is modified
+	void unshare();
+	//Drops the references of the keys, before Variables is cleared
+	void releaseNames();
+	//The atom of the name, INVALID if it's not in the table, as no map can have it then.
+	//With create the name is added if needed and the returned atom holds a reference
+	static uint32_t getNameAtom(const multiname& mname, bool create);
 	//When findObjVar is invoked with create=true the pointer returned is garanteed to be valid
 	obj_var* findObjVar(const tiny_string& name, const nsNameAndKind& ns, bool create, bool borrowedMode);
 	obj_var* findObjVar(const multiname& mname, bool create, bool borrowedMode);
+	obj_var* findObjVar(uint32_t name, const nsNameAndKind& ns, bool create, bool borrowedMode);
+	obj_var* findObjVar(uint32_t name, const std::vector<nsNameAndKind>& nsSet, bool create, bool borrowedMode);
 	void killObjVar(const multiname& mname);
 	ASObject* getSlot(unsigned int n)
 	{
+		if(shape)
+			return values[shape->slots[n-1]].var;
 		return slots_vars[n-1]->second.var.var;
 	}
 	void setSlot(unsigned int n,ASObject* o);
-	void initSlot(unsigned int n,const tiny_string& name, const nsNameAndKind& ns);
+	void initSlot(unsigned int n,const multiname& name);
 	int size() const
 	{
-		return Variables.size();
+		return (shape)?values.size():Variables.size();
 	}
 	tiny_string getNameAt(unsigned int i);
 	obj_var* getValueAt(unsigned int i);
+	variables_map():shape(NULL),cursorIndex(0),cursorValid(false){}
 	~variables_map();
 public:
 	void dumpVariables();
@@ -108,8 +179,14 @@ friend class ASObject;
 private:
 	std::vector<ASObject*> available;
 	uint32_t maxCache;
+	//Only allocated for managers used by more than one thread
+	Mutex* mutex;
 public:
-	Manager(uint32_t m):maxCache(m){}
+	Manager(uint32_t m, bool shared=false):maxCache(m),mutex(shared?new Mutex("Manager"):NULL){}
+	~Manager()
+	{
+		delete mutex;
+	}
 template<class T>
 	T* get();
 	void put(ASObject* o);
@@ -123,6 +200,7 @@ friend class ABCContext;
 friend class Class_base; //Needed for forced cleanup
 friend class InterfaceClass;
 friend class IFunction; //Needed for clone
+friend class CycleCollector; //Needs the reference count and the edges
 CLASSBUILDABLE(ASObject);
 protected:
 	//ASObject* asprototype; //HUMM.. ok the prototype, actually class, should be renamed
@@ -132,6 +210,17 @@ protected:
 	ASObject(const ASObject& o);
 	virtual ~ASObject();
 	SWFOBJECT_TYPE type;
+	/* Used by the cycle collector: appends every object this one holds a counted
+	   reference to. Missing an edge is safe, reporting one that is not counted is not.
+	   Returns false if the object must never be considered garbage */
+	virtual bool enumerateRefs(std::vector<ASObject*>& refs);
+	//Drops all the references reported by enumerateRefs
+	virtual void clearRefs();
+	/* Appends the objects this one points to without holding a reference. They are kept
+	   alive together with this object, but their reference counts are left alone */
+	virtual void enumerateLinks(std::vector<ASObject*>& links)
+	{
+	}
 private:
 	ATOMIC_INT32(ref_count);
 	Manager* manager;
@@ -276,25 +365,39 @@ public:
 
 inline void Manager::put(ASObject* o)
 {
+	if(mutex)
+		mutex->lock();
 	if(available.size()>maxCache)
+	{
+		if(mutex)
+			mutex->unlock();
 		delete o;
-	else
-		available.push_back(o);
+		return;
+	}
+	available.push_back(o);
+	if(mutex)
+		mutex->unlock();
 }
 
 template<class T>
 T* Manager::get()
 {
+	if(mutex)
+		mutex->lock();
 	if(available.size())
 	{
 		T* ret=static_cast<T*>(available.back());
 		available.pop_back();
+		if(mutex)
+			mutex->unlock();
 		ret->incRef();
 		//std::cout << "getting[" << name << "] " << ret << std::endl;
 		return ret;
 	}
 	else
 	{
+		if(mutex)
+			mutex->unlock();
 		T* ret=Class<T>::getInstanceS(this);
 		//std::cout << "newing" << ret << std::endl;
 		return ret;
@@ -26,19 +26,154 @@
 #include "logger.h"
 #include "geometry.h"
 #include "backends/rendering.h"
+#include "backends/renderer.h"
 #include "compat.h"
 
 using namespace std;
 using namespace lightspark;
 
+extern TLSDATA RenderThread* rt;
+
+bool GeomShape::benchmarkTessellation=false;
+
+namespace
+{
+//Totals of the tessellation benchmark, shapes may be built by any thread
+struct tessellation_stats
+{
+	Mutex mutex;
+	uint32_t shapes;
+	uint32_t mismatches;
+	uint64_t triangles[2];
+	uint64_t time[2];
+	tessellation_stats():mutex("Tessellation benchmark"),shapes(0),mismatches(0)
+	{
+		triangles[0]=triangles[1]=0;
+		time[0]=time[1]=0;
+	}
+};
+tessellation_stats tessellationStats;
+
+//Output of the GLU tessellator, which is only kept as a reference for the benchmark
+struct glu_tessellation
+{
+	GLenum target;
+	std::vector<Vector2> triangles;
+	std::vector<std::vector<Vector2> > strips;
+	std::vector<std::vector<Vector2> > fans;
+	std::vector<Vector2*> tmpVertices;
+	glu_tessellation():target(0){}
+	double area() const;
+};
+
+void CALLBACK GLUCallbackBegin(GLenum type, glu_tessellation* obj)
+{
+	assert_and_throw(obj->target==0);
+	if(type==GL_TRIANGLE_FAN)
+		obj->fans.push_back(vector<Vector2>());
+	else if(type==GL_TRIANGLE_STRIP)
+		obj->strips.push_back(vector<Vector2>());
+	else if(type!=GL_TRIANGLES)
+		::abort();
+	obj->target=type;
+}
+
+void CALLBACK GLUCallbackVertex(Vector2* vertexData, glu_tessellation* obj)
+{
+	assert_and_throw(obj->target!=0);
+	if(obj->target==GL_TRIANGLE_FAN)
+		obj->fans.back().push_back(*vertexData);
+	else if(obj->target==GL_TRIANGLE_STRIP)
+		obj->strips.back().push_back(*vertexData);
+	else
+		obj->triangles.push_back(*vertexData);
+}
+
+void CALLBACK GLUCallbackEnd(glu_tessellation* obj)
+{
+	assert_and_throw(obj->target!=0);
+	obj->target=0;
+}
+
+void CALLBACK GLUCallbackCombine(GLdouble coords[3], void* vertex_data[4],
+				   GLfloat weight[4], Vector2** outData, glu_tessellation* obj)
+{
+	//No real operations, apart from generating a new vertex at the passed coordinates
+	obj->tmpVertices.push_back(new Vector2(coords[0],coords[1]));
+	*outData=obj->tmpVertices.back();
+}
+
+void tessellateGLU(const vector<vector<Vector2> >& outlines, glu_tessellation& out)
+{
+	GLUtesselator* tess=gluNewTess();
+
+	gluTessCallback(tess,GLU_TESS_BEGIN_DATA,(void(CALLBACK *)())GLUCallbackBegin);
+	gluTessCallback(tess,GLU_TESS_VERTEX_DATA,(void(CALLBACK *)())GLUCallbackVertex);
+	gluTessCallback(tess,GLU_TESS_END_DATA,(void(CALLBACK *)())GLUCallbackEnd);
+	gluTessCallback(tess,GLU_TESS_COMBINE_DATA,(void(CALLBACK *)())GLUCallbackCombine);
+	gluTessProperty(tess,GLU_TESS_WINDING_RULE,GLU_TESS_WINDING_ODD);
+
+	vector<GLdouble*> tmpCoord;
+	gluTessBeginPolygon(tess,&out);
+	for(unsigned int i=0;i<outlines.size();i++)
+	{
+		if(outlines[i].front()!=outlines[i].back())
+			continue;
+		gluTessBeginContour(tess);
+			//First and last vertex are automatically linked
+			for(unsigned int j=1;j<outlines[i].size();j++)
+			{
+				GLdouble* loc=new GLdouble[3];
+				loc[0]=outlines[i][j].x;
+				loc[1]=outlines[i][j].y;
+				loc[2]=0;
+				tmpCoord.push_back(loc);
+				//As the data we pass the Vector2 pointer
+				gluTessVertex(tess,loc,const_cast<Vector2*>(&outlines[i][j]));
+			}
+		gluTessEndContour(tess);
+	}
+	gluTessEndPolygon(tess);
+
+	for(unsigned int i=0;i<tmpCoord.size();i++)
+		delete[] tmpCoord[i];
+	for(unsigned int i=0;i<out.tmpVertices.size();i++)
+		delete out.tmpVertices[i];
+	out.tmpVertices.clear();
+
+	gluDeleteTess(tess);
+}
+
+double triangleArea(const Vector2& a, const Vector2& b, const Vector2& c)
+{
+	return fabs((double(b.x)-a.x)*(double(c.y)-a.y)-(double(c.x)-a.x)*(double(b.y)-a.y))/2;
+}
+
+double glu_tessellation::area() const
+{
+	double ret=0;
+	for(unsigned int i=0;i+2<triangles.size();i+=3)
+		ret+=triangleArea(triangles[i],triangles[i+1],triangles[i+2]);
+	for(unsigned int i=0;i<strips.size();i++)
+	{
+		for(unsigned int j=2;j<strips[i].size();j++)
+			ret+=triangleArea(strips[i][j-2],strips[i][j-1],strips[i][j]);
+	}
+	for(unsigned int i=0;i<fans.size();i++)
+	{
+		for(unsigned int j=2;j<fans[i].size();j++)
+			ret+=triangleArea(fans[i][0],fans[i][j-1],fans[i][j]);
+	}
+	return ret;
+}
+
+};
+
 /*! \brief Renders the shape interior and outline setting the correct
 * *        parameters for the shader
 * * \param x Optional x translation
 * * \param y Optional y translation */
 
-extern TLSDATA RenderThread* rt;
-
-
 void GeomShape::Render(int x, int y) const
 {
 	if(outlines.empty())
@@ -47,67 +182,24 @@ void GeomShape::Render(int x, int y) const
 		return;
 	}
 
+	IRenderer* renderer=rt->renderer;
 	bool filled=false;
 	if(hasFill && color)
 	{
 		if(!rt->materialOverride)
-			style->setFragmentProgram();
+			renderer->setFillStyle(*style);
 
-		//Render the strips
-		for(unsigned int i=0;i<triangle_strips.size();i++)
-		{
-			glBegin(GL_TRIANGLE_STRIP);
-			for(unsigned int j=0;j<triangle_strips[i].size();j++)
-				glVertex2i(triangle_strips[i][j].x+x,triangle_strips[i][j].y+y);
-			glEnd();
-		}
-		
-		//Render the fans
-		for(unsigned int i=0;i<triangle_fans.size();i++)
-		{
-			glBegin(GL_TRIANGLE_FAN);
-			for(unsigned int j=0;j<triangle_fans[i].size();j++)
-				glVertex2i(triangle_fans[i][j].x+x,triangle_fans[i][j].y+y);
-			glEnd();
-		}
-
-		//Render lone triangles
-		glBegin(GL_TRIANGLES);
-		for(unsigned int i=0;i<triangles.size();i++)
-			glVertex2i(triangles[i].x+x,triangles[i].y+y);
-		glEnd();
+		renderer->drawTriangles(vertices,indices,x,y);
 		filled=true;
-
-		/*char* t=(char*)varray;
-		glVertexPointer(2,GL_INT,sizeof(arrayElem),t);
-		glColorPointer(3,GL_FLOAT,sizeof(arrayElem),t+2*sizeof(GLint));
-		glTexCoordPointer(4,GL_FLOAT,sizeof(arrayElem),t+2*sizeof(GLint)+3*sizeof(GLfloat));
-
-		glEnableClientState(GL_VERTEX_ARRAY);
-		glEnableClientState(GL_COLOR_ARRAY);
-		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-		int used=0;
-		for(int i=0;i<triangle_strips.size();i++)
-		{
-			glDrawArrays(GL_TRIANGLE_STRIP,used,triangle_strips[i].size());
-			used+=triangle_strips[i].size();
-		}
-		glDisableClientState(GL_VERTEX_ARRAY);*/
 	}
 
 	if(/*graphic.stroked ||*/ !filled && color)
 	{
 		//LOG(TRACE,_("Line tracing"));
 		if(!rt->materialOverride)
-			FILLSTYLE::fixedColor(0,0,0);
+			renderer->setFixedColor(0,0,0);
 		for(unsigned int i=0;i<outlines.size();i++)
-		{
-			std::vector<Vector2>::const_iterator it=outlines[i].begin();
-			glBegin(GL_LINE_STRIP);
-			for(;it!=outlines[i].end();it++)
-				glVertex2i(it->x+x,it->y+y);
-			glEnd();
-		}
+			renderer->drawLineStrip(outlines[i],x,y);
 	}
 }
 
@@ -127,117 +219,255 @@ void GeomShape::SetStyles(const std::list<FILLSTYLE>* styles)
 	}
 }
 
-void GeomShape::BuildFromEdges(const std::list<FILLSTYLE>* styles)
+void GeomShape::BuildFromEdges(const std::list<FILLSTYLE>* styles, Triangulator& triangulator)
 {
 	if(outlines.empty())
 		return;
 
 	SetStyles(styles);
 
-	TessellateGLU();
+	for(unsigned int i=0;i<outlines.size() && !hasFill;i++)
+		hasFill=(outlines[i].front()==outlines[i].back());
+
+	const uint64_t start=benchmarkTessellation?compat_get_thread_cputime_us():0;
+	triangulator.triangulate(outlines,FILL_EVEN_ODD,vertices,indices);
+	if(!benchmarkTessellation)
+		return;
+
+	const uint64_t ownTime=compat_get_thread_cputime_us()-start;
+	glu_tessellation reference;
+	tessellateGLU(outlines,reference);
+	const uint64_t gluTime=compat_get_thread_cputime_us()-start-ownTime;
+
+	//The two tessellations may only differ by the rounding of the new vertices
+	double area=0;
+	for(unsigned int i=0;i+2<indices.size();i+=3)
+		area+=triangleArea(vertices[indices[i]],vertices[indices[i+1]],vertices[indices[i+2]]);
+	const double referenceArea=reference.area();
+	const bool mismatch=fabs(area-referenceArea)>0.01*referenceArea+100;
+	if(mismatch)
+		LOG(LOG_ERROR,_("Tessellation of a shape with ") << outlines.size() << _(" outlines covers ") << area <<
+			_(" twips^2, GLU covers ") << referenceArea);
+
+	uint64_t referenceTriangles=reference.triangles.size()/3;
+	for(unsigned int i=0;i<reference.strips.size();i++)
+		referenceTriangles+=reference.strips[i].size()-2;
+	for(unsigned int i=0;i<reference.fans.size();i++)
+		referenceTriangles+=reference.fans[i].size()-2;
+
+	Locker l(tessellationStats.mutex);
+	tessellationStats.shapes++;
+	if(mismatch)
+		tessellationStats.mismatches++;
+	tessellationStats.triangles[0]+=indices.size()/3;
+	tessellationStats.triangles[1]+=referenceTriangles;
+	tessellationStats.time[0]+=ownTime;
+	tessellationStats.time[1]+=gluTime;
 }
 
-void GeomShape::TessellateGLU()
+void GeomShape::logTessellationBenchmark()
 {
-	//NOTE: do not invalidate the contents of outline in this function
-	GLUtesselator* tess=gluNewTess();
+	Locker l(tessellationStats.mutex);
+	LOG(LOG_NO_INFO,_("Tessellation of ") << tessellationStats.shapes << _(" shapes: ") <<
+		tessellationStats.triangles[0] << _(" triangles in ") << tessellationStats.time[0] << _(" us, GLU ") <<
+		tessellationStats.triangles[1] << _(" triangles in ") << tessellationStats.time[1] << _(" us, ") <<
+		tessellationStats.mismatches << _(" mismatches"));
+}
 
-	gluTessCallback(tess,GLU_TESS_BEGIN_DATA,(void(CALLBACK *)())GLUCallbackBegin);
-	gluTessCallback(tess,GLU_TESS_VERTEX_DATA,(void(CALLBACK *)())GLUCallbackVertex);
-	gluTessCallback(tess,GLU_TESS_END_DATA,(void(CALLBACK *)())GLUCallbackEnd);
-	gluTessCallback(tess,GLU_TESS_COMBINE_DATA,(void(CALLBACK *)())GLUCallbackCombine);
-	gluTessProperty(tess,GLU_TESS_WINDING_RULE,GLU_TESS_WINDING_ODD);
-	
-	//Let's create a vector of pointers to store temporary coordinates
-	//passed to GLU
-	vector<GLdouble*> tmpCoord;
-	gluTessBeginPolygon(tess,this);
+void Triangulator::triangulate(const vector<vector<Vector2> >& outlines, FILL_RULE rule,
+		vector<Vector2>& vertices, vector<uint32_t>& indices)
+{
+	edges.clear();
+	stops.clear();
 	for(unsigned int i=0;i<outlines.size();i++)
 	{
-		//Check if the contour is closed
-		if(outlines[i].front()==outlines[i].back())
-			hasFill=true;
-		else
+		const vector<Vector2>& outline=outlines[i];
+		if(outline.front()!=outline.back())
 			continue;
-		gluTessBeginContour(tess);
-			//First and last vertex are automatically linked
-			for(unsigned int j=1;j<outlines[i].size();j++)
-			{
-				GLdouble* loc=new GLdouble[3];
-				loc[0]=outlines[i][j].x;
-				loc[1]=outlines[i][j].y;
-				loc[2]=0;
-				tmpCoord.push_back(loc);
-				//As the data we pass the Vector2 pointer
-				gluTessVertex(tess,loc,&outlines[i][j]);
-			}
-		gluTessEndContour(tess);
+		for(unsigned int j=1;j<outline.size();j++)
+		{
+			const Vector2& a=outline[j-1];
+			const Vector2& b=outline[j];
+			//Horizontal edges do not change the fill of the spans
+			if(a.y==b.y)
+				continue;
+			const Vector2& top=(a.y<b.y)?a:b;
+			const Vector2& bottom=(a.y<b.y)?b:a;
+			edge e;
+			e.x=top.x;
+			e.y=top.y;
+			e.dxdy=double(bottom.x-top.x)/(bottom.y-top.y);
+			e.ymax=bottom.y;
+			e.winding=(a.y<b.y)?1:-1;
+			e.trapezoid=UINT32_MAX;
+			edges.push_back(e);
+			stops.push_back(top.y);
+			stops.push_back(bottom.y);
+		}
 	}
-	gluTessEndPolygon(tess);
-	
-	//Clean up locations
-	for(unsigned int i=0;i<tmpCoord.size();i++)
-		delete[] tmpCoord[i];
-	
-	//Clean up temporary vertices
-	for(unsigned int i=0;i<tmpVertices.size();i++)
-		delete tmpVertices[i];
+	if(edges.empty())
+		return;
 
-	gluDeleteTess(tess);
+	sort(stops.begin(),stops.end());
+	stops.erase(unique(stops.begin(),stops.end()),stops.end());
+	order.resize(edges.size());
+	for(unsigned int i=0;i<order.size();i++)
+		order[i]=i;
+	//Edges are created by outline, so the tops are mostly unordered
+	sort(order.begin(),order.end(),edge_order(edges));
+
+	sweep.clear();
+	trapezoids.clear();
+	unsigned int next=0;
+	for(unsigned int i=0;i+1<stops.size();i++)
+	{
+		double y=stops[i];
+		const double yend=stops[i+1];
+		for(;next<order.size() && edges[order[next]].y<=y;next++)
+		{
+			sweep_entry entry;
+			entry.edge=order[next];
+			sweep.push_back(entry);
+		}
+		while(y<yend)
+		{
+			const double ystep=advance(y,yend);
+			addSpans(y,ystep,rule);
+			y=ystep;
+		}
+	}
+
+	vertices.reserve(vertices.size()+trapezoids.size()*4);
+	indices.reserve(indices.size()+trapezoids.size()*6);
+	for(unsigned int i=0;i<trapezoids.size();i++)
+		emitTrapezoid(trapezoids[i],vertices,indices);
 }
 
-void CALLBACK GeomShape::GLUCallbackBegin(GLenum type, GeomShape* obj)
+double Triangulator::advance(double y, double yend)
 {
-	assert_and_throw(obj->curTessTarget==0);
-	if(type==GL_TRIANGLE_FAN)
+	//Steps shorter than this are not useful, as the vertices are rounded to twips anyway
+	const double minStep=1.0/64;
+	//Edges which are converging on the same vertex are not crossing
+	const double epsilon=1e-6;
+
+	unsigned int count=0;
+	for(unsigned int i=0;i<sweep.size();i++)
 	{
-		obj->triangle_fans.push_back(vector<Vector2>());
-		obj->curTessTarget=GL_TRIANGLE_FAN;
+		const edge& e=edges[sweep[i].edge];
+		if(e.ymax<=y)
+			continue;
+		sweep[count].edge=sweep[i].edge;
+		sweep[count].xtop=e.xAt(y);
+		sweep[count].xbottom=e.xAt(yend);
+		count++;
 	}
-	else if(type==GL_TRIANGLE_STRIP)
+	sweep.resize(count);
+
+	//The order changes little from one step to the next, so insertion sort is linear most of the time
+	for(unsigned int i=1;i<sweep.size();i++)
 	{
-		obj->triangle_strips.push_back(vector<Vector2>());
-		obj->curTessTarget=GL_TRIANGLE_STRIP;
+		const sweep_entry entry=sweep[i];
+		unsigned int j=i;
+		for(;j>0 && entry<sweep[j-1];j--)
+			sweep[j]=sweep[j-1];
+		sweep[j]=entry;
 	}
-	else if(type==GL_TRIANGLES)
+
+	//Edges are adjacent in the order just before their first crossing
+	double ret=yend;
+	for(unsigned int i=1;i<sweep.size();i++)
 	{
-		obj->curTessTarget=GL_TRIANGLES;
+		const sweep_entry& l=sweep[i-1];
+		const sweep_entry& r=sweep[i];
+		if(l.xbottom<=r.xbottom+epsilon)
+			continue;
+		const double t=(r.xtop-l.xtop)/((l.xbottom-l.xtop)-(r.xbottom-r.xtop));
+		ret=dmin(ret,y+t*(yend-y));
 	}
-	else
-		::abort();
+	return dmin(yend,dmax(ret,y+minStep));
 }
 
-void CALLBACK GeomShape::GLUCallbackVertex(Vector2* vertexData, GeomShape* obj)
+void Triangulator::addSpans(double ytop, double ybottom, FILL_RULE rule)
 {
-	assert_and_throw(obj->curTessTarget!=0);
-	if(obj->curTessTarget==GL_TRIANGLE_FAN)
+	int winding=0;
+	uint32_t left=0;
+	for(unsigned int i=0;i<sweep.size();i++)
 	{
-		obj->triangle_fans.back().push_back(*vertexData);
-	}
-	else if(obj->curTessTarget==GL_TRIANGLE_STRIP)
-	{
-		obj->triangle_strips.back().push_back(*vertexData);
-	}
-	else if(obj->curTessTarget==GL_TRIANGLES)
-	{
-		obj->triangles.push_back(*vertexData);
+		const uint32_t e=sweep[i].edge;
+		const bool wasInside=(rule==FILL_EVEN_ODD)?(winding&1):(winding!=0);
+		winding+=edges[e].winding;
+		const bool inside=(rule==FILL_EVEN_ODD)?(winding&1):(winding!=0);
+		if(!wasInside && inside)
+			left=e;
+		else if(wasInside && !inside)
+			addSpan(left,e,ytop,ybottom);
 	}
 }
 
-void CALLBACK GeomShape::GLUCallbackEnd(GeomShape* obj)
+void Triangulator::addSpan(uint32_t left, uint32_t right, double ytop, double ybottom)
 {
-	assert_and_throw(obj->curTessTarget!=0);
-	if(obj->curTessTarget==GL_TRIANGLES)
-		assert_and_throw(obj->triangles.size()%3==0);
-	obj->curTessTarget=0;
+	const uint32_t last=edges[left].trapezoid;
+	//Extend the trapezoid of the previous step if it has the same sides
+	if(last!=UINT32_MAX && trapezoids[last].right==right && trapezoids[last].ybottom==ytop)
+	{
+		trapezoids[last].ybottom=ybottom;
+		return;
+	}
+	trapezoid t;
+	t.left=left;
+	t.right=right;
+	t.ytop=ytop;
+	t.ybottom=ybottom;
+	edges[left].trapezoid=trapezoids.size();
+	trapezoids.push_back(t);
 }
 
-void CALLBACK GeomShape::GLUCallbackCombine(GLdouble coords[3], void* vertex_data[4], 
-				   GLfloat weight[4], Vector2** outData, GeomShape* obj)
+void Triangulator::emitTrapezoid(const trapezoid& t, vector<Vector2>& vertices, vector<uint32_t>& indices) const
 {
-	//No real operations, apart from generating a new vertex at the passed coordinates
-	obj->tmpVertices.push_back(new Vector2(coords[0],coords[1]));
-	*outData=obj->tmpVertices.back();
+	const edge& l=edges[t.left];
+	const edge& r=edges[t.right];
+	const int ytop=lrint(t.ytop);
+	const int ybottom=lrint(t.ybottom);
+	if(ytop==ybottom)
+		return;
+	const Vector2 tl(lrint(l.xAt(t.ytop)),ytop);
+	const Vector2 tr(lrint(r.xAt(t.ytop)),ytop);
+	const Vector2 br(lrint(r.xAt(t.ybottom)),ybottom);
+	const Vector2 bl(lrint(l.xAt(t.ybottom)),ybottom);
+	const uint32_t base=vertices.size();
+	if(tl==tr && bl==br)
+		return;
+	else if(tl==tr)
+	{
+		vertices.push_back(tl);
+		vertices.push_back(br);
+		vertices.push_back(bl);
+		indices.push_back(base);
+		indices.push_back(base+1);
+		indices.push_back(base+2);
+	}
+	else if(bl==br)
+	{
+		vertices.push_back(tl);
+		vertices.push_back(tr);
+		vertices.push_back(br);
+		indices.push_back(base);
+		indices.push_back(base+1);
+		indices.push_back(base+2);
+	}
+	else
+	{
+		vertices.push_back(tl);
+		vertices.push_back(tr);
+		vertices.push_back(br);
+		vertices.push_back(bl);
+		indices.push_back(base);
+		indices.push_back(base+1);
+		indices.push_back(base+2);
+		indices.push_back(base);
+		indices.push_back(base+2);
+		indices.push_back(base+3);
+	}
 }
 
 bool ShapesBuilder::isOutlineEmpty(const std::vector< Vector2 >& outline)
@@ -54,36 +54,95 @@ struct arrayElem
 } PACKED;
 #include "packed_end.h"
 
+enum FILL_RULE { FILL_EVEN_ODD=0, FILL_NON_ZERO };
+
+/*
+	Decomposes closed outlines in triangles with a sweep from top to bottom. The sweep stops at
+	the vertices and at the crossings of the edges, so that between two stops the edges are
+	ordered and the spans which are inside the fill are trapezoids. A trapezoid is extended
+	across stops while the same two edges delimit it. Self intersecting and nested outlines
+	are resolved by the fill rule. The working buffers are kept between calls, so that an
+	instance used for many shapes only allocates when they grow
+*/
+class Triangulator
+{
+private:
+	struct edge
+	{
+		//Top vertex, the slope and the bottom
+		double x,y;
+		double dxdy;
+		double ymax;
+		//1 for edges going down, -1 for edges going up
+		int winding;
+		//Last trapezoid on the right of the edge
+		uint32_t trapezoid;
+		double xAt(double yy) const { return x+(yy-y)*dxdy; }
+	};
+	struct sweep_entry
+	{
+		uint32_t edge;
+		//Coordinates at the top and bottom of the current step
+		double xtop,xbottom;
+		bool operator<(const sweep_entry& r) const
+		{
+			return (xtop==r.xtop)?(xbottom<r.xbottom):(xtop<r.xtop);
+		}
+	};
+	struct trapezoid
+	{
+		uint32_t left,right;
+		double ytop,ybottom;
+	};
+	std::vector<edge> edges;
+	//Edges sorted by their top
+	std::vector<uint32_t> order;
+	std::vector<double> stops;
+	std::vector<sweep_entry> sweep;
+	std::vector<trapezoid> trapezoids;
+	struct edge_order
+	{
+		const std::vector<edge>& edges;
+		edge_order(const std::vector<edge>& e):edges(e){}
+		bool operator()(uint32_t a, uint32_t b) const { return edges[a].y<edges[b].y; }
+	};
+	//Sorts the edges crossing [y,yend] and returns where the first crossing, if any, ends the step
+	double advance(double y, double yend);
+	void addSpans(double ytop, double ybottom, FILL_RULE rule);
+	void addSpan(uint32_t left, uint32_t right, double ytop, double ybottom);
+	void emitTrapezoid(const trapezoid& t, std::vector<Vector2>& vertices, std::vector<uint32_t>& indices) const;
+public:
+	//Appends the triangles as indices in vertices, open outlines are ignored
+	void triangulate(const std::vector<std::vector<Vector2> >& outlines, FILL_RULE rule,
+			std::vector<Vector2>& vertices, std::vector<uint32_t>& indices);
+};
+
 class GeomShape
 {
 friend class DefineTextTag;
 friend class DefineShape2Tag;
 friend class DefineShape3Tag;
 private:
-	void TessellateGLU();
-	static void CALLBACK GLUCallbackBegin(GLenum type, GeomShape* obj);
-	static void CALLBACK GLUCallbackEnd(GeomShape* obj);
-	static void CALLBACK GLUCallbackVertex(Vector2* vertexData, GeomShape* obj);
-	static void CALLBACK GLUCallbackCombine(GLdouble coords[3], void *vertex_data[4], 
-				       GLfloat weight[4], Vector2** outData, GeomShape* obj);
-	GLenum curTessTarget;
-	std::vector<Vector2*> tmpVertices;
 	void SetStyles(const std::list<FILLSTYLE>* styles);
 	const FILLSTYLE* style;
 	arrayElem* varray;
 	bool hasFill;
 public:
-	GeomShape():curTessTarget(0),style(NULL),varray(NULL),hasFill(false),color(0){}
-	std::vector<Vector2> triangles;
-	std::vector<std::vector<Vector2> > triangle_strips;
-	std::vector<std::vector<Vector2> > triangle_fans;
+	GeomShape():style(NULL),varray(NULL),hasFill(false),color(0){}
+	//The fill, as triangles indexing vertices
+	std::vector<Vector2> vertices;
+	std::vector<uint32_t> indices;
 
 	std::vector<std::vector<Vector2> > outlines;
 
 	unsigned int color;
 
 	void Render(int x=0, int y=0) const;
-	void BuildFromEdges(const std::list<FILLSTYLE>* styles);
+	//The triangulator is owned by the caller, so that its buffers are reused between shapes
+	void BuildFromEdges(const std::list<FILLSTYLE>* styles, Triangulator& triangulator);
+	//When enabled every shape is also tessellated with GLU, to compare the speed and the results
+	static bool benchmarkTessellation;
+	static void logTessellationBenchmark();
 };
 
 class ShapesBuilder
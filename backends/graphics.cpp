@@ -24,6 +24,7 @@
 #include "logger.h"
 #include "exceptions.h"
 #include "backends/rendering.h"
+#include "backends/renderer.h"
 #include "compat.h"
 
 #include <iostream>
@@ -276,38 +277,22 @@ TextureBuffer::~TextureBuffer()
 MatrixApplier::MatrixApplier()
 {
 	//First of all try to preserve current matrix
-	glPushMatrix();
-	if(glGetError()==GL_STACK_OVERFLOW)
-		throw RunTimeException("GL matrix stack exceeded");
-
-	//TODO: implement smart stack flush
-	//Save all the current stack, compute using SSE the final matrix and push that one
-	//Maybe mulps, shuffle and parallel add
-	//On unapply the stack will be reset as before
+	rt->renderer->pushMatrix();
 }
 
 MatrixApplier::MatrixApplier(const MATRIX& m)
 {
 	//First of all try to preserve current matrix
-	glPushMatrix();
-	if(glGetError()==GL_STACK_OVERFLOW)
-	{
-		::abort();
-	}
-
-	float matrix[16];
-	m.get4DMatrix(matrix);
-	glMultMatrixf(matrix);
+	rt->renderer->pushMatrix();
+	rt->renderer->multMatrix(m);
 }
 
 void MatrixApplier::concat(const MATRIX& m)
 {
-	float matrix[16];
-	m.get4DMatrix(matrix);
-	glMultMatrixf(matrix);
+	rt->renderer->multMatrix(m);
 }
 
 void MatrixApplier::unapply()
 {
-	glPopMatrix();
+	rt->renderer->popMatrix();
 }
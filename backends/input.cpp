@@ -54,6 +54,10 @@ InputThread::InputThread(SystemState* s,ENGINE e, void* param):m_sys(s),terminat
 		g_signal_connect(G_OBJECT(container), "event", G_CALLBACK(gtkplug_worker), this);
 	}
 #endif
+	else if(e==HEADLESS)
+	{
+		//No input events are generated without a window
+	}
 	else
 		::abort();
 }
@@ -63,6 +67,14 @@ InputThread::~InputThread()
 	wait();
 }
 
+//Mouse events are taken from the pool of the VM, the queue keeps its own reference
+static void sendMouseEvent(ABCVm* vm, EventDispatcher* target, uint32_t typeId)
+{
+	MouseEvent* e=Event::getPooled<MouseEvent>(vm->mouse_event_manager,typeId,true);
+	vm->addEvent(target,e);
+	e->decRef();
+}
+
 void InputThread::wait()
 {
 	if(terminated)
@@ -92,6 +104,11 @@ gboolean InputThread::gtkplug_worker(GtkWidget *widget, GdkEvent *event, InputTh
 				case GDK_p:
 					th->m_sys->showProfilingData=!th->m_sys->showProfilingData;
 					break;
+				case GDK_l:
+					Mutex::dumpProfile();
+					if(th->m_sys->currentVm)
+						th->m_sys->currentVm->dumpEventLatency();
+					break;
 				default:
 					break;
 			}
@@ -120,7 +137,7 @@ gboolean InputThread::gtkplug_worker(GtkWidget *widget, GdkEvent *event, InputTh
 
 				th->lastMouseDownTarget=th->listeners[index];
 				//Add event to the event queue
-				th->m_sys->currentVm->addEvent(th->listeners[index],Class<MouseEvent>::getInstanceS("mouseDown",true));
+				sendMouseEvent(th->m_sys->currentVm,th->listeners[index],ET_MOUSE_DOWN);
 				//And select that object for debugging (if needed)
 				if(th->m_sys->showDebug)
 					th->m_sys->getRenderThread()->selectedDebug=th->listeners[index];
@@ -140,11 +157,11 @@ gboolean InputThread::gtkplug_worker(GtkWidget *widget, GdkEvent *event, InputTh
 				index--;
 
 				//Add event to the event queue
-				getVm()->addEvent(th->listeners[index],Class<MouseEvent>::getInstanceS("mouseUp",true));
+				sendMouseEvent(getVm(),th->listeners[index],ET_MOUSE_UP);
 				//Also send the click event
 				if(th->lastMouseDownTarget==th->listeners[index])
 				{
-					getVm()->addEvent(th->listeners[index],Class<MouseEvent>::getInstanceS("click",true));
+					sendMouseEvent(getVm(),th->listeners[index],ET_CLICK);
 					th->lastMouseDownTarget=NULL;
 				}
 			}
@@ -184,6 +201,11 @@ void* InputThread::sdl_worker(InputThread* th)
 					case SDLK_p:
 						th->m_sys->showProfilingData=!th->m_sys->showProfilingData;
 						break;
+					case SDLK_l:
+						Mutex::dumpProfile();
+						if(th->m_sys->currentVm)
+							th->m_sys->currentVm->dumpEventLatency();
+						break;
 					case SDLK_q:
 						th->m_sys->setShutdownFlag();
 						if(th->m_sys->currentVm)
@@ -227,7 +249,7 @@ void* InputThread::sdl_worker(InputThread* th)
 
 				th->lastMouseDownTarget=th->listeners[index];
 				//Add event to the event queue
-				th->m_sys->currentVm->addEvent(th->listeners[index],Class<MouseEvent>::getInstanceS("mouseDown",true));
+				sendMouseEvent(th->m_sys->currentVm,th->listeners[index],ET_MOUSE_DOWN);
 				//And select that object for debugging (if needed)
 				if(th->m_sys->showDebug)
 					th->m_sys->getRenderThread()->selectedDebug=th->listeners[index];
@@ -245,11 +267,11 @@ void* InputThread::sdl_worker(InputThread* th)
 				index--;
 
 				//Add event to the event queue
-				getVm()->addEvent(th->listeners[index],Class<MouseEvent>::getInstanceS("mouseUp",true));
+				sendMouseEvent(getVm(),th->listeners[index],ET_MOUSE_UP);
 				//Also send the click event
 				if(th->lastMouseDownTarget==th->listeners[index])
 				{
-					getVm()->addEvent(th->listeners[index],Class<MouseEvent>::getInstanceS("click",true));
+					sendMouseEvent(getVm(),th->listeners[index],ET_CLICK);
 					th->lastMouseDownTarget=NULL;
 				}
 				break;
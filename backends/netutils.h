@@ -146,7 +146,10 @@ public:
 class ThreadedDownloader : public Downloader, public IThreadJob
 {
 public:
-	ThreadedDownloader(bool cached):Downloader(cached){}
+	ThreadedDownloader(bool cached):Downloader(cached)
+	{
+		blocking=true;
+	}
 };
 
 //CurlDownloader can be used as a thread job, standalone or as a streambuf
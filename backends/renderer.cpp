@@ -0,0 +1,127 @@
+/**************************************************************************
+    Lightspark, a free flash player implementation
+
+    Copyright (C) 2009,2010  Alessandro Pignotti (a.pignotti@sssup.it)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "swf.h"
+#include "renderer.h"
+#include "rendering.h"
+#include "exceptions.h"
+#include <GL/glew.h>
+#include <math.h>
+#include <algorithm>
+
+using namespace std;
+using namespace lightspark;
+
+extern TLSDATA RenderThread* rt;
+
+void GLRenderer::loadIdentity()
+{
+	glLoadIdentity();
+	matrixStack.clear();
+	current=linear_transform();
+}
+
+void GLRenderer::pushMatrix()
+{
+	glPushMatrix();
+	if(glGetError()==GL_STACK_OVERFLOW)
+		throw RunTimeException("GL matrix stack exceeded");
+	matrixStack.push_back(current);
+}
+
+void GLRenderer::popMatrix()
+{
+	assert_and_throw(!matrixStack.empty());
+	glPopMatrix();
+	current=matrixStack.back();
+	matrixStack.pop_back();
+}
+
+void GLRenderer::multMatrix(const MATRIX& m)
+{
+	float matrix[16];
+	m.get4DMatrix(matrix);
+	glMultMatrixf(matrix);
+	linear_transform ret;
+	ret.a=current.a*m.ScaleX+current.c*m.RotateSkew0;
+	ret.b=current.b*m.ScaleX+current.d*m.RotateSkew0;
+	ret.c=current.a*m.RotateSkew1+current.c*m.ScaleY;
+	ret.d=current.b*m.RotateSkew1+current.d*m.ScaleY;
+	current=ret;
+}
+
+void GLRenderer::scale(float sx, float sy)
+{
+	glScalef(sx,sy,1);
+	current.a*=sx;
+	current.b*=sx;
+	current.c*=sy;
+	current.d*=sy;
+}
+
+float GLRenderer::getScale() const
+{
+	return max(sqrtf(current.a*current.a+current.b*current.b),sqrtf(current.c*current.c+current.d*current.d));
+}
+
+void GLRenderer::setFillStyle(const FILLSTYLE& style)
+{
+	style.setFragmentProgram();
+}
+
+void GLRenderer::setFixedColor(float r, float g, float b)
+{
+	FILLSTYLE::fixedColor(r,g,b);
+}
+
+void GLRenderer::drawTriangles(const vector<Vector2>& v, const vector<uint32_t>& indices, int x, int y)
+{
+	glBegin(GL_TRIANGLES);
+	for(unsigned int i=0;i<indices.size();i++)
+		glVertex2i(v[indices[i]].x+x,v[indices[i]].y+y);
+	glEnd();
+}
+
+void GLRenderer::drawLineStrip(const vector<Vector2>& v, int x, int y)
+{
+	glBegin(GL_LINE_STRIP);
+	for(unsigned int i=0;i<v.size();i++)
+		glVertex2i(v[i].x+x,v[i].y+y);
+	glEnd();
+}
+
+void GLRenderer::drawRect(int xmin, int ymin, int xmax, int ymax)
+{
+	glBegin(GL_QUADS);
+		glVertex2i(xmin,ymin);
+		glVertex2i(xmax,ymin);
+		glVertex2i(xmax,ymax);
+		glVertex2i(xmin,ymax);
+	glEnd();
+}
+
+void GLRenderer::beginLayer(number_t xmin, number_t xmax, number_t ymin, number_t ymax)
+{
+	rt->glAcquireTempBuffer(xmin,xmax,ymin,ymax);
+}
+
+void GLRenderer::endLayer(number_t xmin, number_t xmax, number_t ymin, number_t ymax, float alpha)
+{
+	rt->glBlitTempBuffer(xmin,xmax,ymin,ymax,alpha);
+}
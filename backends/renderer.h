@@ -0,0 +1,98 @@
+/**************************************************************************
+    Lightspark, a free flash player implementation
+
+    Copyright (C) 2009,2010  Alessandro Pignotti (a.pignotti@sssup.it)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#ifndef _RENDERER_H
+#define _RENDERER_H
+
+#include "compat.h"
+#include <vector>
+#include "swftypes.h"
+#include "backends/geometry.h"
+
+namespace lightspark
+{
+
+/*
+	Drawing primitives used by the Render methods of the display objects. The renderer of the
+	current RenderThread is used, and only from the render thread
+*/
+class IRenderer
+{
+public:
+	virtual ~IRenderer(){}
+	//The current transformation is saved by pushMatrix and restored by popMatrix
+	virtual void pushMatrix()=0;
+	virtual void popMatrix()=0;
+	virtual void multMatrix(const MATRIX& m)=0;
+	virtual void scale(float sx, float sy)=0;
+	//Pixels for each unit of the current coordinates, along the axis which is stretched the most
+	virtual float getScale() const=0;
+	//The transformation is concatenated to the current one, popColorTransform restores the previous
+	virtual void pushColorTransform(const CXFORMWITHALPHA& cx)=0;
+	virtual void popColorTransform()=0;
+	//Fill of the next primitives
+	virtual void setFillStyle(const FILLSTYLE& style)=0;
+	//Components are in the [0,1] range
+	virtual void setFixedColor(float r, float g, float b)=0;
+	//The vertices are translated by (x,y) before being transformed
+	//Each three indices in v make a triangle
+	virtual void drawTriangles(const std::vector<Vector2>& v, const std::vector<uint32_t>& indices, int x, int y)=0;
+	virtual void drawLineStrip(const std::vector<Vector2>& v, int x, int y)=0;
+	virtual void drawRect(int xmin, int ymin, int xmax, int ymax)=0;
+	//Objects which are not simple are drawn on a separate layer, which is then blended with the given alpha
+	virtual void beginLayer(number_t xmin, number_t xmax, number_t ymin, number_t ymax)=0;
+	virtual void endLayer(number_t xmin, number_t xmax, number_t ymin, number_t ymax, float alpha)=0;
+	//Textures, and so videos, are only available when rendering with OpenGL
+	virtual bool isAccelerated() const=0;
+};
+
+class GLRenderer: public IRenderer
+{
+private:
+	//Linear part of the modelview matrix, tracked to avoid reading it back from GL
+	struct linear_transform
+	{
+		float a,b,c,d;
+		linear_transform():a(1),b(0),c(0),d(1){}
+	};
+	linear_transform current;
+	std::vector<linear_transform> matrixStack;
+public:
+	//Resets the modelview matrix at the beginning of a frame
+	void loadIdentity();
+	void pushMatrix();
+	void popMatrix();
+	void multMatrix(const MATRIX& m);
+	void scale(float sx, float sy);
+	float getScale() const;
+	//Color transformations are not supported by the shaders yet
+	void pushColorTransform(const CXFORMWITHALPHA& cx){}
+	void popColorTransform(){}
+	void setFillStyle(const FILLSTYLE& style);
+	void setFixedColor(float r, float g, float b);
+	void drawTriangles(const std::vector<Vector2>& v, const std::vector<uint32_t>& indices, int x, int y);
+	void drawLineStrip(const std::vector<Vector2>& v, int x, int y);
+	void drawRect(int xmin, int ymin, int xmax, int ymax);
+	void beginLayer(number_t xmin, number_t xmax, number_t ymin, number_t ymax);
+	void endLayer(number_t xmin, number_t xmax, number_t ymin, number_t ymax, float alpha);
+	bool isAccelerated() const { return true; }
+};
+
+};
+#endif
@@ -20,6 +20,9 @@
 #include "scripting/abc.h"
 #include "parsing/textfile.h"
 #include "rendering.h"
+#include "frame_scheduler.h"
+#include "renderer.h"
+#include "swrenderer.h"
 #include "compat.h"
 #include <sstream>
 //#include "swf.h"
@@ -52,7 +55,8 @@ void RenderThread::wait()
 RenderThread::RenderThread(SystemState* s,ENGINE e,void* params):m_sys(s),terminated(false),inputNeeded(false),inputDisabled(false),
 	resizeNeeded(false),newWidth(0),newHeight(0),scaleX(1),scaleY(1),offsetX(0),offsetY(0),interactive_buffer(NULL),tempBufferAcquired(false),
 	frameCount(0),secsCount(0),mutexResources("GLResource Mutex"),dataTex(false),mainTex(false),tempTex(false),inputTex(false),
-	hasNPOTTextures(false),selectedDebug(NULL),currentId(0),materialOverride(false)
+	hasNPOTTextures(false),selectedDebug(NULL),currentId(0),materialOverride(false),renderer(NULL),
+	triangulator(new Triangulator)
 {
 	LOG(LOG_NO_INFO,_("RenderThread this=") << this);
 	m_sys=s;
@@ -87,6 +91,8 @@ RenderThread::RenderThread(SystemState* s,ENGINE e,void* params):m_sys(s),termin
 
 	if(e==SDL)
 		pthread_create(&t,NULL,(thread_worker)sdl_worker,this);
+	else if(e==HEADLESS)
+		pthread_create(&t,NULL,(thread_worker)headless_worker,this);
 #ifdef COMPILE_PLUGIN
 	else if(e==GTKPLUG)
 	{
@@ -103,6 +109,8 @@ RenderThread::~RenderThread()
 	sem_destroy(&render);
 	sem_destroy(&inputDone);
 	delete[] interactive_buffer;
+	delete renderer;
+	delete triangulator;
 	LOG(LOG_NO_INFO,_("~RenderThread this=") << this);
 }
 
@@ -151,16 +159,19 @@ void RenderThread::glAcquireTempBuffer(number_t xmin, number_t xmax, number_t ym
 	glEnd();
 }
 
-void RenderThread::glBlitTempBuffer(number_t xmin, number_t xmax, number_t ymin, number_t ymax)
+void RenderThread::glBlitTempBuffer(number_t xmin, number_t xmax, number_t ymin, number_t ymax, float alpha)
 {
 	assert(tempBufferAcquired==true);
 	tempBufferAcquired=false;
 
 	//Use the blittler program to blit only the used buffer
 	glUseProgram(blitter_program);
+	glUniform1f(blitterAlphaUniform,alpha);
 	glEnable(GL_BLEND);
 	glDrawBuffer(GL_COLOR_ATTACHMENT0);
 
+	//The alpha of the layer is passed as the vertex color
+	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
 	rt->tempTex.bind();
 	glBegin(GL_QUADS);
 		glVertex2f(xmin,ymin);
@@ -168,6 +179,7 @@ void RenderThread::glBlitTempBuffer(number_t xmin, number_t xmax, number_t ymin,
 		glVertex2f(xmax,ymax);
 		glVertex2f(xmin,ymax);
 	glEnd();
+	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
 	glUseProgram(gpu_program);
 }
 
@@ -229,6 +241,8 @@ void* RenderThread::gtkplug_worker(RenderThread* th)
 
 	th->commonGLInit(th->windowWidth, th->windowHeight);
 	th->commonGLResize(th->windowWidth, th->windowHeight);
+	GLRenderer* renderer=new GLRenderer;
+	th->renderer=renderer;
 	
 	ThreadProfile* profile=sys->allocateProfiler(RGB(200,0,0));
 	profile->setTag("Render");
@@ -248,6 +262,7 @@ void* RenderThread::gtkplug_worker(RenderThread* th)
 		{
 			sem_wait(&th->render);
 			Chronometer chronometer;
+			const uint64_t renderStart=compat_get_current_time_us();
 			
 			if(th->resizeNeeded)
 			{
@@ -324,9 +339,9 @@ void* RenderThread::gtkplug_worker(RenderThread* th)
 				RGB bg=sys->getBackground();
 				glClearColor(bg.Red/255.0F,bg.Green/255.0F,bg.Blue/255.0F,0);
 				glClear(GL_COLOR_BUFFER_BIT);
-				glLoadIdentity();
+				renderer->loadIdentity();
 				glTranslatef(th->offsetX,th->offsetY,0);
-				glScalef(th->scaleX,th->scaleY,1);
+				renderer->scale(th->scaleX,th->scaleY);
 				
 				sys->Render();
 
@@ -395,6 +410,7 @@ void* RenderThread::gtkplug_worker(RenderThread* th)
 				glFlush();
 			}
 			profile->accountTime(chronometer.checkpoint());
+			th->m_sys->getFrameScheduler()->renderDone(compat_get_current_time_us()-renderStart);
 		}
 	}
 	catch(LightsparkException& e)
@@ -544,6 +560,8 @@ void RenderThread::commonGLInit(int width, int height)
 	glUseProgram(blitter_program);
 	int texScale=glGetUniformLocation(blitter_program,"texScale");
 	mainTex.setTexScale(texScale);
+	blitterAlphaUniform=glGetUniformLocation(blitter_program,"layerAlpha");
+	glUniform1f(blitterAlphaUniform,1);
 	cleanGLErrors();
 
 	glUseProgram(gpu_program);
@@ -705,6 +723,8 @@ void* RenderThread::sdl_worker(RenderThread* th)
 	SDL_SetVideoMode(th->windowWidth, th->windowHeight, 24, SDL_OPENGL|SDL_RESIZABLE);
 	th->commonGLInit(th->windowWidth, th->windowHeight);
 	th->commonGLResize(th->windowWidth, th->windowHeight);
+	GLRenderer* renderer=new GLRenderer;
+	th->renderer=renderer;
 
 	ThreadProfile* profile=sys->allocateProfiler(RGB(200,0,0));
 	profile->setTag("Render");
@@ -722,6 +742,7 @@ void* RenderThread::sdl_worker(RenderThread* th)
 		{
 			sem_wait(&th->render);
 			chronometer.checkpoint();
+			const uint64_t renderStart=compat_get_current_time_us();
 
 			SDL_GL_SwapBuffers( );
 			if(th->resizeNeeded)
@@ -803,9 +824,9 @@ void* RenderThread::sdl_worker(RenderThread* th)
 				glClearColor(bg.Red/255.0F,bg.Green/255.0F,bg.Blue/255.0F,1);
 				glClear(GL_COLOR_BUFFER_BIT);
 				
-				glLoadIdentity();
+				renderer->loadIdentity();
 				glTranslatef(th->offsetX,th->offsetY,0);
-				glScalef(th->scaleX,th->scaleY,1);
+				renderer->scale(th->scaleX,th->scaleY);
 				glTranslatef(th->m_sys->xOffset,th->m_sys->yOffset,0);
 				
 				th->m_sys->Render();
@@ -886,6 +907,7 @@ void* RenderThread::sdl_worker(RenderThread* th)
 				glEnable(GL_BLEND);
 			}
 			profile->accountTime(chronometer.checkpoint());
+			th->m_sys->getFrameScheduler()->renderDone(compat_get_current_time_us()-renderStart);
 		}
 		glDisable(GL_TEXTURE_2D);
 	}
@@ -898,6 +920,75 @@ void* RenderThread::sdl_worker(RenderThread* th)
 	return NULL;
 }
 
+uint32_t RenderThread::maxHeadlessFrames=0;
+
+void* RenderThread::headless_worker(RenderThread* th)
+{
+	sys=th->m_sys;
+	rt=th;
+	RECT size=sys->getFrameSize();
+	th->windowWidth=size.Xmax/20;
+	th->windowHeight=size.Ymax/20;
+	SoftwareRenderer* renderer=new SoftwareRenderer(th->windowWidth, th->windowHeight);
+	th->renderer=renderer;
+	//There is no window to get input from
+	th->inputDisabled=true;
+
+	ThreadProfile* profile=sys->allocateProfiler(RGB(200,0,0));
+	profile->setTag("Render");
+	uint32_t renderedFrames=0;
+	uint64_t totalTime=0;
+	try
+	{
+		Chronometer chronometer;
+		while(1)
+		{
+			sem_wait(&th->render);
+			chronometer.checkpoint();
+			const uint64_t renderStart=compat_get_current_time_us();
+
+			//Before starting rendering, cleanup all the request arrived in the meantime
+			while(sem_trywait(&th->render)==0)
+			{
+				if(th->m_sys->isShuttingDown())
+					break;
+			}
+
+			if(th->m_sys->isShuttingDown())
+				break;
+
+			if(th->m_sys->isOnError())
+				renderer->clear(RGB(0,0,0));
+			else
+			{
+				renderer->clear(sys->getBackground());
+				th->m_sys->Render();
+			}
+			renderer->flush();
+
+			const uint32_t renderTime=compat_get_current_time_us()-renderStart;
+			profile->accountTime(chronometer.checkpoint());
+			th->m_sys->getFrameScheduler()->renderDone(renderTime);
+			renderedFrames++;
+			totalTime+=renderTime;
+			if(maxHeadlessFrames && renderedFrames==maxHeadlessFrames)
+				th->m_sys->setShutdownFlag();
+		}
+	}
+	catch(LightsparkException& e)
+	{
+		LOG(LOG_ERROR,_("Exception in RenderThread ") << e.cause);
+		sys->setError(e.cause);
+	}
+	if(renderedFrames)
+	{
+		LOG(LOG_NO_INFO,_("Software rendering: ") << renderedFrames << _(" frames at ") << th->windowWidth << 'x' << th->windowHeight
+				<< _(", average ") << totalTime/renderedFrames << _(" us, ")
+				<< (totalTime?(renderedFrames*1000000.0/totalTime):0) << _(" frames/s"));
+	}
+	return NULL;
+}
+
 void RenderThread::draw()
 {
 	sem_post(&render);
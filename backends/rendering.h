@@ -25,6 +25,9 @@
 namespace lightspark
 {
 
+class IRenderer;
+class Triangulator;
+
 class RenderThread: public ITickJob
 {
 private:
@@ -32,6 +35,8 @@ private:
 	pthread_t t;
 	bool terminated;
 	static void* sdl_worker(RenderThread*);
+	//Renders in memory with the SoftwareRenderer, no display is needed
+	static void* headless_worker(RenderThread*);
 #ifdef COMPILE_PLUGIN
 	NPAPI_params* npapi_params;
 	static void* gtkplug_worker(RenderThread*);
@@ -77,7 +82,7 @@ public:
 	float getIdAt(int x, int y);
 	//The calling context MUST call this function with the transformation matrix ready
 	void glAcquireTempBuffer(number_t xmin, number_t xmax, number_t ymin, number_t ymax);
-	void glBlitTempBuffer(number_t xmin, number_t xmax, number_t ymin, number_t ymax);
+	void glBlitTempBuffer(number_t xmin, number_t xmax, number_t ymin, number_t ymax, float alpha);
 	/**
 		Add a GLResource to the managed pool
 		@param res The GLResource to be manged
@@ -123,10 +128,17 @@ public:
 	uint32_t windowHeight;
 	bool hasNPOTTextures;
 	GLuint fragmentTexScaleUniform;
+	GLuint blitterAlphaUniform;
 	
 	InteractiveObject* selectedDebug;
 	float currentId;
 	bool materialOverride;
+	//Used by the Render methods, it is valid only inside the render thread
+	IRenderer* renderer;
+	//Tessellates the shapes built while rendering, it is valid only inside the render thread
+	Triangulator* triangulator;
+	//The headless renderer stops the player after this many frames, 0 means no limit
+	static uint32_t maxHeadlessFrames;
 };
 
 };
@@ -0,0 +1,658 @@
+/**************************************************************************
+    Lightspark, a free flash player implementation
+
+    Copyright (C) 2009,2010  Alessandro Pignotti (a.pignotti@sssup.it)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "spankernels.h"
+#include "logger.h"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+//The vector kernels are compiled for their instruction set only, and selected at runtime
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define SPAN_KERNELS_X86
+#include <immintrin.h>
+#define TARGET(isa) __attribute__((target(isa)))
+#endif
+
+using namespace std;
+using namespace lightspark;
+
+namespace
+{
+const float linearScale=256/(2*gradientSize);
+const float radialScale=256/gradientSize;
+
+//Same as a truncation after clamping to [0,255], NaNs give 0 as with the vector min/max
+inline int gradientIndex(float f)
+{
+	return (f>0)?((f<255)?int(f):255):0;
+}
+
+inline uint32_t clampChannel(float c)
+{
+	return (c>0)?((c<255)?uint32_t(c+0.5f):255):0;
+}
+
+void solidScalar(uint32_t* dst, uint32_t count, uint32_t color)
+{
+	if((color>>24)==0xff)
+		std::fill(dst,dst+count,color);
+	else if(color>>24)
+	{
+		for(uint32_t i=0;i<count;i++)
+			dst[i]=blendPixel(dst[i],color);
+	}
+}
+
+void compositeScalar(uint32_t* dst, uint32_t* src, uint32_t count, uint32_t alpha)
+{
+	for(uint32_t i=0;i<count;i++)
+	{
+		//Blending a transparent pixel leaves dst unchanged
+		if(src[i]==0)
+			continue;
+		dst[i]=blendPixel(dst[i],scalePixel(src[i],alpha));
+		src[i]=0;
+	}
+}
+
+void linearGradientScalar(uint32_t* dst, uint32_t count, const uint32_t* ramp, float gx, float gy, float dx, float dy)
+{
+	for(uint32_t i=0;i<count;i++)
+	{
+		//Coordinates are not accumulated, so that the error does not grow along the span
+		const float x=gx+float(i)*dx;
+		dst[i]=blendPixel(dst[i],ramp[gradientIndex((x+gradientSize)*linearScale)]);
+	}
+}
+
+void radialGradientScalar(uint32_t* dst, uint32_t count, const uint32_t* ramp, float gx, float gy, float dx, float dy)
+{
+	for(uint32_t i=0;i<count;i++)
+	{
+		const float x=gx+float(i)*dx;
+		const float y=gy+float(i)*dy;
+		dst[i]=blendPixel(dst[i],ramp[gradientIndex(sqrtf(x*x+y*y)*radialScale)]);
+	}
+}
+
+void transformColorsScalar(uint32_t* dst, const uint32_t* src, uint32_t count, const float mult[4], const float add[4])
+{
+	for(uint32_t i=0;i<count;i++)
+	{
+		const uint32_t c=src[i];
+		const uint32_t r=clampChannel(float((c>>16)&0xff)*mult[0]+add[0]);
+		const uint32_t g=clampChannel(float((c>>8)&0xff)*mult[1]+add[1]);
+		const uint32_t b=clampChannel(float(c&0xff)*mult[2]+add[2]);
+		const uint32_t a=clampChannel(float(c>>24)*mult[3]+add[3]);
+		dst[i]=(a<<24)|(((r*a+127)/255)<<16)|(((g*a+127)/255)<<8)|((b*a+127)/255);
+	}
+}
+
+const span_kernels scalarKernels={ ISA_SCALAR, "scalar", solidScalar, compositeScalar,
+	linearGradientScalar, radialGradientScalar, transformColorsScalar };
+
+#ifdef SPAN_KERNELS_X86
+/*
+	Channels are widened to 16 bits, multiplied and divided by 255 with the same rounding of
+	scalePixel: (t+(t>>8)+0x80)>>8, which never overflows 16 bits for t<=255*255
+*/
+TARGET("sse2") inline __m128i div255SSE2(__m128i t)
+{
+	return _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(t,_mm_srli_epi16(t,8)),_mm_set1_epi16(0x80)),8);
+}
+
+//Scales the pixels by the 16 bits factors, for the low and high pairs of pixels
+TARGET("sse2") inline __m128i scaleSSE2(__m128i p, __m128i lo, __m128i hi)
+{
+	const __m128i zero=_mm_setzero_si128();
+	const __m128i plo=div255SSE2(_mm_mullo_epi16(_mm_unpacklo_epi8(p,zero),lo));
+	const __m128i phi=div255SSE2(_mm_mullo_epi16(_mm_unpackhi_epi8(p,zero),hi));
+	return _mm_packus_epi16(plo,phi);
+}
+
+TARGET("sse2") inline __m128i blendSSE2(__m128i d, __m128i s)
+{
+	//255-alpha of each pixel, in both the 16 bits halves
+	__m128i inv=_mm_sub_epi32(_mm_set1_epi32(255),_mm_srli_epi32(s,24));
+	inv=_mm_or_si128(inv,_mm_slli_epi32(inv,16));
+	return _mm_add_epi32(s,scaleSSE2(d,_mm_unpacklo_epi32(inv,inv),_mm_unpackhi_epi32(inv,inv)));
+}
+
+TARGET("sse2") void solidSSE2(uint32_t* dst, uint32_t count, uint32_t color)
+{
+	const uint32_t alpha=color>>24;
+	if(alpha==0xff || alpha==0)
+	{
+		solidScalar(dst,count,color);
+		return;
+	}
+	const __m128i s=_mm_set1_epi32(color);
+	const __m128i inv=_mm_set1_epi16(255-alpha);
+	uint32_t i=0;
+	for(;i+4<=count;i+=4)
+	{
+		const __m128i d=_mm_loadu_si128((const __m128i*)(dst+i));
+		_mm_storeu_si128((__m128i*)(dst+i),_mm_add_epi32(s,scaleSSE2(d,inv,inv)));
+	}
+	solidScalar(dst+i,count-i,color);
+}
+
+TARGET("sse2") void compositeSSE2(uint32_t* dst, uint32_t* src, uint32_t count, uint32_t alpha)
+{
+	const __m128i a=_mm_set1_epi16(alpha);
+	const __m128i zero=_mm_setzero_si128();
+	uint32_t i=0;
+	for(;i+4<=count;i+=4)
+	{
+		const __m128i s=_mm_loadu_si128((const __m128i*)(src+i));
+		//Layers are mostly empty
+		if(_mm_movemask_epi8(_mm_cmpeq_epi32(s,zero))==0xffff)
+			continue;
+		const __m128i d=_mm_loadu_si128((const __m128i*)(dst+i));
+		_mm_storeu_si128((__m128i*)(dst+i),blendSSE2(d,scaleSSE2(s,a,a)));
+		_mm_storeu_si128((__m128i*)(src+i),zero);
+	}
+	compositeScalar(dst+i,src+i,count-i,alpha);
+}
+
+TARGET("sse2") inline __m128i gradientIndexSSE2(__m128 f)
+{
+	return _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(f,_mm_setzero_ps()),_mm_set1_ps(255)));
+}
+
+TARGET("sse2") inline __m128i loadRampSSE2(const uint32_t* ramp, __m128i index)
+{
+	int32_t idx[4];
+	_mm_storeu_si128((__m128i*)idx,index);
+	return _mm_setr_epi32(ramp[idx[0]],ramp[idx[1]],ramp[idx[2]],ramp[idx[3]]);
+}
+
+TARGET("sse2") void linearGradientSSE2(uint32_t* dst, uint32_t count, const uint32_t* ramp, float gx, float gy, float dx, float dy)
+{
+	const __m128 lanes=_mm_setr_ps(0,1,2,3);
+	uint32_t i=0;
+	for(;i+4<=count;i+=4)
+	{
+		const __m128 n=_mm_add_ps(_mm_set1_ps(float(i)),lanes);
+		const __m128 x=_mm_add_ps(_mm_set1_ps(gx),_mm_mul_ps(n,_mm_set1_ps(dx)));
+		const __m128 f=_mm_mul_ps(_mm_add_ps(x,_mm_set1_ps(gradientSize)),_mm_set1_ps(linearScale));
+		const __m128i s=loadRampSSE2(ramp,gradientIndexSSE2(f));
+		const __m128i d=_mm_loadu_si128((const __m128i*)(dst+i));
+		_mm_storeu_si128((__m128i*)(dst+i),blendSSE2(d,s));
+	}
+	//The tail starts from the coordinates of pixel i, computed as in the scalar loop
+	for(;i<count;i++)
+	{
+		const float x=gx+float(i)*dx;
+		dst[i]=blendPixel(dst[i],ramp[gradientIndex((x+gradientSize)*linearScale)]);
+	}
+}
+
+TARGET("sse2") void radialGradientSSE2(uint32_t* dst, uint32_t count, const uint32_t* ramp, float gx, float gy, float dx, float dy)
+{
+	const __m128 lanes=_mm_setr_ps(0,1,2,3);
+	uint32_t i=0;
+	for(;i+4<=count;i+=4)
+	{
+		const __m128 n=_mm_add_ps(_mm_set1_ps(float(i)),lanes);
+		const __m128 x=_mm_add_ps(_mm_set1_ps(gx),_mm_mul_ps(n,_mm_set1_ps(dx)));
+		const __m128 y=_mm_add_ps(_mm_set1_ps(gy),_mm_mul_ps(n,_mm_set1_ps(dy)));
+		const __m128 f=_mm_mul_ps(_mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(x,x),_mm_mul_ps(y,y))),_mm_set1_ps(radialScale));
+		const __m128i s=loadRampSSE2(ramp,gradientIndexSSE2(f));
+		const __m128i d=_mm_loadu_si128((const __m128i*)(dst+i));
+		_mm_storeu_si128((__m128i*)(dst+i),blendSSE2(d,s));
+	}
+	for(;i<count;i++)
+	{
+		const float x=gx+float(i)*dx;
+		const float y=gy+float(i)*dy;
+		dst[i]=blendPixel(dst[i],ramp[gradientIndex(sqrtf(x*x+y*y)*radialScale)]);
+	}
+}
+
+TARGET("sse2") void transformColorsSSE2(uint32_t* dst, const uint32_t* src, uint32_t count, const float mult[4], const float add[4])
+{
+	//Lanes follow the order of the bytes in memory: blue, green, red, alpha
+	const __m128 m=_mm_setr_ps(mult[2],mult[1],mult[0],mult[3]);
+	const __m128 a=_mm_setr_ps(add[2],add[1],add[0],add[3]);
+	const __m128i zero=_mm_setzero_si128();
+	const __m128i alphaMask=_mm_setr_epi32(0,0,0,-1);
+	for(uint32_t i=0;i<count;i++)
+	{
+		__m128i c=_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(src[i]),zero),zero);
+		__m128 v=_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(c),m),a);
+		v=_mm_min_ps(_mm_max_ps(v,_mm_setzero_ps()),_mm_set1_ps(255));
+		c=_mm_cvttps_epi32(_mm_add_ps(v,_mm_set1_ps(0.5f)));
+		//(c*alpha+127)/255, the values fit in the low 16 bits of each lane
+		__m128i n=_mm_add_epi32(_mm_mullo_epi16(c,_mm_shuffle_epi32(c,0xff)),_mm_set1_epi32(127));
+		n=_mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(n,_mm_set1_epi32(1)),_mm_srli_epi32(n,8)),8);
+		c=_mm_or_si128(_mm_andnot_si128(alphaMask,n),_mm_and_si128(alphaMask,c));
+		dst[i]=_mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(c,zero),zero));
+	}
+}
+
+const span_kernels sse2Kernels={ ISA_SSE2, "SSE2", solidSSE2, compositeSSE2,
+	linearGradientSSE2, radialGradientSSE2, transformColorsSSE2 };
+
+//SSSE3 spreads the inverted alpha of each pixel over its channels with a single shuffle
+TARGET("ssse3") inline __m128i blendSSSE3(__m128i d, __m128i s)
+{
+	const __m128i inv=_mm_xor_si128(s,_mm_set1_epi32(-1));
+	const __m128i lo=_mm_shuffle_epi8(inv,_mm_setr_epi8(3,-1,3,-1,3,-1,3,-1,7,-1,7,-1,7,-1,7,-1));
+	const __m128i hi=_mm_shuffle_epi8(inv,_mm_setr_epi8(11,-1,11,-1,11,-1,11,-1,15,-1,15,-1,15,-1,15,-1));
+	return _mm_add_epi32(s,scaleSSE2(d,lo,hi));
+}
+
+TARGET("ssse3") void compositeSSSE3(uint32_t* dst, uint32_t* src, uint32_t count, uint32_t alpha)
+{
+	const __m128i a=_mm_set1_epi16(alpha);
+	const __m128i zero=_mm_setzero_si128();
+	uint32_t i=0;
+	for(;i+4<=count;i+=4)
+	{
+		const __m128i s=_mm_loadu_si128((const __m128i*)(src+i));
+		if(_mm_movemask_epi8(_mm_cmpeq_epi32(s,zero))==0xffff)
+			continue;
+		const __m128i d=_mm_loadu_si128((const __m128i*)(dst+i));
+		_mm_storeu_si128((__m128i*)(dst+i),blendSSSE3(d,scaleSSE2(s,a,a)));
+		_mm_storeu_si128((__m128i*)(src+i),zero);
+	}
+	compositeScalar(dst+i,src+i,count-i,alpha);
+}
+
+TARGET("ssse3") void linearGradientSSSE3(uint32_t* dst, uint32_t count, const uint32_t* ramp, float gx, float gy, float dx, float dy)
+{
+	const __m128 lanes=_mm_setr_ps(0,1,2,3);
+	uint32_t i=0;
+	for(;i+4<=count;i+=4)
+	{
+		const __m128 n=_mm_add_ps(_mm_set1_ps(float(i)),lanes);
+		const __m128 x=_mm_add_ps(_mm_set1_ps(gx),_mm_mul_ps(n,_mm_set1_ps(dx)));
+		const __m128 f=_mm_mul_ps(_mm_add_ps(x,_mm_set1_ps(gradientSize)),_mm_set1_ps(linearScale));
+		const __m128i s=loadRampSSE2(ramp,gradientIndexSSE2(f));
+		const __m128i d=_mm_loadu_si128((const __m128i*)(dst+i));
+		_mm_storeu_si128((__m128i*)(dst+i),blendSSSE3(d,s));
+	}
+	for(;i<count;i++)
+	{
+		const float x=gx+float(i)*dx;
+		dst[i]=blendPixel(dst[i],ramp[gradientIndex((x+gradientSize)*linearScale)]);
+	}
+}
+
+TARGET("ssse3") void radialGradientSSSE3(uint32_t* dst, uint32_t count, const uint32_t* ramp, float gx, float gy, float dx, float dy)
+{
+	const __m128 lanes=_mm_setr_ps(0,1,2,3);
+	uint32_t i=0;
+	for(;i+4<=count;i+=4)
+	{
+		const __m128 n=_mm_add_ps(_mm_set1_ps(float(i)),lanes);
+		const __m128 x=_mm_add_ps(_mm_set1_ps(gx),_mm_mul_ps(n,_mm_set1_ps(dx)));
+		const __m128 y=_mm_add_ps(_mm_set1_ps(gy),_mm_mul_ps(n,_mm_set1_ps(dy)));
+		const __m128 f=_mm_mul_ps(_mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(x,x),_mm_mul_ps(y,y))),_mm_set1_ps(radialScale));
+		const __m128i s=loadRampSSE2(ramp,gradientIndexSSE2(f));
+		const __m128i d=_mm_loadu_si128((const __m128i*)(dst+i));
+		_mm_storeu_si128((__m128i*)(dst+i),blendSSSE3(d,s));
+	}
+	for(;i<count;i++)
+	{
+		const float x=gx+float(i)*dx;
+		const float y=gy+float(i)*dy;
+		dst[i]=blendPixel(dst[i],ramp[gradientIndex(sqrtf(x*x+y*y)*radialScale)]);
+	}
+}
+
+const span_kernels ssse3Kernels={ ISA_SSSE3, "SSSE3", solidSSE2, compositeSSSE3,
+	linearGradientSSSE3, radialGradientSSSE3, transformColorsSSE2 };
+
+//AVX2 works on 8 pixels, the byte shuffles and the unpacking stay inside each 128 bits lane
+TARGET("avx2") inline __m256i div255AVX2(__m256i t)
+{
+	return _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(t,_mm256_srli_epi16(t,8)),_mm256_set1_epi16(0x80)),8);
+}
+
+TARGET("avx2") inline __m256i scaleAVX2(__m256i p, __m256i lo, __m256i hi)
+{
+	const __m256i zero=_mm256_setzero_si256();
+	const __m256i plo=div255AVX2(_mm256_mullo_epi16(_mm256_unpacklo_epi8(p,zero),lo));
+	const __m256i phi=div255AVX2(_mm256_mullo_epi16(_mm256_unpackhi_epi8(p,zero),hi));
+	return _mm256_packus_epi16(plo,phi);
+}
+
+TARGET("avx2") inline __m256i blendAVX2(__m256i d, __m256i s)
+{
+	const __m256i inv=_mm256_xor_si256(s,_mm256_set1_epi32(-1));
+	const __m256i lo=_mm256_shuffle_epi8(inv,_mm256_setr_epi8(3,-1,3,-1,3,-1,3,-1,7,-1,7,-1,7,-1,7,-1,
+				3,-1,3,-1,3,-1,3,-1,7,-1,7,-1,7,-1,7,-1));
+	const __m256i hi=_mm256_shuffle_epi8(inv,_mm256_setr_epi8(11,-1,11,-1,11,-1,11,-1,15,-1,15,-1,15,-1,15,-1,
+				11,-1,11,-1,11,-1,11,-1,15,-1,15,-1,15,-1,15,-1));
+	return _mm256_add_epi32(s,scaleAVX2(d,lo,hi));
+}
+
+TARGET("avx2") void solidAVX2(uint32_t* dst, uint32_t count, uint32_t color)
+{
+	const uint32_t alpha=color>>24;
+	if(alpha==0)
+		return;
+	const __m256i s=_mm256_set1_epi32(color);
+	uint32_t i=0;
+	if(alpha==0xff)
+	{
+		for(;i+8<=count;i+=8)
+			_mm256_storeu_si256((__m256i*)(dst+i),s);
+	}
+	else
+	{
+		const __m256i inv=_mm256_set1_epi16(255-alpha);
+		for(;i+8<=count;i+=8)
+		{
+			const __m256i d=_mm256_loadu_si256((const __m256i*)(dst+i));
+			_mm256_storeu_si256((__m256i*)(dst+i),_mm256_add_epi32(s,scaleAVX2(d,inv,inv)));
+		}
+	}
+	solidScalar(dst+i,count-i,color);
+}
+
+TARGET("avx2") void compositeAVX2(uint32_t* dst, uint32_t* src, uint32_t count, uint32_t alpha)
+{
+	const __m256i a=_mm256_set1_epi16(alpha);
+	const __m256i zero=_mm256_setzero_si256();
+	uint32_t i=0;
+	for(;i+8<=count;i+=8)
+	{
+		const __m256i s=_mm256_loadu_si256((const __m256i*)(src+i));
+		if(_mm256_testz_si256(s,s))
+			continue;
+		const __m256i d=_mm256_loadu_si256((const __m256i*)(dst+i));
+		_mm256_storeu_si256((__m256i*)(dst+i),blendAVX2(d,scaleAVX2(s,a,a)));
+		_mm256_storeu_si256((__m256i*)(src+i),zero);
+	}
+	compositeScalar(dst+i,src+i,count-i,alpha);
+}
+
+TARGET("avx2") inline __m256i loadRampAVX2(const uint32_t* ramp, __m256 f)
+{
+	const __m256i index=_mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(f,_mm256_setzero_ps()),_mm256_set1_ps(255)));
+	return _mm256_i32gather_epi32((const int*)ramp,index,4);
+}
+
+TARGET("avx2") void linearGradientAVX2(uint32_t* dst, uint32_t count, const uint32_t* ramp, float gx, float gy, float dx, float dy)
+{
+	const __m256 lanes=_mm256_setr_ps(0,1,2,3,4,5,6,7);
+	uint32_t i=0;
+	for(;i+8<=count;i+=8)
+	{
+		const __m256 n=_mm256_add_ps(_mm256_set1_ps(float(i)),lanes);
+		const __m256 x=_mm256_add_ps(_mm256_set1_ps(gx),_mm256_mul_ps(n,_mm256_set1_ps(dx)));
+		const __m256 f=_mm256_mul_ps(_mm256_add_ps(x,_mm256_set1_ps(gradientSize)),_mm256_set1_ps(linearScale));
+		const __m256i d=_mm256_loadu_si256((const __m256i*)(dst+i));
+		_mm256_storeu_si256((__m256i*)(dst+i),blendAVX2(d,loadRampAVX2(ramp,f)));
+	}
+	for(;i<count;i++)
+	{
+		const float x=gx+float(i)*dx;
+		dst[i]=blendPixel(dst[i],ramp[gradientIndex((x+gradientSize)*linearScale)]);
+	}
+}
+
+TARGET("avx2") void radialGradientAVX2(uint32_t* dst, uint32_t count, const uint32_t* ramp, float gx, float gy, float dx, float dy)
+{
+	const __m256 lanes=_mm256_setr_ps(0,1,2,3,4,5,6,7);
+	uint32_t i=0;
+	for(;i+8<=count;i+=8)
+	{
+		const __m256 n=_mm256_add_ps(_mm256_set1_ps(float(i)),lanes);
+		const __m256 x=_mm256_add_ps(_mm256_set1_ps(gx),_mm256_mul_ps(n,_mm256_set1_ps(dx)));
+		const __m256 y=_mm256_add_ps(_mm256_set1_ps(gy),_mm256_mul_ps(n,_mm256_set1_ps(dy)));
+		const __m256 f=_mm256_mul_ps(_mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(x,x),_mm256_mul_ps(y,y))),
+				_mm256_set1_ps(radialScale));
+		const __m256i d=_mm256_loadu_si256((const __m256i*)(dst+i));
+		_mm256_storeu_si256((__m256i*)(dst+i),blendAVX2(d,loadRampAVX2(ramp,f)));
+	}
+	for(;i<count;i++)
+	{
+		const float x=gx+float(i)*dx;
+		const float y=gy+float(i)*dy;
+		dst[i]=blendPixel(dst[i],ramp[gradientIndex(sqrtf(x*x+y*y)*radialScale)]);
+	}
+}
+
+const span_kernels avx2Kernels={ ISA_AVX2, "AVX2", solidAVX2, compositeAVX2,
+	linearGradientAVX2, radialGradientAVX2, transformColorsSSE2 };
+#endif
+
+bool isSupported(SPAN_ISA isa)
+{
+	switch(isa)
+	{
+		case ISA_SCALAR:
+			return true;
+#ifdef SPAN_KERNELS_X86
+		case ISA_SSE2:
+			return __builtin_cpu_supports("sse2");
+		case ISA_SSSE3:
+			return __builtin_cpu_supports("ssse3");
+		case ISA_AVX2:
+			return __builtin_cpu_supports("avx2");
+#endif
+		default:
+			return false;
+	}
+}
+
+//Deterministic pseudo random numbers, so that failures can be reproduced
+uint32_t nextRandom(uint32_t& seed)
+{
+	seed=seed*1664525+1013904223;
+	return seed;
+}
+
+//Random premultiplied pixel, with many opaque and transparent ones as in real frames
+uint32_t randomPixel(uint32_t& seed)
+{
+	const uint32_t r=nextRandom(seed);
+	uint32_t a=r>>24;
+	if((r&3)==0)
+		a=0;
+	else if((r&3)==1)
+		a=255;
+	const uint32_t c=nextRandom(seed);
+	return (a<<24)|(scalePixel(c,a)&0x00ffffff);
+}
+
+bool validateKernels(const span_kernels& k)
+{
+	const span_kernels& ref=scalarKernels;
+	uint32_t seed=0x1234567;
+	uint32_t ramp[256];
+	for(int i=0;i<256;i++)
+		ramp[i]=randomPixel(seed);
+	bool ret=true;
+	//All the lengths of the tails and some longer spans
+	for(uint32_t count=0;count<80 && ret;count++)
+	{
+		const uint32_t len=(count<64)?count:(count*37);
+		vector<uint32_t> dst(len),expected(len),src(len),srcExpected(len);
+		for(int test=0;test<8 && ret;test++)
+		{
+			for(uint32_t i=0;i<len;i++)
+			{
+				dst[i]=expected[i]=randomPixel(seed);
+				src[i]=srcExpected[i]=randomPixel(seed);
+			}
+			const uint32_t color=randomPixel(seed);
+			const uint32_t alpha=nextRandom(seed)>>24;
+			const float gx=int32_t(nextRandom(seed))/65536.0f;
+			const float gy=int32_t(nextRandom(seed))/65536.0f;
+			const float dx=int32_t(nextRandom(seed))/float(1<<24);
+			const float dy=int32_t(nextRandom(seed))/float(1<<24);
+			float mult[4],add[4];
+			for(int i=0;i<4;i++)
+			{
+				mult[i]=(nextRandom(seed)>>16)/32768.0f;
+				add[i]=(int32_t(nextRandom(seed))>>22);
+			}
+			const uint32_t* d=len?&dst[0]:NULL;
+			switch(test%5)
+			{
+				case 0:
+					ref.solid(len?&expected[0]:NULL,len,color);
+					k.solid(len?&dst[0]:NULL,len,color);
+					break;
+				case 1:
+					ref.composite(len?&expected[0]:NULL,len?&srcExpected[0]:NULL,len,alpha);
+					k.composite(len?&dst[0]:NULL,len?&src[0]:NULL,len,alpha);
+					break;
+				case 2:
+					ref.linearGradient(len?&expected[0]:NULL,len,ramp,gx,gy,dx,dy);
+					k.linearGradient(len?&dst[0]:NULL,len,ramp,gx,gy,dx,dy);
+					break;
+				case 3:
+					ref.radialGradient(len?&expected[0]:NULL,len,ramp,gx,gy,dx,dy);
+					k.radialGradient(len?&dst[0]:NULL,len,ramp,gx,gy,dx,dy);
+					break;
+				case 4:
+					ref.transformColors(len?&expected[0]:NULL,len?&srcExpected[0]:NULL,len,mult,add);
+					k.transformColors(len?&dst[0]:NULL,len?&src[0]:NULL,len,mult,add);
+					break;
+			}
+			for(uint32_t i=0;i<len;i++)
+			{
+				if(d[i]!=expected[i] || src[i]!=srcExpected[i])
+				{
+					LOG(LOG_ERROR,_("Span kernel ") << test%5 << _(" of ") << k.name << _(" differs at ") << i << _(" of ") << len
+							<< hex << _(": ") << d[i] << _(" instead of ") << expected[i] << dec);
+					ret=false;
+					break;
+				}
+			}
+		}
+	}
+	return ret;
+}
+
+const span_kernels* selectKernels()
+{
+	for(int isa=ISA_COUNT-1;isa>ISA_SCALAR;isa--)
+	{
+		const span_kernels* k=getSpanKernels((SPAN_ISA)isa);
+		if(k==NULL)
+			continue;
+		if(validateKernels(*k))
+		{
+			LOG(LOG_NO_INFO,_("Using ") << k->name << _(" span kernels"));
+			return k;
+		}
+		LOG(LOG_ERROR,_("Span kernels for ") << k->name << _(" do not match the scalar ones, not using them"));
+	}
+	return &scalarKernels;
+}
+};
+
+const span_kernels* lightspark::getSpanKernels(SPAN_ISA isa)
+{
+	if(!isSupported(isa))
+		return NULL;
+	switch(isa)
+	{
+		case ISA_SCALAR:
+			return &scalarKernels;
+#ifdef SPAN_KERNELS_X86
+		case ISA_SSE2:
+			return &sse2Kernels;
+		case ISA_SSSE3:
+			return &ssse3Kernels;
+		case ISA_AVX2:
+			return &avx2Kernels;
+#endif
+		default:
+			return NULL;
+	}
+}
+
+const span_kernels& lightspark::getSpanKernels()
+{
+	//Selected once, the first renderer is created before any other thread uses the kernels
+	static const span_kernels* selected=selectKernels();
+	return *selected;
+}
+
+bool lightspark::benchmarkSpanKernels()
+{
+	const uint32_t len=1920;
+	const uint32_t iterations=2000;
+	vector<uint32_t> dst(len),src(len),colors(256);
+	uint32_t seed=0x7654321;
+	uint32_t ramp[256];
+	for(int i=0;i<256;i++)
+	{
+		ramp[i]=randomPixel(seed);
+		colors[i]=nextRandom(seed);
+	}
+	const float mult[4]={0.5f,1,0.75f,0.9f};
+	const float add[4]={10,-20,0,5};
+	bool ret=true;
+	for(int isa=ISA_SCALAR;isa<ISA_COUNT;isa++)
+	{
+		const span_kernels* k=getSpanKernels((SPAN_ISA)isa);
+		if(k==NULL)
+			continue;
+		const bool valid=validateKernels(*k);
+		ret&=valid;
+		//Times are in microseconds for 1000 spans
+		uint64_t times[5];
+		for(int test=0;test<5;test++)
+		{
+			for(uint32_t i=0;i<len;i++)
+				dst[i]=randomPixel(seed);
+			const uint64_t start=compat_get_thread_cputime_us();
+			for(uint32_t j=0;j<iterations;j++)
+			{
+				switch(test)
+				{
+					case 0:
+						k->solid(&dst[0],len,0x80402010);
+						break;
+					case 1:
+						//Half of the layer pixels are drawn again at each iteration
+						for(uint32_t i=0;i<len;i+=2)
+							src[i]=0x80402010;
+						k->composite(&dst[0],&src[0],len,128);
+						break;
+					case 2:
+						k->linearGradient(&dst[0],len,ramp,-16384,0,17,0);
+						break;
+					case 3:
+						k->radialGradient(&dst[0],len,ramp,-8000,-3000,9,2);
+						break;
+					case 4:
+						k->transformColors(&dst[0],&colors[0],256,mult,add);
+						break;
+				}
+			}
+			times[test]=(compat_get_thread_cputime_us()-start)*1000/iterations;
+		}
+		LOG(LOG_NO_INFO,k->name << (valid?_(" (valid)"):_(" (MISMATCH)")) << _(": solid ") << times[0]
+				<< _(" us, composite ") << times[1] << _(" us, linear ") << times[2] << _(" us, radial ") << times[3]
+				<< _(" us per 1000 spans of ") << len << _(" pixels, color transform ") << times[4] << _(" us per 1000 ramps"));
+	}
+	return ret;
+}
@@ -0,0 +1,82 @@
+/**************************************************************************
+    Lightspark, a free flash player implementation
+
+    Copyright (C) 2009,2010  Alessandro Pignotti (a.pignotti@sssup.it)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#ifndef _SPAN_KERNELS_H
+#define _SPAN_KERNELS_H
+
+#include "compat.h"
+#include <inttypes.h>
+
+namespace lightspark
+{
+
+//Multiplies the four channels of a premultiplied pixel by a/255
+inline uint32_t scalePixel(uint32_t p, uint32_t a)
+{
+	uint32_t rb=(p&0x00ff00ff)*a;
+	uint32_t ag=((p>>8)&0x00ff00ff)*a;
+	//Division by 255 with rounding, on two channels at a time
+	rb=((rb+((rb>>8)&0x00ff00ff)+0x00800080)>>8)&0x00ff00ff;
+	ag=(ag+((ag>>8)&0x00ff00ff)+0x00800080)&0xff00ff00;
+	return rb|ag;
+}
+
+//Source over blending of premultiplied pixels
+inline uint32_t blendPixel(uint32_t dst, uint32_t src)
+{
+	const uint32_t alpha=src>>24;
+	if(alpha==0xff)
+		return src;
+	return src+scalePixel(dst,255-alpha);
+}
+
+enum SPAN_ISA { ISA_SCALAR=0, ISA_SSE2, ISA_SSSE3, ISA_AVX2, ISA_COUNT };
+
+/*
+	Inner loops of the software renderer. Pixels are premultiplied 0xAARRGGBB words, colors
+	which are not premultiplied yet use the same layout. Every instruction set gives exactly
+	the results of the scalar kernels, so they can be switched freely
+*/
+struct span_kernels
+{
+	SPAN_ISA isa;
+	const char* name;
+	//Fills with a premultiplied color, blending it unless it is opaque
+	void (*solid)(uint32_t* dst, uint32_t count, uint32_t color);
+	//Blends src, scaled by alpha (0-255), over dst and clears src
+	void (*composite)(uint32_t* dst, uint32_t* src, uint32_t count, uint32_t alpha);
+	//The i-th pixel blends the entry of the 256 colors ramp at (gx+i*dx, gy+i*dy) in the gradient square
+	void (*linearGradient)(uint32_t* dst, uint32_t count, const uint32_t* ramp, float gx, float gy, float dx, float dy);
+	void (*radialGradient)(uint32_t* dst, uint32_t count, const uint32_t* ramp, float gx, float gy, float dx, float dy);
+	//Applies a color transformation, terms are in RGBA order, and premultiplies the result
+	void (*transformColors)(uint32_t* dst, const uint32_t* src, uint32_t count, const float mult[4], const float add[4]);
+};
+
+//Gradients are defined on a square of 32768 twips centered on the origin
+const float gradientSize=16384;
+
+//Kernels of the best instruction set supported by the CPU which passed validation
+const span_kernels& getSpanKernels();
+//Kernels of the given instruction set, NULL if the CPU does not support it
+const span_kernels* getSpanKernels(SPAN_ISA isa);
+//Compares every instruction set against the scalar kernels on random spans and times them, returns false on mismatches
+bool benchmarkSpanKernels();
+
+};
+#endif
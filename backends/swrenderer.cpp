@@ -0,0 +1,762 @@
+/**************************************************************************
+    Lightspark, a free flash player implementation
+
+    Copyright (C) 2009,2010  Alessandro Pignotti (a.pignotti@sssup.it)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "swf.h"
+#include "swrenderer.h"
+#include "spankernels.h"
+#include "logger.h"
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace lightspark;
+
+extern TLSDATA SystemState* sys;
+
+namespace
+{
+inline int clampChannel(float c)
+{
+	if(c<=0)
+		return 0;
+	if(c>=255)
+		return 255;
+	return int(c+0.5f);
+}
+
+inline uint32_t packColor(const RGBA& c)
+{
+	return (uint32_t(c.Alpha)<<24)|(uint32_t(c.Red)<<16)|(uint32_t(c.Green)<<8)|uint32_t(c.Blue);
+}
+};
+
+SoftwareRenderer::affine SoftwareRenderer::affine::operator*(const affine& m) const
+{
+	return affine(a*m.a+c*m.b, b*m.a+d*m.b, a*m.c+c*m.d, b*m.c+d*m.d, a*m.tx+c*m.ty+tx, b*m.tx+d*m.ty+ty);
+}
+
+bool SoftwareRenderer::affine::invert(affine& ret) const
+{
+	const float det=a*d-b*c;
+	if(fabsf(det)<1e-12f)
+		return false;
+	ret.a=d/det;
+	ret.b=-b/det;
+	ret.c=-c/det;
+	ret.d=a/det;
+	ret.tx=-(ret.a*tx+ret.c*ty);
+	ret.ty=-(ret.b*tx+ret.d*ty);
+	return true;
+}
+
+uint32_t SoftwareRenderer::threadCount=0;
+
+/*
+	Rasterizes tiles of the frame being flushed, alongside the render thread. Jobs are reused
+	across frames and queued again only when they have finished, so a busy pool never
+	accumulates them
+*/
+class SoftwareRenderer::tile_job: public IThreadJob
+{
+private:
+	SoftwareRenderer* renderer;
+	raster_context context;
+	void execute();
+	void threadAbort(){}
+public:
+	//Protected by the tile mutex of the renderer
+	bool idle;
+	tile_job(SoftwareRenderer* r):renderer(r),idle(true){}
+};
+
+void SoftwareRenderer::tile_job::execute()
+{
+	renderer->rasterizeTiles(context);
+	Locker l(renderer->tileMutex);
+	idle=true;
+}
+
+SoftwareRenderer::raster_context::~raster_context()
+{
+	for(uint32_t i=0;i<layers.size();i++)
+		delete layers[i];
+}
+
+SoftwareRenderer::SoftwareRenderer(uint32_t w, uint32_t h):width(w),height(h),framebuffer(w*h,0xff000000),background(0xff000000),
+	kernels(getSpanKernels()),fillType(FILL_SOLID),focalPoint(0),fillDirty(true),fillPixel(0),gradientOffset(0),tileMutex("Software renderer tiles"),
+	frameActive(false),nextTile(0),doneTiles(0)
+{
+	assert_and_throw(w && h);
+	sem_init(&frameDone,0,0);
+	for(int i=0;i<4;i++)
+	{
+		colorTransform.mult[i]=1;
+		colorTransform.add[i]=0;
+	}
+	for(uint32_t y=0;y<height;y+=tileSize)
+	{
+		for(uint32_t x=0;x<width;x+=tileSize)
+		{
+			tile t;
+			t.xmin=x;
+			t.xmax=imin(x+tileSize,width);
+			t.ymin=y;
+			t.ymax=imin(y+tileSize,height);
+			t.covered=false;
+			tiles.push_back(t);
+		}
+	}
+
+	uint32_t count=threadCount;
+#ifndef WIN32
+	if(count==0)
+	{
+		long cores=sysconf(_SC_NPROCESSORS_ONLN);
+		count=(cores>0)?cores:1;
+	}
+#endif
+	//The render thread is one of the threads
+	for(uint32_t i=1;i<count && i<tiles.size();i++)
+		helpers.push_back(new tile_job(this));
+	LOG(LOG_NO_INFO,_("Software renderer: ") << tiles.size() << _(" tiles, ") << helpers.size()+1 << _(" threads"));
+}
+
+SoftwareRenderer::~SoftwareRenderer()
+{
+	//The ThreadPool has already been stopped, so the helpers are not running
+	for(uint32_t i=0;i<helpers.size();i++)
+		delete helpers[i];
+	sem_destroy(&frameDone);
+}
+
+void SoftwareRenderer::clear(const RGB& bg)
+{
+	commands.clear();
+	vertices.clear();
+	gradientPool.clear();
+	layerStack.clear();
+	for(uint32_t i=0;i<tiles.size();i++)
+	{
+		tiles[i].commands.clear();
+		tiles[i].covered=false;
+	}
+	matrixStack.clear();
+	current=affine();
+	colorStack.clear();
+	for(int i=0;i<4;i++)
+	{
+		colorTransform.mult[i]=1;
+		colorTransform.add[i]=0;
+	}
+	fillType=FILL_SOLID;
+	fillColor=0xff000000;
+	fillDirty=true;
+	background=0xff000000|(bg.Red<<16)|(bg.Green<<8)|bg.Blue;
+}
+
+void SoftwareRenderer::flush()
+{
+	{
+		Locker l(tileMutex);
+		nextTile=0;
+		doneTiles=0;
+		frameActive=true;
+	}
+	//The pool is going away during shutdown
+	if(!sys->isShuttingDown())
+	{
+		for(uint32_t i=0;i<helpers.size();i++)
+		{
+			tileMutex.lock();
+			const bool start=helpers[i]->idle;
+			helpers[i]->idle=false;
+			tileMutex.unlock();
+			if(start)
+				sys->addJob(helpers[i]);
+		}
+	}
+	//Helpers which are not running yet only take the tiles left, if any
+	rasterizeTiles(mainContext);
+	sem_wait(&frameDone);
+}
+
+void SoftwareRenderer::rasterizeTiles(raster_context& ctx)
+{
+	while(1)
+	{
+		uint32_t index;
+		{
+			Locker l(tileMutex);
+			if(!frameActive || nextTile==tiles.size())
+				return;
+			index=nextTile++;
+		}
+		rasterizeTile(tiles[index],ctx);
+		Locker l(tileMutex);
+		doneTiles++;
+		if(doneTiles==tiles.size())
+		{
+			frameActive=false;
+			sem_post(&frameDone);
+		}
+	}
+}
+
+void SoftwareRenderer::pushMatrix()
+{
+	matrixStack.push_back(current);
+}
+
+void SoftwareRenderer::popMatrix()
+{
+	assert_and_throw(!matrixStack.empty());
+	current=matrixStack.back();
+	matrixStack.pop_back();
+}
+
+void SoftwareRenderer::multMatrix(const MATRIX& m)
+{
+	current=current*affine(m.ScaleX,m.RotateSkew0,m.RotateSkew1,m.ScaleY,m.TranslateX,m.TranslateY);
+}
+
+void SoftwareRenderer::scale(float sx, float sy)
+{
+	current=current*affine(sx,0,0,sy,0,0);
+}
+
+float SoftwareRenderer::getScale() const
+{
+	return max(sqrtf(current.a*current.a+current.b*current.b),sqrtf(current.c*current.c+current.d*current.d));
+}
+
+void SoftwareRenderer::pushColorTransform(const CXFORMWITHALPHA& cx)
+{
+	colorStack.push_back(colorTransform);
+	if(cx.isIdentity())
+		return;
+	float mult[4];
+	float add[4];
+	cx.getTerms(mult,add);
+	//The transformation of the parent is applied after the one of the child
+	for(int i=0;i<4;i++)
+	{
+		colorTransform.add[i]+=colorTransform.mult[i]*add[i];
+		colorTransform.mult[i]*=mult[i];
+	}
+	fillDirty=true;
+}
+
+void SoftwareRenderer::popColorTransform()
+{
+	assert_and_throw(!colorStack.empty());
+	colorTransform=colorStack.back();
+	colorStack.pop_back();
+	fillDirty=true;
+}
+
+void SoftwareRenderer::setGradient(const vector<GRADRECORD>& records)
+{
+	if(records.empty())
+	{
+		for(int i=0;i<256;i++)
+			gradientColors[i]=0;
+		return;
+	}
+	//Colors are interpolated between the records, and padded outside of them
+	uint32_t next=0;
+	for(int i=0;i<256;i++)
+	{
+		while(next<records.size() && records[next].Ratio<i)
+			next++;
+		if(next==0)
+			gradientColors[i]=packColor(records[0].Color);
+		else if(next==records.size())
+			gradientColors[i]=packColor(records.back().Color);
+		else
+		{
+			const GRADRECORD& l=records[next-1];
+			const GRADRECORD& r=records[next];
+			const float t=float(i-l.Ratio)/float(r.Ratio-l.Ratio);
+			gradientColors[i]=packColor(RGBA(clampChannel(l.Color.Red+(r.Color.Red-l.Color.Red)*t),
+					clampChannel(l.Color.Green+(r.Color.Green-l.Color.Green)*t),
+					clampChannel(l.Color.Blue+(r.Color.Blue-l.Color.Blue)*t),
+					clampChannel(l.Color.Alpha+(r.Color.Alpha-l.Color.Alpha)*t)));
+		}
+	}
+}
+
+void SoftwareRenderer::setFillStyle(const FILLSTYLE& style)
+{
+	fillDirty=true;
+	const MATRIX& m=style.GradientMatrix;
+	switch(style.FillStyleType)
+	{
+		case 0x00:
+			fillType=FILL_SOLID;
+			fillColor=packColor(style.Color);
+			return;
+		case 0x10:
+			fillType=FILL_LINEAR;
+			setGradient(style.Gradient.GradientRecords);
+			break;
+		case 0x12:
+			fillType=FILL_RADIAL;
+			setGradient(style.Gradient.GradientRecords);
+			break;
+		case 0x13:
+			fillType=FILL_FOCAL;
+			setGradient(style.FocalGradient.GradientRecords);
+			//The focal point must stay inside the circle
+			focalPoint=dmax(-0.99,dmin(0.99,style.FocalGradient.FocalPoint));
+			break;
+		default:
+			LOG(LOG_NOT_IMPLEMENTED,_("Style not implemented"));
+			fillType=FILL_SOLID;
+			fillColor=0xff808000;
+			return;
+	}
+	//The translation of the matrix is read in pixels, while shapes are in twips
+	gradientMatrix=affine(m.ScaleX,m.RotateSkew0,m.RotateSkew1,m.ScaleY,m.TranslateX*20,m.TranslateY*20);
+}
+
+void SoftwareRenderer::setFixedColor(float r, float g, float b)
+{
+	fillType=FILL_SOLID;
+	fillColor=packColor(RGBA(clampChannel(r*255),clampChannel(g*255),clampChannel(b*255),255));
+	fillDirty=true;
+}
+
+void SoftwareRenderer::addVertex(float x, float y)
+{
+	float tx,ty;
+	current.apply(x,y,tx,ty);
+	vertices.push_back(tx);
+	vertices.push_back(ty);
+}
+
+void SoftwareRenderer::addPrimitive(COMMAND_TYPE type, uint32_t firstVertex, const float* cover, int coverCount)
+{
+	const uint32_t count=vertices.size()/2-firstVertex;
+	draw_command cmd;
+	cmd.type=type;
+	cmd.firstVertex=firstVertex;
+	cmd.vertexCount=count;
+	cmd.alpha=1;
+	//Bounds of the pixels which may be touched
+	float xmin=FLT_MAX,xmax=-FLT_MAX,ymin=FLT_MAX,ymax=-FLT_MAX;
+	for(uint32_t i=0;i<count;i++)
+	{
+		const float x=vertices[(firstVertex+i)*2];
+		const float y=vertices[(firstVertex+i)*2+1];
+		xmin=min(xmin,x);
+		xmax=max(xmax,x);
+		ymin=min(ymin,y);
+		ymax=max(ymax,y);
+	}
+	if(count && xmax>=0 && ymax>=0 && xmin<width && ymin<height)
+	{
+		cmd.xmin=imax(0,int(floorf(xmin)));
+		cmd.xmax=imin(width,int(floorf(xmax))+1);
+		cmd.ymin=imax(0,int(floorf(ymin)));
+		cmd.ymax=imin(height,int(floorf(ymax))+1);
+	}
+	else
+		cmd.xmin=cmd.xmax=cmd.ymin=cmd.ymax=0;
+
+	if(fillDirty)
+	{
+		if(fillType==FILL_SOLID)
+			kernels.transformColors(&fillPixel,&fillColor,1,colorTransform.mult,colorTransform.add);
+		else
+		{
+			gradientOffset=gradientPool.size();
+			gradientPool.resize(gradientOffset+256);
+			kernels.transformColors(&gradientPool[gradientOffset],gradientColors,256,colorTransform.mult,colorTransform.add);
+		}
+		fillDirty=false;
+	}
+	cmd.fillType=fillType;
+	if(fillType==FILL_SOLID)
+	{
+		cmd.fill=fillPixel;
+		//Invisible primitives are dropped
+		if((fillPixel>>24)==0)
+			cmd.xmin=cmd.xmax=0;
+	}
+	else
+	{
+		cmd.fill=gradientOffset;
+		cmd.focalPoint=focalPoint;
+		//Degenerate gradients are filled with the central color
+		if(!(current*gradientMatrix).invert(cmd.pixelToGradient))
+			cmd.pixelToGradient=affine(0,0,0,0,0,0);
+	}
+
+	if(cmd.xmin>=cmd.xmax || cmd.ymin>=cmd.ymax)
+	{
+		vertices.resize(firstVertex*2);
+		return;
+	}
+	commands.push_back(cmd);
+	if(!layerStack.empty())
+	{
+		layer_record& l=layerStack.back();
+		l.xmin=imin(l.xmin,cmd.xmin);
+		l.xmax=imax(l.xmax,cmd.xmax);
+		l.ymin=imin(l.ymin,cmd.ymin);
+		l.ymax=imax(l.ymax,cmd.ymax);
+	}
+	binCommand(commands.size()-1,cover,coverCount);
+}
+
+bool SoftwareRenderer::polygonCovers(const float* v, int count, const tile& t)
+{
+	//The centers of the corner pixels must be strictly inside, then all the centers are
+	const float cx[4]={t.xmin+0.5f,t.xmax-0.5f,t.xmax-0.5f,t.xmin+0.5f};
+	const float cy[4]={t.ymin+0.5f,t.ymin+0.5f,t.ymax-0.5f,t.ymax-0.5f};
+	float area=0;
+	for(int i=0;i<count;i++)
+	{
+		const int j=(i+1)%count;
+		area+=v[i*2]*v[j*2+1]-v[j*2]*v[i*2+1];
+	}
+	if(fabsf(area)<1e-6f)
+		return false;
+	const float orientation=(area>0)?1:-1;
+	for(int i=0;i<count;i++)
+	{
+		const int j=(i+1)%count;
+		const float ex=v[j*2]-v[i*2];
+		const float ey=v[j*2+1]-v[i*2+1];
+		for(int k=0;k<4;k++)
+		{
+			const float side=ex*(cy[k]-v[i*2+1])-ey*(cx[k]-v[i*2]);
+			if(side*orientation<=1e-3f)
+				return false;
+		}
+	}
+	return true;
+}
+
+void SoftwareRenderer::binCommand(uint32_t index, const float* cover, int coverCount)
+{
+	const draw_command& cmd=commands[index];
+	//Only opaque fills drawn directly on the framebuffer hide what is below them
+	bool opaque=layerStack.empty() && cmd.type==CMD_TRIANGLES && cmd.fillType==FILL_SOLID && (cmd.fill>>24)==0xff;
+	//Testing many triangles against each tile would cost more than it saves
+	if(cover==NULL && cmd.vertexCount>48)
+		opaque=false;
+	const uint32_t tilesX=(width+tileSize-1)/tileSize;
+	for(int ty=cmd.ymin/tileSize;ty<=(cmd.ymax-1)/tileSize;ty++)
+	{
+		for(int tx=cmd.xmin/tileSize;tx<=(cmd.xmax-1)/tileSize;tx++)
+		{
+			tile& t=tiles[ty*tilesX+tx];
+			if(opaque)
+			{
+				bool covers=false;
+				if(cover)
+					covers=polygonCovers(cover,coverCount,t);
+				else
+				{
+					for(uint32_t i=0;i+2<cmd.vertexCount && !covers;i+=3)
+						covers=polygonCovers(&vertices[(cmd.firstVertex+i)*2],3,t);
+				}
+				if(covers)
+				{
+					t.commands.clear();
+					t.covered=true;
+				}
+			}
+			t.commands.push_back(index);
+		}
+	}
+}
+
+void SoftwareRenderer::drawTriangles(const vector<Vector2>& v, const vector<uint32_t>& indices, int x, int y)
+{
+	const uint32_t first=vertices.size()/2;
+	for(unsigned int i=0;i+2<indices.size();i+=3)
+	{
+		for(int j=0;j<3;j++)
+			addVertex(v[indices[i+j]].x+x,v[indices[i+j]].y+y);
+	}
+	addPrimitive(CMD_TRIANGLES,first);
+}
+
+void SoftwareRenderer::drawLineStrip(const vector<Vector2>& v, int x, int y)
+{
+	const uint32_t first=vertices.size()/2;
+	for(unsigned int i=1;i<v.size();i++)
+	{
+		addVertex(v[i-1].x+x,v[i-1].y+y);
+		addVertex(v[i].x+x,v[i].y+y);
+	}
+	addPrimitive(CMD_LINES,first);
+}
+
+void SoftwareRenderer::drawRect(int xmin, int ymin, int xmax, int ymax)
+{
+	const uint32_t first=vertices.size()/2;
+	float corners[8];
+	current.apply(xmin,ymin,corners[0],corners[1]);
+	current.apply(xmax,ymin,corners[2],corners[3]);
+	current.apply(xmax,ymax,corners[4],corners[5]);
+	current.apply(xmin,ymax,corners[6],corners[7]);
+	addVertex(xmin,ymin);
+	addVertex(xmax,ymin);
+	addVertex(xmax,ymax);
+	addVertex(xmin,ymin);
+	addVertex(xmax,ymax);
+	addVertex(xmin,ymax);
+	addPrimitive(CMD_TRIANGLES,first,corners,4);
+}
+
+void SoftwareRenderer::beginLayer(number_t xmin, number_t xmax, number_t ymin, number_t ymax)
+{
+	//The layer is binned when it ends, in the tiles touched by its contents
+	layer_record l;
+	l.beginCommand=commands.size();
+	l.xmin=width;
+	l.xmax=0;
+	l.ymin=height;
+	l.ymax=0;
+	layerStack.push_back(l);
+	draw_command cmd;
+	cmd.type=CMD_BEGIN_LAYER;
+	cmd.fillType=FILL_SOLID;
+	cmd.fill=0;
+	cmd.firstVertex=cmd.vertexCount=0;
+	cmd.xmin=cmd.xmax=cmd.ymin=cmd.ymax=0;
+	cmd.alpha=1;
+	commands.push_back(cmd);
+}
+
+void SoftwareRenderer::endLayer(number_t xmin, number_t xmax, number_t ymin, number_t ymax, float alpha)
+{
+	assert_and_throw(!layerStack.empty());
+	const layer_record l=layerStack.back();
+	layerStack.pop_back();
+	if(l.xmin>=l.xmax || l.ymin>=l.ymax)
+		return;
+	draw_command cmd=commands[l.beginCommand];
+	cmd.type=CMD_END_LAYER;
+	cmd.xmin=l.xmin;
+	cmd.xmax=l.xmax;
+	cmd.ymin=l.ymin;
+	cmd.ymax=l.ymax;
+	cmd.alpha=alpha;
+	commands.push_back(cmd);
+	const uint32_t endCommand=commands.size()-1;
+	const uint32_t tilesX=(width+tileSize-1)/tileSize;
+	for(int ty=l.ymin/tileSize;ty<=(l.ymax-1)/tileSize;ty++)
+	{
+		for(int tx=l.xmin/tileSize;tx<=(l.xmax-1)/tileSize;tx++)
+		{
+			vector<uint32_t>& c=tiles[ty*tilesX+tx].commands;
+			c.insert(lower_bound(c.begin(),c.end(),l.beginCommand),l.beginCommand);
+			c.push_back(endCommand);
+		}
+	}
+	if(!layerStack.empty())
+	{
+		layer_record& parent=layerStack.back();
+		parent.xmin=imin(parent.xmin,l.xmin);
+		parent.xmax=imax(parent.xmax,l.xmax);
+		parent.ymin=imin(parent.ymin,l.ymin);
+		parent.ymax=imax(parent.ymax,l.ymax);
+	}
+}
+
+void SoftwareRenderer::rasterizeTile(const tile& t, raster_context& ctx)
+{
+	raster_target base;
+	base.pixels=&framebuffer[0];
+	base.stride=width;
+	base.x=0;
+	base.y=0;
+	base.xmin=t.xmin;
+	base.xmax=t.xmax;
+	base.ymin=t.ymin;
+	base.ymax=t.ymax;
+	if(!t.covered)
+	{
+		for(int y=t.ymin;y<t.ymax;y++)
+			std::fill(base.pixels+y*width+t.xmin,base.pixels+y*width+t.xmax,background);
+	}
+	ctx.targets.clear();
+	ctx.targets.push_back(base);
+
+	for(uint32_t i=0;i<t.commands.size();i++)
+	{
+		const draw_command& cmd=commands[t.commands[i]];
+		const raster_target& cur=ctx.targets.back();
+		switch(cmd.type)
+		{
+			case CMD_TRIANGLES:
+				for(uint32_t j=0;j+2<cmd.vertexCount;j+=3)
+					fillTriangle(cur,cmd,&vertices[(cmd.firstVertex+j)*2]);
+				break;
+			case CMD_LINES:
+				for(uint32_t j=0;j+1<cmd.vertexCount;j+=2)
+					drawLine(cur,cmd,&vertices[(cmd.firstVertex+j)*2]);
+				break;
+			case CMD_BEGIN_LAYER:
+			{
+				//Layers are transparent when not in use
+				const uint32_t depth=ctx.targets.size()-1;
+				if(depth==ctx.layers.size())
+				{
+					ctx.layers.push_back(new layer);
+					ctx.layers.back()->pixels.assign(tileSize*tileSize,0);
+				}
+				raster_target l=base;
+				l.pixels=&ctx.layers[depth]->pixels[0];
+				l.stride=tileSize;
+				l.x=t.xmin;
+				l.y=t.ymin;
+				ctx.targets.push_back(l);
+				break;
+			}
+			case CMD_END_LAYER:
+			{
+				assert(ctx.targets.size()>1);
+				const raster_target src=ctx.targets.back();
+				ctx.targets.pop_back();
+				const raster_target& dst=ctx.targets.back();
+				const uint32_t a=clampChannel(cmd.alpha*255);
+				for(int y=t.ymin;y<t.ymax;y++)
+				{
+					uint32_t* srcRow=src.pixels+(y-src.y)*src.stride-src.x;
+					uint32_t* dstRow=dst.pixels+(y-dst.y)*dst.stride-dst.x;
+					kernels.composite(dstRow+t.xmin,srcRow+t.xmin,t.xmax-t.xmin,a);
+				}
+				break;
+			}
+		}
+	}
+	assert(ctx.targets.size()==1);
+}
+
+void SoftwareRenderer::fillSpan(const raster_target& t, const draw_command& cmd, int y, int xmin, int xmax) const
+{
+	uint32_t* row=t.pixels+(y-t.y)*t.stride-t.x+xmin;
+	const uint32_t count=xmax-xmin;
+	if(cmd.fillType==FILL_SOLID)
+	{
+		kernels.solid(row,count,cmd.fill);
+		return;
+	}
+	float gx,gy;
+	cmd.pixelToGradient.apply(xmin+0.5f,y+0.5f,gx,gy);
+	const affine& m=cmd.pixelToGradient;
+	if(cmd.fillType==FILL_LINEAR)
+		kernels.linearGradient(row,count,&gradientPool[cmd.fill],gx,gy,m.a,m.b);
+	else if(cmd.fillType==FILL_RADIAL)
+		kernels.radialGradient(row,count,&gradientPool[cmd.fill],gx,gy,m.a,m.b);
+	else
+		focalGradient(row,count,&gradientPool[cmd.fill],gx,gy,m.a,m.b,cmd.focalPoint);
+}
+
+void SoftwareRenderer::focalGradient(uint32_t* dst, uint32_t count, const uint32_t* ramp, float gx, float gy, float dx, float dy, float focal)
+{
+	//Focal gradients are rare, so there is no vector kernel for them
+	for(uint32_t i=0;i<count;i++)
+	{
+		//The ratio is the distance from the focal point, over the distance from it to the circle in the same direction
+		const float x=(gx+float(i)*dx)/gradientSize-focal;
+		const float y=(gy+float(i)*dy)/gradientSize;
+		const float d2=x*x+y*y;
+		const float fx=focal*x;
+		const float den=sqrtf(fx*fx+d2*(1-focal*focal))-fx;
+		const float f=(den>0)?(d2/den*256):0;
+		const int index=(f>0)?((f<255)?int(f):255):0;
+		dst[i]=blendPixel(dst[i],ramp[index]);
+	}
+}
+
+void SoftwareRenderer::fillTriangle(const raster_target& t, const draw_command& cmd, const float* v) const
+{
+	const float px[3]={v[0],v[2],v[4]};
+	const float py[3]={v[1],v[3],v[5]};
+	if(max(px[0],max(px[1],px[2]))<t.xmin || min(px[0],min(px[1],px[2]))>=t.xmax)
+		return;
+	//Rows are covered if their center is inside the triangle
+	const float ymin=min(py[0],min(py[1],py[2]));
+	const float ymax=max(py[0],max(py[1],py[2]));
+	const int yStart=imax(t.ymin,int(ceilf(ymin-0.5f)));
+	const int yEnd=imin(t.ymax,int(ceilf(ymax-0.5f)));
+	for(int y=yStart;y<yEnd;y++)
+	{
+		const float yc=y+0.5f;
+		float xl=FLT_MAX;
+		float xr=-FLT_MAX;
+		int crossings=0;
+		for(int i=0;i<3;i++)
+		{
+			//Edges are walked from the top, so an edge shared by two triangles gives the same result
+			int top=i;
+			int bottom=(i+1)%3;
+			if(py[top]>py[bottom])
+				std::swap(top,bottom);
+			if(yc<py[top] || yc>=py[bottom])
+				continue;
+			const float x=px[top]+(yc-py[top])*(px[bottom]-px[top])/(py[bottom]-py[top]);
+			xl=min(xl,x);
+			xr=max(xr,x);
+			crossings++;
+		}
+		if(crossings<2)
+			continue;
+		const int xStart=imax(t.xmin,int(ceilf(xl-0.5f)));
+		const int xEnd=imin(t.xmax,int(ceilf(xr-0.5f)));
+		if(xStart<xEnd)
+			fillSpan(t,cmd,y,xStart,xEnd);
+	}
+}
+
+void SoftwareRenderer::drawLine(const raster_target& t, const draw_command& cmd, const float* v) const
+{
+	const float x0=v[0];
+	const float y0=v[1];
+	const float x1=v[2];
+	const float y1=v[3];
+	//Lines completely outside of the tile are dropped
+	if(max(x0,x1)<t.xmin || min(x0,x1)>=t.xmax || max(y0,y1)<t.ymin || min(y0,y1)>=t.ymax)
+		return;
+	const uint32_t p=(cmd.fillType==FILL_SOLID)?cmd.fill:gradientPool[cmd.fill+128];
+	const float dx=x1-x0;
+	const float dy=y1-y0;
+	//One pixel for each step on the major axis
+	const int steps=imin(int(ceilf(max(fabsf(dx),fabsf(dy)))),(width+height)*4);
+	for(int i=0;i<=steps;i++)
+	{
+		const float f=(steps==0)?0:float(i)/steps;
+		const int x=int(floorf(x0+dx*f));
+		const int y=int(floorf(y0+dy*f));
+		if(x<t.xmin || x>=t.xmax || y<t.ymin || y>=t.ymax)
+			continue;
+		uint32_t* pixel=t.pixels+(y-t.y)*t.stride+(x-t.x);
+		*pixel=blendPixel(*pixel,p);
+	}
+}
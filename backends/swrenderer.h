@@ -0,0 +1,203 @@
+/**************************************************************************
+    Lightspark, a free flash player implementation
+
+    Copyright (C) 2009,2010  Alessandro Pignotti (a.pignotti@sssup.it)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#ifndef _SWRENDERER_H
+#define _SWRENDERER_H
+
+#include "compat.h"
+#include <vector>
+#include <semaphore.h>
+#include "threading.h"
+#include "backends/renderer.h"
+
+namespace lightspark
+{
+
+struct span_kernels;
+
+/*
+	Rasterizes the shapes on the CPU into a BGRA framebuffer in memory, so that no GPU or
+	display is needed. Pixels are stored with premultiplied alpha as 0xAARRGGBB words and the
+	first row is the top of the stage.
+	The traversal of the display list only records a flat list of commands, with the vertices
+	already transformed to pixels. Each command is binned in the screen tiles touched by its
+	bounds, and an opaque command covering a whole tile drops what was binned there before.
+	flush then rasterizes the tiles in parallel, on the render thread and on helper jobs of the
+	ThreadPool. Triangles are scan converted into horizontal spans, sampling at the pixel centers,
+	and each span is filled by the kernel of the fill of the command
+*/
+class SoftwareRenderer: public IRenderer
+{
+private:
+	//x'=a*x+c*y+tx, y'=b*x+d*y+ty
+	struct affine
+	{
+		float a,b,c,d,tx,ty;
+		affine():a(1),b(0),c(0),d(1),tx(0),ty(0){}
+		affine(float _a, float _b, float _c, float _d, float _tx, float _ty):a(_a),b(_b),c(_c),d(_d),tx(_tx),ty(_ty){}
+		//Returns this*m, m is applied first
+		affine operator*(const affine& m) const;
+		bool invert(affine& ret) const;
+		void apply(float x, float y, float& xout, float& yout) const
+		{
+			xout=a*x+c*y+tx;
+			yout=b*x+d*y+ty;
+		}
+	};
+	struct color_transform
+	{
+		float mult[4];
+		float add[4];
+	};
+	struct layer
+	{
+		std::vector<uint32_t> pixels;
+	};
+	enum FILL_TYPE { FILL_SOLID=0, FILL_LINEAR, FILL_RADIAL, FILL_FOCAL };
+	enum COMMAND_TYPE { CMD_TRIANGLES=0, CMD_LINES, CMD_BEGIN_LAYER, CMD_END_LAYER };
+	struct draw_command
+	{
+		COMMAND_TYPE type;
+		FILL_TYPE fillType;
+		//The pixel of solid fills, or the offset of the 256 entries ramp in gradientPool
+		uint32_t fill;
+		//Maps the pixel centers to the gradient square
+		affine pixelToGradient;
+		//Vertices are counted in (x,y) pairs
+		uint32_t firstVertex;
+		uint32_t vertexCount;
+		//Bounds in pixels, the maximums are excluded
+		int xmin,xmax,ymin,ymax;
+		//Only used by CMD_END_LAYER
+		float alpha;
+		//Only used by FILL_FOCAL, in radius units on the x axis of the gradient square
+		float focalPoint;
+	};
+	struct tile
+	{
+		int xmin,xmax,ymin,ymax;
+		//Indices of the commands, in drawing order
+		std::vector<uint32_t> commands;
+		//The first command covers the tile, so the background is not needed
+		bool covered;
+	};
+	//A layer which is still being recorded and the bounds of what has been drawn on it
+	struct layer_record
+	{
+		uint32_t beginCommand;
+		int xmin,xmax,ymin,ymax;
+	};
+	//Where a tile is drawn: the framebuffer or a layer local to the tile
+	struct raster_target
+	{
+		uint32_t* pixels;
+		int stride;
+		//Coordinates of pixels[0]
+		int x,y;
+		//Clipping rectangle, the maximums are excluded
+		int xmin,xmax,ymin,ymax;
+	};
+	//Each thread rasterizing tiles has its own layers
+	struct raster_context
+	{
+		std::vector<layer*> layers;
+		std::vector<raster_target> targets;
+		~raster_context();
+	};
+	class tile_job;
+	static const int tileSize=64;
+	uint32_t width;
+	uint32_t height;
+	std::vector<uint32_t> framebuffer;
+	uint32_t background;
+	const span_kernels& kernels;
+	//The recorded frame
+	std::vector<draw_command> commands;
+	std::vector<float> vertices;
+	std::vector<uint32_t> gradientPool;
+	std::vector<layer_record> layerStack;
+	std::vector<tile> tiles;
+	//State of the traversal
+	affine current;
+	std::vector<affine> matrixStack;
+	color_transform colorTransform;
+	std::vector<color_transform> colorStack;
+	//Current fill, colors are 0xAARRGGBB and not premultiplied
+	FILL_TYPE fillType;
+	uint32_t fillColor;
+	uint32_t gradientColors[256];
+	//Maps the gradient square to the shape space
+	affine gradientMatrix;
+	float focalPoint;
+	//The pixels are computed lazily, as the fill and the color transformation change often
+	bool fillDirty;
+	uint32_t fillPixel;
+	uint32_t gradientOffset;
+	//Distribution of the tiles of the frame being flushed
+	Mutex tileMutex;
+	bool frameActive;
+	uint32_t nextTile;
+	uint32_t doneTiles;
+	sem_t frameDone;
+	raster_context mainContext;
+	std::vector<tile_job*> helpers;
+	void setGradient(const std::vector<GRADRECORD>& records);
+	void addVertex(float x, float y);
+	//Records the vertices added since firstVertex as a command, cover is a convex polygon of them, if known
+	void addPrimitive(COMMAND_TYPE type, uint32_t firstVertex, const float* cover=NULL, int coverCount=0);
+	void binCommand(uint32_t index, const float* cover, int coverCount);
+	static bool polygonCovers(const float* v, int count, const tile& t);
+	void rasterizeTiles(raster_context& ctx);
+	void rasterizeTile(const tile& t, raster_context& ctx);
+	void fillTriangle(const raster_target& t, const draw_command& cmd, const float* v) const;
+	void fillSpan(const raster_target& t, const draw_command& cmd, int y, int xmin, int xmax) const;
+	static void focalGradient(uint32_t* dst, uint32_t count, const uint32_t* ramp, float gx, float gy, float dx, float dy, float focal);
+	void drawLine(const raster_target& t, const draw_command& cmd, const float* v) const;
+public:
+	//Count of threads rasterizing, 0 means one for each core
+	static uint32_t threadCount;
+	SoftwareRenderer(uint32_t w, uint32_t h);
+	~SoftwareRenderer();
+	uint32_t getWidth() const { return width; }
+	uint32_t getHeight() const { return height; }
+	//The framebuffer is complete after flush
+	const uint32_t* getFramebuffer() const { return &framebuffer[0]; }
+	//Starts a new frame, all the transformations are reset
+	void clear(const RGB& bg);
+	//Rasterizes the recorded frame
+	void flush();
+	void pushMatrix();
+	void popMatrix();
+	void multMatrix(const MATRIX& m);
+	void scale(float sx, float sy);
+	float getScale() const;
+	void pushColorTransform(const CXFORMWITHALPHA& cx);
+	void popColorTransform();
+	void setFillStyle(const FILLSTYLE& style);
+	void setFixedColor(float r, float g, float b);
+	void drawTriangles(const std::vector<Vector2>& v, const std::vector<uint32_t>& indices, int x, int y);
+	void drawLineStrip(const std::vector<Vector2>& v, int x, int y);
+	void drawRect(int xmin, int ymin, int xmax, int ymax);
+	void beginLayer(number_t xmin, number_t xmax, number_t ymin, number_t ymax);
+	void endLayer(number_t xmin, number_t xmax, number_t ymin, number_t ymax, float alpha);
+	bool isAccelerated() const { return false; }
+};
+
+};
+#endif
@@ -119,6 +119,20 @@ uint64_t compat_get_current_time_ms()
 	return lightspark::timespecToMsecs(tp);
 }
 
+uint64_t compat_get_current_time_us()
+{
+	timespec tp;
+	clock_gettime(CLOCK_REALTIME,&tp);
+	return lightspark::timespecToUsecs(tp);
+}
+
+uint64_t compat_get_monotonic_time_us()
+{
+	timespec tp;
+	clock_gettime(CLOCK_MONOTONIC,&tp);
+	return lightspark::timespecToUsecs(tp);
+}
+
 uint64_t compat_get_thread_cputime_us()
 {
 	timespec tp;
@@ -171,6 +185,14 @@ uint64_t compat_get_current_time_us()
 	uint64_t ret = get_corrected_wintime();
 	return ret / 10i64;
 }
+uint64_t compat_get_monotonic_time_us()
+{
+	LARGE_INTEGER count, frequency;
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&frequency);
+	return count.QuadPart / frequency.QuadPart * 1000000i64 +
+		count.QuadPart % frequency.QuadPart * 1000000i64 / frequency.QuadPart;
+}
 
 uint64_t compat_get_thread_cputime_us()
 {
@@ -49,6 +49,8 @@ typedef int pid_t;
 #define ATOMIC_INT32(x) __declspec(align(4)) long x
 #define ATOMIC_INCREMENT(x) InterlockedIncrement(&x)
 #define ATOMIC_DECREMENT(x) InterlockedDecrement(&x)
+#define ATOMIC_PTR(T,x) T* volatile x
+#define ATOMIC_EXCHANGE_PTR(x,v) ((decltype(v))InterlockedExchangePointer((PVOID volatile*)&x,v))
 
 #define TLSDATA __declspec( thread )
 
@@ -97,6 +99,8 @@ long lrint(double f);
 #define ATOMIC_INT32(x) std::atomic<int32_t> x
 #define ATOMIC_INCREMENT(x) x.fetch_add(1)
 #define ATOMIC_DECREMENT(x) x.fetch_sub(1)
+#define ATOMIC_PTR(T,x) std::atomic<T*> x
+#define ATOMIC_EXCHANGE_PTR(x,v) x.exchange(v)
 
 int aligned_malloc(void **memptr, size_t alignment, size_t size);
 void aligned_free(void *mem);
@@ -167,6 +171,8 @@ std::uint64_t compat_msectiming();
 void compat_msleep(unsigned int time);
 std::uint64_t compat_get_current_time_ms();
 std::uint64_t compat_get_current_time_us();
+//Not affected by changes of the system time, only meaningful to measure intervals
+std::uint64_t compat_get_monotonic_time_us();
 std::uint64_t compat_get_thread_cputime_us();
 
 int kill_child(pid_t p);
@@ -0,0 +1,245 @@
+/**************************************************************************
+    Lightspark, a free flash player implementation
+
+    Copyright (C) 2009,2010  Alessandro Pignotti (a.pignotti@sssup.it)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "frame_scheduler.h"
+#include "swf.h"
+#include "timer.h"
+#include "logger.h"
+#include "scripting/abc.h"
+#include "scripting/flashevents.h"
+#include "backends/rendering.h"
+#include <errno.h>
+
+using namespace std;
+using namespace lightspark;
+
+extern TLSDATA SystemState* sys;
+
+namespace
+{
+//Past this many periods of delay the missed frames are dropped instead of being caught up
+const uint32_t maxBacklog=5;
+//Late renders are not skipped more than this many times in a row, so the screen is still updated
+const uint32_t maxSkippedRenders=3;
+const char* phaseNames[PHASE_COUNT]={"script","layout","render"};
+};
+
+FrameScheduler::FrameScheduler(SystemState* s):m_sys(s),mutex("FrameScheduler"),stopped(false),frameRate(0),renderRate(0),
+	renderPending(false),consecutiveSkips(0)
+{
+	sem_init(&wakeUp,0,0);
+	pthread_create(&t,NULL,(thread_worker)frame_worker,this);
+}
+
+FrameScheduler::~FrameScheduler()
+{
+	stop();
+	sem_destroy(&wakeUp);
+}
+
+void FrameScheduler::stop()
+{
+	Locker l(mutex);
+	if(!stopped)
+	{
+		stopped=true;
+		sem_post(&wakeUp);
+	}
+}
+
+void FrameScheduler::wait()
+{
+	stop();
+	pthread_join(t,NULL);
+	dumpStats();
+}
+
+void FrameScheduler::setFrameRate(float rate)
+{
+	Locker l(mutex);
+	frameRate=rate;
+	sem_post(&wakeUp);
+}
+
+void FrameScheduler::setRenderRate(float rate)
+{
+	Locker l(mutex);
+	renderRate=rate;
+	sem_post(&wakeUp);
+}
+
+void FrameScheduler::syncVm()
+{
+	ABCVm* vm=m_sys->currentVm;
+	if(vm==NULL)
+		return;
+	SynchronizationEvent* se=new SynchronizationEvent;
+	//The VM refuses new events when terminating
+	if(vm->addEvent(NULL,se))
+		se->wait();
+	se->decRef();
+}
+
+void FrameScheduler::runFrame()
+{
+	//Frame advancement may cause exceptions
+	try
+	{
+		const uint64_t start=compat_get_monotonic_time_us();
+		m_sys->dispatchEnterFrame();
+		syncVm();
+		const uint64_t scriptEnd=compat_get_monotonic_time_us();
+		m_sys->advanceFrames();
+		//Wait for the frame scripts too
+		syncVm();
+		const uint64_t layoutEnd=compat_get_monotonic_time_us();
+		m_sys->tickProfilingData();
+
+		Locker l(mutex);
+		stats.frames++;
+		stats.phases[PHASE_SCRIPT].account(scriptEnd-start);
+		stats.phases[PHASE_LAYOUT].account(layoutEnd-scriptEnd);
+	}
+	catch(LightsparkException& e)
+	{
+		LOG(LOG_ERROR,_("Exception in FrameScheduler ") << e.cause);
+		m_sys->setError(e.cause);
+	}
+}
+
+void FrameScheduler::runRender(uint64_t deadline)
+{
+	RenderThread* rt=m_sys->getRenderThread();
+	if(rt==NULL)
+		return;
+	{
+		Locker l(mutex);
+		//Queueing more renders would only make the next frames later
+		const bool late=compat_get_current_time_us()>=deadline && consecutiveSkips<maxSkippedRenders;
+		if(renderPending || late)
+		{
+			stats.skippedRenders++;
+			consecutiveSkips++;
+			return;
+		}
+		renderPending=true;
+		consecutiveSkips=0;
+		stats.renders++;
+	}
+	rt->draw();
+}
+
+void FrameScheduler::renderDone(uint32_t time)
+{
+	Locker l(mutex);
+	renderPending=false;
+	stats.phases[PHASE_RENDER].account(time);
+}
+
+void* FrameScheduler::frame_worker(FrameScheduler* th)
+{
+	sys=th->m_sys;
+	//Start of the next period and due time of the next logical frame, 0 until known
+	uint64_t nextPeriod=0;
+	uint64_t nextFrame=0;
+	while(1)
+	{
+		Locker l(th->mutex);
+		if(th->stopped)
+			break;
+		const float frameRate=th->frameRate;
+		const float renderRate=th->renderRate;
+		l.unlock();
+		if(frameRate==0 && renderRate==0)
+		{
+			sem_wait(&th->wakeUp);
+			continue;
+		}
+
+		//Renders are always asked at the beginning of a period, so the period follows the higher rate
+		const uint64_t period=1000000/max(frameRate,renderRate);
+		uint64_t now=compat_get_current_time_us();
+		if(nextPeriod==0)
+			nextPeriod=now;
+		if(now<nextPeriod)
+		{
+			//Wait for the absolute time, or for a change of the rates
+			timespec tmpt=usecsToTimespec(nextPeriod);
+			int ret=sem_timedwait(&th->wakeUp,&tmpt);
+			if(ret!=0 && errno!=ETIMEDOUT && errno!=EINTR)
+				LOG(LOG_ERROR,_("Unexpected failure of sem_timedwait.. Trying to go on. errno=") << errno);
+			continue;
+		}
+
+		const uint64_t deadline=nextPeriod+period;
+		if(frameRate && now>=nextFrame)
+		{
+			if(nextFrame==0)
+				nextFrame=now;
+			const uint64_t framePeriod=1000000/frameRate;
+			const uint64_t lateness=now-nextFrame;
+			{
+				Locker s(th->mutex);
+				th->stats.totalLateness+=lateness;
+				if(lateness>th->stats.maxLateness)
+					th->stats.maxLateness=lateness;
+			}
+			th->runFrame();
+			nextFrame+=framePeriod;
+			now=compat_get_current_time_us();
+			if(now>nextFrame+maxBacklog*framePeriod)
+			{
+				Locker s(th->mutex);
+				th->stats.droppedFrames+=(now-nextFrame)/framePeriod;
+				nextFrame=now;
+			}
+		}
+		//Late frames are still run to keep the logical frame rate, but they are usually not rendered
+		if(renderRate)
+			th->runRender(deadline);
+		nextPeriod=deadline;
+		if(now>nextPeriod+maxBacklog*period)
+			nextPeriod=now;
+	}
+	return NULL;
+}
+
+void FrameScheduler::getStats(frame_stats& ret)
+{
+	Locker l(mutex);
+	ret=stats;
+}
+
+void FrameScheduler::dumpStats()
+{
+	Locker l(mutex);
+	if(stats.frames==0)
+		return;
+	LOG(LOG_NO_INFO,_("Frames: ") << stats.frames << _(" run, ") << stats.droppedFrames << _(" dropped, average lateness ")
+		<< stats.totalLateness/stats.frames << _(" us, max ") << stats.maxLateness << _(" us"));
+	LOG(LOG_NO_INFO,_("Renders: ") << stats.renders << _(" run, ") << stats.skippedRenders << _(" skipped"));
+	for(uint32_t i=0;i<PHASE_COUNT;i++)
+	{
+		const phase_stats& p=stats.phases[i];
+		if(p.count==0)
+			continue;
+		LOG(LOG_NO_INFO,_("Frame phase ") << phaseNames[i] << _(": average ") << p.total/p.count << _(" us, max ")
+			<< p.max << _(" us, last ") << p.last << _(" us"));
+	}
+}
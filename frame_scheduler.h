@@ -0,0 +1,117 @@
+/**************************************************************************
+    Lightspark, a free flash player implementation
+
+    Copyright (C) 2009,2010  Alessandro Pignotti (a.pignotti@sssup.it)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#ifndef _FRAME_SCHEDULER_H
+#define _FRAME_SCHEDULER_H
+
+#include "compat.h"
+#include <pthread.h>
+#include <semaphore.h>
+#include <inttypes.h>
+#include "threading.h"
+
+namespace lightspark
+{
+
+class SystemState;
+
+enum FRAME_PHASE { PHASE_SCRIPT=0, PHASE_LAYOUT, PHASE_RENDER, PHASE_COUNT };
+
+//Times are in microseconds
+struct phase_stats
+{
+	uint32_t count;
+	uint32_t last;
+	uint64_t total;
+	uint32_t max;
+	phase_stats():count(0),last(0),total(0),max(0){}
+	void account(uint32_t time)
+	{
+		count++;
+		last=time;
+		total+=time;
+		if(time>max)
+			max=time;
+	}
+};
+
+struct frame_stats
+{
+	//Logical frames, they are never skipped unless the player falls too far behind
+	uint32_t frames;
+	uint32_t droppedFrames;
+	uint32_t renders;
+	//Renders skipped because the frame was over budget or the previous render was not done
+	uint32_t skippedRenders;
+	//How much later than due the frames started
+	uint64_t totalLateness;
+	uint64_t maxLateness;
+	phase_stats phases[PHASE_COUNT];
+	frame_stats():frames(0),droppedFrames(0),renders(0),skippedRenders(0),totalLateness(0),maxLateness(0){}
+};
+
+/*
+	Paces the main movie. Each logical frame runs the enterFrame scripts, then lays out the
+	display list by advancing the timeline, waiting for the VM after each phase, and then asks
+	for a render. Frames are due at absolute times, so a late frame shortens the next period
+	instead of slowing the movie down. When a frame ends past its deadline the render is skipped,
+	the logical frame rate is kept. Only a few renders in a row are skipped, so a movie that is
+	always late is still shown. The render rate may be higher than the frame rate (e.g. for
+	videos), in which case the extra periods only render
+*/
+class FrameScheduler
+{
+private:
+	SystemState* m_sys;
+	pthread_t t;
+	sem_t wakeUp;
+	Mutex mutex;
+	//Protected by the mutex, like all the state shared with the other threads
+	bool stopped;
+	//Rates are 0 until known
+	float frameRate;
+	float renderRate;
+	//A render has been asked and the render thread has not completed it yet
+	bool renderPending;
+	//Renders skipped since the last one
+	uint32_t consecutiveSkips;
+	frame_stats stats;
+	static void* frame_worker(FrameScheduler* th);
+	//Waits until the VM has handled all the events sent so far
+	void syncVm();
+	void runFrame();
+	void runRender(uint64_t deadline);
+public:
+	FrameScheduler(SystemState* s);
+	~FrameScheduler();
+	void stop();
+	void wait();
+	//The frame rate is known when the first frame is committed
+	void setFrameRate(float rate);
+	//Rendering starts when the render rate is known
+	void setRenderRate(float rate);
+	//Called by the render thread when a render is complete
+	void renderDone(uint32_t time);
+	void getStats(frame_stats& ret);
+	//Logs the pacing of the frames and the time spent in each phase
+	void dumpStats();
+};
+
+};
+#endif
@@ -0,0 +1,256 @@
+/**************************************************************************
+    Lightspark, a free flash player implementation
+
+    Copyright (C) 2009,2010  Alessandro Pignotti (a.pignotti@sssup.it)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "gc.h"
+#include "asobject.h"
+#include "scripting/toplevel.h"
+#include "logger.h"
+#include <algorithm>
+
+using namespace std;
+using namespace lightspark;
+
+Mutex CycleCollector::classesMutex("classesMutex");
+set<Class_base*> CycleCollector::classes;
+
+CycleCollector::CycleCollector(uint32_t m):maxNodes(m),cursorClass(NULL),cursorObject(NULL),collected(0)
+{
+}
+
+void CycleCollector::registerClass(Class_base* c)
+{
+	Locker l(classesMutex);
+	classes.insert(c);
+}
+
+void CycleCollector::unregisterClass(Class_base* c)
+{
+	Locker l(classesMutex);
+	classes.erase(c);
+}
+
+bool CycleCollector::takeFrom(Class_base* c, uint32_t count, vector<ASObject*>& candidates)
+{
+	Locker l(c->referencedObjectsMutex);
+	set<ASObject*>::iterator it=c->referencedObjects.upper_bound(cursorObject);
+	for(;it!=c->referencedObjects.end() && candidates.size()<count;++it)
+	{
+		ASObject* o=*it;
+		cursorObject=o;
+		//Skip objects being destroyed or cached by a Manager
+		if(o->ref_count<=0)
+			continue;
+		//Keep the candidate alive while it is scanned
+		o->incRef();
+		candidates.push_back(o);
+	}
+	return it==c->referencedObjects.end();
+}
+
+void CycleCollector::pickCandidates(uint32_t count, vector<ASObject*>& candidates)
+{
+	Locker l(classesMutex);
+	if(classes.empty())
+		return;
+	set<Class_base*>::iterator it=classes.lower_bound(cursorClass);
+	//Visit each class at most once per slice
+	for(uint32_t i=0;i<=classes.size() && candidates.size()<count;i++)
+	{
+		if(it==classes.end())
+			it=classes.begin();
+		if(*it!=cursorClass)
+		{
+			cursorClass=*it;
+			cursorObject=NULL;
+		}
+		if(!takeFrom(*it,count,candidates))
+			return;
+		++it;
+	}
+	//The current class is done, start from the next one
+	if(it==classes.end())
+		it=classes.begin();
+	cursorClass=*it;
+	cursorObject=NULL;
+}
+
+CycleCollector::gc_node* CycleCollector::addNode(ASObject* o)
+{
+	unordered_map<ASObject*, gc_node>::iterator it=nodes.find(o);
+	if(it!=nodes.end())
+		return &it->second;
+	if(order.size()==maxNodes)
+		return NULL;
+	gc_node newNode;
+	newNode.refCount=o->ref_count;
+	newNode.trialCount=newNode.refCount;
+	newNode.firstEdge=0;
+	newNode.edgeCount=0;
+	newNode.firstLink=0;
+	newNode.linkCount=0;
+	newNode.live=false;
+	order.push_back(o);
+	return &nodes.insert(make_pair(o,newNode)).first->second;
+}
+
+uint32_t CycleCollector::scan(ASObject* candidate)
+{
+	nodes.clear();
+	order.clear();
+	edges.clear();
+	links.clear();
+
+	//Build the graph reachable from the candidate, subtracting the internal references
+	gc_node* first=addNode(candidate);
+	//Our own reference is not counted
+	first->trialCount--;
+	for(uint32_t i=0;i<order.size();i++)
+	{
+		ASObject* cur=order[i];
+		const uint32_t firstEdge=edges.size();
+		const uint32_t firstLink=links.size();
+		bool collectable=cur->enumerateRefs(edges);
+		cur->enumerateLinks(links);
+		gc_node& n=nodes[cur];
+		n.firstEdge=firstEdge;
+		n.edgeCount=edges.size()-firstEdge;
+		n.firstLink=firstLink;
+		n.linkCount=links.size()-firstLink;
+		if(!collectable)
+			n.live=true;
+		for(uint32_t j=firstEdge;j<edges.size();j++)
+		{
+			gc_node* target=addNode(edges[j]);
+			if(target==NULL)
+				return 0;
+			target->trialCount--;
+		}
+		//Linked objects are part of the graph, but they are not referenced by this one
+		for(uint32_t j=firstLink;j<links.size();j++)
+		{
+			if(addNode(links[j])==NULL)
+				return 0;
+		}
+	}
+
+	//Objects still referenced from outside are alive, and so is everything they reach
+	vector<ASObject*> pending;
+	for(uint32_t i=0;i<order.size();i++)
+	{
+		gc_node& n=nodes[order[i]];
+		if(n.trialCount>0 || n.live)
+		{
+			n.live=true;
+			pending.push_back(order[i]);
+		}
+	}
+	while(!pending.empty())
+	{
+		const gc_node& n=nodes[pending.back()];
+		pending.pop_back();
+		for(uint32_t j=n.firstEdge;j<n.firstEdge+n.edgeCount;j++)
+		{
+			gc_node& target=nodes[edges[j]];
+			if(!target.live)
+			{
+				target.live=true;
+				pending.push_back(edges[j]);
+			}
+		}
+		for(uint32_t j=n.firstLink;j<n.firstLink+n.linkCount;j++)
+		{
+			gc_node& target=nodes[links[j]];
+			if(!target.live)
+			{
+				target.live=true;
+				pending.push_back(links[j]);
+			}
+		}
+	}
+
+	//Everything is reachable from the candidate, so if it is alive there is no garbage
+	if(nodes[candidate].live)
+		return 0;
+
+	vector<ASObject*> garbage;
+	for(uint32_t i=0;i<order.size();i++)
+	{
+		if(!nodes[order[i]].live)
+			garbage.push_back(order[i]);
+	}
+	//Give up if another thread changed the graph meanwhile
+	if(!unchanged(garbage))
+		return 0;
+	release(garbage);
+	return garbage.size();
+}
+
+bool CycleCollector::unchanged(const vector<ASObject*>& garbage)
+{
+	vector<ASObject*> current;
+	for(uint32_t i=0;i<garbage.size();i++)
+	{
+		const gc_node& n=nodes[garbage[i]];
+		if(garbage[i]->ref_count!=n.refCount)
+			return false;
+		current.clear();
+		garbage[i]->enumerateRefs(current);
+		if(current.size()!=n.edgeCount || !equal(current.begin(),current.end(),edges.begin()+n.firstEdge))
+			return false;
+		current.clear();
+		garbage[i]->enumerateLinks(current);
+		if(current.size()!=n.linkCount || !equal(current.begin(),current.end(),links.begin()+n.firstLink))
+			return false;
+	}
+	return true;
+}
+
+void CycleCollector::release(const vector<ASObject*>& garbage)
+{
+	//Keep all the objects alive until every internal reference has been dropped
+	for(uint32_t i=0;i<garbage.size();i++)
+		garbage[i]->incRef();
+	for(uint32_t i=0;i<garbage.size();i++)
+		garbage[i]->clearRefs();
+	for(uint32_t i=0;i<garbage.size();i++)
+		garbage[i]->decRef();
+}
+
+uint32_t CycleCollector::collect(uint32_t count)
+{
+	vector<ASObject*> candidates;
+	pickCandidates(count,candidates);
+	uint32_t freed=0;
+	for(uint32_t i=0;i<candidates.size();i++)
+	{
+		freed+=scan(candidates[i]);
+		//The candidate is destroyed here if it was garbage
+		candidates[i]->decRef();
+	}
+	nodes.clear();
+	order.clear();
+	edges.clear();
+	links.clear();
+	if(freed)
+	{
+		collected+=freed;
+		LOG(LOG_CALLS,_("Cycle collector freed ") << freed << _(" objects"));
+	}
+	return freed;
+}
@@ -0,0 +1,96 @@
+/**************************************************************************
+    Lightspark, a free flash player implementation
+
+    Copyright (C) 2009,2010  Alessandro Pignotti (a.pignotti@sssup.it)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#ifndef _GC_H
+#define _GC_H
+
+#include "compat.h"
+#include <vector>
+#include <set>
+#include <unordered_map>
+#include "threading.h"
+
+namespace lightspark
+{
+
+class ASObject;
+class Class_base;
+
+/*
+	Incremental cycle collector based on trial deletion. A few candidates are taken at a time
+	from the instance registries of the classes. For each one the graph reachable from it is
+	scanned and the references coming from inside the graph are subtracted from the reference
+	counts: what is still referenced is alive (together with what it reaches), what is left is
+	garbage only kept alive by cycles. Roots (globals, the VM stacks, the timelines, pending
+	jobs) hold references which are not reported as edges, so they never look like garbage.
+	Other threads keep running while a graph is scanned, so the garbage is scanned again before
+	being released and nothing is freed if its references or its edges changed meanwhile.
+*/
+class CycleCollector
+{
+private:
+	struct gc_node
+	{
+		int32_t refCount;
+		int32_t trialCount;
+		uint32_t firstEdge;
+		uint32_t edgeCount;
+		uint32_t firstLink;
+		uint32_t linkCount;
+		bool live;
+	};
+	std::unordered_map<ASObject*, gc_node> nodes;
+	//Objects of the graph being scanned in discovery order, and their edges
+	std::vector<ASObject*> order;
+	std::vector<ASObject*> edges;
+	std::vector<ASObject*> links;
+	//Scanning stops when the graph of a candidate is bigger than this
+	uint32_t maxNodes;
+	//Where the previous slice stopped
+	Class_base* cursorClass;
+	ASObject* cursorObject;
+	uint32_t collected;
+	void pickCandidates(uint32_t count, std::vector<ASObject*>& candidates);
+	bool takeFrom(Class_base* c, uint32_t count, std::vector<ASObject*>& candidates);
+	uint32_t scan(ASObject* candidate);
+	gc_node* addNode(ASObject* o);
+	bool unchanged(const std::vector<ASObject*>& garbage);
+	void release(const std::vector<ASObject*>& garbage);
+
+	//All the classes, they own the instance registries
+	static Mutex classesMutex;
+	static std::set<Class_base*> classes;
+public:
+	CycleCollector(uint32_t m=4096);
+	/**
+		Looks for garbage cycles starting from at most count candidates
+
+		@return The number of objects freed
+	*/
+	uint32_t collect(uint32_t count);
+	uint32_t getCollectedCount() const
+	{
+		return collected;
+	}
+	static void registerClass(Class_base* c);
+	static void unregisterClass(Class_base* c);
+};
+
+};
+#endif
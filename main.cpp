@@ -20,7 +20,12 @@
 #include "swf.h"
 #include "logger.h"
 #include "parsing/streams.h"
+#include "parsing/tags.h"
 #include "backends/netutils.h"
+#include "backends/rendering.h"
+#include "backends/swrenderer.h"
+#include "backends/spankernels.h"
+#include "scripting/method_cache.h"
 #ifndef WIN32
 #include <sys/resource.h>
 #include <unistd.h>
@@ -52,6 +57,12 @@ int main(int argc, char* argv[])
 	Security::SANDBOXTYPE sandboxType=Security::REMOTE;
 	bool useInterpreter=true;
 	bool useJit=false;
+	bool useThreadedDispatch=true;
+	bool headless=false;
+	bool benchmarkKernels=false;
+	//0 keeps the defaults
+	uint32_t jitQuickThreshold=0;
+	uint32_t jitOptimizedThreshold=0;
 	LOG_LEVEL log_level=LOG_NOT_IMPLEMENTED;
 
 	setlocale(LC_ALL, "");
@@ -82,6 +93,49 @@ int main(int argc, char* argv[])
 		{
 			useJit=true;
 		}
+		else if(strcmp(argv[i],"-nt")==0 || 
+			strcmp(argv[i],"--disable-threaded-dispatch")==0)
+		{
+			useThreadedDispatch=false;
+		}
+		else if(strcmp(argv[i],"-jq")==0 || 
+			strcmp(argv[i],"--jit-quick-threshold")==0)
+		{
+			i++;
+			if(i==argc)
+			{
+				fileName=NULL;
+				break;
+			}
+			jitQuickThreshold=atoi(argv[i]);
+		}
+		else if(strcmp(argv[i],"-jo")==0 || 
+			strcmp(argv[i],"--jit-optimized-threshold")==0)
+		{
+			i++;
+			if(i==argc)
+			{
+				fileName=NULL;
+				break;
+			}
+			jitOptimizedThreshold=atoi(argv[i]);
+		}
+		else if(strcmp(argv[i],"-jc")==0 || 
+			strcmp(argv[i],"--jit-cache-dir")==0)
+		{
+			i++;
+			if(i==argc)
+			{
+				fileName=NULL;
+				break;
+			}
+			MethodCache::directory=argv[i];
+		}
+		else if(strcmp(argv[i],"-njc")==0 || 
+			strcmp(argv[i],"--disable-jit-cache")==0)
+		{
+			MethodCache::enabled=false;
+		}
 		else if(strcmp(argv[i],"-l")==0 || 
 			strcmp(argv[i],"--log-level")==0)
 		{
@@ -105,6 +159,86 @@ int main(int argc, char* argv[])
 			}
 			paramsFileName=argv[i];
 		}
+		else if(strcmp(argv[i],"-pl")==0 || 
+			strcmp(argv[i],"--profile-locks")==0)
+		{
+			Mutex::profilingEnabled=true;
+		}
+		else if(strcmp(argv[i],"-ot")==0 || 
+			strcmp(argv[i],"--offload-ticks")==0)
+		{
+			TimerThread::offloadHeavyTicks=true;
+		}
+		else if(strcmp(argv[i],"-hl")==0 || 
+			strcmp(argv[i],"--headless")==0)
+		{
+			headless=true;
+		}
+		else if(strcmp(argv[i],"-hf")==0 || 
+			strcmp(argv[i],"--headless-frames")==0)
+		{
+			i++;
+			if(i==argc)
+			{
+				fileName=NULL;
+				break;
+			}
+			RenderThread::maxHeadlessFrames=atoi(argv[i]);
+		}
+		else if(strcmp(argv[i],"-bk")==0 || 
+			strcmp(argv[i],"--benchmark-kernels")==0)
+		{
+			benchmarkKernels=true;
+		}
+		else if(strcmp(argv[i],"-rt")==0 || 
+			strcmp(argv[i],"--render-threads")==0)
+		{
+			i++;
+			if(i==argc)
+			{
+				fileName=NULL;
+				break;
+			}
+			SoftwareRenderer::threadCount=atoi(argv[i]);
+		}
+		else if(strcmp(argv[i],"-ct")==0 || 
+			strcmp(argv[i],"--curve-tolerance")==0)
+		{
+			i++;
+			if(i==argc)
+			{
+				fileName=NULL;
+				break;
+			}
+			DefineShapeTag::curveTolerance=atof(argv[i]);
+		}
+		else if(strcmp(argv[i],"-bt")==0 || 
+			strcmp(argv[i],"--benchmark-tessellation")==0)
+		{
+			GeomShape::benchmarkTessellation=true;
+		}
+		else if(strcmp(argv[i],"-w")==0 || 
+			strcmp(argv[i],"--worker-threads")==0)
+		{
+			i++;
+			if(i==argc)
+			{
+				fileName=NULL;
+				break;
+			}
+			ThreadPool::workerCount=atoi(argv[i]);
+		}
+		else if(strcmp(argv[i],"-io")==0 || 
+			strcmp(argv[i],"--io-threads")==0)
+		{
+			i++;
+			if(i==argc)
+			{
+				fileName=NULL;
+				break;
+			}
+			ThreadPool::maxIoWorkers=atoi(argv[i]);
+		}
 		else if(strcmp(argv[i],"-s")==0 || 
 			strcmp(argv[i],"--security-sandbox")==0)
 		{
@@ -143,12 +277,20 @@ int main(int argc, char* argv[])
 		}
 	}
 
+	if(benchmarkKernels)
+	{
+		Log::initLogging(log_level);
+		return benchmarkSpanKernels()?0:1;
+	}
 
 	if(fileName==NULL)
 	{
 		cout << "Usage: " << argv[0] << " [--url|-u http://loader.url/file.swf]" << 
-			" [--disable-interpreter|-ni] [--enable-jit|-j] [--log-level|-l 0-4]" << 
-			" [--parameters-file|-p params-file] [--security-sandbox|-s sandbox] <file.swf>" << endl;
+			" [--disable-interpreter|-ni] [--enable-jit|-j] [--disable-threaded-dispatch|-nt] [--log-level|-l 0-4]" << 
+			" [--jit-quick-threshold|-jq count] [--jit-optimized-threshold|-jo count]" << 
+			" [--jit-cache-dir|-jc dir] [--disable-jit-cache|-njc]" << 
+			" [--parameters-file|-p params-file] [--security-sandbox|-s sandbox] [--worker-threads|-w count] [--io-threads|-io count] [--profile-locks|-pl] [--offload-ticks|-ot]" <<
+			" [--headless|-hl] [--headless-frames|-hf count] [--render-threads|-rt count] [--curve-tolerance|-ct pixels] [--benchmark-kernels|-bk] [--benchmark-tessellation|-bt] <file.swf>" << endl;
 		exit(-1);
 	}
 
@@ -162,7 +304,7 @@ int main(int argc, char* argv[])
 #endif
 
 	Log::initLogging(log_level);
-	zlib_file_filter zf(fileName);
+	mapped_swf_filter zf(fileName);
 	istream f(&zf);
 	f.exceptions ( istream::eofbit | istream::failbit | istream::badbit );
 	cout.exceptions( ios::failbit | ios::badbit);
@@ -203,11 +345,21 @@ int main(int argc, char* argv[])
 	}
 	sys->useInterpreter=useInterpreter;
 	sys->useJit=useJit;
+	sys->useThreadedDispatch=useThreadedDispatch;
+	if(jitQuickThreshold)
+		sys->jitQuickThreshold=jitQuickThreshold;
+	if(jitOptimizedThreshold)
+		sys->jitOptimizedThreshold=jitOptimizedThreshold;
 	if(paramsFileName)
 		sys->parseParametersFromFile(paramsFileName);
 	
-	SDL_Init ( SDL_INIT_VIDEO |SDL_INIT_EVENTTHREAD );
-	sys->setParamsAndEngine(SDL, NULL);
+	if(headless)
+		sys->setParamsAndEngine(HEADLESS, NULL);
+	else
+	{
+		SDL_Init ( SDL_INIT_VIDEO |SDL_INIT_EVENTTHREAD );
+		sys->setParamsAndEngine(SDL, NULL);
+	}
 	sys->sandboxType = sandboxType;
 
 	sys->downloadManager=new StandaloneDownloadManager();
@@ -227,6 +379,8 @@ int main(int argc, char* argv[])
 	pt->wait();
 	delete sys;
 	delete pt;
+	if(GeomShape::benchmarkTessellation)
+		GeomShape::logTessellationBenchmark();
 
 	SystemState::staticDeinit();
 	SDL_Quit();
@@ -23,7 +23,14 @@
 #include "compat.h"
 #include <cstdlib>
 #include <cstring>
+#include <new>
 #include <assert.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 
@@ -258,6 +265,137 @@ int zlib_file_filter::provideBuffer(int limit)
 	return ret;
 }
 
+mapped_swf_filter::mapped_swf_filter(const char* file_name):data(NULL),len(0),mapped(false)
+{
+	uint8_t* file=NULL;
+	uint32_t file_len=0;
+#ifndef WIN32
+	int fd=open(file_name,O_RDONLY);
+	if(fd<0)
+		throw lightspark::RunTimeException("File does not exists");
+	struct stat st;
+	if(fstat(fd,&st)!=0)
+	{
+		close(fd);
+		throw lightspark::RunTimeException("Cannot stat file");
+	}
+	file_len=st.st_size;
+	if(file_len<8)
+	{
+		close(fd);
+		throw lightspark::ParseException("Not an SWF file");
+	}
+	void* m=mmap(NULL,file_len,PROT_READ,MAP_PRIVATE,fd,0);
+	close(fd);
+	if(m==MAP_FAILED)
+		throw lightspark::RunTimeException("Cannot map file");
+	file=(uint8_t*)m;
+	//The file is read from start to end
+	madvise(m,file_len,MADV_SEQUENTIAL);
+#else
+	FILE* f=fopen(file_name,"rb");
+	if(f==NULL)
+		throw lightspark::RunTimeException("File does not exists");
+	fseek(f,0,SEEK_END);
+	file_len=ftell(f);
+	fseek(f,0,SEEK_SET);
+	file=new uint8_t[file_len];
+	file_len=fread(file,1,file_len,f);
+	fclose(f);
+#endif
+
+	try
+	{
+		if(file_len<8 || file[1]!='W' || file[2]!='S')
+			throw lightspark::ParseException("Not an SWF file");
+		if(file[0]=='F')
+		{
+			data=file;
+			len=file_len;
+			mapped=true;
+		}
+		else if(file[0]=='C')
+			inflateData(file,file_len);
+		else
+			throw lightspark::ParseException("Not an SWF file");
+	}
+	catch(lightspark::LightsparkException&)
+	{
+#ifndef WIN32
+		munmap(file,file_len);
+#else
+		delete[] file;
+#endif
+		throw;
+	}
+
+	if(!mapped)
+	{
+		//The compressed data is not needed anymore
+#ifndef WIN32
+		munmap(file,file_len);
+#else
+		delete[] file;
+#endif
+	}
+	setBuffer(data,len);
+}
+
+mapped_swf_filter::~mapped_swf_filter()
+{
+	if(mapped)
+	{
+#ifndef WIN32
+		munmap(data,len);
+#else
+		delete[] data;
+#endif
+	}
+	else
+		delete[] data;
+}
+
+void mapped_swf_filter::inflateData(const uint8_t* file, uint32_t file_len)
+{
+	//The header is not compressed and contains the length of the whole uncompressed file
+	uint32_t full_len=file[4]|(file[5]<<8)|(file[6]<<16)|(file[7]<<24);
+	if(full_len<8)
+		throw lightspark::ParseException("Not an SWF file");
+	//A length that the compressed data can't produce is corrupt, don't trust it for the allocation
+	const uint64_t max_len=uint64_t(file_len-8)*maxInflateRatio+8;
+	if(full_len>max_len)
+		throw lightspark::ParseException("Invalid length in SWF header");
+	data=new (std::nothrow) uint8_t[full_len];
+	if(data==NULL)
+		throw lightspark::ParseException("SWF file is too big");
+	memcpy(data,file,8);
+
+	z_stream strm;
+	strm.zalloc = Z_NULL;
+	strm.zfree = Z_NULL;
+	strm.opaque = Z_NULL;
+	strm.next_in = (Bytef*)file+8;
+	strm.avail_in = file_len-8;
+	if(inflateInit(&strm)!=Z_OK)
+	{
+		delete[] data;
+		data=NULL;
+		throw lightspark::RunTimeException("Failed to initialize ZLib");
+	}
+	strm.next_out = data+8;
+	strm.avail_out = full_len-8;
+	//The output buffer is big enough to inflate everything in a single call
+	int ret=inflate(&strm, Z_FINISH);
+	len=8+strm.total_out;
+	inflateEnd(&strm);
+	if(ret!=Z_STREAM_END && ret!=Z_BUF_ERROR)
+	{
+		delete[] data;
+		data=NULL;
+		throw lightspark::ParseException("Unexpected Zlib error");
+	}
+}
+
 zlib_bytes_filter::zlib_bytes_filter(const uint8_t* b, int l):buf(b),offset(0),len(l)
 {
 }
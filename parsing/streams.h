@@ -27,6 +27,54 @@
 #include <inttypes.h>
 #include "zlib.h"
 
+//Read only stream buffer over a block of memory
+class memory_buf: public std::streambuf
+{
+protected:
+	memory_buf(){}
+	void setBuffer(const uint8_t* b, uint32_t l)
+	{
+		char* p=(char*)b;
+		setg(p,p,p+l);
+	}
+	virtual pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode mode)
+	{
+		char* p;
+		if(dir==std::ios_base::beg)
+			p=eback()+off;
+		else if(dir==std::ios_base::cur)
+			p=gptr()+off;
+		else
+			p=egptr()+off;
+		if(p<eback() || p>egptr())
+			return pos_type(off_type(-1));
+		setg(eback(),p,egptr());
+		return pos_type(p-eback());
+	}
+public:
+	memory_buf(const uint8_t* b, uint32_t l)
+	{
+		setBuffer(b,l);
+	}
+	uint32_t consumed() const
+	{
+		return gptr()-eback();
+	}
+	uint32_t remaining() const
+	{
+		return egptr()-gptr();
+	}
+	//Direct access to the data, to parse it without copies
+	const uint8_t* current() const
+	{
+		return (const uint8_t*)gptr();
+	}
+	void skip(uint32_t n)
+	{
+		gbump(n);
+	}
+};
+
 class zlib_filter: public std::streambuf
 {
 private:
@@ -77,6 +125,25 @@ public:
 	zlib_file_filter(const char* file_name);
 };
 
+/*
+	Local SWF files are mapped in memory. Uncompressed files are parsed straight from the mapping,
+	compressed ones are inflated once in a buffer of the size declared in the header
+*/
+class DLL_PUBLIC mapped_swf_filter: public memory_buf
+{
+private:
+	uint8_t* data;
+	uint32_t len;
+	//True if data is the mapping of the file, otherwise it's the inflated buffer
+	bool mapped;
+	//Highest expansion of the deflate format
+	static const uint64_t maxInflateRatio=1032;
+	void inflateData(const uint8_t* file, uint32_t file_len);
+public:
+	mapped_swf_filter(const char* file_name);
+	~mapped_swf_filter();
+};
+
 class zlib_bytes_filter:public zlib_filter
 {
 private:
@@ -20,11 +20,13 @@
 #include <vector>
 #include <list>
 #include <algorithm>
+#include <math.h>
 #include "scripting/abc.h"
 #include "tags.h"
 #include "scripting/actions.h"
 #include "backends/geometry.h"
 #include "backends/rendering.h"
+#include "backends/renderer.h"
 #include "swftypes.h"
 #include "swf.h"
 #include "logger.h"
@@ -41,11 +43,17 @@ extern TLSDATA SystemState* sys;
 extern TLSDATA RenderThread* rt;
 extern TLSDATA ParseThread* pt;
 
+float DefineShapeTag::curveTolerance=0.5;
+
 Tag* TagFactory::readTag()
 {
 	RECORDHEADER h;
 	f >> h;
-	
+	return readTag(h);
+}
+
+Tag* TagFactory::readTag(const RECORDHEADER& h)
+{
 	unsigned int expectedLen=h.getLength();
 	unsigned int start=f.tellg();
 	Tag* ret=NULL;
@@ -704,10 +712,10 @@ void DefineTextTag::inputRender()
 	MatrixApplier ma(getMatrix());
 	ma.concat(TextMatrix);
 	//Shapes are defined in twips, so scale then down
-	glScalef(0.05,0.05,1);
+	rt->renderer->scale(0.05,0.05);
 	
 	//The next 1/20 scale is needed by DefineFont3. Should be conditional
-	glScalef(0.05,0.05,1);
+	rt->renderer->scale(0.05,0.05);
 	float scale_cur=1;
 	int count=0;
 	unsigned int shapes_done=0;
@@ -718,7 +726,7 @@ void DefineTextTag::inputRender()
 		{
 			float scale=it->TextHeight;
 			scale/=1024;
-			glScalef(scale/scale_cur,scale/scale_cur,1);
+			rt->renderer->scale(scale/scale_cur,scale/scale_cur);
 			scale_cur=scale;
 		}
 		it2 = it->GlyphEntries.begin();
@@ -791,15 +799,16 @@ void DefineTextTag::Render()
 	f.FillStyleType=0x00;
 	f.Color=it->TextColor;
 	MatrixApplier ma(getMatrix());
+	rt->renderer->pushColorTransform(ColorTransform);
 	ma.concat(TextMatrix);
 	//Shapes are defined in twips, so scale then down
-	glScalef(0.05,0.05,1);
+	rt->renderer->scale(0.05,0.05);
 
 	if(!isSimple())
-		rt->glAcquireTempBuffer(TextBounds.Xmin,TextBounds.Xmax, TextBounds.Ymin,TextBounds.Ymax);
+		rt->renderer->beginLayer(TextBounds.Xmin,TextBounds.Xmax,TextBounds.Ymin,TextBounds.Ymax);
 
 	//The next 1/20 scale is needed by DefineFont3. Should be conditional
-	glScalef(0.05,0.05,1);
+	rt->renderer->scale(0.05,0.05);
 	float scale_cur=1;
 	int count=0;
 	unsigned int shapes_done=0;
@@ -809,7 +818,7 @@ void DefineTextTag::Render()
 		{
 			float scale=it->TextHeight;
 			scale/=1024;
-			glScalef(scale/scale_cur,scale/scale_cur,1);
+			rt->renderer->scale(scale/scale_cur,scale/scale_cur);
 			scale_cur=scale;
 		}
 		it2 = it->GlyphEntries.begin();
@@ -835,7 +844,8 @@ void DefineTextTag::Render()
 	}
 
 	if(!isSimple())
-		rt->glBlitTempBuffer(TextBounds.Xmin,TextBounds.Xmax,TextBounds.Ymin,TextBounds.Ymax);
+		rt->renderer->endLayer(TextBounds.Xmin,TextBounds.Xmax,TextBounds.Ymin,TextBounds.Ymax,alpha);
+	rt->renderer->popColorTransform();
 	ma.unapply();
 }
 
@@ -859,34 +869,66 @@ DefineShapeTag::DefineShapeTag(RECORDHEADER h, std::istream& in):DictionaryTag(h
 {
 	LOG(LOG_TRACE,_("DefineShapeTag"));
 	Shapes.version=1;
-	in >> ShapeId >> ShapeBounds >> Shapes;
+	unsigned int dest=in.tellg();
+	dest+=h.getLength();
+	in >> ShapeId >> ShapeBounds;
+	readShapes(in,dest);
+}
+
+void DefineShapeTag::readShapes(std::istream& in, unsigned int dest)
+{
+	unsigned int start=in.tellg();
+	if(dest<=start)
+		throw ParseException("Malformed SWF file");
+	//The whole body is parsed from memory, so that the bit fields are read a word at a time
+	memory_buf* mem=dynamic_cast<memory_buf*>(in.rdbuf());
+	if(mem && mem->remaining()>=dest-start)
+	{
+		//The input is already in memory, no need to copy
+		readShapeWithStyle(Shapes,mem->current(),dest-start);
+		mem->skip(dest-start);
+		return;
+	}
+	vector<uint8_t> body(dest-start);
+	in.read((char*)&body[0],body.size());
+	if(in.fail())
+		throw ParseException("Malformed SWF file");
+	readShapeWithStyle(Shapes,&body[0],body.size());
 }
 
 DefineShape2Tag::DefineShape2Tag(RECORDHEADER h, std::istream& in):DefineShapeTag(h)
 {
 	LOG(LOG_TRACE,_("DefineShape2Tag"));
 	Shapes.version=2;
-	in >> ShapeId >> ShapeBounds >> Shapes;
+	unsigned int dest=in.tellg();
+	dest+=h.getLength();
+	in >> ShapeId >> ShapeBounds;
+	readShapes(in,dest);
 }
 
 DefineShape3Tag::DefineShape3Tag(RECORDHEADER h, std::istream& in):DefineShape2Tag(h)
 {
 	LOG(LOG_TRACE,_("DefineShape3Tag"));
 	Shapes.version=3;
-	in >> ShapeId >> ShapeBounds >> Shapes;
+	unsigned int dest=in.tellg();
+	dest+=h.getLength();
+	in >> ShapeId >> ShapeBounds;
+	readShapes(in,dest);
 }
 
 DefineShape4Tag::DefineShape4Tag(RECORDHEADER h, std::istream& in):DefineShape3Tag(h)
 {
 	LOG(LOG_TRACE,_("DefineShape4Tag"));
 	Shapes.version=4;
+	unsigned int dest=in.tellg();
+	dest+=h.getLength();
 	in >> ShapeId >> ShapeBounds >> EdgeBounds;
 	BitStream bs(in);
 	UB(5,bs);
 	UsesFillWindingRule=UB(1,bs);
 	UsesNonScalingStrokes=UB(1,bs);
 	UsesScalingStrokes=UB(1,bs);
-	in >> Shapes;
+	readShapes(in,dest);
 }
 
 DefineMorphShapeTag::DefineMorphShapeTag(RECORDHEADER h, std::istream& in):DictionaryTag(h)
@@ -957,10 +999,11 @@ void DefineShapeTag::inputRender()
 		return;
 
 	MatrixApplier ma(getMatrix());
-	glScalef(0.05,0.05,1);
+	rt->renderer->scale(0.05,0.05);
 
-	std::vector < GeomShape >::iterator it=cached.begin();
-	for(;it!=cached.end();it++)
+	std::vector<GeomShape>& shapes=getShapes();
+	std::vector < GeomShape >::iterator it=shapes.begin();
+	for(;it!=shapes.end();it++)
 	{
 		assert_and_throw(it->color <= Shapes.FillStyles.FillStyleCount);
 		it->Render();
@@ -968,6 +1011,37 @@ void DefineShapeTag::inputRender()
 	ma.unapply();
 }
 
+std::vector<GeomShape>& DefineShapeTag::getShapes()
+{
+	//Keeping a few tolerances is enough for shapes which are zoomed back and forth
+	const unsigned int maxCachedTolerances=3;
+	//Tolerances are rounded down to a power of two twips, between 1 and 4096
+	const float scale=rt->renderer->getScale();
+	int bucket=12;
+	if(scale>0)
+		bucket=imax(0,imin(12,ilogbf(curveTolerance/scale)));
+
+	list<flattened_shapes>::iterator it=cached.begin();
+	for(;it!=cached.end();it++)
+	{
+		if(it->bucket==bucket)
+		{
+			cached.splice(cached.begin(),cached,it);
+			return cached.front().shapes;
+		}
+	}
+
+	if(cached.size()==maxCachedTolerances)
+		cached.pop_back();
+	cached.push_front(flattened_shapes());
+	cached.front().bucket=bucket;
+	std::vector<GeomShape>& ret=cached.front().shapes;
+	FromShaperecordListToShapeVector(Shapes.ShapeRecords,ret,1<<bucket);
+	for(unsigned int i=0;i<ret.size();i++)
+		ret[i].BuildFromEdges(&Shapes.FillStyles.FillStyles,*rt->triangulator);
+	return ret;
+}
+
 void DefineShapeTag::Render()
 {
 	if(alpha==0)
@@ -975,30 +1049,25 @@ void DefineShapeTag::Render()
 	if(!visible)
 		return;
 
-	if(cached.size()==0)
-	{
-		FromShaperecordListToShapeVector(Shapes.ShapeRecords,cached);
-
-		for(unsigned int i=0;i<cached.size();i++)
-			cached[i].BuildFromEdges(&Shapes.FillStyles.FillStyles);
-	}
-
 	MatrixApplier ma(getMatrix());
-	glScalef(0.05,0.05,1);
+	rt->renderer->pushColorTransform(ColorTransform);
+	rt->renderer->scale(0.05,0.05);
 
 	if(!isSimple())
-		rt->glAcquireTempBuffer(ShapeBounds.Xmin,ShapeBounds.Xmax,ShapeBounds.Ymin,ShapeBounds.Ymax);
+		rt->renderer->beginLayer(ShapeBounds.Xmin,ShapeBounds.Xmax,ShapeBounds.Ymin,ShapeBounds.Ymax);
 
-	std::vector < GeomShape >::iterator it=cached.begin();
-	for(;it!=cached.end();it++)
+	std::vector<GeomShape>& shapes=getShapes();
+	std::vector < GeomShape >::iterator it=shapes.begin();
+	for(;it!=shapes.end();it++)
 	{
 		assert_and_throw(it->color <= Shapes.FillStyles.FillStyleCount);
 		it->Render();
 	}
 
 	if(!isSimple())
-		rt->glBlitTempBuffer(ShapeBounds.Xmin,ShapeBounds.Xmax,ShapeBounds.Ymin,ShapeBounds.Ymax);
+		rt->renderer->endLayer(ShapeBounds.Xmin,ShapeBounds.Xmax,ShapeBounds.Ymin,ShapeBounds.Ymax,alpha);
 
+	rt->renderer->popColorTransform();
 	ma.unapply();
 }
 
@@ -1052,9 +1121,10 @@ Vector2 DefineShape3Tag::debugRender(FTFont* font, bool deep)
 
 /*! \brief Generate a vector of shapes from a SHAPERECORD list
 * * \param cur SHAPERECORD list head
-* * \param shapes a vector to be populated with the shapes */
+* * \param shapes a vector to be populated with the shapes
+* * \param tolerance maximum distance, in twips, of the segments from the curves */
 
-void lightspark::FromShaperecordListToShapeVector(const vector<SHAPERECORD>& shapeRecords, vector<GeomShape>& shapes)
+void lightspark::FromShaperecordListToShapeVector(const vector<SHAPERECORD>& shapeRecords, vector<GeomShape>& shapes, float tolerance)
 {
 	int startX=0;
 	int startY=0;
@@ -1090,15 +1160,34 @@ void lightspark::FromShaperecordListToShapeVector(const vector<SHAPERECORD>& sha
 				startY+=cur->AnchorDeltaY;
 				Vector2 p3(startX,startY);
 
-				if(color0)
+				if(color0==0 && color1==0)
+					continue;
+				//The chords of n uniform steps are at most |p1-2*p2+p3|/(4*n^2) away from the curve
+				const float dx=p1.x-2*p2.x+p3.x;
+				const float dy=p1.y-2*p2.y+p3.y;
+				const float deviation=sqrtf(dx*dx+dy*dy);
+				int steps=1;
+				if(deviation>4*tolerance)
+					steps=imin(int(ceilf(sqrtf(deviation/(4*tolerance)))),256);
+
+				Vector2 prev=p1;
+				for(int j=1;j<=steps;j++)
 				{
-					shapesBuilder.extendOutlineForColor(color0,p1,p2);
-					shapesBuilder.extendOutlineForColor(color0,p2,p3);
-				}
-				if(color1)
-				{
-					shapesBuilder.extendOutlineForColor(color1,p1,p2);
-					shapesBuilder.extendOutlineForColor(color1,p2,p3);
+					Vector2 next=p3;
+					if(j<steps)
+					{
+						const float t=float(j)/steps;
+						const float u=1-t;
+						next=Vector2(lrintf(u*u*p1.x+2*u*t*p2.x+t*t*p3.x),lrintf(u*u*p1.y+2*u*t*p2.y+t*t*p3.y));
+					}
+					//Points closer than a twip are merged
+					if(next==prev)
+						continue;
+					if(color0)
+						shapesBuilder.extendOutlineForColor(color0,prev,next);
+					if(color1)
+						shapesBuilder.extendOutlineForColor(color1,prev,next);
+					prev=next;
 				}
 			}
 		}
@@ -1134,7 +1223,7 @@ void DefineFont3Tag::genGlyphShape(vector<GeomShape>& s, int glyph)
 	FromShaperecordListToShapeVector(shape.ShapeRecords,s);
 
 	for(unsigned int i=0;i<s.size();i++)
-		s[i].BuildFromEdges(NULL);
+		s[i].BuildFromEdges(NULL,*rt->triangulator);
 
 	//Should check fill state
 
@@ -1174,7 +1263,7 @@ void DefineFont2Tag::genGlyphShape(vector<GeomShape>& s, int glyph)
 	FromShaperecordListToShapeVector(shape.ShapeRecords,s);
 
 	for(unsigned int i=0;i<s.size();i++)
-		s[i].BuildFromEdges(NULL);
+		s[i].BuildFromEdges(NULL,*rt->triangulator);
 
 	//Should check fill state
 
@@ -1214,7 +1303,7 @@ void DefineFontTag::genGlyphShape(vector<GeomShape>& s,int glyph)
 	FromShaperecordListToShapeVector(shape.ShapeRecords,s);
 
 	for(unsigned int i=0;i<s.size();i++)
-		s[i].BuildFromEdges(NULL);
+		s[i].BuildFromEdges(NULL,*rt->triangulator);
 
 	//Should check fill state
 }
@@ -1688,12 +1777,10 @@ void DefineButton2Tag::Render()
 		IRenderObject* c=dynamic_cast<IRenderObject*>(r);
 		if(c==NULL)
 			LOG(ERROR,_("Rendering something strange"));
-		float matrix[16];
-		Characters[i].PlaceMatrix.get4DMatrix(matrix);
-		glPushMatrix();
-		glMultMatrixf(matrix);
+		rt->renderer->pushMatrix();
+		rt->renderer->multMatrix(Characters[i].PlaceMatrix);
 		c->Render();
-		glPopMatrix();
+		rt->renderer->popMatrix();
 	}
 	for(unsigned int i=0;i<Actions.size();i++)
 	{
@@ -1743,13 +1830,8 @@ void DefineVideoStreamTag::Render()
 		return;
 	if(!visible)
 		return;*/
-	glColor4f(1,0,0,0);
-	glBegin(GL_QUADS);
-		glVertex2i(0,0);
-		glVertex2i(Width,0);
-		glVertex2i(Width,Height);
-		glVertex2i(0,Height);
-	glEnd();
+	rt->renderer->setFixedColor(1,0,0);
+	rt->renderer->drawRect(0,0,Width,Height);
 }
 
 DefineBinaryDataTag::DefineBinaryDataTag(RECORDHEADER h,std::istream& s):DictionaryTag(h)
@@ -38,8 +38,13 @@ namespace lightspark
 
 enum TAGTYPE {TAG=0,DISPLAY_LIST_TAG,SHOW_TAG,CONTROL_TAG,DICT_TAG,FRAMELABEL_TAG,END_TAG};
 
+//Used when the shape is not drawn at a known scale, e.g. for glyphs
+const float defaultCurveTolerance=10;
+
 void ignore(std::istream& i, int count);
-void FromShaperecordListToShapeVector(const std::vector<SHAPERECORD>& shapeRecords, std::vector<GeomShape>& shapes);
+//Curves are flattened so that the segments are at most tolerance twips away from them
+void FromShaperecordListToShapeVector(const std::vector<SHAPERECORD>& shapeRecords, std::vector<GeomShape>& shapes,
+		float tolerance=defaultCurveTolerance);
 
 class Tag
 {
@@ -100,9 +105,22 @@ protected:
 	UI16 ShapeId;
 	RECT ShapeBounds;
 	SHAPEWITHSTYLE Shapes;
+	//The shapes flattened with a tolerance of 2^bucket twips, the most recently used first
+	struct flattened_shapes
+	{
+		int bucket;
+		std::vector<GeomShape> shapes;
+	};
+	std::list<flattened_shapes> cached;
+	//Returns the shapes flattened for the current scale of the renderer
+	std::vector<GeomShape>& getShapes();
 	DefineShapeTag(RECORDHEADER h):DictionaryTag(h){};
+	//Reads the shapes from the rest of the tag body, which ends at dest
+	void readShapes(std::istream& in, unsigned int dest);
 public:
 	DefineShapeTag(RECORDHEADER h, std::istream& in);
+	//Maximum distance, in pixels, of the drawn curves from the real ones
+	static float curveTolerance;
 	virtual int getId(){ return ShapeId; }
 	virtual void Render();
 	virtual void inputRender();
@@ -741,6 +759,8 @@ private:
 public:
 	TagFactory(std::istream& in, bool t):f(in),firstTag(true),topLevel(t){}
 	Tag* readTag();
+	//Reads the body of a tag whose header has already been read
+	Tag* readTag(const RECORDHEADER& h);
 };
 
 };
@@ -30,6 +30,7 @@
 #include "swftypes.h"
 #include <sstream>
 #include <limits>
+#include <algorithm>
 #include <math.h>
 #include "swf.h"
 #include "flashevents.h"
@@ -395,9 +396,11 @@ multiname* ABCContext::s_getMultiname(call_context* th, ASObject* rt1, int n)
 			{
 				const namespace_info* n=&th->context->constant_pool.namespaces[m->ns];
 				assert_and_throw(n->name);
-				ret->ns.push_back(nsNameAndKind(th->context->getString(n->name),(NS_KIND)(int)n->kind));
+				ret->ns.push_back(nsNameAndKind(th->context->getString(n->name),th->context->getStringAtom(n->name),
+							(NS_KIND)(int)n->kind));
 
 				ret->name_s=th->context->getString(m->name);
+				ret->name_atom=th->context->getStringAtom(m->name);
 				ret->name_type=multiname::NAME_STRING;
 				break;
 			}
@@ -408,10 +411,12 @@ multiname* ABCContext::s_getMultiname(call_context* th, ASObject* rt1, int n)
 				for(unsigned int i=0;i<s->count;i++)
 				{
 					const namespace_info* n=&th->context->constant_pool.namespaces[s->ns[i]];
-					ret->ns.push_back(nsNameAndKind(th->context->getString(n->name),(NS_KIND)(int)n->kind));
+					ret->ns.push_back(nsNameAndKind(th->context->getString(n->name),th->context->getStringAtom(n->name),
+								(NS_KIND)(int)n->kind));
 				}
 				sort(ret->ns.begin(),ret->ns.end());
 				ret->name_s=th->context->getString(m->name);
+				ret->name_atom=th->context->getStringAtom(m->name);
 				ret->name_type=multiname::NAME_STRING;
 				break;
 			}
@@ -475,6 +480,7 @@ multiname* ABCContext::s_getMultiname(call_context* th, ASObject* rt1, int n)
 				ret->ns.push_back(nsNameAndKind(tmpns->uri,NAMESPACE));
 				ret->name_type=multiname::NAME_STRING;
 				ret->name_s=th->context->getString(m->name);
+				ret->name_atom=th->context->getStringAtom(m->name);
 				rt1->decRef();
 				break;
 			}
@@ -674,11 +680,12 @@ multiname* ABCContext::getMultiname(unsigned int n, call_context* th)
 			{
 				const namespace_info* n=&constant_pool.namespaces[m->ns];
 				if(n->name)
-					ret->ns.push_back(nsNameAndKind(getString(n->name),(NS_KIND)(int)n->kind));
+					ret->ns.push_back(nsNameAndKind(getString(n->name),getStringAtom(n->name),(NS_KIND)(int)n->kind));
 				else
-					ret->ns.push_back(nsNameAndKind("",(NS_KIND)(int)n->kind));
+					ret->ns.push_back(nsNameAndKind("",Atoms::EMPTY,(NS_KIND)(int)n->kind));
 
 				ret->name_s=getString(m->name);
+				ret->name_atom=getStringAtom(m->name);
 				ret->name_type=multiname::NAME_STRING;
 				break;
 			}
@@ -689,11 +696,12 @@ multiname* ABCContext::getMultiname(unsigned int n, call_context* th)
 				for(unsigned int i=0;i<s->count;i++)
 				{
 					const namespace_info* n=&constant_pool.namespaces[s->ns[i]];
-					ret->ns.push_back(nsNameAndKind(getString(n->name),(NS_KIND)(int)n->kind));
+					ret->ns.push_back(nsNameAndKind(getString(n->name),getStringAtom(n->name),(NS_KIND)(int)n->kind));
 				}
 				sort(ret->ns.begin(),ret->ns.end());
 
 				ret->name_s=getString(m->name);
+				ret->name_atom=getStringAtom(m->name);
 				ret->name_type=multiname::NAME_STRING;
 				break;
 			}
@@ -758,6 +766,7 @@ multiname* ABCContext::getMultiname(unsigned int n, call_context* th)
 				ret->ns.push_back(nsNameAndKind(tmpns->uri,NAMESPACE));
 				ret->name_type=multiname::NAME_STRING;
 				ret->name_s=getString(m->name);
+				ret->name_atom=getStringAtom(m->name);
 				n->decRef();
 				break;
 			}
@@ -769,6 +778,7 @@ multiname* ABCContext::getMultiname(unsigned int n, call_context* th)
 				const namespace_info* n=&constant_pool.namespaces[td->ns];
 				ret->ns.push_back(nsNameAndKind(getString(n->name),(NS_KIND)(int)n->kind));
 				ret->name_s=getString(td->name);
+				ret->name_atom=getStringAtom(td->name);
 				ret->name_type=multiname::NAME_STRING;
 				break;
 			}
@@ -898,6 +908,7 @@ ABCContext::ABCContext(istream& in)
 	in >> minor >> major;
 	LOG(LOG_CALLS,_("ABCVm version ") << major << '.' << minor);
 	in >> constant_pool;
+	poolHash=MethodCache::hashConstantPool(constant_pool);
 
 	in >> method_count;
 	methods.resize(method_count);
@@ -962,13 +973,16 @@ ABCContext::ABCContext(istream& in)
 	}
 }
 
-ABCVm::ABCVm(SystemState* s):m_sys(s),terminated(false),shuttingdown(false)
+ABCVm::ABCVm(SystemState* s):m_sys(s),terminated(false),shuttingdown(false),pendingEvents(0),vmWaiting(0),
+	interpretedInstructions(0),compiler(this)
 {
-	sem_init(&event_queue_mutex,0,1);
 	sem_init(&sem_event_count,0,0);
 	m_sys=s;
 	int_manager=new Manager(15);
 	number_manager=new Manager(15);
+	event_manager=new Manager(64,true);
+	mouse_event_manager=new Manager(64,true);
+	timer_event_manager=new Manager(64,true);
 	Global=new GlobalObject;
 	LOG(LOG_NO_INFO,_("Global is ") << Global);
 	//Push a dummy default context
@@ -987,9 +1001,11 @@ void ABCVm::shutdown()
 ABCVm::~ABCVm()
 {
 	sem_destroy(&sem_event_count);
-	sem_destroy(&event_queue_mutex);
 	delete int_manager;
 	delete number_manager;
+	delete event_manager;
+	delete mouse_event_manager;
+	delete timer_event_manager;
 }
 
 void ABCVm::wait()
@@ -1006,7 +1022,42 @@ void ABCVm::wait()
 
 int ABCVm::getEventQueueSize()
 {
-	return events_queue.size();
+	return pendingEvents;
+}
+
+event_latency ABCVm::getEventLatency(uint32_t priority) const
+{
+	assert_and_throw(priority<PRIORITY_COUNT);
+	return latency[priority];
+}
+
+void ABCVm::dumpEventLatency() const
+{
+	const char* names[PRIORITY_COUNT]={"high","normal","low"};
+	for(uint32_t i=0;i<PRIORITY_COUNT;i++)
+	{
+		const event_latency& l=latency[i];
+		if(l.count==0)
+			continue;
+		LOG(LOG_NO_INFO,_("Event latency (") << names[i] << _(" priority): ") << l.count << _(" events, average ")
+			<< l.total/l.count << _(" us, max ") << l.max << _(" us"));
+	}
+}
+
+ABCVm::EVENT_PRIORITY ABCVm::getEventPriority(EventDispatcher* obj, Event* ev)
+{
+	if(ev->getEventType()==MOUSE_EVENT)
+		return PRIORITY_HIGH;
+	//Network notifications may come in floods. They must stay ordered among themselves, so the
+	//ones closing a transfer share the queue of the progress ones
+	if(obj && ev->getEventType()==EVENT)
+	{
+		const tiny_string& t=ev->type;
+		if(t=="progress" || t=="open" || t=="complete" || t=="httpStatus" || t=="ioError")
+			return PRIORITY_LOW;
+	}
+	//Frame handling and internal events depend on each other's order
+	return PRIORITY_NORMAL;
 }
 
 void ABCVm::handleEvent(pair<EventDispatcher*,Event*> e)
@@ -1014,24 +1065,40 @@ void ABCVm::handleEvent(pair<EventDispatcher*,Event*> e)
 	e.second->check();
 	if(e.first)
 	{
-		//TODO: implement capture phase
-		//Do target phase
 		Event* event=e.second;
 		assert_and_throw(event->target==NULL);
 		event->target=e.first;
+		//The path is computed once, listeners changing the display list do not change it
+		vector<EventDispatcher*> path;
+		//Broadcast events have no capture and bubbling phases, so the path is left empty
+		if(!event->isBroadcast())
+		{
+			for(EventDispatcher* cur=e.first->getEventParent();cur;cur=cur->getEventParent())
+			{
+				cur->incRef();
+				path.push_back(cur);
+			}
+		}
+		//Do capture phase, from the root down to the parent of the target
+		for(uint32_t i=path.size();i>0;i--)
+		{
+			event->currentTarget=path[i-1];
+			path[i-1]->handleEvent(event,true);
+		}
+		//Do target phase
 		event->currentTarget=e.first;
 		e.first->handleEvent(event);
 		//Do bubbling phase
-		if(event->bubbles && e.first->prototype->isSubClass(Class<DisplayObject>::getClass()))
+		if(event->bubbles)
 		{
-			DisplayObjectContainer* cur=static_cast<DisplayObject*>(e.first)->parent;
-			while(cur)
+			for(uint32_t i=0;i<path.size();i++)
 			{
-				event->currentTarget=cur;
-				cur->handleEvent(event);
-				cur=cur->parent;
+				event->currentTarget=path[i];
+				path[i]->handleEvent(event);
 			}
 		}
+		for(uint32_t i=0;i<path.size();i++)
+			path[i]->decRef();
 		//Reset events so they might be recycled
 		event->currentTarget=NULL;
 		event->target=NULL;
@@ -1122,16 +1189,68 @@ bool ABCVm::addEvent(EventDispatcher* obj ,Event* ev)
 		return true;
 	}
 
-	sem_wait(&event_queue_mutex);
 	if(obj)
 		obj->incRef();
 	ev->incRef();
-	events_queue.push_back(pair<EventDispatcher*,Event*>(obj, ev));
-	sem_post(&event_queue_mutex);
-	sem_post(&sem_event_count);
+	event_entry e;
+	e.obj=obj;
+	e.ev=ev;
+	e.time=compat_get_monotonic_time_us();
+	//Counted before being pushed, so that the VM does not go to sleep while the push completes
+	ATOMIC_INCREMENT(pendingEvents);
+	events_queue[getEventPriority(obj,ev)].push(e);
+	//Wake up the VM only if it is waiting, events added while it is running are taken by the current batch
+	if(vmWaiting)
+	{
+		vmWaiting=0;
+		sem_post(&sem_event_count);
+	}
 	return true;
 }
 
+void ABCVm::waitForEvents()
+{
+	vmWaiting=1;
+	//Events added before the flag was set would not wake us up
+	if(pendingEvents==0 && !shuttingdown)
+		sem_wait(&sem_event_count);
+	vmWaiting=0;
+}
+
+uint32_t ABCVm::dispatchEvents()
+{
+	//Input is taken as soon as it is available, normal and bulk events in batches. Bulk events are
+	//dispatched even if the normal queue never gets empty
+	const uint32_t batchSize[PRIORITY_COUNT]={0,64,16};
+	uint32_t dispatched[PRIORITY_COUNT]={0,0,0};
+	uint32_t total=0;
+	while(1)
+	{
+		event_entry e;
+		uint32_t p;
+		if(events_queue[PRIORITY_HIGH].pop(e))
+			p=PRIORITY_HIGH;
+		else if(dispatched[PRIORITY_NORMAL]<batchSize[PRIORITY_NORMAL] && events_queue[PRIORITY_NORMAL].pop(e))
+			p=PRIORITY_NORMAL;
+		else if(dispatched[PRIORITY_LOW]<batchSize[PRIORITY_LOW] && events_queue[PRIORITY_LOW].pop(e))
+			p=PRIORITY_LOW;
+		else
+			break;
+		ATOMIC_DECREMENT(pendingEvents);
+		dispatched[p]++;
+		total++;
+
+		event_latency& l=latency[p];
+		const uint64_t wait=compat_get_monotonic_time_us()-e.time;
+		l.count++;
+		l.total+=wait;
+		if(wait>l.max)
+			l.max=wait;
+		handleEvent(make_pair(e.obj,e.ev));
+	}
+	return total;
+}
+
 void ABCVm::buildClassAndInjectBase(const string& s, ASObject* base, ASObject* const* args, const unsigned int argslen, bool isRoot)
 {
 	//It seems to be acceptable for the same base to be binded multiple times,
@@ -1247,6 +1366,8 @@ call_context::call_context(method_info* th, int level, ASObject* const* args, co
 	stack=new ASObject*[th->body->max_stack];
 	stack_index=0;
 	context=th->context;
+	exec_pos=0;
+	osr_offset=0;
 }
 
 call_context::~call_context()
@@ -1392,62 +1513,33 @@ void ABCVm::Run(ABCVm* th)
 	while(getVm()!=th);
 	isVmThread=true;
 	if(th->m_sys->useJit)
-	{
-		llvm::InitializeNativeTarget();
-		th->module=new llvm::Module(llvm::StringRef("abc jit"),th->llvm_context);
-		llvm::EngineBuilder eb(th->module);
-		eb.setEngineKind(llvm::EngineKind::JIT);
-		eb.setOptLevel(llvm::CodeGenOpt::Default);
-		th->ex=eb.create();
-		assert_and_throw(th->ex);
-
-		th->FPM=new llvm::FunctionPassManager(th->module);
-	      
-		th->FPM->add(new llvm::TargetData(*th->ex->getTargetData()));
-#ifdef EXPENSIVE_DEBUG
-		//This is pretty heavy, do not enable in release
-		th->FPM->add(llvm::createVerifierPass());
-#endif
-		th->FPM->add(llvm::createPromoteMemoryToRegisterPass());
-		th->FPM->add(llvm::createReassociatePass());
-		th->FPM->add(llvm::createCFGSimplificationPass());
-		th->FPM->add(llvm::createGVNPass());
-		th->FPM->add(llvm::createInstructionCombiningPass());
-		th->FPM->add(llvm::createLICMPass());
-		th->FPM->add(llvm::createDeadStoreEliminationPass());
-
-		th->registerFunctions();
-	}
+		th->compiler.start();
 	th->registerClasses();
 
 	ThreadProfile* profile=th->m_sys->allocateProfiler(RGB(0,200,0));
 	profile->setTag("VM");
+	//Candidates examined by each slice of the cycle collector
+	const uint32_t gcSliceSize=64;
 	//When aborting execution remaining events should be handled
 	bool bailOut=false;
 	//bailout is used to keep the vm running. When bailout is true only process evnts until the queue in empty
-	while(!bailOut || !th->events_queue.empty())
+	while(!bailOut || th->pendingEvents!=0)
 	{
 		try
 		{
-			sem_wait(&th->sem_event_count);
 			if(th->shuttingdown)
 				bailOut=true;
 			if(bailOut)
-			{
-				//If the queue is empty stop immediately
-				if(th->events_queue.empty())
-					break;
-				else
-					LOG(LOG_NO_INFO,th->events_queue.size() << _(" events missing before exit"));
-			}
+				LOG(LOG_NO_INFO,th->pendingEvents << _(" events missing before exit"));
+			else
+				th->waitForEvents();
 			Chronometer chronometer;
-			sem_wait(&th->event_queue_mutex);
-			pair<EventDispatcher*,Event*> e=th->events_queue.front();
-			th->events_queue.pop_front();
-			sem_post(&th->event_queue_mutex);
-			th->handleEvent(e);
+			th->dispatchEvents();
 			if(th->shuttingdown)
 				bailOut=true;
+			//Use the idle time to look for garbage cycles, a slice at a time
+			else if(th->pendingEvents==0)
+				th->collector.collect(gcSliceSize);
 			profile->accountTime(chronometer.checkpoint());
 		}
 		catch(LightsparkException& e)
@@ -1466,11 +1558,215 @@ void ABCVm::Run(ABCVm* th)
 			bailOut=true;
 		}
 	}
-	if(th->m_sys->useJit)
+	th->compiler.stop();
+	th->methodCache.save();
+	th->dumpEventLatency();
+}
+
+JitCompiler::JitCompiler(ABCVm* v):vm(v),started(false),shuttingdown(false),mutex("JitCompiler"),pendingResults(0)
+{
+	sem_init(&sem_requests,0,0);
+	sem_init(&sem_done,0,0);
+}
+
+JitCompiler::~JitCompiler()
+{
+	sem_destroy(&sem_requests);
+	sem_destroy(&sem_done);
+}
+
+void JitCompiler::start()
+{
+	assert(!started);
+	started=true;
+	pthread_create(&t,NULL,(thread_worker)worker,this);
+}
+
+void JitCompiler::stop()
+{
+	if(!started)
+		return;
+	{
+		Locker l(mutex);
+		shuttingdown=true;
+	}
+	sem_post(&sem_requests);
+	if(pthread_join(t,NULL)!=0)
+		LOG(LOG_ERROR,_("pthread_join in JitCompiler failed"));
+	started=false;
+	//Unblock a pending synchronous compilation
+	sem_post(&sem_done);
+}
+
+void JitCompiler::worker(JitCompiler* th)
+{
+	ABCVm* vm=th->vm;
+	sys=vm->m_sys;
+	llvm::InitializeNativeTarget();
+	vm->module=new llvm::Module(llvm::StringRef("abc jit"),vm->llvm_context);
+	llvm::EngineBuilder eb(vm->module);
+	eb.setEngineKind(llvm::EngineKind::JIT);
+	eb.setOptLevel(llvm::CodeGenOpt::Default);
+	vm->ex=eb.create();
+	assert_and_throw(vm->ex);
+	//Lazy stubs would call back in the JIT from the VM thread
+	vm->ex->DisableLazyCompilation(true);
+
+	vm->FPM=new llvm::FunctionPassManager(vm->module);
+
+	vm->FPM->add(new llvm::TargetData(*vm->ex->getTargetData()));
+#ifdef EXPENSIVE_DEBUG
+	//This is pretty heavy, do not enable in release
+	vm->FPM->add(llvm::createVerifierPass());
+#endif
+	vm->FPM->add(llvm::createPromoteMemoryToRegisterPass());
+	vm->FPM->add(llvm::createReassociatePass());
+	vm->FPM->add(llvm::createCFGSimplificationPass());
+	vm->FPM->add(llvm::createGVNPass());
+	vm->FPM->add(llvm::createInstructionCombiningPass());
+	vm->FPM->add(llvm::createLICMPass());
+	vm->FPM->add(llvm::createDeadStoreEliminationPass());
+
+	vm->registerFunctions();
+
+	ThreadProfile* profile=vm->m_sys->allocateProfiler(RGB(200,200,0));
+	profile->setTag("JIT");
+	while(1)
+	{
+		sem_wait(&th->sem_requests);
+		Locker l(th->mutex);
+		if(th->shuttingdown)
+			break;
+		jit_job job=th->requests.front();
+		th->requests.pop_front();
+		l.unlock();
+
+		Chronometer chronometer;
+		th->compile(job);
+		profile->accountTime(chronometer.checkpoint());
+
+		l.lock();
+		th->results.push_back(job);
+		th->pendingResults=1;
+		l.unlock();
+		sem_post(&th->sem_done);
+	}
+	//Compiled code is not used anymore after the VM is stopped
+	vm->ex->clearAllGlobalMappings();
+	delete vm->FPM;
+	delete vm->module;
+}
+
+void JitCompiler::compile(jit_job& job)
+{
+	try
+	{
+		job.f=job.mi->synt_method(job.tier,job.profile);
+	}
+	catch(LightsparkException& e)
+	{
+		LOG(LOG_ERROR,_("JIT compilation failed ") << e.cause);
+		job.f=NULL;
+	}
+}
+
+void JitCompiler::request(method_info* mi, JIT_TIER tier)
+{
+	mi->requestedTier=tier;
+	//Hot methods are remembered for the next runs
+	vm->methodCache.store(mi);
+	jit_job job(mi,tier);
+	if(!mi->speculationFailed)
+		job.profile=mi->argProfile;
+	Locker l(mutex);
+	requests.push_back(job);
+	sem_post(&sem_requests);
+}
+
+void JitCompiler::tierUp(method_info* mi)
+{
+	mi->hotness++;
+	//When the quick tier threshold is not lower the method is optimized right away.
+	//Methods that were hot in previous runs skip the warm up
+	if(mi->hotness>=sys->jitOptimizedThreshold || mi->profiledTier==TIER_OPTIMIZED)
+		request(mi,TIER_OPTIMIZED);
+	else if((mi->hotness>=sys->jitQuickThreshold || mi->profiledTier==TIER_QUICK) && mi->requestedTier==TIER_INTERPRETER)
+		request(mi,TIER_QUICK);
+}
+
+void JitCompiler::installResults()
+{
+	Locker l(mutex);
+	for(unsigned int i=0;i<results.size();i++)
+	{
+		const jit_job& job=results[i];
+		if(job.f==NULL)
+		{
+			//Keep interpreting the method, or using the code of the previous tier
+			job.mi->jitFailed=true;
+			continue;
+		}
+		//Requested before a speculation failed
+		if(!job.profile.empty() && job.mi->speculationFailed)
+			continue;
+		if(job.tier>job.mi->tier)
+		{
+			job.mi->f=job.f;
+			job.mi->tier=job.tier;
+		}
+	}
+	results.clear();
+	pendingResults=0;
+}
+
+SyntheticFunction::synt_function JitCompiler::enterMethod(method_info* mi)
+{
+	if(pendingResults)
+		installResults();
+	if(!mi->jitFailed && mi->requestedTier!=TIER_OPTIMIZED)
+		tierUp(mi);
+	return mi->f;
+}
+
+SyntheticFunction::synt_function JitCompiler::backEdge(method_info* mi, uint32_t offset)
+{
+	if(pendingResults)
+		installResults();
+	if(!mi->jitFailed && mi->requestedTier!=TIER_OPTIMIZED)
+		tierUp(mi);
+	if(mi->f && !mi->osrFailed && binary_search(mi->osr_entries.begin(),mi->osr_entries.end(),offset))
+		return mi->f;
+	return NULL;
+}
+
+void JitCompiler::deoptimize(method_info* mi, bool fromLoop)
+{
+	if(fromLoop)
+	{
+		//The loops are left to the interpreter, calls can still use the code
+		mi->osrFailed=true;
+		return;
+	}
+	LOG(LOG_CALLS,_("Speculation failed, the method will be compiled again"));
+	mi->speculationFailed=true;
+	mi->f=NULL;
+	mi->tier=TIER_INTERPRETER;
+	mi->requestedTier=TIER_INTERPRETER;
+	mi->hotness=0;
+}
+
+SyntheticFunction::synt_function JitCompiler::compileNow(method_info* mi)
+{
+	if(mi->f || mi->jitFailed)
+		return mi->f;
+	if(mi->requestedTier==TIER_INTERPRETER)
+		request(mi,TIER_OPTIMIZED);
+	while(mi->f==NULL && !mi->jitFailed && started)
 	{
-		th->ex->clearAllGlobalMappings();
-		delete th->module;
+		sem_wait(&sem_done);
+		installResults();
 	}
+	return mi->f;
 }
 
 const tiny_string& ABCContext::getString(unsigned int s) const
@@ -2032,7 +2328,10 @@ istream& lightspark::operator>>(istream& in, string_info& v)
 		if(t&0x80)
 			LOG(LOG_NOT_IMPLEMENTED,_("Multibyte not handled"));
 	}
-	v.val=tmp;
+	//All the strings are interned at load time. The interned copy is never freed, so it can
+	//be referenced without copying it
+	v.atom=Atoms::intern(tmp.c_str());
+	v.val=Atoms::getString(v.atom);
 	return in;
 }
 
@@ -34,6 +34,8 @@
 #include <map>
 #include <set>
 #include "swf.h"
+#include "gc.h"
+#include "method_cache.h"
 
 namespace lightspark
 {
@@ -109,8 +111,11 @@ friend std::istream& operator>>(std::istream& in, string_info& v);
 private:
 	u30 size;
 	tiny_string val;
+	uint32_t atom;
 public:
+	string_info():atom(Atoms::EMPTY){}
 	operator const tiny_string&() const{return val;}
+	uint32_t getAtom() const{return atom;}
 };
 
 struct namespace_info
@@ -167,6 +172,41 @@ class method_info;
 class ABCContext;
 class ABCVm;
 
+/*
+	Inline cache of a property access site. It maps the class of the receiver to the trait
+	resolved on the class chain, so that the chain is not walked again on each access.
+	When the receiver still has the shape of its class the own variable is also resolved,
+	either to its index in the values of the shape or to the knowledge that the name is not
+	an own variable.
+	Entries are discarded when borrowed traits are added or destroyed anywhere
+*/
+struct inline_cache
+{
+	enum { SIZE=4 };
+	//The name may be an own variable of the receiver, the map has to be searched
+	static const int32_t UNKNOWN_INDEX=-1;
+	//The name is not an own variable of the instances with the cached shape
+	static const int32_t NOT_OWN=-2;
+	struct entry
+	{
+		Class_base* cls;
+		//NULL if the class has a custom lookup or the name is not a trait of the class
+		obj_var* var;
+		//Shape of the instances for which index is valid
+		const instance_shape* shape;
+		int32_t index;
+		bool usable() const { return var!=NULL || index>=0; }
+	};
+	//Value of Class_base::traitsVersion when the entries were filled
+	int32_t version;
+	uint32_t used;
+	uint32_t next;
+	entry entries[SIZE];
+	inline_cache():version(-1),used(0),next(0){}
+	const entry* lookup(const Class_base* c);
+	const entry* insert(Class_base* c, obj_var* var, const instance_shape* shape, int32_t index);
+};
+
 struct call_context
 {
 #include "packed_begin.h"
@@ -175,6 +215,8 @@ struct call_context
 		ASObject** locals;
 		ASObject** stack;
 		uint32_t stack_index;
+		//Byte offset of the loop header where compiled code is entered, 0 to start from the beginning
+		uint32_t osr_offset;
 	} PACKED;
 #include "packed_end.h"
 	ABCContext* context;
@@ -186,7 +228,8 @@ struct call_context
 	ASObject* runtime_stack_pop();
 	ASObject* runtime_stack_peek();
 	method_info* mi;
-	std::stringstream* code;
+	//Index of the next instruction in the decoded code of the method
+	uint32_t exec_pos;
 	call_context(method_info* th, int l, ASObject* const* args, const unsigned int numArgs);
 	~call_context();
 };
@@ -215,6 +258,13 @@ inline stack_entry make_stack_entry(llvm::Value* v, STACK_TYPE t)
 	return std::make_pair(v, t);
 }
 
+//Compilation tiers, each one is tried when a method gets hotter
+enum JIT_TIER { TIER_INTERPRETER=0, TIER_QUICK, TIER_OPTIMIZED };
+
+//Returned by compiled code when a speculation does not hold. Nothing has been changed yet,
+//so the execution can go on in the interpreter
+#define JIT_DEOPTIMIZED ((ASObject*)1)
+
 class method_info
 {
 friend std::istream& operator>>(std::istream& in, method_info& v);
@@ -260,22 +310,61 @@ private:
 	std::pair<unsigned int, STACK_TYPE> popTypeFromStack(static_stack_types_vector& stack, unsigned int localIp) const;
 	llvm::FunctionType* synt_method_prototype(llvm::ExecutionEngine* ex);
 	llvm::Function* llvmf;
+	//Set if llvmf has guards on the profiled argument types
+	bool llvmfSpeculated;
+	//Adds the method entry and the ones used to continue in compiled code the execution of a loop
+	//started by the interpreter. Speculated locals are checked before being used
+	void addEntries(llvm::IRBuilder<>& Builder, std::map<unsigned int,block_info>& blocks,
+			llvm::Value* context, llvm::Value* locals, const std::vector<bool>& speculated);
+	//Loads from memory the locals a block expects in registers
+	void loadTypedLocals(llvm::IRBuilder<>& Builder, const block_info& block, llvm::Value* locals,
+			const std::vector<bool>& guarded, llvm::BasicBlock* deoptimize);
+	//Type of the locals when the method is entered, from declared and profiled parameter types
+	void getEntryTypes(const std::vector<uint8_t>& profile, std::vector<STACK_TYPE>& types,
+			std::vector<bool>& speculated) const;
+	STACK_TYPE getDeclaredType(unsigned int typeIndex) const;
+	//Inline caches used by the synthetized code, the deque keeps their address stable
+	std::deque<inline_cache> jit_caches;
+	llvm::Constant* jit_inline_cache(const llvm::Type* int_type, unsigned int n);
 
 	//Does analysis on function code to find optimization chances
-	void doAnalysis(std::map<unsigned int,block_info>& blocks, llvm::IRBuilder<>& Builder);
+	void doAnalysis(std::map<unsigned int,block_info>& blocks, llvm::IRBuilder<>& Builder,
+			const std::vector<STACK_TYPE>& entry_types);
 
 public:
+	//Translates the body code to the pre-decoded form used by the interpreter
+	void decode();
 	u30 option_count;
 	SyntheticFunction::synt_function f;
 	ABCContext* context;
 	method_body_info* body;
-	SyntheticFunction::synt_function synt_method();
+	//Tiered compilation state, only used by the VM thread
+	JIT_TIER tier;
+	JIT_TIER requestedTier;
+	//Tier reached in previous runs, known from the method cache
+	JIT_TIER profiledTier;
+	bool jitFailed;
+	//Calls and loop iterations done since the method was loaded
+	uint32_t hotness;
+	//Sorted byte offsets of the loop headers where the compiled code can be entered
+	std::vector<uint32_t> osr_entries;
+	//Types of the arguments seen by the interpreter, one mask for each parameter
+	enum { PROFILE_INT=1, PROFILE_NUMBER=2, PROFILE_BOOLEAN=4, PROFILE_OTHER=8 };
+	std::vector<uint8_t> argProfile;
+	void profileArguments(ASObject* const* args);
+	//Set when compiled code had to give back control to the interpreter
+	bool speculationFailed;
+	bool osrFailed;
+	//Must be called by the JIT compiler thread, profile is used to speculate on the argument types
+	SyntheticFunction::synt_function synt_method(JIT_TIER t, const std::vector<uint8_t>& profile);
 	bool needsArgs() { return (flags & NEED_ARGUMENTS) != 0;}
 	bool needsRest() { return (flags & NEED_REST) != 0;}
 	bool hasOptional() { return (flags & HAS_OPTIONAL) != 0;}
 	ASObject* getOptional(unsigned int i);
 	int numArgs() { return param_count; }
-	method_info():option_count(0),f(NULL),context(NULL),body(NULL)
+	method_info():llvmf(NULL),llvmfSpeculated(false),option_count(0),f(NULL),context(NULL),body(NULL),tier(TIER_INTERPRETER),
+		requestedTier(TIER_INTERPRETER),profiledTier(TIER_INTERPRETER),jitFailed(false),hotness(0),
+		speculationFailed(false),osrFailed(false)
 	{
 	}
 };
@@ -350,6 +439,26 @@ struct exception_info
 	u30 var_name;
 };
 
+//Pseudo opcodes used in the decoded code, they are outside of the range of real opcodes.
+//Sentinels for the end of the code and invalid jumps are followed by superinstructions
+enum { OPCODE_END_OF_CODE=0x100, OPCODE_INVALID_JUMP, OPCODE_GETLOCAL0_PUSHSCOPE, OPCODE_GETLOCAL_GETPROPERTY,
+	DECODED_OPCODE_COUNT };
+
+/*
+	An instruction of the pre-decoded code. Operands are already parsed and jump targets
+	are expressed as indices in the decoded code
+*/
+struct decoded_instruction
+{
+	static const uint32_t NO_CACHE=0xffffffff;
+	uint32_t opcode;
+	uint32_t arg1;
+	uint32_t arg2;
+	//Index of the inline cache of property access instructions
+	uint32_t cache;
+	explicit decoded_instruction(uint32_t o):opcode(o),arg1(0),arg2(0),cache(NO_CACHE){}
+};
+
 struct method_body_info
 {
 	u30 method;
@@ -364,6 +473,16 @@ struct method_body_info
 	std::vector<exception_info> exceptions;
 	u30 trait_count;
 	std::vector<traits_info> traits;
+	//Pre-decoded code, built the first time the method is called
+	bool decoded;
+	std::vector<decoded_instruction> decoded_code;
+	//Jump tables of lookupswitch instructions, they hold the case count, the default target and the case targets
+	std::vector<uint32_t> switch_targets;
+	//Exceptions with from, to and target expressed as indices in the decoded code
+	std::vector<exception_info> decoded_exceptions;
+	//Inline caches of the property access instructions
+	std::vector<inline_cache> inline_caches;
+	method_body_info():decoded(false){}
 };
 
 struct opcode_handler
@@ -373,7 +492,8 @@ struct opcode_handler
 };
 
 enum ARGS_TYPE { ARGS_OBJ_OBJ=0, ARGS_OBJ_INT, ARGS_OBJ, ARGS_INT, ARGS_OBJ_OBJ_INT, ARGS_NUMBER, ARGS_OBJ_NUMBER, 
-	ARGS_BOOL, ARGS_INT_OBJ, ARGS_NONE, ARGS_NUMBER_OBJ, ARGS_INT_INT, ARGS_CONTEXT, ARGS_CONTEXT_INT, ARGS_CONTEXT_INT_INT};
+	ARGS_BOOL, ARGS_INT_OBJ, ARGS_NONE, ARGS_NUMBER_OBJ, ARGS_INT_INT, ARGS_CONTEXT, ARGS_CONTEXT_INT, ARGS_CONTEXT_INT_INT,
+	ARGS_CONTEXT_INT_INT_OBJ, ARGS_OBJ_OBJ_OBJ};
 
 struct typed_opcode_handler
 {
@@ -389,6 +509,10 @@ friend class method_info;
 private:
 	method_info* get_method(unsigned int m);
 	const tiny_string& getString(unsigned int s) const;
+	uint32_t getStringAtom(unsigned int s) const
+	{
+		return constant_pool.strings[s].getAtom();
+	}
 	//Qname getQname(unsigned int m, call_context* th=NULL) const;
 	static multiname* s_getMultiname(call_context*, ASObject*, int m);
 	static multiname* s_getMultiname_i(call_context*, uintptr_t i , int m);
@@ -399,6 +523,8 @@ public:
 	u16 minor;
 	u16 major;
 	cpool_info constant_pool;
+	//Identifies the constant pool data the decoded code depends on
+	uint64_t poolHash;
 	u30 method_count;
 	std::vector<method_info> methods;
 	u30 metadata_count;
@@ -435,10 +561,79 @@ struct thisAndLevel
 	thisAndLevel(ASObject* t,int l):cur_this(t),cur_level(l){}
 };
 
+//Times are in microseconds
+struct event_latency
+{
+	uint32_t count;
+	uint64_t total;
+	uint64_t max;
+	event_latency():count(0),total(0),max(0){}
+};
+
+/*
+	Compiles hot methods on a dedicated thread, so that the VM is not stalled while LLVM is working.
+	Methods are compiled first without running the optimization passes (quick tier) and compiled
+	again with the full pipeline if they stay hot (optimized tier). LLVM is only used by the compiler
+	thread, the compiled code is installed by the VM thread when a method is entered
+*/
+class JitCompiler
+{
+private:
+	struct jit_job
+	{
+		method_info* mi;
+		JIT_TIER tier;
+		//Copy of the argument profile, the VM keeps updating the original one
+		std::vector<uint8_t> profile;
+		SyntheticFunction::synt_function f;
+		jit_job(method_info* m, JIT_TIER t):mi(m),tier(t),f(NULL){}
+	};
+	ABCVm* vm;
+	pthread_t t;
+	bool started;
+	bool shuttingdown;
+	Mutex mutex;
+	sem_t sem_requests;
+	//Signaled when a job is done, used by synchronous compilations
+	sem_t sem_done;
+	std::deque<jit_job> requests;
+	std::vector<jit_job> results;
+	//Set when there are results to install, checked without locking
+	ATOMIC_INT32(pendingResults);
+	static void worker(JitCompiler* th);
+	void compile(jit_job& job);
+	void request(method_info* mi, JIT_TIER tier);
+	void tierUp(method_info* mi);
+	void installResults();
+public:
+	JitCompiler(ABCVm* v);
+	~JitCompiler();
+	void start();
+	void stop();
+	/**
+		Accounts a call of the method and installs the code compiled meanwhile
+
+		@return The code to run, or NULL if the method has to be interpreted
+	*/
+	SyntheticFunction::synt_function enterMethod(method_info* mi);
+	/**
+		Accounts a loop back-edge taken by the interpreter
+
+		@param offset The byte offset of the loop header
+		@return The code to continue the execution from the loop header, or NULL
+	*/
+	SyntheticFunction::synt_function backEdge(method_info* mi, uint32_t offset);
+	//Used when there is no interpreter, compiles the method and waits for the code
+	SyntheticFunction::synt_function compileNow(method_info* mi);
+	//Called when compiled code returned JIT_DEOPTIMIZED, the method will be compiled again without speculations
+	void deoptimize(method_info* mi, bool fromLoop);
+};
+
 class ABCVm
 {
 friend class ABCContext;
 friend class method_info;
+friend class JitCompiler;
 private:
 	SystemState* m_sys;
 	pthread_t t;
@@ -451,10 +646,10 @@ private:
 	void registerFunctions();
 	//Interpreted AS instructions
 	static bool hasNext2(call_context* th, int n, int m); 
-	static void callPropVoid(call_context* th, int n, int m); 
+	static void callPropVoid(call_context* th, int n, int m, inline_cache* cache); 
 	static void callSuperVoid(call_context* th, int n, int m); 
 	static void callSuper(call_context* th, int n, int m); 
-	static void callProperty(call_context* th, int n, int m); 
+	static void callProperty(call_context* th, int n, int m, inline_cache* cache); 
 	static void constructProp(call_context* th, int n, int m); 
 	static void setLocal(int n); 
 	static void setLocal_int(int n,int v); 
@@ -502,9 +697,9 @@ private:
 	static void pushDouble(call_context* th, int n);
 	static void incLocal_i(call_context* th, int n);
 	static void coerce(call_context* th, int n);
-	static ASObject* getProperty(ASObject* obj, multiname* name);
+	static ASObject* getProperty(ASObject* obj, multiname* name, inline_cache* cache);
 	static intptr_t getProperty_i(ASObject* obj, multiname* name);
-	static void setProperty(ASObject* value,ASObject* obj, multiname* name);
+	static void setProperty(ASObject* value,ASObject* obj, multiname* name, inline_cache* cache);
 	static void setProperty_i(intptr_t value,ASObject* obj, multiname* name);
 	static void call(call_context* th, int n);
 	static void constructSuper(call_context* th, int n);
@@ -577,32 +772,56 @@ private:
 	static uintptr_t decrement_i(ASObject*);
 	static ASObject* getGlobalScope(call_context* th);
 	static bool strictEquals(ASObject*,ASObject*);
+	//Guard of the speculations done by the JIT
+	static bool checkLocalType(ASObject* o, intptr_t type);
 	//Utility
 	static void not_impl(int p);
 
 	//Internal utilities
 	static void method_reset(method_info* th);
 	static void newClassRecursiveLink(Class_base* target, Class_base* c);
+	//Property lookup through the inline cache of the access site, cache may be NULL
+	static const inline_cache::entry* getCacheEntry(ASObject* obj, const multiname& name, inline_cache* cache, bool settable);
+	static obj_var* findCachedVar(ASObject* obj, const multiname& name, const inline_cache::entry* e, bool settable);
+	static ASObject* getVariableCached(ASObject* obj, const multiname& name, bool skip_impl, inline_cache* cache);
+	static void setVariableCached(ASObject* obj, const multiname& name, ASObject* value, inline_cache* cache);
 
 	//Opcode tables
 	void register_table(const llvm::Type* ret_type,typed_opcode_handler* table, int table_len);
 	static opcode_handler opcode_table_args_pointer_2int[];
 	static opcode_handler opcode_table_args_pointer_number_int[];
-	static opcode_handler opcode_table_args3_pointers[];
+	static opcode_handler opcode_table_args4_pointers[];
 	static typed_opcode_handler opcode_table_uintptr_t[];
 	static typed_opcode_handler opcode_table_number_t[];
 	static typed_opcode_handler opcode_table_void[];
 	static typed_opcode_handler opcode_table_voidptr[];
 	static typed_opcode_handler opcode_table_bool_t[];
 
-	//Synchronization
-	sem_t event_queue_mutex;
-	sem_t sem_event_count;
-
 	//Event handling
 	bool shuttingdown;
-	std::deque<std::pair<EventDispatcher*,Event*> > events_queue;
+	//Input goes before everything else, bulk network notifications after
+	enum EVENT_PRIORITY { PRIORITY_HIGH=0, PRIORITY_NORMAL, PRIORITY_LOW, PRIORITY_COUNT };
+	struct event_entry
+	{
+		EventDispatcher* obj;
+		Event* ev;
+		//Time of the enqueue in microseconds
+		uint64_t time;
+	};
+	MPSCQueue<event_entry> events_queue[PRIORITY_COUNT];
+	//Events added and not yet dispatched
+	ATOMIC_INT32(pendingEvents);
+	//Set while the VM thread may be waiting on sem_event_count, producers only post if it is set
+	ATOMIC_INT32(vmWaiting);
+	sem_t sem_event_count;
+	event_latency latency[PRIORITY_COUNT];
+	static EVENT_PRIORITY getEventPriority(EventDispatcher* obj, Event* ev);
+	void waitForEvents();
+	//Dispatches the events available now, up to a batch per priority
+	uint32_t dispatchEvents();
 	void handleEvent(std::pair<EventDispatcher*,Event*> e);
+	//Runs between events, when the VM stacks are empty
+	CycleCollector collector;
 
 	void buildClassAndInjectBase(const std::string& n, ASObject*, ASObject* const* a, const unsigned int argslen, bool isRoot);
 
@@ -614,6 +833,15 @@ public:
 	GlobalObject* Global;
 	Manager* int_manager;
 	Manager* number_manager;
+	//Pools of the events sent by the player, they are built and released on different threads
+	Manager* event_manager;
+	Manager* mouse_event_manager;
+	Manager* timer_event_manager;
+	//Count of instructions executed by the interpreter
+	uint64_t interpretedInstructions;
+	//The LLVM state is owned by the compiler thread
+	JitCompiler compiler;
+	MethodCache methodCache;
 	llvm::ExecutionEngine* ex;
 	llvm::FunctionPassManager* FPM;
 	llvm::LLVMContext llvm_context;
@@ -626,8 +854,16 @@ public:
 	~ABCVm();
 	static void Run(ABCVm* th);
 	static ASObject* executeFunction(SyntheticFunction* function, call_context* context);
+private:
+	//The instruction counter is compiled out of the dispatch path when it is not needed
+	template<bool countInstructions>
+	static ASObject* interpret(SyntheticFunction* function, call_context* context);
+public:
 	bool addEvent(EventDispatcher*,Event*) DLL_PUBLIC;
 	int getEventQueueSize();
+	//Enqueue to dispatch latency of the events, by priority
+	event_latency getEventLatency(uint32_t priority) const;
+	void dumpEventLatency() const DLL_PUBLIC;
 	void shutdown();
 	void wait();
 
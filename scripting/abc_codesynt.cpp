@@ -24,7 +24,9 @@
 #include <llvm/Constants.h> 
 #include <llvm/Support/IRBuilder.h> 
 #include <llvm/Target/TargetData.h>
+#include <llvm/Transforms/Utils/Cloning.h>
 #include <sstream>
+#include <algorithm>
 #include "swftypes.h"
 #include "compat.h"
 #include "exceptions.h"
@@ -50,7 +52,7 @@ opcode_handler ABCVm::opcode_table_args_pointer_number_int[]={
 	{"getMultiname_d",(void*)&ABCContext::s_getMultiname_d}
 };
 
-opcode_handler ABCVm::opcode_table_args3_pointers[]={
+opcode_handler ABCVm::opcode_table_args4_pointers[]={
 	{"setProperty",(void*)&ABCVm::setProperty},
 };
 
@@ -130,8 +132,8 @@ typed_opcode_handler ABCVm::opcode_table_void[]={
 	{"initProperty",(void*)&ABCVm::initProperty,ARGS_CONTEXT_INT},
 	{"kill",(void*)&ABCVm::kill,ARGS_INT},
 	{"jump",(void*)&ABCVm::jump,ARGS_INT},
-	{"callProperty",(void*)&ABCVm::callProperty,ARGS_CONTEXT_INT_INT},
-	{"callPropVoid",(void*)&ABCVm::callPropVoid,ARGS_CONTEXT_INT_INT},
+	{"callProperty",(void*)&ABCVm::callProperty,ARGS_CONTEXT_INT_INT_OBJ},
+	{"callPropVoid",(void*)&ABCVm::callPropVoid,ARGS_CONTEXT_INT_INT_OBJ},
 	{"constructProp",(void*)&ABCVm::constructProp,ARGS_CONTEXT_INT_INT},
 	{"callSuper",(void*)&ABCVm::callSuper,ARGS_CONTEXT_INT_INT},
 	{"callSuperVoid",(void*)&ABCVm::callSuperVoid,ARGS_CONTEXT_INT_INT},
@@ -153,7 +155,7 @@ typed_opcode_handler ABCVm::opcode_table_voidptr[]={
 	{"pushNaN",(void*)&ABCVm::pushNaN,ARGS_NONE},
 	{"pushNull",(void*)&ABCVm::pushNull,ARGS_NONE},
 	{"pushUndefined",(void*)&ABCVm::pushUndefined,ARGS_NONE},
-	{"getProperty",(void*)&ABCVm::getProperty,ARGS_OBJ_OBJ},
+	{"getProperty",(void*)&ABCVm::getProperty,ARGS_OBJ_OBJ_OBJ},
 	{"asTypelate",(void*)&ABCVm::asTypelate,ARGS_OBJ_OBJ},
 	{"getGlobalScope",(void*)&ABCVm::getGlobalScope,ARGS_CONTEXT},
 	{"findPropStrict",(void*)&ABCVm::findPropStrict,ARGS_CONTEXT_INT},
@@ -173,6 +175,7 @@ typed_opcode_handler ABCVm::opcode_table_bool_t[]={
 	{"not",(void*)&ABCVm::_not,ARGS_OBJ},
 	{"equals",(void*)&ABCVm::equals,ARGS_OBJ_OBJ},
 	{"strictEquals",(void*)&ABCVm::strictEquals,ARGS_OBJ_OBJ},
+	{"checkLocalType",(void*)&ABCVm::checkLocalType,ARGS_OBJ_INT},
 	{"greaterThan",(void*)&ABCVm::greaterThan,ARGS_OBJ_OBJ},
 	{"greaterEquals",(void*)&ABCVm::greaterEquals,ARGS_OBJ_OBJ},
 	{"lessThan",(void*)&ABCVm::lessThan,ARGS_OBJ_OBJ},
@@ -257,20 +260,22 @@ void ABCVm::registerFunctions()
 	}
 	//End of lazy pushing
 
-	//Lazy pushing, no context, (ASObject*, ASObject*, void*)
+	//Lazy pushing, no context, (ASObject*, ASObject*, void*, inline_cache*)
 	sig.clear();
 	sig.push_back(llvm::PointerType::getUnqual(ptr_type));
 	sig.push_back(llvm::PointerType::getUnqual(ptr_type));
 	sig.push_back(llvm::PointerType::getUnqual(ptr_type));
+	sig.push_back(llvm::PointerType::getUnqual(ptr_type));
 	FT=llvm::FunctionType::get(void_type, sig, false);
-	elems=sizeof(opcode_table_args3_pointers)/sizeof(opcode_handler);
+	elems=sizeof(opcode_table_args4_pointers)/sizeof(opcode_handler);
 	for(int i=0;i<elems;i++)
 	{
-		F=llvm::Function::Create(FT,llvm::Function::ExternalLinkage,opcode_table_args3_pointers[i].name,module);
-		ex->addGlobalMapping(F,opcode_table_args3_pointers[i].addr);
+		F=llvm::Function::Create(FT,llvm::Function::ExternalLinkage,opcode_table_args4_pointers[i].name,module);
+		ex->addGlobalMapping(F,opcode_table_args4_pointers[i].addr);
 	}
 
 	//Build the concrete interface
+	sig.pop_back();
 	sig[0]=int_type;
 	FT=llvm::FunctionType::get(void_type, sig, false);
 	F=llvm::Function::Create(FT,llvm::Function::ExternalLinkage,"setProperty_i",module);
@@ -320,6 +325,11 @@ void ABCVm::register_table(const llvm::Type* ret_type,typed_opcode_handler* tabl
 
 	vector<const llvm::Type*> sig_none;
 
+	vector<const llvm::Type*> sig_obj_obj_obj;
+	sig_obj_obj_obj.push_back(voidptr_type);
+	sig_obj_obj_obj.push_back(voidptr_type);
+	sig_obj_obj_obj.push_back(voidptr_type);
+
 	vector<const llvm::Type*> sig_obj_obj_int;
 	sig_obj_obj_int.push_back(voidptr_type);
 	sig_obj_obj_int.push_back(voidptr_type);
@@ -351,6 +361,9 @@ void ABCVm::register_table(const llvm::Type* ret_type,typed_opcode_handler* tabl
 	sig_context_int_int.push_back(int_type);
 	sig_context_int_int.push_back(int_type);
 
+	vector<const llvm::Type*> sig_context_int_int_obj(sig_context_int_int);
+	sig_context_int_int_obj.push_back(voidptr_type);
+
 	llvm::FunctionType* FT=NULL;
 	for(int i=0;i<table_len;i++)
 	{
@@ -401,6 +414,12 @@ void ABCVm::register_table(const llvm::Type* ret_type,typed_opcode_handler* tabl
 			case ARGS_CONTEXT_INT_INT:
 				FT=llvm::FunctionType::get(ret_type, sig_context_int_int, false);
 				break;
+			case ARGS_CONTEXT_INT_INT_OBJ:
+				FT=llvm::FunctionType::get(ret_type, sig_context_int_int_obj, false);
+				break;
+			case ARGS_OBJ_OBJ_OBJ:
+				FT=llvm::FunctionType::get(ret_type, sig_obj_obj_obj, false);
+				break;
 		}
 
 		llvm::Function* F=llvm::Function::Create(FT,llvm::Function::ExternalLinkage,table[i].name,module);
@@ -408,6 +427,20 @@ void ABCVm::register_table(const llvm::Type* ret_type,typed_opcode_handler* tabl
 	}
 }
 
+llvm::Constant* method_info::jit_inline_cache(const llvm::Type* int_type, unsigned int n)
+{
+	inline_cache* cache=NULL;
+	//Names known only at runtime can't be cached
+	uint32_t kind=context->constant_pool.multinames[n].kind;
+	if(kind==0x07 || kind==0x09)
+	{
+		jit_caches.push_back(inline_cache());
+		cache=&jit_caches.back();
+	}
+	llvm::Constant* constant = llvm::ConstantInt::get(int_type, (uintptr_t)cache);
+	return llvm::ConstantExpr::getIntToPtr(constant, llvm::PointerType::getUnqual(int_type));
+}
+
 llvm::Value* method_info::llvm_stack_pop(llvm::IRBuilder<>& builder,llvm::Value* dynamic_stack,llvm::Value* dynamic_stack_index)
 {
 	//decrement stack index
@@ -583,6 +616,7 @@ llvm::FunctionType* method_info::synt_method_prototype(llvm::ExecutionEngine* ex
 	struct_elems.push_back(llvm::PointerType::getUnqual(llvm::PointerType::getUnqual(ptr_type)));
 	struct_elems.push_back(llvm::PointerType::getUnqual(llvm::PointerType::getUnqual(ptr_type)));
 	struct_elems.push_back(llvm::IntegerType::get(getVm()->llvm_context,32));
+	struct_elems.push_back(llvm::IntegerType::get(getVm()->llvm_context,32));
 	llvm::Type* context_type=llvm::PointerType::getUnqual(llvm::StructType::get(getVm()->llvm_context,struct_elems,true));
 
 	//Initialize LLVM representation of method
@@ -632,7 +666,8 @@ void method_info::addBlock(map<unsigned int,block_info>& blocks, unsigned int ip
 		blocks.insert(make_pair(ip, block_info(this, blockName)));
 }
 
-void method_info::doAnalysis(std::map<unsigned int,block_info>& blocks, llvm::IRBuilder<>& Builder)
+void method_info::doAnalysis(std::map<unsigned int,block_info>& blocks, llvm::IRBuilder<>& Builder,
+		const vector<STACK_TYPE>& entry_types)
 {
 	bool stop;
 	stringstream code(body->code);
@@ -1408,18 +1443,21 @@ void method_info::doAnalysis(std::map<unsigned int,block_info>& blocks, llvm::IR
 			block_info& cur=bit->second;
 			vector<STACK_TYPE> new_start;
 			new_start.resize(body->local_count,STACK_NONE);
-			if(!cur.preds.empty())
+			set<block_info*>::iterator pred=cur.preds.begin();
+			//The method entry is a predecessor of the first block
+			if(bit->first==0)
+				new_start=entry_types;
+			else if(pred!=cur.preds.end())
 			{
-				set<block_info*>::iterator pred=cur.preds.begin();
 				new_start=(*pred)->locals;
 				pred++;
-				for(;pred!=cur.preds.end();pred++)
+			}
+			for(;pred!=cur.preds.end();pred++)
+			{
+				for(unsigned int j=0;j<(*pred)->locals.size();j++)
 				{
-					for(unsigned int j=0;j<(*pred)->locals.size();j++)
-					{
-						if(new_start[j]!=(*pred)->locals[j])
-							new_start[j]=STACK_NONE;
-					}
+					if(new_start[j]!=(*pred)->locals[j])
+						new_start[j]=STACK_NONE;
 				}
 			}
 			//It's not useful to sync variables that are going to be resetted
@@ -1470,10 +1508,183 @@ void method_info::doAnalysis(std::map<unsigned int,block_info>& blocks, llvm::IR
 	}
 }
 
-SyntheticFunction::synt_function method_info::synt_method()
+STACK_TYPE method_info::getDeclaredType(unsigned int typeIndex) const
 {
-	if(f)
-		return f;
+	//0 is the any type
+	if(typeIndex==0 || typeIndex>=context->constant_pool.multinames.size())
+		return STACK_NONE;
+	//Only the builtin types of the public package are interesting
+	const multiname_info& m=context->constant_pool.multinames[typeIndex];
+	if(m.kind!=0x07 || context->getString(context->constant_pool.namespaces[m.ns].name)!="")
+		return STACK_NONE;
+	const tiny_string& n=context->getString(m.name);
+	if(n=="int")
+		return STACK_INT;
+	else if(n=="Number")
+		return STACK_NUMBER;
+	else if(n=="Boolean")
+		return STACK_BOOLEAN;
+	return STACK_NONE;
+}
+
+void method_info::getEntryTypes(const vector<uint8_t>& profile, vector<STACK_TYPE>& types, vector<bool>& speculated) const
+{
+	types.assign(body->local_count,STACK_NONE);
+	speculated.assign(body->local_count,false);
+	//Parameters start from local 1
+	for(unsigned int i=0;i<param_count && i+1<body->local_count;i++)
+	{
+		//Declared types are enforced by converting the arguments, as the AVM does
+		STACK_TYPE t=getDeclaredType(param_type[i]);
+		if(t==STACK_NONE && i<profile.size())
+		{
+			//Untyped parameters are speculated to keep the type they had so far
+			const uint8_t seen=profile[i];
+			if(seen==PROFILE_INT)
+				t=STACK_INT;
+			else if(seen==PROFILE_BOOLEAN)
+				t=STACK_BOOLEAN;
+			else if(seen!=0 && (seen&~(PROFILE_INT|PROFILE_NUMBER))==0)
+				t=STACK_NUMBER;
+			speculated[i+1]=(t!=STACK_NONE);
+		}
+		types[i+1]=t;
+	}
+}
+
+void method_info::loadTypedLocals(llvm::IRBuilder<>& Builder, const block_info& block, llvm::Value* locals,
+		const vector<bool>& guarded, llvm::BasicBlock* deoptimize)
+{
+	llvm::ExecutionEngine* ex=getVm()->ex;
+	llvm::LLVMContext& llvm_context=getVm()->llvm_context;
+	const llvm::IntegerType* int32_type=llvm::IntegerType::get(llvm_context,32);
+	const llvm::Type* int_type=ex->getTargetData()->getIntPtrType(llvm_context);
+
+	//All the guards are checked before changing anything, so that the interpreter can take over
+	vector<llvm::Value*> values(block.locals_start.size(),NULL);
+	for(unsigned int i=0;i<block.locals_start.size();i++)
+	{
+		if(block.locals_start[i]==STACK_NONE)
+			continue;
+		llvm::Value* t=Builder.CreateGEP(locals,llvm::ConstantInt::get(int32_type,i));
+		values[i]=Builder.CreateLoad(t);
+		if(!guarded[i] || block.locals_start[i]==STACK_OBJECT)
+			continue;
+		llvm::Value* type=llvm::ConstantInt::get(int_type,block.locals_start[i]);
+		llvm::Value* check=Builder.CreateCall2(ex->FindFunctionNamed("checkLocalType"),values[i],type);
+		llvm::BasicBlock* next=llvm::BasicBlock::Create(llvm_context,"guarded",llvmf);
+		Builder.CreateCondBr(check,next,deoptimize);
+		Builder.SetInsertPoint(next);
+	}
+
+	//The interpreter keeps all the locals in memory, load the ones the block expects in registers
+	for(unsigned int i=0;i<values.size();i++)
+	{
+		llvm::Value* v=values[i];
+		if(v==NULL)
+			continue;
+		//The memory keeps its own reference, the conversions consume the new one
+		Builder.CreateCall(ex->FindFunctionNamed("incRef"),v);
+		switch(block.locals_start[i])
+		{
+			case STACK_OBJECT:
+				break;
+			case STACK_INT:
+				v=Builder.CreateCall(ex->FindFunctionNamed("convert_i"),v);
+				break;
+			case STACK_NUMBER:
+				v=Builder.CreateCall(ex->FindFunctionNamed("convert_d"),v);
+				break;
+			case STACK_BOOLEAN:
+				v=Builder.CreateCall(ex->FindFunctionNamed("convert_b"),v);
+				break;
+			default:
+				throw RunTimeException("Unsupported object type");
+		}
+		Builder.CreateStore(v,block.locals_start_obj[i]);
+	}
+}
+
+void method_info::addEntries(llvm::IRBuilder<>& Builder, map<unsigned int,block_info>& blocks,
+		llvm::Value* context, llvm::Value* locals, const vector<bool>& speculated)
+{
+	llvm::ExecutionEngine* ex=getVm()->ex;
+	llvm::LLVMContext& llvm_context=getVm()->llvm_context;
+	const llvm::IntegerType* int32_type=llvm::IntegerType::get(llvm_context,32);
+	const llvm::Type* int_type=ex->getTargetData()->getIntPtrType(llvm_context);
+
+	//Entering again the method (e.g. from an exception handler) must start from the beginning
+	llvm::Value* osr_ptr=Builder.CreateStructGEP(context,3);
+	llvm::Value* osr_offset=Builder.CreateLoad(osr_ptr);
+	Builder.CreateStore(llvm::ConstantInt::get(int32_type,0),osr_ptr);
+
+	//Loop headers are the blocks reached by a branch from a following block
+	map<const block_info*,unsigned int> offsets;
+	map<unsigned int,block_info>::iterator it=blocks.begin();
+	for(;it!=blocks.end();it++)
+		offsets[&it->second]=it->first;
+	vector<unsigned int> headers;
+	for(it=blocks.begin();it!=blocks.end();it++)
+	{
+		if(it->first==0)
+			continue;
+		set<block_info*>::const_iterator pit=it->second.preds.begin();
+		for(;pit!=it->second.preds.end();pit++)
+		{
+			if(offsets[*pit]>=it->first)
+			{
+				headers.push_back(it->first);
+				break;
+			}
+		}
+	}
+
+	llvm::BasicBlock* prologueBB=llvm::BasicBlock::Create(llvm_context,"prologue",llvmf);
+	llvm::SwitchInst* entry=Builder.CreateSwitch(osr_offset,prologueBB,headers.size());
+
+	//Failed guards return control to the caller, which goes on with the interpreter
+	llvm::BasicBlock* deoptBB=llvm::BasicBlock::Create(llvm_context,"deoptimize",llvmf);
+	Builder.SetInsertPoint(deoptBB);
+	llvm::Constant* constant=llvm::ConstantInt::get(int_type,(uintptr_t)JIT_DEOPTIMIZED);
+	Builder.CreateRet(llvm::ConstantExpr::getIntToPtr(constant,llvm::PointerType::getUnqual(int_type)));
+
+	//The first block may expect the typed parameters in registers
+	Builder.SetInsertPoint(prologueBB);
+	loadTypedLocals(Builder,blocks[0],locals,speculated,deoptBB);
+	Builder.CreateBr(blocks[0].BB);
+
+	osr_entries.clear();
+	//The compiled code keeps exec_pos at the loop header and the locals in registers, so an exception
+	//thrown after entering from a loop would be matched against the wrong handler and would lose the
+	//locals. Methods with handlers are only entered from the beginning
+	if(body->exception_count!=0)
+		return;
+	//The locals of the interpreter are not known at compile time, so all the typed ones are checked
+	const vector<bool> guarded(body->local_count,true);
+	for(unsigned int i=0;i<headers.size();i++)
+	{
+		block_info& cur=blocks[headers[i]];
+		llvm::BasicBlock* osrBB=llvm::BasicBlock::Create(llvm_context,"osr",llvmf);
+		Builder.SetInsertPoint(osrBB);
+		loadTypedLocals(Builder,cur,locals,guarded,deoptBB);
+		Builder.CreateBr(cur.BB);
+		entry->addCase(llvm::ConstantInt::get(int32_type,headers[i]),osrBB);
+		osr_entries.push_back(headers[i]);
+	}
+}
+
+SyntheticFunction::synt_function method_info::synt_method(JIT_TIER t, const vector<uint8_t>& profile)
+{
+	//Code that speculated on types which turned out to be wrong is built again
+	if(llvmf && t==TIER_OPTIMIZED && (!llvmfSpeculated || !profile.empty()))
+	{
+		//Already built by the quick tier. The code in use must not be touched, so a copy is optimized
+		assert(t==TIER_OPTIMIZED);
+		llvm::Function* optimized=llvm::CloneFunction(llvmf);
+		getVm()->module->getFunctionList().push_back(optimized);
+		getVm()->FPM->run(*optimized);
+		return (SyntheticFunction::synt_function)getVm()->ex->getPointerToFunction(optimized);
+	}
 
 	string method_name="method";
 	method_name+=context->getString(name).raw_buf();
@@ -1540,7 +1751,13 @@ SyntheticFunction::synt_function method_info::synt_method()
 	//Let's build a block for the real function code
 	addBlock(blocks, 0, "begin");
 
-	doAnalysis(blocks,Builder);
+	//Typed parameters are passed in registers to the first block
+	vector<STACK_TYPE> entry_types;
+	vector<bool> speculated;
+	getEntryTypes(profile,entry_types,speculated);
+	llvmfSpeculated=(find(speculated.begin(),speculated.end(),true)!=speculated.end());
+
+	doAnalysis(blocks,Builder,entry_types);
 
 	//Let's reset the stream
 	stringstream code(body->code);
@@ -1548,7 +1765,7 @@ SyntheticFunction::synt_function method_info::synt_method()
 	block_info* cur_block=NULL;
 
 	static_stack.clear();
-	Builder.CreateBr(blocks[0].BB);
+	addEntries(Builder,blocks,context,locals,speculated);
 	u8 opcode;
 	bool last_is_branch=true;
 
@@ -2580,6 +2797,7 @@ SyntheticFunction::synt_function method_info::synt_method()
 				u30 t;
 				code >> t;
 				constant = llvm::ConstantInt::get(int_type, t);
+				llvm::Constant* cache=jit_inline_cache(int_type,t);
 				code >> t;
 				constant2 = llvm::ConstantInt::get(int_type, t);
 
@@ -2588,7 +2806,7 @@ SyntheticFunction::synt_function method_info::synt_method()
 				for(int i=0;i<t;i++)
 					args[t-i]=static_stack_pop(Builder,static_stack,m).first;*/
 				//Call the function resolver, static case could be resolved at this time (TODO)
-				Builder.CreateCall3(ex->FindFunctionNamed("callProperty"), context, constant, constant2);
+				Builder.CreateCall4(ex->FindFunctionNamed("callProperty"), context, constant, constant2, cache);
 	/*				//Pop the function object, and then the object itself
 				llvm::Value* fun=static_stack_pop(Builder,static_stack,m).first;
 
@@ -2694,9 +2912,10 @@ SyntheticFunction::synt_function method_info::synt_method()
 				u30 t;
 				code >> t;
 				constant = llvm::ConstantInt::get(int_type, t);
+				llvm::Constant* cache=jit_inline_cache(int_type,t);
 				code >> t;
 				constant2 = llvm::ConstantInt::get(int_type, t);
-				Builder.CreateCall3(ex->FindFunctionNamed("callPropVoid"), context, constant, constant2);
+				Builder.CreateCall4(ex->FindFunctionNamed("callPropVoid"), context, constant, constant2, cache);
 				break;
 			}
 			case 0x53:
@@ -2836,6 +3055,7 @@ SyntheticFunction::synt_function method_info::synt_method()
 				u30 t;
 				code >> t;
 				constant = llvm::ConstantInt::get(int_type, t);
+				llvm::Constant* cache=jit_inline_cache(int_type,t);
 				int rtdata=this->context->getMultinameRTData(t);
 				stack_entry value=static_stack_pop(Builder,static_stack,dynamic_stack,dynamic_stack_index);
 				llvm::Value* name=NULL;
@@ -2865,15 +3085,15 @@ SyntheticFunction::synt_function method_info::synt_method()
 				else if(value.second==STACK_NUMBER)
 				{
 					value.first=Builder.CreateCall(ex->FindFunctionNamed("abstract_d"),value.first);
-					Builder.CreateCall3(ex->FindFunctionNamed("setProperty"),value.first, obj.first, name);
+					Builder.CreateCall4(ex->FindFunctionNamed("setProperty"),value.first, obj.first, name, cache);
 				}
 				else if(value.second==STACK_BOOLEAN)
 				{
 					value.first=Builder.CreateCall(ex->FindFunctionNamed("abstract_b"),value.first);
-					Builder.CreateCall3(ex->FindFunctionNamed("setProperty"),value.first, obj.first, name);
+					Builder.CreateCall4(ex->FindFunctionNamed("setProperty"),value.first, obj.first, name, cache);
 				}
 				else
-					Builder.CreateCall3(ex->FindFunctionNamed("setProperty"),value.first, obj.first, name);
+					Builder.CreateCall4(ex->FindFunctionNamed("setProperty"),value.first, obj.first, name, cache);
 				break;
 			}
 			case 0x62:
@@ -2969,6 +3189,7 @@ SyntheticFunction::synt_function method_info::synt_method()
 				u30 t;
 				code >> t;
 				constant = llvm::ConstantInt::get(int_type, t);
+				llvm::Constant* cache=jit_inline_cache(int_type,t);
 				int rtdata=this->context->getMultinameRTData(t);
 				llvm::Value* name=NULL;
 				//HACK: we need to reinterpret the pointer to the generic type
@@ -2996,7 +3217,7 @@ SyntheticFunction::synt_function method_info::synt_method()
 				if(cur_block->push_types[local_ip]==STACK_OBJECT ||
 					cur_block->push_types[local_ip]==STACK_BOOLEAN)
 				{
-					value=Builder.CreateCall2(ex->FindFunctionNamed("getProperty"), obj.first, name);
+					value=Builder.CreateCall3(ex->FindFunctionNamed("getProperty"), obj.first, name, cache);
 					static_stack_push(static_stack,stack_entry(value,STACK_OBJECT));
 				}
 				else if(cur_block->push_types[local_ip]==STACK_INT)
@@ -3934,8 +4155,7 @@ SyntheticFunction::synt_function method_info::synt_method()
 				Builder.CreateCall(ex->FindFunctionNamed("not_impl"), constant);
 				Builder.CreateRetVoid();
 
-				f=(SyntheticFunction::synt_function)getVm()->ex->getPointerToFunction(llvmf);
-				return f;
+				return (SyntheticFunction::synt_function)getVm()->ex->getPointerToFunction(llvmf);
 		}
 	}
 
@@ -3949,8 +4169,9 @@ SyntheticFunction::synt_function method_info::synt_method()
 		}
 	}
 
-	getVm()->FPM->run(*llvmf);
-	f=(SyntheticFunction::synt_function)getVm()->ex->getPointerToFunction(llvmf);
+	//The quick tier skips the optimization passes
+	if(t==TIER_OPTIMIZED)
+		getVm()->FPM->run(*llvmf);
 	//llvmf->dump();
-	return f;
+	return (SyntheticFunction::synt_function)getVm()->ex->getPointerToFunction(llvmf);
 }
@@ -26,492 +26,864 @@
 using namespace std;
 using namespace lightspark;
 
-ASObject* ABCVm::executeFunction(SyntheticFunction* function, call_context* context)
-{
-	method_info* mi=function->mi;
+//Byte offsets that do not start an instruction
+#define NOT_AN_INSTRUCTION 0xffffffff
 
-	stringstream& code=*(context->code);
-	int code_len=code.str().length();
+void method_info::decode()
+{
+	assert_and_throw(body && !body->decoded);
+	if(getVm()->methodCache.load(this))
+		return;
+	vector<decoded_instruction>& out=body->decoded_code;
+	const uint32_t code_len=body->code.length();
+	istringstream code(body->code);
+
+	//Maps each byte offset to the index of the decoded instruction starting there.
+	//Instructions that are dropped map to the following one, so they are still valid jump targets
+	vector<uint32_t> offset_to_index(code_len+1,NOT_AN_INSTRUCTION);
+	//Jump destinations are collected as byte offsets and resolved when all the code is decoded
+	vector<int32_t> byte_targets;
+	uint32_t cache_count=0;
 
 	u8 opcode;
-
-	//Each case block builds the correct parameters for the interpreter function and call it
 	while(1)
 	{
+		uint32_t here=code.tellg();
 		code >> opcode;
 		if(code.eof())
-			throw ParseException("End of code in intepreter");
+			break;
 
+		offset_to_index[here]=out.size();
+		decoded_instruction instr(opcode);
 		switch(opcode)
 		{
-			case 0x03:
+			case 0x09: //label
+			case 0x70: //convert_s
+				//Nothing to do at runtime
+				continue;
+			case 0x0c:
+			case 0x0d:
+			case 0x0e:
+			case 0x0f:
+			case 0x10:
+			case 0x11:
+			case 0x12:
+			case 0x13:
+			case 0x14:
+			case 0x15:
+			case 0x16:
+			case 0x17:
+			case 0x18:
+			case 0x19:
+			case 0x1a:
 			{
-				//throw
-				_throw(context);
+				//Branches, the destination is relative to the end of the instruction
+				s24 t;
+				code >> t;
+				instr.arg1=byte_targets.size();
+				byte_targets.push_back(int(code.tellg())+t);
 				break;
 			}
-			case 0x04:
+			case 0x1b:
 			{
-				//getsuper
-				u30 t;
+				//lookupswitch, the destinations are relative to the instruction itself
+				s24 t;
 				code >> t;
-				getSuper(context,t);
+				u30 count;
+				code >> count;
+				instr.arg1=body->switch_targets.size();
+				body->switch_targets.push_back(count);
+				body->switch_targets.push_back(byte_targets.size());
+				byte_targets.push_back(here+t);
+				for(unsigned int i=0;i<count+1;i++)
+				{
+					code >> t;
+					body->switch_targets.push_back(byte_targets.size());
+					byte_targets.push_back(here+t);
+				}
 				break;
 			}
+			case 0x24:
+			{
+				//pushbyte
+				int8_t t;
+				code.read((char*)&t,1);
+				instr.arg1=t;
+				break;
+			}
+			case 0x4c:
+			{
+				//callproplex seems to be exactly like callproperty
+				instr.opcode=0x46;
+				u30 t,t2;
+				code >> t >> t2;
+				instr.arg1=t;
+				instr.arg2=t2;
+				break;
+			}
+			case 0x32:
+			case 0x45:
+			case 0x46:
+			case 0x4a:
+			case 0x4e:
+			case 0x4f:
+			{
+				//Instructions with two u30 operands
+				u30 t,t2;
+				code >> t >> t2;
+				instr.arg1=t;
+				instr.arg2=t2;
+				break;
+			}
+			case 0x04:
 			case 0x05:
+			case 0x08:
+			case 0x25:
+			case 0x2c:
+			case 0x2d:
+			case 0x2e:
+			case 0x2f:
+			case 0x40:
+			case 0x41:
+			case 0x42:
+			case 0x49:
+			case 0x53:
+			case 0x55:
+			case 0x56:
+			case 0x58:
+			case 0x59:
+			case 0x5a:
+			case 0x5d:
+			case 0x5e:
+			case 0x60:
+			case 0x61:
+			case 0x62:
+			case 0x63:
+			case 0x65:
+			case 0x66:
+			case 0x68:
+			case 0x6a:
+			case 0x6c:
+			case 0x6d:
+			case 0x80:
+			case 0xb2:
+			case 0xc2:
 			{
-				//setsuper
+				//Instructions with a single u30 operand
 				u30 t;
 				code >> t;
-				setSuper(context,t);
+				instr.arg1=t;
 				break;
 			}
-			case 0x08:
+			case 0xef:
+			{
+				//debug
+				uint8_t debug_type;
+				u30 index;
+				uint8_t reg;
+				u30 extra;
+				code.read((char*)&debug_type,1);
+				code >> index;
+				code.read((char*)&reg,1);
+				code >> extra;
+				continue;
+			}
+			case 0xf0: //debugline
+			case 0xf1: //debugfile
 			{
-				//kill
 				u30 t;
 				code >> t;
-				assert_and_throw(context->locals[t]);
-				context->locals[t]->decRef();
-				context->locals[t]=new Undefined;
+				continue;
+			}
+			case 0x03:
+			case 0x1c:
+			case 0x1d:
+			case 0x1e:
+			case 0x20:
+			case 0x21:
+			case 0x23:
+			case 0x26:
+			case 0x27:
+			case 0x28:
+			case 0x29:
+			case 0x2a:
+			case 0x2b:
+			case 0x30:
+			case 0x47:
+			case 0x48:
+			case 0x57:
+			case 0x64:
+			case 0x73:
+			case 0x74:
+			case 0x75:
+			case 0x76:
+			case 0x78:
+			case 0x82:
+			case 0x85:
+			case 0x87:
+			case 0x90:
+			case 0x91:
+			case 0x93:
+			case 0x95:
+			case 0x96:
+			case 0x97:
+			case 0xa0:
+			case 0xa1:
+			case 0xa2:
+			case 0xa3:
+			case 0xa4:
+			case 0xa5:
+			case 0xa6:
+			case 0xa7:
+			case 0xa8:
+			case 0xa9:
+			case 0xaa:
+			case 0xab:
+			case 0xac:
+			case 0xad:
+			case 0xae:
+			case 0xaf:
+			case 0xb0:
+			case 0xb3:
+			case 0xb4:
+			case 0xc0:
+			case 0xc1:
+			case 0xd0:
+			case 0xd1:
+			case 0xd2:
+			case 0xd3:
+			case 0xd4:
+			case 0xd5:
+			case 0xd6:
+			case 0xd7:
+				//Instructions without operands
+				break;
+			default:
+				//The length of unknown instructions is not known, so decoding can't go on.
+				//The interpreter will fail if this is ever reached
+				out.push_back(instr);
+				goto done;
+		}
+		if(instr.opcode==0x46 || instr.opcode==0x4f || instr.opcode==0x61 || instr.opcode==0x66)
+		{
+			//The names of these instructions are read at runtime, and by the superinstructions, without checks
+			if(instr.arg1>=context->constant_pool.multinames.size())
+				throw ParseException("Invalid multiname index in method body");
+			//Property access sites get an inline cache, unless the name is known only at runtime
+			uint32_t kind=context->constant_pool.multinames[instr.arg1].kind;
+			if(kind==0x07 || kind==0x09)
+				instr.cache=cache_count++;
+		}
+		out.push_back(instr);
+	}
+done:
+	body->inline_caches.resize(cache_count);
+
+	//Past the end of the decoded code there are the sentinels for the end of the code and for invalid jumps
+	const uint32_t end_index=out.size();
+	const uint32_t invalid_jump_index=end_index+1;
+	out.push_back(decoded_instruction(OPCODE_END_OF_CODE));
+	out.push_back(decoded_instruction(OPCODE_INVALID_JUMP));
+
+	//Resolve jump targets, jumping in the middle of an instruction or outside of the code is invalid
+	vector<uint32_t> resolved_targets(byte_targets.size());
+	for(unsigned int i=0;i<byte_targets.size();i++)
+	{
+		int32_t dest=byte_targets[i];
+		if(dest<0 || dest>=int32_t(code_len) || offset_to_index[dest]==NOT_AN_INSTRUCTION)
+			resolved_targets[i]=invalid_jump_index;
+		else
+			resolved_targets[i]=offset_to_index[dest];
+	}
+	for(unsigned int i=0;i<end_index;i++)
+	{
+		decoded_instruction& instr=out[i];
+		if(instr.opcode>=0x0c && instr.opcode<=0x1a)
+		{
+			//The byte offset of the destination is needed to continue loops in compiled code
+			instr.arg2=byte_targets[instr.arg1];
+			instr.arg1=resolved_targets[instr.arg1];
+		}
+		else if(instr.opcode==0x1b)
+		{
+			uint32_t* table=&body->switch_targets[instr.arg1];
+			for(unsigned int j=0;j<table[0]+2;j++)
+				table[j+1]=resolved_targets[table[j+1]];
+		}
+	}
+
+	//Fold common sequences in superinstructions. The second instruction is left in place and skipped
+	//at runtime, so that it's still valid as a jump target and indices don't change
+	for(unsigned int i=0;i+1<end_index;i++)
+	{
+		decoded_instruction& first=out[i];
+		const decoded_instruction& second=out[i+1];
+		if(first.opcode==0xd0 && second.opcode==0x30)
+		{
+			//getlocal0, pushscope
+			first.opcode=OPCODE_GETLOCAL0_PUSHSCOPE;
+			i++;
+		}
+		else if((first.opcode==0x62 || (first.opcode>=0xd0 && first.opcode<=0xd3)) && second.opcode==0x66)
+		{
+			//getlocal, getproperty. The object is on top of the stack only if the name has no runtime data.
+			//The index of the name has been validated while decoding getproperty
+			assert(second.arg1<context->constant_pool.multinames.size());
+			uint32_t kind=context->constant_pool.multinames[second.arg1].kind;
+			if(kind!=0x07 && kind!=0x09)
+				continue;
+			first.arg1=(first.opcode==0x62)?first.arg1:(first.opcode&3);
+			first.arg2=second.arg1;
+			first.cache=second.cache;
+			first.opcode=OPCODE_GETLOCAL_GETPROPERTY;
+			i++;
+		}
+	}
+
+	//Translate exception ranges to instruction indices. Bytes not starting an instruction belong to the
+	//following one, so that the range checks done by the exception handling code are unchanged
+	offset_to_index[code_len]=end_index;
+	for(int i=code_len-1;i>=0;i--)
+	{
+		if(offset_to_index[i]==NOT_AN_INSTRUCTION)
+			offset_to_index[i]=offset_to_index[i+1];
+	}
+	body->decoded_exceptions=body->exceptions;
+	for(unsigned int i=0;i<body->exception_count;i++)
+	{
+		exception_info& exc=body->decoded_exceptions[i];
+		exc.from=offset_to_index[imin(exc.from,code_len)];
+		exc.to=offset_to_index[imin(exc.to,code_len)];
+		if(exc.target>=code_len)
+			exc.target=invalid_jump_index;
+		else
+			exc.target=offset_to_index[exc.target];
+	}
+	body->decoded=true;
+}
+
+#undef NOT_AN_INSTRUCTION
+
+//List of the opcodes handled by the interpreter, used to build the threaded dispatch table
+#define INTERPRETED_OPCODES(X) \
+	X(0x03) X(0x04) X(0x05) X(0x08) X(0x0c) X(0x0d) X(0x0e) X(0x0f) X(0x10) X(0x11) X(0x12) X(0x13) \
+	X(0x14) X(0x15) X(0x16) X(0x17) X(0x18) X(0x19) X(0x1a) X(0x1b) X(0x1c) X(0x1d) X(0x1e) X(0x20) \
+	X(0x21) X(0x23) X(0x24) X(0x25) X(0x26) X(0x27) X(0x28) X(0x29) X(0x2a) X(0x2b) X(0x2c) X(0x2d) \
+	X(0x2e) X(0x2f) X(0x30) X(0x32) X(0x40) X(0x41) X(0x42) X(0x45) X(0x46) X(0x47) X(0x48) X(0x49) \
+	X(0x4a) X(0x4e) X(0x4f) X(0x53) X(0x55) X(0x56) X(0x57) X(0x58) X(0x59) X(0x5a) X(0x5d) X(0x5e) \
+	X(0x60) X(0x61) X(0x62) X(0x63) X(0x64) X(0x65) X(0x66) X(0x68) X(0x6a) X(0x6c) X(0x6d) X(0x73) \
+	X(0x74) X(0x75) X(0x76) X(0x78) X(0x80) X(0x82) X(0x85) X(0x87) X(0x90) X(0x91) X(0x93) X(0x95) \
+	X(0x96) X(0x97) X(0xa0) X(0xa1) X(0xa2) X(0xa3) X(0xa4) X(0xa5) X(0xa6) X(0xa7) X(0xa8) X(0xa9) \
+	X(0xaa) X(0xab) X(0xac) X(0xad) X(0xae) X(0xaf) X(0xb0) X(0xb2) X(0xb3) X(0xb4) X(0xc0) X(0xc1) \
+	X(0xc2) X(0xd0) X(0xd1) X(0xd2) X(0xd3) X(0xd4) X(0xd5) X(0xd6) X(0xd7) \
+	X(OPCODE_END_OF_CODE) X(OPCODE_INVALID_JUMP) X(OPCODE_GETLOCAL0_PUSHSCOPE) X(OPCODE_GETLOCAL_GETPROPERTY)
+
+/*
+	On compilers supporting label addresses each handler jumps directly to the handler of the next
+	instruction, instead of going back to the switch. This gives a separate (and better predicted)
+	indirect branch for each handler. When threaded dispatch is disabled at runtime, or not supported,
+	handlers return to the switch
+*/
+#ifdef __GNUC__
+#define THREADED_DISPATCH
+#define INSTRUCTION(op) case op: handler_##op
+#define UNKNOWN_INSTRUCTION handler_unknown:
+#define NEXT_INSTRUCTION \
+	if(threaded) \
+	{ \
+		instr=&code[pc++]; \
+		if(countInstructions) \
+			counter.count++; \
+		goto *dispatch_table[instr->opcode]; \
+	} \
+	break
+#else
+#define INSTRUCTION(op) case op
+#define UNKNOWN_INSTRUCTION
+#define NEXT_INSTRUCTION break
+#endif
+
+void method_info::profileArguments(ASObject* const* args)
+{
+	if(argProfile.size()!=param_count)
+		argProfile.resize(param_count,0);
+	for(unsigned int i=0;i<param_count;i++)
+	{
+		switch(args[i]->getObjectType())
+		{
+			case T_INTEGER:
+				argProfile[i]|=PROFILE_INT;
 				break;
+			case T_NUMBER:
+				argProfile[i]|=PROFILE_NUMBER;
+				break;
+			case T_BOOLEAN:
+				argProfile[i]|=PROFILE_BOOLEAN;
+				break;
+			default:
+				argProfile[i]|=PROFILE_OTHER;
+		}
+	}
+}
+
+/*
+	Backward branches are loop back-edges, they are accounted to the JIT compiler. When the method
+	has been compiled meanwhile the execution continues in the compiled code from the loop header
+*/
+#define TAKE_BRANCH \
+	do \
+	{ \
+		if(jit && instr->arg1<pc) \
+		{ \
+			SyntheticFunction::synt_function osr=getVm()->compiler.backEdge(mi,instr->arg2); \
+			if(osr) \
+			{ \
+				pc=instr->arg1; \
+				context->osr_offset=instr->arg2; \
+				ASObject* ret=osr(context); \
+				if(ret!=JIT_DEOPTIMIZED) \
+					return ret; \
+				getVm()->compiler.deoptimize(mi,true); \
+			} \
+		} \
+		pc=instr->arg1; \
+	} \
+	while(0)
+
+namespace
+{
+//Accounts the executed instructions to the VM, also when the function is left with an exception
+class InstructionCounter
+{
+public:
+	uint64_t count;
+	InstructionCounter():count(0){}
+	~InstructionCounter()
+	{
+		if(count)
+			getVm()->interpretedInstructions+=count;
+	}
+};
+
+inline inline_cache* getInlineCache(method_body_info* body, const decoded_instruction* instr)
+{
+	return (instr->cache==decoded_instruction::NO_CACHE)?NULL:&body->inline_caches[instr->cache];
+}
+};
+
+ASObject* ABCVm::executeFunction(SyntheticFunction* function, call_context* context)
+{
+	if(sys->countInstructions)
+		return interpret<true>(function,context);
+	else
+		return interpret<false>(function,context);
+}
+
+template<bool countInstructions>
+ASObject* ABCVm::interpret(SyntheticFunction* function, call_context* context)
+{
+	method_info* mi=function->mi;
+	method_body_info* body=mi->body;
+	assert_and_throw(body->decoded);
+
+	const decoded_instruction* code=&body->decoded_code[0];
+	//The position is kept in the context, so that exception handlers can resume from there
+	uint32_t& pc=context->exec_pos;
+	const decoded_instruction* instr;
+	InstructionCounter counter;
+	const bool jit=sys->useJit;
+
+#ifdef THREADED_DISPATCH
+	const bool threaded=sys->useThreadedDispatch;
+	//Label addresses are only available here, so each instance of the template builds its table on the
+	//first call. Each movie has its own VM thread, so the first calls may be concurrent
+	static void* dispatch_table[DECODED_OPCODE_COUNT];
+	static bool dispatch_table_ready=false;
+	if(!__atomic_load_n(&dispatch_table_ready,__ATOMIC_ACQUIRE))
+	{
+		static Mutex dispatch_table_mutex("Interpreter dispatch table");
+		Locker l(dispatch_table_mutex);
+		if(!dispatch_table_ready)
+		{
+			for(unsigned int i=0;i<DECODED_OPCODE_COUNT;i++)
+				dispatch_table[i]=&&handler_unknown;
+#define SET_HANDLER(op) dispatch_table[op]=&&handler_##op;
+			INTERPRETED_OPCODES(SET_HANDLER)
+#undef SET_HANDLER
+			__atomic_store_n(&dispatch_table_ready,true,__ATOMIC_RELEASE);
+		}
+	}
+#endif
+
+	//Each case block builds the correct parameters for the interpreter function and call it
+	while(1)
+	{
+		//The decoded code is terminated by a sentinel, so there is no need to check for the end
+		instr=&code[pc++];
+		if(countInstructions)
+			counter.count++;
+
+		switch(instr->opcode)
+		{
+			INSTRUCTION(0x03):
+			{
+				//throw
+				_throw(context);
+				NEXT_INSTRUCTION;
 			}
-			case 0x09:
+			INSTRUCTION(0x04):
 			{
-				//label
-				break;
+				//getsuper
+				uint32_t t=instr->arg1;
+				getSuper(context,t);
+				NEXT_INSTRUCTION;
 			}
-			case 0x0c:
+			INSTRUCTION(0x05):
+			{
+				//setsuper
+				uint32_t t=instr->arg1;
+				setSuper(context,t);
+				NEXT_INSTRUCTION;
+			}
+			INSTRUCTION(0x08):
+			{
+				//kill
+				uint32_t t=instr->arg1;
+				assert_and_throw(context->locals[t]);
+				context->locals[t]->decRef();
+				context->locals[t]=new Undefined;
+				NEXT_INSTRUCTION;
+			}
+			INSTRUCTION(0x0c):
 			{
 				//ifnlt
-				s24 t;
-				code >> t;
 				ASObject* v1=context->runtime_stack_pop();
 				ASObject* v2=context->runtime_stack_pop();
-				bool cond=ifNLT(v1, v2);
-
-				if(cond)
+				bool cond;
+				if(v1->getObjectType()==T_INTEGER && v2->getObjectType()==T_INTEGER)
 				{
-					int here=code.tellg();
-					int dest=here+t;
-
-					//Now 'jump' to the destination, validate on the length
-					if(dest >= code_len)
-						throw ParseException("Jump out of bounds in intepreter");
-					code.seekg(dest);
+					//Fast path for loops on integers
+					cond=!(static_cast<Integer*>(v2)->val<static_cast<Integer*>(v1)->val);
+					v1->decRef();
+					v2->decRef();
 				}
-				break;
+				else
+					cond=ifNLT(v1, v2);
+
+				if(cond)
+					TAKE_BRANCH;
+				NEXT_INSTRUCTION;
 			}
-			case 0x0d:
+			INSTRUCTION(0x0d):
 			{
 				//ifnle
-				s24 t;
-				code >> t;
 				ASObject* v1=context->runtime_stack_pop();
 				ASObject* v2=context->runtime_stack_pop();
-				bool cond=ifNLE(v1, v2);
-
-				if(cond)
+				bool cond;
+				if(v1->getObjectType()==T_INTEGER && v2->getObjectType()==T_INTEGER)
 				{
-					int here=code.tellg();
-					int dest=here+t;
-
-					//Now 'jump' to the destination, validate on the length
-					if(dest >= code_len)
-						throw ParseException("Jump out of bounds in intepreter");
-					code.seekg(dest);
+					//Fast path for loops on integers
+					cond=!(static_cast<Integer*>(v2)->val<=static_cast<Integer*>(v1)->val);
+					v1->decRef();
+					v2->decRef();
 				}
-				break;
+				else
+					cond=ifNLE(v1, v2);
+
+				if(cond)
+					TAKE_BRANCH;
+				NEXT_INSTRUCTION;
 			}
-			case 0x0e:
+			INSTRUCTION(0x0e):
 			{
 				//ifngt
-				s24 t;
-				code >> t;
 				ASObject* v1=context->runtime_stack_pop();
 				ASObject* v2=context->runtime_stack_pop();
-				bool cond=ifNGT(v1, v2);
-
-				if(cond)
+				bool cond;
+				if(v1->getObjectType()==T_INTEGER && v2->getObjectType()==T_INTEGER)
 				{
-					int here=code.tellg();
-					int dest=here+t;
-
-					//Now 'jump' to the destination, validate on the length
-					if(dest >= code_len)
-						throw ParseException("Jump out of bounds in intepreter");
-					code.seekg(dest);
+					//Fast path for loops on integers
+					cond=!(static_cast<Integer*>(v2)->val>static_cast<Integer*>(v1)->val);
+					v1->decRef();
+					v2->decRef();
 				}
-				break;
+				else
+					cond=ifNGT(v1, v2);
+
+				if(cond)
+					TAKE_BRANCH;
+				NEXT_INSTRUCTION;
 			}
-			case 0x0f:
+			INSTRUCTION(0x0f):
 			{
 				//ifnge
-				s24 t;
-				code >> t;
 				ASObject* v1=context->runtime_stack_pop();
 				ASObject* v2=context->runtime_stack_pop();
-				bool cond=ifNGE(v1, v2);
-				if(cond)
+				bool cond;
+				if(v1->getObjectType()==T_INTEGER && v2->getObjectType()==T_INTEGER)
 				{
-					int here=code.tellg();
-					int dest=here+t;
-
-					//Now 'jump' to the destination, validate on the length
-					if(dest >= code_len)
-						throw ParseException("Jump out of bounds in intepreter");
-					code.seekg(dest);
+					//Fast path for loops on integers
+					cond=!(static_cast<Integer*>(v2)->val>=static_cast<Integer*>(v1)->val);
+					v1->decRef();
+					v2->decRef();
 				}
-				break;
+				else
+					cond=ifNGE(v1, v2);
+				if(cond)
+					TAKE_BRANCH;
+				NEXT_INSTRUCTION;
 			}
-			case 0x10:
+			INSTRUCTION(0x10):
 			{
 				//jump
-				s24 t;
-				code >> t;
-
-				int here=code.tellg();
-				int dest=here+t;
-
-				//Now 'jump' to the destination, validate on the length
-				if(dest >= code_len)
-					throw ParseException("Jump out of bounds in intepreter");
-				code.seekg(dest);
-				break;
+				TAKE_BRANCH;
+				NEXT_INSTRUCTION;
 			}
-			case 0x11:
+			INSTRUCTION(0x11):
 			{
 				//iftrue
-				s24 t;
-				code >> t;
-
 				ASObject* v1=context->runtime_stack_pop();
 				bool cond=ifTrue(v1);
 				if(cond)
-				{
-					int here=code.tellg();
-					int dest=here+t;
-
-					//Now 'jump' to the destination, validate on the length
-					if(dest >= code_len)
-						throw ParseException("Jump out of bounds in intepreter");
-					code.seekg(dest);
-				}
-				break;
+					TAKE_BRANCH;
+				NEXT_INSTRUCTION;
 			}
-			case 0x12:
+			INSTRUCTION(0x12):
 			{
 				//iffalse
-				s24 t;
-				code >> t;
-
 				ASObject* v1=context->runtime_stack_pop();
 				bool cond=ifFalse(v1);
 				if(cond)
-				{
-					int here=code.tellg();
-					int dest=here+t;
-
-					//Now 'jump' to the destination, validate on the length
-					if(dest >= code_len)
-						throw ParseException("Jump out of bounds in intepreter");
-					code.seekg(dest);
-				}
-				break;
+					TAKE_BRANCH;
+				NEXT_INSTRUCTION;
 			}
-			case 0x13:
+			INSTRUCTION(0x13):
 			{
 				//ifeq
-				s24 t;
-				code >> t;
-
 				ASObject* v1=context->runtime_stack_pop();
 				ASObject* v2=context->runtime_stack_pop();
 				bool cond=ifEq(v1, v2);
 				if(cond)
-				{
-					int here=code.tellg();
-					int dest=here+t;
-
-					//Now 'jump' to the destination, validate on the length
-					if(dest >= code_len)
-						throw ParseException("Jump out of bounds in intepreter");
-					code.seekg(dest);
-				}
-				break;
+					TAKE_BRANCH;
+				NEXT_INSTRUCTION;
 			}
-			case 0x14:
+			INSTRUCTION(0x14):
 			{
 				//ifne
-				s24 t;
-				code >> t;
-
 				ASObject* v1=context->runtime_stack_pop();
 				ASObject* v2=context->runtime_stack_pop();
 				bool cond=ifNE(v1, v2);
 				if(cond)
-				{
-					int here=code.tellg();
-					int dest=here+t;
-
-					//Now 'jump' to the destination, validate on the length
-					if(dest >= code_len)
-						throw ParseException("Jump out of bounds in intepreter");
-					code.seekg(dest);
-				}
-				break;
+					TAKE_BRANCH;
+				NEXT_INSTRUCTION;
 			}
-			case 0x15:
+			INSTRUCTION(0x15):
 			{
 				//iflt
-				s24 t;
-				code >> t;
-
 				ASObject* v1=context->runtime_stack_pop();
 				ASObject* v2=context->runtime_stack_pop();
-				bool cond=ifLT(v1, v2);
-				if(cond)
+				bool cond;
+				if(v1->getObjectType()==T_INTEGER && v2->getObjectType()==T_INTEGER)
 				{
-					int here=code.tellg();
-					int dest=here+t;
-
-					//Now 'jump' to the destination, validate on the length
-					if(dest >= code_len)
-						throw ParseException("Jump out of bounds in intepreter");
-					code.seekg(dest);
+					//Fast path for loops on integers
+					cond=static_cast<Integer*>(v2)->val<static_cast<Integer*>(v1)->val;
+					v1->decRef();
+					v2->decRef();
 				}
-				break;
+				else
+					cond=ifLT(v1, v2);
+				if(cond)
+					TAKE_BRANCH;
+				NEXT_INSTRUCTION;
 			}
-			case 0x16:
+			INSTRUCTION(0x16):
 			{
 				//ifle
-				s24 t;
-				code >> t;
-
 				ASObject* v1=context->runtime_stack_pop();
 				ASObject* v2=context->runtime_stack_pop();
-				bool cond=ifLE(v1, v2);
-				if(cond)
+				bool cond;
+				if(v1->getObjectType()==T_INTEGER && v2->getObjectType()==T_INTEGER)
 				{
-					int here=code.tellg();
-					int dest=here+t;
-
-					//Now 'jump' to the destination, validate on the length
-					if(dest >= code_len)
-						throw ParseException("Jump out of bounds in intepreter");
-					code.seekg(dest);
+					//Fast path for loops on integers
+					cond=static_cast<Integer*>(v2)->val<=static_cast<Integer*>(v1)->val;
+					v1->decRef();
+					v2->decRef();
 				}
-				break;
+				else
+					cond=ifLE(v1, v2);
+				if(cond)
+					TAKE_BRANCH;
+				NEXT_INSTRUCTION;
 			}
-			case 0x17:
+			INSTRUCTION(0x17):
 			{
 				//ifgt
-				s24 t;
-				code >> t;
-
 				ASObject* v1=context->runtime_stack_pop();
 				ASObject* v2=context->runtime_stack_pop();
-				bool cond=ifGT(v1, v2);
-				if(cond)
+				bool cond;
+				if(v1->getObjectType()==T_INTEGER && v2->getObjectType()==T_INTEGER)
 				{
-					int here=code.tellg();
-					int dest=here+t;
-
-					//Now 'jump' to the destination, validate on the length
-					if(dest >= code_len)
-						throw ParseException("Jump out of bounds in intepreter");
-					code.seekg(dest);
+					//Fast path for loops on integers
+					cond=static_cast<Integer*>(v2)->val>static_cast<Integer*>(v1)->val;
+					v1->decRef();
+					v2->decRef();
 				}
-				break;
+				else
+					cond=ifGT(v1, v2);
+				if(cond)
+					TAKE_BRANCH;
+				NEXT_INSTRUCTION;
 			}
-			case 0x18:
+			INSTRUCTION(0x18):
 			{
 				//ifge
-				s24 t;
-				code >> t;
-
 				ASObject* v1=context->runtime_stack_pop();
 				ASObject* v2=context->runtime_stack_pop();
-				bool cond=ifGE(v1, v2);
-				if(cond)
+				bool cond;
+				if(v1->getObjectType()==T_INTEGER && v2->getObjectType()==T_INTEGER)
 				{
-					int here=code.tellg();
-					int dest=here+t;
-
-					//Now 'jump' to the destination, validate on the length
-					if(dest >= code_len)
-						throw ParseException("Jump out of bounds in intepreter");
-					code.seekg(dest);
+					//Fast path for loops on integers
+					cond=static_cast<Integer*>(v2)->val>=static_cast<Integer*>(v1)->val;
+					v1->decRef();
+					v2->decRef();
 				}
-				break;
+				else
+					cond=ifGE(v1, v2);
+				if(cond)
+					TAKE_BRANCH;
+				NEXT_INSTRUCTION;
 			}
-			case 0x19:
+			INSTRUCTION(0x19):
 			{
 				//ifstricteq
-				s24 t;
-				code >> t;
-
 				ASObject* v1=context->runtime_stack_pop();
 				ASObject* v2=context->runtime_stack_pop();
 				bool cond=ifStrictEq(v1, v2);
 				if(cond)
-				{
-					int here=code.tellg();
-					int dest=here+t;
-
-					//Now 'jump' to the destination, validate on the length
-					if(dest >= code_len)
-						throw ParseException("Jump out of bounds in intepreter");
-					code.seekg(dest);
-				}
-				break;
+					TAKE_BRANCH;
+				NEXT_INSTRUCTION;
 			}
-			case 0x1a:
+			INSTRUCTION(0x1a):
 			{
 				//ifstrictne
-				s24 t;
-				code >> t;
-
 				ASObject* v1=context->runtime_stack_pop();
 				ASObject* v2=context->runtime_stack_pop();
 				bool cond=ifStrictNE(v1, v2);
 				if(cond)
-				{
-					int here=code.tellg();
-					int dest=here+t;
-
-					//Now 'jump' to the destination, validate on the length
-					if(dest >= code_len)
-						throw ParseException("Jump out of bounds in intepreter");
-					code.seekg(dest);
-				}
-				break;
+					TAKE_BRANCH;
+				NEXT_INSTRUCTION;
 			}
-			case 0x1b:
+			INSTRUCTION(0x1b):
 			{
 				//lookupswitch
-				int here=int(code.tellg())-1; //Base for the jumps is the instruction itself for the switch
-				s24 t;
-				code >> t;
-				int defaultdest=here+t;
-				LOG(LOG_CALLS,_("Switch default dest ") << defaultdest);
-				u30 count;
-				code >> count;
-				vector<s24> offsets(count+1);
-				for(unsigned int i=0;i<count+1;i++)
-				{
-					code >> offsets[i];
-					LOG(LOG_CALLS,_("Switch dest ") << i << ' ' << offsets[i]);
-				}
+				//The jump table is stored as the case count, the default target and the case targets
+				const uint32_t* table=&body->switch_targets[instr->arg1];
+				uint32_t count=table[0];
 
 				ASObject* index_obj=context->runtime_stack_pop();
 				assert_and_throw(index_obj->getObjectType()==T_INTEGER);
 				unsigned int index=index_obj->toUInt();
 
-				int dest=defaultdest;
-				if(index>=0 && index<=count)
-					dest=here+offsets[index];
-
-				if(dest >= code_len)
-					throw ParseException("Jump out of bounds in intepreter");
-				code.seekg(dest);
-				break;
+				if(index<=count)
+					pc=table[2+index];
+				else
+					pc=table[1];
+				LOG(LOG_CALLS,_("Switch dest ") << pc);
+				NEXT_INSTRUCTION;
 			}
-			case 0x1c:
+			INSTRUCTION(0x1c):
 			{
 				//pushwith
 				pushWith(context);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x1d:
+			INSTRUCTION(0x1d):
 			{
 				//popscope
 				popScope(context);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x1e:
+			INSTRUCTION(0x1e):
 			{
 				//nextname
 				ASObject* v1=context->runtime_stack_pop();
 				ASObject* v2=context->runtime_stack_pop();
 				context->runtime_stack_push(nextName(v1,v2));
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x20:
+			INSTRUCTION(0x20):
 			{
 				//pushnull
 				context->runtime_stack_push(pushNull());
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x21:
+			INSTRUCTION(0x21):
 			{
 				//pushundefined
 				context->runtime_stack_push(pushUndefined());
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x23:
+			INSTRUCTION(0x23):
 			{
 				//nextvalue
 				ASObject* v1=context->runtime_stack_pop();
 				ASObject* v2=context->runtime_stack_pop();
 				context->runtime_stack_push(nextValue(v1,v2));
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x24:
+			INSTRUCTION(0x24):
 			{
 				//pushbyte
-				int8_t t;
-				code.read((char*)&t,1);
+				int8_t t=instr->arg1;
 				context->runtime_stack_push(abstract_i(t));
 				pushByte(t);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x25:
+			INSTRUCTION(0x25):
 			{
 				//pushshort
-				u30 t;
-				code >> t;
+				uint32_t t=instr->arg1;
 				context->runtime_stack_push(abstract_i(t));
 				pushShort(t);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x26:
+			INSTRUCTION(0x26):
 			{
 				//pushtrue
 				context->runtime_stack_push(abstract_b(pushTrue()));
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x27:
+			INSTRUCTION(0x27):
 			{
 				//pushfalse
 				context->runtime_stack_push(abstract_b(pushFalse()));
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x28:
+			INSTRUCTION(0x28):
 			{
 				//pushnan
 				context->runtime_stack_push(pushNaN());
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x29:
+			INSTRUCTION(0x29):
 			{
 				//pop
 				pop();
 				ASObject* o=context->runtime_stack_pop();
 				if(o)
 					o->decRef();
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x2a:
+			INSTRUCTION(0x2a):
 			{
 				//dup
 				dup();
 				ASObject* o=context->runtime_stack_peek();
 				o->incRef();
 				context->runtime_stack_push(o);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x2b:
+			INSTRUCTION(0x2b):
 			{
 				//swap
 				swap();
@@ -520,400 +892,361 @@ ASObject* ABCVm::executeFunction(SyntheticFunction* function, call_context* cont
 
 				context->runtime_stack_push(v1);
 				context->runtime_stack_push(v2);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x2c:
+			INSTRUCTION(0x2c):
 			{
 				//pushstring
-				u30 t;
-				code >> t;
+				uint32_t t=instr->arg1;
 				context->runtime_stack_push(pushString(context,t));
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x2d:
+			INSTRUCTION(0x2d):
 			{
 				//pushint
-				u30 t;
-				code >> t;
+				uint32_t t=instr->arg1;
 				pushInt(context, t);
 
 				ASObject* i=abstract_i(context->context->constant_pool.integer[t]);
 				context->runtime_stack_push(i);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x2e:
+			INSTRUCTION(0x2e):
 			{
 				//pushuint
-				u30 t;
-				code >> t;
+				uint32_t t=instr->arg1;
 				pushUInt(context, t);
 
 				ASObject* i=abstract_i(context->context->constant_pool.uinteger[t]);
 				context->runtime_stack_push(i);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x2f:
+			INSTRUCTION(0x2f):
 			{
 				//pushdouble
-				u30 t;
-				code >> t;
+				uint32_t t=instr->arg1;
 				pushDouble(context, t);
 
 				ASObject* d=abstract_d(context->context->constant_pool.doubles[t]);
 				context->runtime_stack_push(d);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x30:
+			INSTRUCTION(0x30):
 			{
 				//pushscope
 				pushScope(context);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x32:
+			INSTRUCTION(0x32):
 			{
 				//hasnext2
-				u30 t,t2;
-				code >> t;
-				code >> t2;
+				uint32_t t=instr->arg1;
+				uint32_t t2=instr->arg2;
 
 				bool ret=hasNext2(context,t,t2);
 				context->runtime_stack_push(abstract_b(ret));
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x40:
+			INSTRUCTION(0x40):
 			{
 				//newfunction
-				u30 t;
-				code >> t;
+				uint32_t t=instr->arg1;
 				context->runtime_stack_push(newFunction(context,t));
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x41:
+			INSTRUCTION(0x41):
 			{
 				//call
-				u30 t;
-				code >> t;
+				uint32_t t=instr->arg1;
 				call(context,t);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x42:
+			INSTRUCTION(0x42):
 			{
 				//construct
-				u30 t;
-				code >> t;
+				uint32_t t=instr->arg1;
 				construct(context,t);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x45:
+			INSTRUCTION(0x45):
 			{
 				//callsuper
-				u30 t,t2;
-				code >> t;
-				code >> t2;
+				uint32_t t=instr->arg1;
+				uint32_t t2=instr->arg2;
 				callSuper(context,t,t2);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x46:
-			case 0x4c: //callproplex seems to be exactly like callproperty
+			INSTRUCTION(0x46): //callproplex is translated to callproperty by the decoder
 			{
 				//callproperty
-				u30 t,t2;
-				code >> t;
-				code >> t2;
-				callProperty(context,t,t2);
-				break;
+				uint32_t t=instr->arg1;
+				uint32_t t2=instr->arg2;
+				callProperty(context,t,t2,getInlineCache(body,instr));
+				NEXT_INSTRUCTION;
 			}
-			case 0x47:
+			INSTRUCTION(0x47):
 			{
 				//returnvoid
 				LOG(LOG_CALLS,_("returnVoid"));
 				return NULL;
 			}
-			case 0x48:
+			INSTRUCTION(0x48):
 			{
 				//returnvalue
 				ASObject* ret=context->runtime_stack_pop();
 				LOG(LOG_CALLS,_("returnValue ") << ret);
 				return ret;
 			}
-			case 0x49:
+			INSTRUCTION(0x49):
 			{
 				//constructsuper
-				u30 t;
-				code >> t;
+				uint32_t t=instr->arg1;
 				constructSuper(context,t);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x4a:
+			INSTRUCTION(0x4a):
 			{
 				//constructprop
-				u30 t,t2;
-				code >> t;
-				code >> t2;
+				uint32_t t=instr->arg1;
+				uint32_t t2=instr->arg2;
 				constructProp(context,t,t2);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x4e:
+			INSTRUCTION(0x4e):
 			{
 				//callsupervoid
-				u30 t,t2;
-				code >> t;
-				code >> t2;
+				uint32_t t=instr->arg1;
+				uint32_t t2=instr->arg2;
 				callSuperVoid(context,t,t2);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x4f:
+			INSTRUCTION(0x4f):
 			{
 				//callpropvoid
-				u30 t,t2;
-				code >> t;
-				code >> t2;
-				callPropVoid(context,t,t2);
-				break;
+				uint32_t t=instr->arg1;
+				uint32_t t2=instr->arg2;
+				callPropVoid(context,t,t2,getInlineCache(body,instr));
+				NEXT_INSTRUCTION;
 			}
-			case 0x53:
+			INSTRUCTION(0x53):
 			{
 				//constructgenerictype
-				u30 t;
-				code >> t;
+				uint32_t t=instr->arg1;
 				constructGenericType(context, t);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x55:
+			INSTRUCTION(0x55):
 			{
 				//newobject
-				u30 t;
-				code >> t;
+				uint32_t t=instr->arg1;
 				newObject(context,t);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x56:
+			INSTRUCTION(0x56):
 			{
 				//newarray
-				u30 t;
-				code >> t;
+				uint32_t t=instr->arg1;
 				newArray(context,t);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x57:
+			INSTRUCTION(0x57):
 			{
 				//newactivation
 				context->runtime_stack_push(newActivation(context, mi));
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x58:
+			INSTRUCTION(0x58):
 			{
 				//newclass
-				u30 t;
-				code >> t;
+				uint32_t t=instr->arg1;
 				newClass(context,t);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x59:
+			INSTRUCTION(0x59):
 			{
 				//getdescendants
-				u30 t;
-				code >> t;
+				uint32_t t=instr->arg1;
 				getDescendants(context, t);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x5a:
+			INSTRUCTION(0x5a):
 			{
 				//newcatch
-				u30 t;
-				code >> t;
+				uint32_t t=instr->arg1;
 				context->runtime_stack_push(newCatch(context,t));
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x5d:
+			INSTRUCTION(0x5d):
 			{
 				//findpropstrict
-				u30 t;
-				code >> t;
+				uint32_t t=instr->arg1;
 				context->runtime_stack_push(findPropStrict(context,t));
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x5e:
+			INSTRUCTION(0x5e):
 			{
 				//findproperty
-				u30 t;
-				code >> t;
+				uint32_t t=instr->arg1;
 				context->runtime_stack_push(findProperty(context,t));
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x60:
+			INSTRUCTION(0x60):
 			{
 				//getlex
-				u30 t;
-				code >> t;
+				uint32_t t=instr->arg1;
 				getLex(context,t);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x61:
+			INSTRUCTION(0x61):
 			{
 				//setproperty
-				u30 t;
-				code >> t;
+				uint32_t t=instr->arg1;
 				ASObject* value=context->runtime_stack_pop();
 
 				multiname* name=context->context->getMultiname(t,context);
 
 				ASObject* obj=context->runtime_stack_pop();
 
-				setProperty(value,obj,name);
-				break;
+				setProperty(value,obj,name,getInlineCache(body,instr));
+				NEXT_INSTRUCTION;
 			}
-			case 0x62:
+			INSTRUCTION(0x62):
 			{
 				//getlocal
-				u30 i;
-				code >> i;
+				uint32_t i=instr->arg1;
 				assert_and_throw(context->locals[i]);
 				context->locals[i]->incRef();
 				LOG(LOG_CALLS, _("getLocal ") << i << _(": ") << context->locals[i]->toString(true) );
 				context->runtime_stack_push(context->locals[i]);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x63:
+			INSTRUCTION(0x63):
 			{
 				//setlocal
-				u30 i;
-				code >> i;
+				uint32_t i=instr->arg1;
 				LOG(LOG_CALLS, _("setLocal ") << i );
 				ASObject* obj=context->runtime_stack_pop();
 				assert_and_throw(obj);
 				if(context->locals[i])
 					context->locals[i]->decRef();
 				context->locals[i]=obj;
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x64:
+			INSTRUCTION(0x64):
 			{
 				//getglobalscope
 				context->runtime_stack_push(getGlobalScope(context));
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x65:
+			INSTRUCTION(0x65):
 			{
 				//getscopeobject
-				u30 t;
-				code >> t;
+				uint32_t t=instr->arg1;
 				context->runtime_stack_push(getScopeObject(context,t));
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x66:
+			INSTRUCTION(0x66):
 			{
 				//getproperty
-				u30 t;
-				code >> t;
+				uint32_t t=instr->arg1;
 				multiname* name=context->context->getMultiname(t,context);
 
 				ASObject* obj=context->runtime_stack_pop();
 
-				ASObject* ret=getProperty(obj,name);
+				ASObject* ret=getProperty(obj,name,getInlineCache(body,instr));
 
 				context->runtime_stack_push(ret);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x68:
+			INSTRUCTION(0x68):
 			{
 				//initproperty
-				u30 t;
-				code >> t;
+				uint32_t t=instr->arg1;
 				initProperty(context,t);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x6a:
+			INSTRUCTION(0x6a):
 			{
 				//deleteproperty
-				u30 t;
-				code >> t;
+				uint32_t t=instr->arg1;
 				deleteProperty(context, t);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x6c:
+			INSTRUCTION(0x6c):
 			{
 				//getslot
-				u30 t;
-				code >> t;
+				uint32_t t=instr->arg1;
 				ASObject* obj=context->runtime_stack_pop();
 				ASObject* ret=getSlot(obj, t);
 				context->runtime_stack_push(ret);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x6d:
+			INSTRUCTION(0x6d):
 			{
 				//setslot
-				u30 t;
-				code >> t;
+				uint32_t t=instr->arg1;
 
 				ASObject* v1=context->runtime_stack_pop();
 				ASObject* v2=context->runtime_stack_pop();
 
 				setSlot(v1, v2, t);
-				break;
-			}
-			case 0x70:
-			{
-				//convert_s
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x73:
+			INSTRUCTION(0x73):
 			{
 				//convert_i
 				ASObject* val=context->runtime_stack_pop();
 				context->runtime_stack_push(abstract_i(convert_i(val)));
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x74:
+			INSTRUCTION(0x74):
 			{
 				//convert_u
 				ASObject* val=context->runtime_stack_pop();
 				context->runtime_stack_push(abstract_i(convert_u(val)));
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x75:
+			INSTRUCTION(0x75):
 			{
 				//convert_d
 				ASObject* val=context->runtime_stack_pop();
 				context->runtime_stack_push(abstract_d(convert_d(val)));
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x76:
+			INSTRUCTION(0x76):
 			{
 				//convert_b
 				ASObject* val=context->runtime_stack_pop();
 				context->runtime_stack_push(abstract_b(convert_b(val)));
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x78:
+			INSTRUCTION(0x78):
 			{
 				//checkfilter
 				ASObject* val=context->runtime_stack_pop();
 				context->runtime_stack_push(checkfilter(val));
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x80:
+			INSTRUCTION(0x80):
 			{
 				//coerce
-				u30 t;
-				code >> t;
+				uint32_t t=instr->arg1;
 				coerce(context, t);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x82:
+			INSTRUCTION(0x82):
 			{
 				//coerce_a
 				coerce_a();
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x85:
+			INSTRUCTION(0x85):
 			{
 				//coerce_s
 				context->runtime_stack_push(coerce_s(context->runtime_stack_pop()));
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x87:
+			INSTRUCTION(0x87):
 			{
 				//astypelate
 				ASObject* v1=context->runtime_stack_pop();
@@ -921,57 +1254,57 @@ ASObject* ABCVm::executeFunction(SyntheticFunction* function, call_context* cont
 
 				ASObject* ret=asTypelate(v1, v2);
 				context->runtime_stack_push(ret);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x90:
+			INSTRUCTION(0x90):
 			{
 				//negate
 				ASObject* val=context->runtime_stack_pop();
 				ASObject* ret=abstract_d(negate(val));
 				context->runtime_stack_push(ret);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x91:
+			INSTRUCTION(0x91):
 			{
 				//increment
 				ASObject* val=context->runtime_stack_pop();
 				ASObject* ret=abstract_i(increment(val));
 				context->runtime_stack_push(ret);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x93:
+			INSTRUCTION(0x93):
 			{
 				//decrement
 				ASObject* val=context->runtime_stack_pop();
 				ASObject* ret=abstract_i(decrement(val));
 				context->runtime_stack_push(ret);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x95:
+			INSTRUCTION(0x95):
 			{
 				//typeof
 				ASObject* val=context->runtime_stack_pop();
 				ASObject* ret=typeOf(val);
 				context->runtime_stack_push(ret);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x96:
+			INSTRUCTION(0x96):
 			{
 				//not
 				ASObject* val=context->runtime_stack_pop();
 				ASObject* ret=abstract_b(_not(val));
 				context->runtime_stack_push(ret);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0x97:
+			INSTRUCTION(0x97):
 			{
 				//bitnot
 				ASObject* val=context->runtime_stack_pop();
 				ASObject* ret=abstract_i(bitNot(val));
 				context->runtime_stack_push(ret);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0xa0:
+			INSTRUCTION(0xa0):
 			{
 				//add
 				ASObject* v2=context->runtime_stack_pop();
@@ -979,9 +1312,9 @@ ASObject* ABCVm::executeFunction(SyntheticFunction* function, call_context* cont
 
 				ASObject* ret=add(v2, v1);
 				context->runtime_stack_push(ret);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0xa1:
+			INSTRUCTION(0xa1):
 			{
 				//subtract
 				//Be careful, operands in subtract implementation are swapped
@@ -990,9 +1323,9 @@ ASObject* ABCVm::executeFunction(SyntheticFunction* function, call_context* cont
 
 				ASObject* ret=abstract_d(subtract(v2, v1));
 				context->runtime_stack_push(ret);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0xa2:
+			INSTRUCTION(0xa2):
 			{
 				//multiply
 				ASObject* v2=context->runtime_stack_pop();
@@ -1000,9 +1333,9 @@ ASObject* ABCVm::executeFunction(SyntheticFunction* function, call_context* cont
 
 				ASObject* ret=abstract_d(multiply(v2, v1));
 				context->runtime_stack_push(ret);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0xa3:
+			INSTRUCTION(0xa3):
 			{
 				//divide
 				ASObject* v2=context->runtime_stack_pop();
@@ -1010,9 +1343,9 @@ ASObject* ABCVm::executeFunction(SyntheticFunction* function, call_context* cont
 
 				ASObject* ret=abstract_d(divide(v2, v1));
 				context->runtime_stack_push(ret);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0xa4:
+			INSTRUCTION(0xa4):
 			{
 				//modulo
 				ASObject* v2=context->runtime_stack_pop();
@@ -1020,9 +1353,9 @@ ASObject* ABCVm::executeFunction(SyntheticFunction* function, call_context* cont
 
 				ASObject* ret=abstract_i(modulo(v1, v2));
 				context->runtime_stack_push(ret);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0xa5:
+			INSTRUCTION(0xa5):
 			{
 				//lshift
 				ASObject* v1=context->runtime_stack_pop();
@@ -1030,9 +1363,9 @@ ASObject* ABCVm::executeFunction(SyntheticFunction* function, call_context* cont
 
 				ASObject* ret=abstract_i(lShift(v1, v2));
 				context->runtime_stack_push(ret);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0xa6:
+			INSTRUCTION(0xa6):
 			{
 				//rshift
 				ASObject* v1=context->runtime_stack_pop();
@@ -1040,9 +1373,9 @@ ASObject* ABCVm::executeFunction(SyntheticFunction* function, call_context* cont
 
 				ASObject* ret=abstract_i(rShift(v1, v2));
 				context->runtime_stack_push(ret);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0xa7:
+			INSTRUCTION(0xa7):
 			{
 				//urshift
 				ASObject* v1=context->runtime_stack_pop();
@@ -1050,9 +1383,9 @@ ASObject* ABCVm::executeFunction(SyntheticFunction* function, call_context* cont
 
 				ASObject* ret=abstract_i(urShift(v1, v2));
 				context->runtime_stack_push(ret);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0xa8:
+			INSTRUCTION(0xa8):
 			{
 				//bitand
 				ASObject* v1=context->runtime_stack_pop();
@@ -1060,9 +1393,9 @@ ASObject* ABCVm::executeFunction(SyntheticFunction* function, call_context* cont
 
 				ASObject* ret=abstract_i(bitAnd(v1, v2));
 				context->runtime_stack_push(ret);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0xa9:
+			INSTRUCTION(0xa9):
 			{
 				//bitor
 				ASObject* v1=context->runtime_stack_pop();
@@ -1070,9 +1403,9 @@ ASObject* ABCVm::executeFunction(SyntheticFunction* function, call_context* cont
 
 				ASObject* ret=abstract_i(bitOr(v1, v2));
 				context->runtime_stack_push(ret);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0xaa:
+			INSTRUCTION(0xaa):
 			{
 				//bitxor
 				ASObject* v1=context->runtime_stack_pop();
@@ -1080,9 +1413,9 @@ ASObject* ABCVm::executeFunction(SyntheticFunction* function, call_context* cont
 
 				ASObject* ret=abstract_i(bitXor(v1, v2));
 				context->runtime_stack_push(ret);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0xab:
+			INSTRUCTION(0xab):
 			{
 				//equals
 				ASObject* v2=context->runtime_stack_pop();
@@ -1090,9 +1423,9 @@ ASObject* ABCVm::executeFunction(SyntheticFunction* function, call_context* cont
 
 				ASObject* ret=abstract_b(equals(v1, v2));
 				context->runtime_stack_push(ret);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0xac:
+			INSTRUCTION(0xac):
 			{
 				//strictequals
 				ASObject* v2=context->runtime_stack_pop();
@@ -1100,9 +1433,9 @@ ASObject* ABCVm::executeFunction(SyntheticFunction* function, call_context* cont
 
 				ASObject* ret=abstract_b(strictEquals(v1, v2));
 				context->runtime_stack_push(ret);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0xad:
+			INSTRUCTION(0xad):
 			{
 				//lessthan
 				ASObject* v2=context->runtime_stack_pop();
@@ -1110,9 +1443,9 @@ ASObject* ABCVm::executeFunction(SyntheticFunction* function, call_context* cont
 
 				ASObject* ret=abstract_b(lessThan(v1, v2));
 				context->runtime_stack_push(ret);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0xae:
+			INSTRUCTION(0xae):
 			{
 				//lessequals
 				ASObject* v2=context->runtime_stack_pop();
@@ -1120,9 +1453,9 @@ ASObject* ABCVm::executeFunction(SyntheticFunction* function, call_context* cont
 
 				ASObject* ret=abstract_b(lessEquals(v1, v2));
 				context->runtime_stack_push(ret);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0xaf:
+			INSTRUCTION(0xaf):
 			{
 				//greaterthan
 				ASObject* v2=context->runtime_stack_pop();
@@ -1130,9 +1463,9 @@ ASObject* ABCVm::executeFunction(SyntheticFunction* function, call_context* cont
 
 				ASObject* ret=abstract_b(greaterThan(v1, v2));
 				context->runtime_stack_push(ret);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0xb0:
+			INSTRUCTION(0xb0):
 			{
 				//greaterequals
 				ASObject* v2=context->runtime_stack_pop();
@@ -1140,22 +1473,21 @@ ASObject* ABCVm::executeFunction(SyntheticFunction* function, call_context* cont
 
 				ASObject* ret=abstract_b(greaterEquals(v1, v2));
 				context->runtime_stack_push(ret);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0xb2:
+			INSTRUCTION(0xb2):
 			{
 				//istype
-				u30 t;
-				code >> t;
+				uint32_t t=instr->arg1;
 				multiname* name=context->context->getMultiname(t,context);
 
 				ASObject* v1=context->runtime_stack_pop();
 
 				ASObject* ret=abstract_b(isType(v1, name));
 				context->runtime_stack_push(ret);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0xb3:
+			INSTRUCTION(0xb3):
 			{
 				//istypelate
 				ASObject* v1=context->runtime_stack_pop();
@@ -1163,9 +1495,9 @@ ASObject* ABCVm::executeFunction(SyntheticFunction* function, call_context* cont
 
 				ASObject* ret=abstract_b(isTypelate(v1, v2));
 				context->runtime_stack_push(ret);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0xb4:
+			INSTRUCTION(0xb4):
 			{
 				//in
 				ASObject* v1=context->runtime_stack_pop();
@@ -1173,52 +1505,51 @@ ASObject* ABCVm::executeFunction(SyntheticFunction* function, call_context* cont
 
 				ASObject* ret=abstract_b(in(v1, v2));
 				context->runtime_stack_push(ret);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0xc0:
+			INSTRUCTION(0xc0):
 			{
 				//increment_i
 				ASObject* val=context->runtime_stack_pop();
 				ASObject* ret=abstract_i(increment_i(val));
 				context->runtime_stack_push(ret);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0xc1:
+			INSTRUCTION(0xc1):
 			{
 				//decrement_i
 				ASObject* val=context->runtime_stack_pop();
 				ASObject* ret=abstract_i(decrement_i(val));
 				context->runtime_stack_push(ret);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0xc2:
+			INSTRUCTION(0xc2):
 			{
 				//inclocal_i
-				u30 t;
-				code >> t;
+				uint32_t t=instr->arg1;
 				incLocal_i(context, t);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0xd0:
-			case 0xd1:
-			case 0xd2:
-			case 0xd3:
+			INSTRUCTION(0xd0):
+			INSTRUCTION(0xd1):
+			INSTRUCTION(0xd2):
+			INSTRUCTION(0xd3):
 			{
 				//getlocal_n
-				int i=opcode&3;
+				int i=instr->opcode&3;
 				assert_and_throw(context->locals[i]);
 				LOG(LOG_CALLS, _("getLocal ") << i << _(": ") << context->locals[i]->toString(true) );
 				context->locals[i]->incRef();
 				context->runtime_stack_push(context->locals[i]);
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0xd4:
-			case 0xd5:
-			case 0xd6:
-			case 0xd7:
+			INSTRUCTION(0xd4):
+			INSTRUCTION(0xd5):
+			INSTRUCTION(0xd6):
+			INSTRUCTION(0xd7):
 			{
 				//setlocal_n
-				int i=opcode&3;
+				int i=instr->opcode&3;
 				LOG(LOG_CALLS, _("setLocal ") << i );
 				ASObject* obj=context->runtime_stack_pop();
 				if(context->locals[i])
@@ -1226,45 +1557,47 @@ ASObject* ABCVm::executeFunction(SyntheticFunction* function, call_context* cont
 				if(obj==NULL)
 					obj=new Undefined;
 				context->locals[i]=obj;
-				break;
-			}
-			case 0xef:
-			{
-				//debug
-				LOG(LOG_CALLS, _("debug") );
-				uint8_t debug_type;
-				u30 index;
-				uint8_t reg;
-				u30 extra;
-				code.read((char*)&debug_type,1);
-				code >> index;
-				code.read((char*)&reg,1);
-				code >> extra;
-				break;
+				NEXT_INSTRUCTION;
 			}
-			case 0xf0:
+			INSTRUCTION(OPCODE_END_OF_CODE):
+				throw ParseException("End of code in intepreter");
+			INSTRUCTION(OPCODE_INVALID_JUMP):
+				throw ParseException("Jump out of bounds in intepreter");
+			INSTRUCTION(OPCODE_GETLOCAL0_PUSHSCOPE):
 			{
-				//debugline
-				LOG(LOG_CALLS, _("debugline") );
-				u30 t;
-				code >> t;
-				break;
+				//getlocal0 followed by pushscope, skip the second instruction
+				pc++;
+				ASObject* obj=context->locals[0];
+				assert_and_throw(obj);
+				LOG(LOG_CALLS, _("getLocal0 and pushScope ") << obj);
+				obj->incRef();
+				context->scope_stack.push_back(obj);
+				NEXT_INSTRUCTION;
 			}
-			case 0xf1:
+			INSTRUCTION(OPCODE_GETLOCAL_GETPROPERTY):
 			{
-				//debugfile
-				LOG(LOG_CALLS, _("debugfile") );
-				u30 t;
-				code >> t;
-				break;
+				//getlocal followed by getproperty on a name without runtime data, skip the second instruction
+				pc++;
+				ASObject* obj=context->locals[instr->arg1];
+				assert_and_throw(obj);
+				obj->incRef();
+				multiname* name=context->context->getMultiname(instr->arg2,context);
+				context->runtime_stack_push(getProperty(obj,name,getInlineCache(body,instr)));
+				NEXT_INSTRUCTION;
 			}
 			default:
-				LOG(LOG_ERROR,_("Not intepreted instruction @") << code.tellg());
-				LOG(LOG_ERROR,_("dump ") << hex << (unsigned int)opcode << dec);
+			UNKNOWN_INSTRUCTION
+				LOG(LOG_ERROR,_("Not intepreted instruction @") << pc-1);
+				LOG(LOG_ERROR,_("dump ") << hex << instr->opcode << dec);
 				throw ParseException("Not implemented instruction in interpreter");
 		}
 	}
 
+#undef INSTRUCTION
+#undef UNKNOWN_INSTRUCTION
+#undef NEXT_INSTRUCTION
+#undef TAKE_BRANCH
+
 	//We managed to execute all the function
 	return context->runtime_stack_pop();
 }
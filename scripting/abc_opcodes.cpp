@@ -45,7 +45,169 @@ uintptr_t ABCVm::bitAnd_oi(ASObject* val1, intptr_t val2)
 	return i1&i2;
 }
 
-void ABCVm::setProperty(ASObject* value,ASObject* obj,multiname* name)
+const inline_cache::entry* inline_cache::lookup(const Class_base* c)
+{
+	if(version!=Class_base::traitsVersion)
+	{
+		//Traits have changed, all the entries are stale
+		version=Class_base::traitsVersion;
+		used=0;
+		next=0;
+		return NULL;
+	}
+	for(unsigned int i=0;i<used;i++)
+	{
+		if(entries[i].cls==c)
+			return &entries[i];
+	}
+	return NULL;
+}
+
+const inline_cache::entry* inline_cache::insert(Class_base* c, obj_var* var, const instance_shape* shape, int32_t index)
+{
+	entry* ret;
+	if(used<SIZE)
+		ret=&entries[used++];
+	else
+	{
+		//Megamorphic site, replace entries in round robin
+		ret=&entries[next];
+		next=(next+1)%SIZE;
+	}
+	ret->cls=c;
+	ret->var=var;
+	ret->shape=shape;
+	ret->index=index;
+	return ret;
+}
+
+const inline_cache::entry* ABCVm::getCacheEntry(ASObject* obj, const multiname& name, inline_cache* cache, bool settable)
+{
+	Class_base* c=obj->prototype;
+	//The cached traits are only valid if the lookup starts from the class of the object
+	if(cache==NULL || c==NULL || obj->cur_level!=c->max_level)
+		return NULL;
+	//Arrays and classes have their own lookup
+	if(obj->getObjectType()==T_ARRAY || obj->getObjectType()==T_CLASS)
+		return NULL;
+
+	const inline_cache::entry* ret=cache->lookup(c);
+	if(ret)
+		return ret;
+
+	//Look for the trait on the class chain, like [gs]etVariableByMultiname do for borrowed traits
+	obj_var* var=NULL;
+	const instance_shape* shape=NULL;
+	int32_t index=inline_cache::UNKNOWN_INDEX;
+	if(!c->isSubClass(Class<Proxy>::getClass()) && !c->isSubClass(Class<Dictionary>::getClass()) &&
+		!c->isSubClass(Class<ByteArray>::getClass()))
+	{
+		for(Class_base* cur=c;cur;cur=cur->super)
+		{
+			obj_var* v=cur->Variables.findObjVar(name,false,true);
+			if(v && (v->var || (settable?v->setter:v->getter)))
+			{
+				var=v;
+				break;
+			}
+		}
+
+		//If the object still has the layout of its class the own variable is the same for
+		//all the instances sharing it
+		const instance_shape* instanceShape=c->instanceShape;
+		if(obj->Variables.shape!=NULL && obj->Variables.shape==instanceShape)
+		{
+			shape=instanceShape;
+			obj_var* own=(settable)?obj->findSettable(name,false):obj->findGettable(name);
+			if(own==NULL)
+				index=inline_cache::NOT_OWN;
+			else
+				index=own-&obj->Variables.values[0];
+		}
+	}
+	return cache->insert(c,var,shape,index);
+}
+
+obj_var* ABCVm::findCachedVar(ASObject* obj, const multiname& name, const inline_cache::entry* e, bool settable)
+{
+	if(e->shape!=NULL && obj->Variables.shape==e->shape)
+	{
+		//The layout tells where the variable is without searching the map
+		if(e->index>=0)
+			return &obj->Variables.values[e->index];
+		else if(e->index==inline_cache::NOT_OWN)
+			return e->var;
+	}
+
+	//Variables of the object itself take precedence over borrowed traits
+	obj_var* var=(settable)?obj->findSettable(name,false):obj->findGettable(name);
+	if(var==NULL)
+		var=e->var;
+	return var;
+}
+
+ASObject* ABCVm::getVariableCached(ASObject* obj, const multiname& name, bool skip_impl, inline_cache* cache)
+{
+	const inline_cache::entry* e=getCacheEntry(obj,name,cache,false);
+	if(e==NULL || !e->usable())
+		return obj->getVariableByMultiname(name,skip_impl);
+
+	obj->check();
+	obj_var* var=findCachedVar(obj,name,e,false);
+	if(var==NULL)
+		return obj->getVariableByMultiname(name,skip_impl);
+
+	if(var->getter)
+	{
+		LOG(LOG_CALLS,_("Calling the getter"));
+		obj->incRef();
+		ASObject* ret=var->getter->call(obj,NULL,0);
+		LOG(LOG_CALLS,_("End of getter"));
+		assert_and_throw(ret);
+		//The returned value is already owned by the caller
+		ret->fake_decRef();
+		return ret;
+	}
+	assert_and_throw(!var->setter);
+	assert_and_throw(var->var);
+	return var->var;
+}
+
+void ABCVm::setVariableCached(ASObject* obj, const multiname& name, ASObject* value, inline_cache* cache)
+{
+	const inline_cache::entry* e=getCacheEntry(obj,name,cache,true);
+	if(e==NULL || !e->usable())
+	{
+		obj->setVariableByMultiname(name,value);
+		return;
+	}
+
+	obj->check();
+	obj_var* var=findCachedVar(obj,name,e,true);
+	if(var==NULL)
+	{
+		obj->setVariableByMultiname(name,value);
+		return;
+	}
+
+	if(var->setter)
+	{
+		LOG(LOG_CALLS,_("Calling the setter"));
+		obj->incRef();
+		ASObject* ret=var->setter->call(obj,&value,1);
+		assert_and_throw(ret==NULL);
+		LOG(LOG_CALLS,_("End of setter"));
+	}
+	else
+	{
+		assert_and_throw(!var->getter);
+		if(var->var)
+			var->var->decRef();
+		var->var=value;
+	}
+}
+
+void ABCVm::setProperty(ASObject* value,ASObject* obj,multiname* name,inline_cache* cache)
 {
 	LOG(LOG_CALLS,_("setProperty ") << *name << ' ' << obj);
 
@@ -54,7 +216,7 @@ void ABCVm::setProperty(ASObject* value,ASObject* obj,multiname* name)
 	if(tl.cur_this==obj)
 		obj->resetLevel();
 
-	obj->setVariableByMultiname(*name,value);
+	setVariableCached(obj,*name,value,cache);
 	if(tl.cur_this==obj)
 		obj->setLevel(tl.cur_level);
 
@@ -90,6 +252,22 @@ bool ABCVm::convert_b(ASObject* o)
 	return ret;
 }
 
+bool ABCVm::checkLocalType(ASObject* o, intptr_t type)
+{
+	//The reference is not consumed, the guarded value stays in the locals
+	switch(type)
+	{
+		case STACK_INT:
+			return o->getObjectType()==T_INTEGER;
+		case STACK_NUMBER:
+			return o->getObjectType()==T_NUMBER || o->getObjectType()==T_INTEGER;
+		case STACK_BOOLEAN:
+			return o->getObjectType()==T_BOOLEAN;
+		default:
+			return true;
+	}
+}
+
 uintptr_t ABCVm::convert_u(ASObject* o)
 {
 	LOG(LOG_CALLS, _("convert_u") );
@@ -254,7 +432,7 @@ uintptr_t ABCVm::bitOr(ASObject* val2, ASObject* val1)
 	return i1|i2;
 }
 
-void ABCVm::callProperty(call_context* th, int n, int m)
+void ABCVm::callProperty(call_context* th, int n, int m, inline_cache* cache)
 {
 	ASObject** args=new ASObject*[m];
 	for(int i=0;i<m;i++)
@@ -273,7 +451,7 @@ void ABCVm::callProperty(call_context* th, int n, int m)
 		obj->resetLevel();
 
 	//We should skip the special implementation of get
-	ASObject* o=obj->getVariableByMultiname(*name, true);
+	ASObject* o=getVariableCached(obj,*name,true,cache);
 
 	if(tl.cur_this==obj)
 		obj->setLevel(tl.cur_level);
@@ -372,7 +550,7 @@ intptr_t ABCVm::getProperty_i(ASObject* obj, multiname* name)
 	return ret;
 }
 
-ASObject* ABCVm::getProperty(ASObject* obj, multiname* name)
+ASObject* ABCVm::getProperty(ASObject* obj, multiname* name, inline_cache* cache)
 {
 	LOG(LOG_CALLS, _("getProperty ") << *name << ' ' << obj);
 
@@ -381,7 +559,7 @@ ASObject* ABCVm::getProperty(ASObject* obj, multiname* name)
 	if(tl.cur_this==obj)
 		obj->resetLevel();
 
-	ASObject* ret=obj->getVariableByMultiname(*name);
+	ASObject* ret=getVariableCached(obj,*name,false,cache);
 
 	if(tl.cur_this==obj)
 		obj->setLevel(tl.cur_level);
@@ -751,7 +929,7 @@ ASObject* ABCVm::typeOf(ASObject* obj)
 	return Class<ASString>::getInstanceS(ret);
 }
 
-void ABCVm::callPropVoid(call_context* th, int n, int m)
+void ABCVm::callPropVoid(call_context* th, int n, int m, inline_cache* cache)
 {
 	multiname* name=th->context->getMultiname(n,th); 
 	LOG(LOG_CALLS,_("callPropVoid ") << *name << ' ' << m);
@@ -770,7 +948,7 @@ void ABCVm::callPropVoid(call_context* th, int n, int m)
 		obj->resetLevel();
 
 	//We should skip the special implementation of get
-	ASObject* o=obj->getVariableByMultiname(*name,true);
+	ASObject* o=getVariableCached(obj,*name,true,cache);
 
 	if(tl.cur_this==obj)
 		obj->setLevel(tl.cur_level);
@@ -2361,9 +2539,7 @@ ASObject* ABCVm::newFunction(call_context* th, int n)
 
 	method_info* m=&th->context->methods[n];
 	SyntheticFunction* f=Class<IFunction>::getSyntheticFunction(m);
-	f->func_scope=th->scope_stack;
-	for(unsigned int i=0;i<f->func_scope.size();i++)
-		f->func_scope[i]->incRef();
+	f->acquireScope(th->scope_stack);
 
 	//Bind the function to null, as this is not a class method
 	f->bind(NULL,-1);
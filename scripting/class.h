@@ -128,7 +128,9 @@ public:
 	}
 	static Class<T>* getClass()
 	{
-		return getClass(QName(ClassName<T>::name,ClassName<T>::ns));
+		//The name is interned once
+		static const QName name(ClassName<T>::name,ClassName<T>::ns);
+		return getClass(name);
 	}
 	static T* cast(ASObject* o)
 	{
@@ -182,7 +184,9 @@ public:
 	}
 	static Class<ASObject>* getClass()
 	{
-		return getClass(QName(ClassName<ASObject>::name,ClassName<ASObject>::ns));
+		//The name is interned once
+		static const QName name(ClassName<ASObject>::name,ClassName<ASObject>::ns);
+		return getClass(name);
 	}
 	static ASObject* cast(ASObject* o)
 	{
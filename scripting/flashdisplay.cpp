@@ -30,6 +30,7 @@
 #include "compat.h"
 #include "class.h"
 #include "backends/rendering.h"
+#include "backends/renderer.h"
 #include "compat.h"
 
 #include <GL/glew.h>
@@ -365,16 +366,17 @@ void Sprite::Render()
 		return;
 
 	MatrixApplier ma(getMatrix());
+	rt->renderer->pushColorTransform(ColorTransform);
 
 	//Draw the dynamically added graphics, if any
 	if(graphics)
 	{
 		//Should clean only the bounds of the graphics
 		if(!isSimple())
-			rt->glAcquireTempBuffer(t1,t2,t3,t4);
+			rt->renderer->beginLayer(t1,t2,t3,t4);
 		graphics->Render();
 		if(!isSimple())
-			rt->glBlitTempBuffer(t1,t2,t3,t4);
+			rt->renderer->endLayer(t1,t2,t3,t4,alpha);
 	}
 	
 	{
@@ -384,6 +386,7 @@ void Sprite::Render()
 		for(;it!=dynamicDisplayList.end();it++)
 			(*it)->Render();
 	}
+	rt->renderer->popColorTransform();
 	ma.unapply();
 }
 
@@ -649,6 +652,7 @@ void MovieClip::Render()
 		return;
 
 	MatrixApplier ma(getMatrix());
+	rt->renderer->pushColorTransform(ColorTransform);
 	//Save current frame, this may change during rendering
 	uint32_t curFP=state.FP;
 
@@ -671,12 +675,13 @@ void MovieClip::Render()
 	{
 		//Should clean only the bounds of the graphics
 		if(!isSimple())
-			rt->glAcquireTempBuffer(t1,t2,t3,t4);
+			rt->renderer->beginLayer(t1,t2,t3,t4);
 		graphics->Render();
 		if(!isSimple())
-			rt->glBlitTempBuffer(t1,t2,t3,t4);
+			rt->renderer->endLayer(t1,t2,t3,t4,alpha);
 	}
 
+	rt->renderer->popColorTransform();
 	ma.unapply();
 }
 
@@ -856,6 +861,12 @@ DisplayObject::~DisplayObject()
 		loaderInfo->decRef();
 }
 
+void DisplayObject::enumerateLinks(std::vector<ASObject*>& links)
+{
+	if(parent)
+		links.push_back(parent);
+}
+
 void DisplayObject::sinit(Class_base* c)
 {
 	c->setConstructor(Class<IFunction>::getFunction(_constructor));
@@ -953,21 +964,26 @@ void DisplayObject::setOnStage(bool staged)
 		onStage=staged;
 		if(getVm()==NULL)
 			return;
-		if(onStage==true && hasEventListener("addedToStage"))
+		if(onStage==true && hasEventListener(ET_ADDED_TO_STAGE))
 		{
-			Event* e=Class<Event>::getInstanceS("addedToStage");
+			Event* e=Event::getPooled<Event>(getVm()->event_manager,ET_ADDED_TO_STAGE);
 			getVm()->addEvent(this,e);
 			e->decRef();
 		}
-		else if(onStage==false && hasEventListener("removedFromStage"))
+		else if(onStage==false && hasEventListener(ET_REMOVED_FROM_STAGE))
 		{
-			Event* e=Class<Event>::getInstanceS("removedFromStage");
+			Event* e=Event::getPooled<Event>(getVm()->event_manager,ET_REMOVED_FROM_STAGE);
 			getVm()->addEvent(this,e);
 			e->decRef();
 		}
 	}
 }
 
+EventDispatcher* DisplayObject::getEventParent() const
+{
+	return parent;
+}
+
 ASFUNCTIONBODY(DisplayObject,_setAlpha)
 {
 	DisplayObject* th=static_cast<DisplayObject*>(obj);
@@ -1353,6 +1369,33 @@ DisplayObjectContainer::~DisplayObjectContainer()
 	}
 }
 
+bool DisplayObjectContainer::enumerateRefs(std::vector<ASObject*>& refs)
+{
+	{
+		Locker l(mutexDisplayList);
+		list<DisplayObject*>::const_iterator it=dynamicDisplayList.begin();
+		for(;it!=dynamicDisplayList.end();it++)
+			refs.push_back(*it);
+	}
+	return InteractiveObject::enumerateRefs(refs);
+}
+
+void DisplayObjectContainer::clearRefs()
+{
+	{
+		Locker l(mutexDisplayList);
+		//The children may outlive this container, so they must not point to it anymore
+		list<DisplayObject*>::iterator it=dynamicDisplayList.begin();
+		for(;it!=dynamicDisplayList.end();it++)
+		{
+			(*it)->parent=NULL;
+			(*it)->decRef();
+		}
+		dynamicDisplayList.clear();
+	}
+	InteractiveObject::clearRefs();
+}
+
 InteractiveObject::InteractiveObject():id(0)
 {
 }
@@ -1392,7 +1435,7 @@ void InteractiveObject::RenderProloue()
 {
 	rt->pushId();
 	rt->currentId=id;
-	FILLSTYLE::fixedColor(id,id,id);
+	rt->renderer->setFixedColor(id,id,id);
 }
 
 void InteractiveObject::RenderEpilogue()
@@ -1732,15 +1775,17 @@ void Shape::Render()
 		return;
 
 	MatrixApplier ma(getMatrix());
+	rt->renderer->pushColorTransform(ColorTransform);
 
 	if(!isSimple())
-		rt->glAcquireTempBuffer(t1,t2,t3,t4);
+		rt->renderer->beginLayer(t1,t2,t3,t4);
 
 	graphics->Render();
 
 	if(!isSimple())
-		rt->glBlitTempBuffer(t1,t2,t3,t4);
+		rt->renderer->endLayer(t1,t2,t3,t4,alpha);
 	
+	rt->renderer->popColorTransform();
 	ma.unapply();
 }
 
@@ -1911,7 +1956,7 @@ bool Graphics::getBounds(number_t& xmin, number_t& xmax, number_t& ymin, number_
 		geometry.clear();
 		builder.outputShapes(geometry);
 		for(unsigned int i=0;i<geometry.size();i++)
-			geometry[i].BuildFromEdges(&styles);
+			geometry[i].BuildFromEdges(&styles,triangulator);
 	}
 	if(geometry.size()==0)
 		return false;
@@ -2102,7 +2147,7 @@ void Graphics::Render()
 		geometry.clear();
 		builder.outputShapes(geometry);
 		for(unsigned int i=0;i<geometry.size();i++)
-			geometry[i].BuildFromEdges(&styles);
+			geometry[i].BuildFromEdges(&styles,triangulator);
 	}
 
 	for(unsigned int i=0;i<geometry.size();i++)
@@ -51,6 +51,8 @@ private:
 protected:
 	MATRIX getMatrix() const;
 	void valFromMatrix();
+	//The parent does not hold a reference, but it is reachable from the child
+	void enumerateLinks(std::vector<ASObject*>& links);
 	RootMovieClip* root;
 	LoaderInfo* loaderInfo;
 	int computeWidth();
@@ -84,6 +86,7 @@ public:
 	}
 	virtual void setRoot(RootMovieClip* root);
 	virtual void setOnStage(bool staged);
+	EventDispatcher* getEventParent() const;
 	RootMovieClip* getRoot() { return root; }
 	virtual Vector2 debugRender(FTFont* font, bool deep)
 	{
@@ -153,6 +156,8 @@ protected:
 	mutable Mutex mutexDisplayList;
 	void setRoot(RootMovieClip* r);
 	void setOnStage(bool staged);
+	bool enumerateRefs(std::vector<ASObject*>& refs);
+	void clearRefs();
 public:
 	void dumpDisplayList();
 	void _removeChild(DisplayObject*);
@@ -178,6 +183,7 @@ private:
 	//builder and geometry are used by RenderThread and ABCVm
 	mutable Mutex builderMutex;
 	mutable ShapesBuilder builder;
+	mutable Triangulator triangulator;
 	mutable Mutex geometryMutex;
 	mutable bool validGeometry;
 	mutable std::vector<GeomShape> geometry;
@@ -270,6 +276,7 @@ private:
 public:
 	Loader():local_root(NULL),loading(false),loaded(false),content(NULL)
 	{
+		blocking=true;
 	}
 	static void sinit(Class_base* c);
 	static void buildTraits(ASObject* o);
@@ -55,8 +55,50 @@ void IEventDispatcher::linkTraits(Class_base* c)
 	lookupAndLink(c,"hasEventListener","flash.events:IEventDispatcher");
 }
 
-Event::Event(const tiny_string& t, bool b):type(t),target(NULL),currentTarget(NULL),bubbles(b)
+//Must be in the order of EVENT_TYPE_ID, the table never changes so it's read without locking
+static const char* const wellKnownTypes[ET_WELL_KNOWN_COUNT]={"enterFrame","added","addedToStage","removedFromStage",
+	"mouseDown","mouseUp","click","mouseMove","timer","progress","complete","init"};
+
+namespace
+{
+struct well_known_atoms
+{
+	uint32_t atoms[ET_WELL_KNOWN_COUNT];
+	well_known_atoms()
+	{
+		for(uint32_t i=0;i<ET_WELL_KNOWN_COUNT;i++)
+			atoms[i]=Atoms::intern(wellKnownTypes[i]);
+	}
+};
+};
+
+Event::Event(const tiny_string& t, bool b):type(t),typeAtom(Atoms::INVALID),target(NULL),currentTarget(NULL),bubbles(b)
+{
+}
+
+const char* Event::getTypeName(uint32_t id)
+{
+	assert_and_throw(id<ET_WELL_KNOWN_COUNT);
+	return wellKnownTypes[id];
+}
+
+uint32_t Event::getWellKnownAtom(uint32_t id)
+{
+	assert_and_throw(id<ET_WELL_KNOWN_COUNT);
+	//Interned the first time they are needed
+	static const well_known_atoms table;
+	return table.atoms[id];
+}
+
+uint32_t Event::getTypeAtom()
 {
+	if(typeAtom!=Atoms::INVALID)
+		return typeAtom;
+	const uint32_t ret=Atoms::find(type);
+	//Runtime names are released when they have no listeners anymore, and their atoms reused
+	if(ret!=Atoms::INVALID && (ret&Atoms::RUNTIME)==0)
+		typeAtom=ret;
+	return ret;
 }
 
 Event::~Event()
@@ -107,6 +149,7 @@ ASFUNCTIONBODY(Event,_constructor)
 		}
 		assert_and_throw(args[0]->getObjectType()==T_STRING);
 		th->type=args[0]->toString();
+		th->typeAtom=Atoms::INVALID;
 	}
 	return NULL;
 }
@@ -242,6 +285,50 @@ EventDispatcher::EventDispatcher():handlersMutex("handlersMutex")
 {
 }
 
+EventDispatcher::~EventDispatcher()
+{
+	//The listeners own the functions
+	if(!sys->finalizingDestruction)
+		clearHandlers();
+}
+
+void EventDispatcher::clearHandlers()
+{
+	//Releasing the functions may destroy other objects, don't hold the lock meanwhile
+	std::map<uint32_t,std::vector<listener> > tmpHandlers;
+	{
+		Locker l(handlersMutex);
+		tmpHandlers.swap(handlers);
+	}
+	std::map<uint32_t,std::vector<listener> >::iterator it=tmpHandlers.begin();
+	for(;it!=tmpHandlers.end();++it)
+	{
+		for(uint32_t i=0;i<it->second.size();i++)
+			it->second[i].f->decRef();
+		Atoms::decRef(it->first);
+	}
+}
+
+bool EventDispatcher::enumerateRefs(std::vector<ASObject*>& refs)
+{
+	{
+		Locker l(handlersMutex);
+		std::map<uint32_t,std::vector<listener> >::const_iterator it=handlers.begin();
+		for(;it!=handlers.end();++it)
+		{
+			for(uint32_t i=0;i<it->second.size();i++)
+				refs.push_back(it->second[i].f);
+		}
+	}
+	return ASObject::enumerateRefs(refs);
+}
+
+void EventDispatcher::clearRefs()
+{
+	clearHandlers();
+	ASObject::clearRefs();
+}
+
 void EventDispatcher::sinit(Class_base* c)
 {
 	c->setConstructor(Class<IFunction>::getFunction(_constructor));
@@ -263,9 +350,9 @@ void EventDispatcher::buildTraits(ASObject* o)
 
 void EventDispatcher::dumpHandlers()
 {
-	std::map<tiny_string,list<listener> >::iterator it=handlers.begin();
+	std::map<uint32_t,vector<listener> >::iterator it=handlers.begin();
 	for(;it!=handlers.end();it++)
-		std::cout << it->first << std::endl;
+		std::cout << Atoms::getString(it->first) << std::endl;
 }
 
 ASFUNCTIONBODY(EventDispatcher,addEventListener)
@@ -287,24 +374,33 @@ ASFUNCTIONBODY(EventDispatcher,addEventListener)
 	if(argslen>=4)
 		priority=args[3]->toInt();
 
-	if(useCapture || priority!=0)
-		LOG(LOG_NOT_IMPLEMENTED,_("Not implemented mode for addEventListener"));
-
-	const tiny_string& eventName=args[0]->toString();
+	//The type is kept in the table as long as it has listeners
+	const uint32_t typeAtom=Atoms::acquire(args[0]->toString());
 	IFunction* f=static_cast<IFunction*>(args[1]);
 
 	{
 		Locker l(th->handlersMutex);
-		std::map<tiny_string,std::list<listener> >::iterator it=th->handlers.insert(make_pair(eventName,list<listener>())).first;
-
-		if(find(it->second.begin(),it->second.end(),f)!=it->second.end())
+		map<uint32_t, vector<listener> >::iterator h=th->handlers.find(typeAtom);
+		if(h==th->handlers.end())
+			h=th->handlers.insert(make_pair(typeAtom,vector<listener>())).first;
+		else
+			Atoms::decRef(typeAtom);
+		vector<listener>& listeners=h->second;
+		//Listeners with the same priority are called in registration order
+		uint32_t pos=listeners.size();
+		for(uint32_t i=0;i<listeners.size();i++)
 		{
-			LOG(LOG_CALLS,_("Weird event reregistration"));
-			return NULL;
+			if(listeners[i].matches(f,useCapture))
+			{
+				LOG(LOG_CALLS,_("Weird event reregistration"));
+				return NULL;
+			}
+			if(pos==listeners.size() && listeners[i].priority<priority)
+				pos=i;
 		}
 
 		f->incRef();
-		it->second.push_back(listener(f));
+		listeners.insert(listeners.begin()+pos,listener(f,priority,useCapture));
 	}
 
 	return NULL;
@@ -330,9 +426,14 @@ ASFUNCTIONBODY(EventDispatcher,removeEventListener)
 	if(args[0]->getObjectType()!=T_STRING || args[1]->getObjectType()!=T_FUNCTION)
 		throw RunTimeException("Type mismatch in EventDispatcher::removeEventListener");
 
+	bool useCapture=false;
+	if(argslen>=3)
+		useCapture=Boolean_concrete(args[2]);
+
 	{
 		Locker l(th->handlersMutex);
-		map<tiny_string, list<listener> >::iterator h=th->handlers.find(args[0]->toString());
+		//The atom can't be released meanwhile, as the lock is held
+		map<uint32_t, vector<listener> >::iterator h=th->handlers.find(Atoms::find(args[0]->toString()));
 		if(h==th->handlers.end())
 		{
 			LOG(LOG_CALLS,_("Event not found"));
@@ -340,12 +441,21 @@ ASFUNCTIONBODY(EventDispatcher,removeEventListener)
 		}
 
 		IFunction* f=static_cast<IFunction*>(args[1]);
-		std::list<listener>::iterator it=find(h->second.begin(),h->second.end(),f);
-		if(it!=h->second.end())
+		for(uint32_t i=0;i<h->second.size();i++)
+		{
+			if(h->second[i].matches(f,useCapture))
+			{
+				//The listener owns the function
+				h->second[i].f->decRef();
+				h->second.erase(h->second.begin()+i);
+				break;
+			}
+		}
+		//hasEventListener must not find types without listeners
+		if(h->second.empty())
 		{
-			//The listener owns the function
-			it->f->decRef();
-			h->second.erase(it);
+			Atoms::decRef(h->first);
+			th->handlers.erase(h);
 		}
 	}
 	return NULL;
@@ -372,22 +482,29 @@ ASFUNCTIONBODY(EventDispatcher,_constructor)
 	return NULL;
 }
 
-void EventDispatcher::handleEvent(Event* e)
+void EventDispatcher::handleEvent(Event* e, bool capture)
 {
 	check();
 	e->check();
 	Locker l(handlersMutex);
-	map<tiny_string, list<listener> >::iterator h=handlers.find(e->type);
+	//The atom is looked up with the lock held, so it can't be released and reused meanwhile
+	map<uint32_t, vector<listener> >::iterator h=handlers.find(e->getTypeAtom());
 	if(h==handlers.end())
 	{
 		LOG(LOG_CALLS,_("Not handled event ") << e->type);
 		return;
 	}
 
-	LOG(LOG_CALLS, _("Handling event ") << h->first);
+	LOG(LOG_CALLS, _("Handling event ") << e->type);
 
-	//Create a temporary copy of the listeners, as the list can be modified during the calls
-	vector<listener> tmpListener(h->second.begin(),h->second.end());
+	//Create a temporary copy of the listeners of this phase, as the list can be modified during the calls
+	vector<listener> tmpListener;
+	tmpListener.reserve(h->second.size());
+	for(uint32_t i=0;i<h->second.size();i++)
+	{
+		if(h->second[i].useCapture==capture)
+			tmpListener.push_back(h->second[i]);
+	}
 	l.unlock();
 	//TODO: check, ok we should also bind the level
 	for(unsigned int i=0;i<tmpListener.size();i++)
@@ -407,19 +524,24 @@ void EventDispatcher::handleEvent(Event* e)
 	}
 	
 	e->check();
-	//If the number of handlers now if 0, then purge the entry from the map
-	//TODO
 }
 
 bool EventDispatcher::hasEventListener(const tiny_string& eventName)
 {
 	Locker l(handlersMutex);
-	if(handlers.find(eventName)==handlers.end())
+	if(handlers.find(Atoms::find(eventName))==handlers.end())
 		return false;
 	else
 		return true;
 }
 
+bool EventDispatcher::hasEventListener(uint32_t typeId)
+{
+	const uint32_t typeAtom=Event::getWellKnownAtom(typeId);
+	Locker l(handlersMutex);
+	return handlers.find(typeAtom)!=handlers.end();
+}
+
 NetStatusEvent::NetStatusEvent(const tiny_string& l, const tiny_string& c):Event("netStatus"),level(l),code(c)
 {
 }
@@ -24,6 +24,9 @@
 #include "asobject.h"
 #include "toplevel.h"
 #include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
 #include <semaphore.h>
 
 #undef MOUSE_EVENT
@@ -33,13 +36,19 @@ namespace lightspark
 
 enum EVENT_TYPE { EVENT=0,BIND_CLASS, SHUTDOWN, SYNC, MOUSE_EVENT, FUNCTION, CONTEXT_INIT, CONSTRUCT_OBJECT, CHANGE_FRAME };
 
+//Ids of the event types sent by the player itself, their names are interned for good
+enum EVENT_TYPE_ID { ET_ENTER_FRAME=0, ET_ADDED, ET_ADDED_TO_STAGE, ET_REMOVED_FROM_STAGE, ET_MOUSE_DOWN, ET_MOUSE_UP,
+	ET_CLICK, ET_MOUSE_MOVE, ET_TIMER, ET_PROGRESS, ET_COMPLETE, ET_INIT, ET_WELL_KNOWN_COUNT };
+
 class ABCContext;
 
 class Event: public ASObject
 {
 public:
-	Event():type("Event"),target(NULL),currentTarget(NULL),bubbles(false){}
+	Event():type("Event"),typeAtom(Atoms::INVALID),target(NULL),currentTarget(NULL),bubbles(false){}
 	Event(const tiny_string& t, bool b=false);
+	//Used by the event pools of the VM
+	Event(Manager* m):ASObject(m),type("Event"),typeAtom(Atoms::INVALID),target(NULL),currentTarget(NULL),bubbles(false){}
 	virtual ~Event();
 	static void sinit(Class_base*);
 	static void buildTraits(ASObject* o);
@@ -47,7 +56,38 @@ public:
 	ASFUNCTION(_getType);
 	ASFUNCTION(_getTarget);
 	virtual EVENT_TYPE getEventType() {return EVENT;}
+	static const char* getTypeName(uint32_t id);
+	//The atom of a type of EVENT_TYPE_ID
+	static uint32_t getWellKnownAtom(uint32_t id);
+	//The atom of the type, INVALID if the type is not in the table and so has no listeners
+	uint32_t getTypeAtom();
+	//Broadcast events are only sent to the target, without capture and bubbling phases
+	bool isBroadcast()
+	{
+		return getTypeAtom()==getWellKnownAtom(ET_ENTER_FRAME);
+	}
+	/**
+		Takes an event from a pool, or builds a new one if the pool is empty. Events go back
+		to the pool when they are released
+
+		@param m The pool, it must be shared between threads
+	*/
+	template<class T>
+	static T* getPooled(Manager* m, uint32_t id, bool b=false)
+	{
+		T* ret=m->get<T>();
+		//The event may have been recycled
+		ret->type=getTypeName(id);
+		ret->typeAtom=getWellKnownAtom(id);
+		ret->bubbles=b;
+		ret->target=NULL;
+		ret->currentTarget=NULL;
+		return ret;
+	}
 	tiny_string type;
+	//Atom of the type once known, only atoms which are never released are kept.
+	//It must be reset when type is changed
+	uint32_t typeAtom;
 	//Altough events may be recycled and sent to more than a handler, the target property is set before sending
 	//and the handling is serialized
 	ASObject* target;
@@ -185,6 +225,7 @@ class TimerEvent: public Event
 public:
 	TimerEvent():Event("DEPRECATED"){}
 	TimerEvent(const tiny_string& t):Event(t){};
+	TimerEvent(Manager* m):Event(m){}
 	static void sinit(Class_base*);
 	static void buildTraits(ASObject* o)
 	{
@@ -196,6 +237,7 @@ class MouseEvent: public Event
 public:
 	MouseEvent();
 	MouseEvent(const tiny_string& t, bool b=true);
+	MouseEvent(Manager* m):Event(m){}
 	static void sinit(Class_base*);
 	static void buildTraits(ASObject* o);
 	EVENT_TYPE getEventType(){ return MOUSE_EVENT;}
@@ -206,11 +248,13 @@ class listener
 friend class EventDispatcher;
 private:
 	IFunction* f;
+	int32_t priority;
+	bool useCapture;
 public:
-	explicit listener(IFunction* _f):f(_f){};
-	bool operator==(IFunction* r)
+	listener(IFunction* _f, int32_t p, bool c):f(_f),priority(p),useCapture(c){};
+	bool matches(IFunction* r, bool c) const
 	{
-		return f->isEqual(r);
+		return useCapture==c && f->isEqual(r);
 	}
 };
 
@@ -224,15 +268,29 @@ class EventDispatcher: public ASObject
 {
 private:
 	Mutex handlersMutex;
-	std::map<tiny_string,std::list<listener> > handlers;
+	//Listeners by atom of the event type, sorted by decreasing priority and then by registration.
+	//Each key holds a reference to the atom, so only the types with listeners are in the table
+	std::map<uint32_t,std::vector<listener> > handlers;
+	void clearHandlers();
+protected:
+	bool enumerateRefs(std::vector<ASObject*>& refs);
+	void clearRefs();
 public:
 	EventDispatcher();
 	static void sinit(Class_base*);
 	static void buildTraits(ASObject* o);
-	virtual ~EventDispatcher(){}
-	void handleEvent(Event* e);
+	virtual ~EventDispatcher();
+	//Calls the listeners for the capture phase or for the target and bubbling phases
+	void handleEvent(Event* e, bool capture=false);
 	void dumpHandlers();
 	bool hasEventListener(const tiny_string& eventName);
+	//The type is one of EVENT_TYPE_ID
+	bool hasEventListener(uint32_t typeId);
+	//The next dispatcher of the propagation path, if any. Only display objects have one
+	virtual EventDispatcher* getEventParent() const
+	{
+		return NULL;
+	}
 
 	ASFUNCTION(_constructor);
 	ASFUNCTION(addEventListener);
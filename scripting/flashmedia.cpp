@@ -22,6 +22,7 @@
 #include "compat.h"
 #include <iostream>
 #include "backends/rendering.h"
+#include "backends/renderer.h"
 
 using namespace lightspark;
 using namespace std;
@@ -90,13 +91,7 @@ void Video::inputRender()
 		videoHeight=netStream->getVideoHeight();
 
 		MatrixApplier ma(getMatrix());
-
-		glBegin(GL_QUADS);
-			glVertex2i(0,0);
-			glVertex2i(width,0);
-			glVertex2i(width,height);
-			glVertex2i(0,height);
-		glEnd();
+		rt->renderer->drawRect(0,0,width,height);
 		ma.unapply();
 		netStream->unlock();
 	}
@@ -105,6 +100,11 @@ void Video::inputRender()
 
 void Video::Render()
 {
+	if(!rt->renderer->isAccelerated())
+	{
+		renderPlaceholder();
+		return;
+	}
 	if(!initialized)
 	{
 		videoTexture.init(0,0,GL_LINEAR);
@@ -123,7 +123,7 @@ void Video::Render()
 		MatrixApplier ma(getMatrix());
 
 		if(!isSimple())
-			rt->glAcquireTempBuffer(0,width,0,height);
+			rt->renderer->beginLayer(0,width,0,height);
 
 		bool frameReady=netStream->copyFrameToTexture(videoTexture);
 		videoTexture.bind();
@@ -150,7 +150,7 @@ void Video::Render()
 		}
 
 		if(!isSimple())
-			rt->glBlitTempBuffer(0,width,0,height);
+			rt->renderer->endLayer(0,width,0,height,alpha);
 		
 		ma.unapply();
 		netStream->unlock();
@@ -158,6 +158,25 @@ void Video::Render()
 	sem_post(&mutex);
 }
 
+void Video::renderPlaceholder()
+{
+	//Frames are decoded into textures, so without OpenGL only the area of the video is drawn
+	sem_wait(&mutex);
+	if(netStream && netStream->lockIfReady())
+	{
+		videoWidth=netStream->getVideoWidth();
+		videoHeight=netStream->getVideoHeight();
+		MatrixApplier ma(getMatrix());
+		rt->renderer->pushColorTransform(ColorTransform);
+		rt->renderer->setFixedColor(0,0,0);
+		rt->renderer->drawRect(0,0,width,height);
+		rt->renderer->popColorTransform();
+		ma.unapply();
+		netStream->unlock();
+	}
+	sem_post(&mutex);
+}
+
 bool Video::getBounds(number_t& xmin, number_t& xmax, number_t& ymin, number_t& ymax) const
 {
 	xmin=0;
@@ -53,6 +53,8 @@ private:
 	bool initialized;
 	TextureBuffer videoTexture;
 	NetStream* netStream;
+	//Used when the renderer has no textures
+	void renderPlaceholder();
 public:
 	Video():width(320),height(240),videoWidth(0),videoHeight(0),initialized(false),videoTexture(false),netStream(NULL)
 	{
@@ -79,6 +79,7 @@ ASFUNCTIONBODY(URLRequest,_getURL)
 
 URLLoader::URLLoader():dataFormat("text"),data(NULL),downloader(NULL),executingAbort(false)
 {
+	blocking=true;
 }
 
 void URLLoader::sinit(Class_base* c)
@@ -383,6 +384,7 @@ NetStream::NetStream():frameRate(0),tickStarted(false),downloader(NULL),videoDec
 		paused(false),closed(true)
 {
 	sem_init(&mutex,0,1);
+	blocking=true;
 }
 
 NetStream::~NetStream()
@@ -84,6 +84,11 @@ private:
 	volatile bool executingAbort;
 	void execute();
 	void threadAbort();
+	//The thread pool may still be using us
+	bool enumerateRefs(std::vector<ASObject*>& refs)
+	{
+		return false;
+	}
 public:
 	URLLoader();
 	static void sinit(Class_base*);
@@ -135,6 +140,11 @@ private:
 	AudioStream *audioStream;
 	uint32_t streamTime;
 	sem_t mutex;
+	//The thread pool and the timer may still be using us
+	bool enumerateRefs(std::vector<ASObject*>& refs)
+	{
+		return false;
+	}
 	//IThreadJob interface for long jobs
 	void execute();
 	void threadAbort();
@@ -79,9 +79,9 @@ ASFUNCTIONBODY(ApplicationDomain,hasDefinition)
 
 	multiname name;
 	name.name_type=multiname::NAME_STRING;
-	name.ns.push_back(nsNameAndKind("",NAMESPACE)); //TODO: set type
-
-	stringToQName(tmp,name.name_s,name.ns[0].name);
+	tiny_string nsName;
+	stringToQName(tmp,name.name_s,nsName);
+	name.ns.push_back(nsNameAndKind(nsName,NAMESPACE)); //TODO: set type
 
 	LOG(LOG_CALLS,_("Looking for definition of ") << name);
 	ASObject* target;
@@ -114,9 +114,9 @@ ASFUNCTIONBODY(ApplicationDomain,getDefinition)
 
 	multiname name;
 	name.name_type=multiname::NAME_STRING;
-	name.ns.push_back(nsNameAndKind("",NAMESPACE)); //TODO: set type
-
-	stringToQName(tmp,name.name_s,name.ns[0].name);
+	tiny_string nsName;
+	stringToQName(tmp,name.name_s,nsName);
+	name.ns.push_back(nsNameAndKind(nsName,NAMESPACE)); //TODO: set type
 
 	LOG(LOG_CALLS,_("Looking for definition of ") << name);
 	ASObject* target;
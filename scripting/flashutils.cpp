@@ -205,7 +205,7 @@ void ByteArray::acquireBuffer(uint8_t* buf, int bufLen)
 
 void Timer::tick()
 {
-	TimerEvent* e=Class<TimerEvent>::getInstanceS("timer");
+	TimerEvent* e=Event::getPooled<TimerEvent>(getVm()->timer_event_manager,ET_TIMER);
 	sys->currentVm->addEvent(this,e);
 	e->decRef();
 	if(repeatCount==0)
@@ -336,9 +336,11 @@ Dictionary::~Dictionary()
 {
 	if(!sys->finalizingDestruction)
 	{
-		std::map<ASObject*,ASObject*>::iterator it=data.begin();
-		for(;it!=data.end();it++)
-			it->second->decRef();
+		for(uint32_t i=0;i<entries.size();i++)
+		{
+			if(entries[i].key)
+				entries[i].value->decRef();
+		}
 	}
 }
 
@@ -356,6 +358,42 @@ ASFUNCTIONBODY(Dictionary,_constructor)
 	return NULL;
 }
 
+void Dictionary::compact()
+{
+	uint32_t j=0;
+	for(uint32_t i=0;i<entries.size();i++)
+	{
+		if(entries[i].key==NULL)
+			continue;
+		if(i!=j)
+		{
+			entries[j]=entries[i];
+			positions[entries[j].key]=j;
+		}
+		j++;
+	}
+	entries.resize(j,dict_entry(NULL,NULL));
+	holes=0;
+}
+
+void Dictionary::insertEntry(ASObject* key, ASObject* value)
+{
+	std::unordered_map<ASObject*,uint32_t>::iterator it=positions.find(key);
+	if(it!=positions.end())
+	{
+		//We already own a reference to both the key and the old value
+		dict_entry& e=entries[it->second];
+		e.value->decRef();
+		e.value=value;
+		key->decRef();
+		return;
+	}
+	if(holes>16 && holes*2>entries.size())
+		compact();
+	positions.insert(make_pair(key,(uint32_t)entries.size()));
+	entries.push_back(dict_entry(key,value));
+}
+
 void Dictionary::setVariableByMultiname_i(const multiname& name, intptr_t value)
 {
 	assert_and_throw(implEnable);
@@ -367,18 +405,17 @@ void Dictionary::setVariableByMultiname(const multiname& name, ASObject* o, ASOb
 	assert_and_throw(implEnable);
 	if(name.name_type==multiname::NAME_OBJECT)
 	{
-		//We can use the [] operator, as the value is just a pointer and there is no side effect in creating one
-		data[name.name_o]=o;
+		insertEntry(name.name_o,o);
 		//This is ugly, but at least we are sure that we own name_o
 		multiname* tmp=const_cast<multiname*>(&name);
 		tmp->name_o=NULL;
 	}
 	else if(name.name_type==multiname::NAME_STRING)
-		data[Class<ASString>::getInstanceS(name.name_s)]=o;
+		insertEntry(Class<ASString>::getInstanceS(name.name_s),o);
 	else if(name.name_type==multiname::NAME_INT)
-		data[abstract_i(name.name_i)]=o;
+		insertEntry(abstract_i(name.name_i),o);
 	else if(name.name_type==multiname::NAME_NUMBER)
-		data[abstract_d(name.name_d)]=o;
+		insertEntry(abstract_d(name.name_d),o);
 	else
 	{
 		throw UnsupportedException("Unsupported name kind in Dictionary::setVariableByMultiname");
@@ -389,20 +426,23 @@ void Dictionary::deleteVariableByMultiname(const multiname& name)
 {
 	assert_and_throw(implEnable);
 	
-	map<ASObject*, ASObject*>::iterator it;
-	getIteratorByMultiname(name, it);
-	
-	assert_and_throw(it != data.end());
+	uint32_t pos=findEntry(name);
+	assert_and_throw(pos!=entries.size());
 	
-	it->second->decRef();
-	data.erase(it);
+	dict_entry& e=entries[pos];
+	e.value->decRef();
+	positions.erase(e.key);
+	//Leave a hole, a for..in loop may be walking the entries
+	e.key=NULL;
+	e.value=NULL;
+	holes++;
 
 	//This is ugly, but at least we are sure that we own name_o
 	multiname* tmp=const_cast<multiname*>(&name);
 	tmp->name_o=NULL;
 }
 
-void Dictionary::getIteratorByMultiname(const multiname& name, map<ASObject*, ASObject*>::iterator& iter)
+uint32_t Dictionary::findEntry(const multiname& name)
 {
 	assert_and_throw(implEnable);
 	//It seems that various kind of implementation works only with the empty namespace
@@ -410,30 +450,28 @@ void Dictionary::getIteratorByMultiname(const multiname& name, map<ASObject*, AS
 	if(name.name_type==multiname::NAME_OBJECT)
 	{
 		//From specs, then === operator compare references when working on generic objects
-		map<ASObject*,ASObject*>::iterator it=data.find(name.name_o);
-		if(it != data.end())
+		std::unordered_map<ASObject*,uint32_t>::iterator it=positions.find(name.name_o);
+		if(it != positions.end())
 		{
-			iter = it;
 			//This is ugly, but at least we are sure that we own name_o
 			multiname* tmp=const_cast<multiname*>(&name);
 			tmp->name_o=NULL;
-			return;
+			return it->second;
 		}
 	}
 	else if(name.name_type==multiname::NAME_STRING)
 	{
 		//Ok, we need to do the slow lookup on every object and check for === comparison
-		map<ASObject*, ASObject*>::iterator it=data.begin();
-		for(;it!=data.end();it++)
+		for(uint32_t i=0;i<entries.size();i++)
 		{
-			if(it->first->getObjectType()==T_STRING)
+			ASObject* key=entries[i].key;
+			if(key && key->getObjectType()==T_STRING)
 			{
-				ASString* s=Class<ASString>::cast(it->first);
+				ASString* s=Class<ASString>::cast(key);
 				if(name.name_s == s->data.c_str())
 				{
 					//Value found
-					iter = it;
-					return;
+					return i;
 				}
 			}
 		}
@@ -441,17 +479,18 @@ void Dictionary::getIteratorByMultiname(const multiname& name, map<ASObject*, AS
 	else if(name.name_type==multiname::NAME_INT)
 	{
 		//Ok, we need to do the slow lookup on every object and check for === comparison
-		map<ASObject*, ASObject*>::iterator it=data.begin();
-		for(;it!=data.end();it++)
+		for(uint32_t i=0;i<entries.size();i++)
 		{
-			SWFOBJECT_TYPE type=it->first->getObjectType();
+			ASObject* key=entries[i].key;
+			if(key==NULL)
+				continue;
+			SWFOBJECT_TYPE type=key->getObjectType();
 			if(type==T_INTEGER || type==T_UINTEGER || type==T_NUMBER)
 			{
-				if(name.name_i == it->first->toNumber())
+				if(name.name_i == key->toNumber())
 				{
 					//Value found
-					iter = it;
-					return;
+					return i;
 				}
 			}
 		}
@@ -459,17 +498,18 @@ void Dictionary::getIteratorByMultiname(const multiname& name, map<ASObject*, AS
 	else if(name.name_type==multiname::NAME_NUMBER)
 	{
 		//Ok, we need to do the slow lookup on every object and check for === comparison
-		map<ASObject*, ASObject*>::iterator it=data.begin();
-		for(;it!=data.end();it++)
+		for(uint32_t i=0;i<entries.size();i++)
 		{
-			SWFOBJECT_TYPE type=it->first->getObjectType();
+			ASObject* key=entries[i].key;
+			if(key==NULL)
+				continue;
+			SWFOBJECT_TYPE type=key->getObjectType();
 			if(type==T_INTEGER || type==T_UINTEGER || type==T_NUMBER)
 			{
-				if(name.name_d == it->first->toNumber())
+				if(name.name_d == key->toNumber())
 				{
 					//Value found
-					iter = it;
-					return;
+					return i;
 				}
 			}
 		}
@@ -478,7 +518,7 @@ void Dictionary::getIteratorByMultiname(const multiname& name, map<ASObject*, AS
 	{
 		throw UnsupportedException("Unsupported name kind on Dictionary::getVariableByMultiname");
 	}
-	iter = data.end();
+	return entries.size();
 }
 
 
@@ -487,20 +527,22 @@ ASObject* Dictionary::getVariableByMultiname(const multiname& name, bool skip_im
 	assert_and_throw(!skip_impl);
 	assert_and_throw(implEnable);
 	
-	map<ASObject*, ASObject*>::iterator it;
-	getIteratorByMultiname(name, it);
+	uint32_t pos=findEntry(name);
 	
-	if (it == data.end())
+	if (pos == entries.size())
 		return new Undefined;
 		
-	it->second->incRef();
-	return it->second;
+	entries[pos].value->incRef();
+	return entries[pos].value;
 }
 
 bool Dictionary::hasNext(unsigned int& index, bool& out)
 {
 	assert_and_throw(implEnable);
-	out=index<data.size();
+	//Skip the holes left by deleted entries
+	while(index<entries.size() && entries[index].key==NULL)
+		index++;
+	out=index<entries.size();
 	index++;
 	return true;
 }
@@ -510,22 +552,18 @@ bool Dictionary::nextName(unsigned int index, ASObject*& out)
 	assert(index>0);
 	index--;
 	assert_and_throw(implEnable);
-	assert_and_throw(index<data.size());
-	map<ASObject*,ASObject*>::iterator it=data.begin();
-	for(unsigned int i=0;i<index;i++)
-		it++;
-	out=it->first;
+	assert_and_throw(index<entries.size() && entries[index].key);
+	out=entries[index].key;
+	//The caller owns the returned name
+	out->incRef();
 	return true;
 }
 
 bool Dictionary::nextValue(unsigned int index, ASObject*& out)
 {
 	assert_and_throw(implEnable);
-	assert(index<data.size());
-	map<ASObject*,ASObject*>::iterator it=data.begin();
-	for(unsigned int i=0;i<index;i++)
-		it++;
-	out=it->second;
+	assert_and_throw(index<entries.size() && entries[index].key);
+	out=entries[index].value;
 	return true;
 }
 
@@ -536,13 +574,15 @@ tiny_string Dictionary::toString(bool debugMsg)
 		
 	std::stringstream retstr;
 	retstr << "{";
-	map<ASObject*,ASObject*>::iterator it=data.begin();
-	while(it != data.end())
+	bool first=true;
+	for(uint32_t i=0;i<entries.size();i++)
 	{
-		if(it != data.begin())
+		if(entries[i].key==NULL)
+			continue;
+		if(!first)
 			retstr << ", ";
-		retstr << "{" << it->first->toString() << ", " << it->second->toString() << "}";
-		it++;
+		first=false;
+		retstr << "{" << entries[i].key->toString() << ", " << entries[i].value->toString() << "}";
 	}
 	retstr << "}";
 	
@@ -27,6 +27,7 @@
 #include "timer.h"
 
 #include <map>
+#include <unordered_map>
 
 namespace lightspark
 {
@@ -88,14 +89,28 @@ class Dictionary: public ASObject
 {
 friend class ABCVm;
 private:
-	std::map<ASObject*,ASObject*> data;
+	struct dict_entry
+	{
+		ASObject* key;
+		ASObject* value;
+		dict_entry(ASObject* k, ASObject* v):key(k),value(v){}
+	};
+	//Entries in insertion order, so that enumerating them is a plain walk. Deleted entries leave
+	//a hole (key==NULL) which is squeezed out when adding keys, not while for..in may be deleting
+	std::vector<dict_entry> entries;
+	//Position of each key in entries
+	std::unordered_map<ASObject*,uint32_t> positions;
+	uint32_t holes;
+	void insertEntry(ASObject* key, ASObject* value);
+	void compact();
+	//Returns the position of the entry, or entries.size() if not found
+	uint32_t findEntry(const multiname& name);
 public:
-	Dictionary(){}
+	Dictionary():holes(0){}
 	virtual ~Dictionary();
 	static void sinit(Class_base*);
 	static void buildTraits(ASObject* o);
 	ASFUNCTION(_constructor);
-	void getIteratorByMultiname(const multiname& name, std::map<ASObject*, ASObject*>::iterator& iter);
 	ASObject* getVariableByMultiname(const multiname& name, bool skip_impl=false, ASObject* base=NULL);
 	intptr_t getVariableByMultiname_i(const multiname& name)
 	{
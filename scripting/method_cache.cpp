@@ -0,0 +1,394 @@
+/**************************************************************************
+    Lightspark, a free flash player implementation
+
+    Copyright (C) 2009,2010  Alessandro Pignotti (a.pignotti@sssup.it)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "method_cache.h"
+#include "abc.h"
+#include "logger.h"
+#include <fstream>
+#include <sstream>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef WIN32
+#include <direct.h>
+#include <process.h>
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace lightspark;
+
+bool MethodCache::enabled=true;
+string MethodCache::directory;
+
+namespace
+{
+//Must be changed each time the decoded form or the file layout change
+const uint32_t formatVersion=1;
+const char magic[4]={'L','S','M','C'};
+//New methods are not recorded past this limit
+const uint32_t maxRecords=16384;
+//Upper bound for the vectors read from the file, to detect corruption
+const uint32_t maxVectorSize=1<<24;
+
+//64 bit FNV-1a
+const uint64_t fnvOffset=14695981039346656037ULL;
+const uint64_t fnvPrime=1099511628211ULL;
+
+inline void hashBytes(uint64_t& h, const void* data, size_t len)
+{
+	const uint8_t* p=(const uint8_t*)data;
+	for(size_t i=0;i<len;i++)
+	{
+		h^=p[i];
+		h*=fnvPrime;
+	}
+}
+
+inline void hashValue(uint64_t& h, uint32_t v)
+{
+	hashBytes(h,&v,sizeof(v));
+}
+
+template<class T>
+inline void writeValue(ostream& out, const T& v)
+{
+	out.write((const char*)&v,sizeof(T));
+}
+
+template<class T>
+inline bool readValue(istream& in, T& v)
+{
+	in.read((char*)&v,sizeof(T));
+	return in.good();
+}
+
+void writeVector(ostream& out, const vector<uint32_t>& v)
+{
+	writeValue<uint32_t>(out,v.size());
+	if(!v.empty())
+		out.write((const char*)&v[0],v.size()*sizeof(uint32_t));
+}
+
+bool readVector(istream& in, vector<uint32_t>& v)
+{
+	uint32_t size;
+	if(!readValue(in,size) || size>maxVectorSize)
+		return false;
+	v.resize(size);
+	if(size)
+		in.read((char*)&v[0],size*sizeof(uint32_t));
+	return in.good();
+}
+
+void makeDirectory(const string& path)
+{
+	//Errors, like the directory already existing, are detected when writing the file
+#ifdef WIN32
+	_mkdir(path.c_str());
+#else
+	mkdir(path.c_str(),0755);
+#endif
+}
+};
+
+MethodCache::MethodCache():loaded(false),dirty(false),hits(0)
+{
+}
+
+uint64_t MethodCache::hashConstantPool(const cpool_info& pool)
+{
+	//The decoded code depends on the kinds of the multinames
+	uint64_t h=fnvOffset;
+	hashValue(h,pool.multinames.size());
+	for(unsigned int i=0;i<pool.multinames.size();i++)
+		hashValue(h,pool.multinames[i].kind);
+	return h;
+}
+
+uint64_t MethodCache::computeKey(const method_info* mi)
+{
+	const method_body_info* body=mi->body;
+	uint64_t h=fnvOffset;
+	hashValue(h,formatVersion);
+	hashBytes(h,&mi->context->poolHash,sizeof(uint64_t));
+	hashValue(h,body->code.size());
+	hashBytes(h,body->code.data(),body->code.size());
+	for(unsigned int i=0;i<body->exceptions.size();i++)
+	{
+		hashValue(h,body->exceptions[i].from);
+		hashValue(h,body->exceptions[i].to);
+		hashValue(h,body->exceptions[i].target);
+	}
+	return h;
+}
+
+string MethodCache::getFileName() const
+{
+	string dir=directory;
+	if(dir.empty())
+	{
+		const char* cacheHome=getenv("XDG_CACHE_HOME");
+		const char* home=getenv("HOME");
+		if(cacheHome && cacheHome[0])
+			dir=string(cacheHome)+"/lightspark";
+		else if(home && home[0])
+			dir=string(home)+"/.cache/lightspark";
+		else
+			return "";
+	}
+	return dir+"/methods.cache";
+}
+
+bool MethodCache::validate(const method_record& r)
+{
+	if(r.tier>TIER_OPTIMIZED || r.code.size()%4!=0 || r.exceptions.size()%3!=0)
+		return false;
+	const uint32_t count=r.code.size()/4;
+	//The code is terminated by the sentinels for the end of the code and for invalid jumps
+	if(count<2 || r.code[(count-2)*4]!=OPCODE_END_OF_CODE || r.code[(count-1)*4]!=OPCODE_INVALID_JUMP)
+		return false;
+	if(r.cacheCount>count)
+		return false;
+	for(uint32_t i=0;i<count;i++)
+	{
+		const uint32_t* instr=&r.code[i*4];
+		if(instr[0]>=DECODED_OPCODE_COUNT)
+			return false;
+		if(instr[3]!=decoded_instruction::NO_CACHE && instr[3]>=r.cacheCount)
+			return false;
+		if(instr[0]>=0x0c && instr[0]<=0x1a && instr[1]>=count)
+			return false;
+		if(instr[0]==0x1b)
+		{
+			//The table holds the case count, the default target and the case targets
+			if(instr[1]>=r.switch_targets.size())
+				return false;
+			const uint64_t end=uint64_t(instr[1])+r.switch_targets[instr[1]]+3;
+			if(end>r.switch_targets.size())
+				return false;
+			for(uint32_t j=instr[1]+1;j<end;j++)
+			{
+				if(r.switch_targets[j]>=count)
+					return false;
+			}
+		}
+	}
+	for(uint32_t i=0;i<r.exceptions.size();i++)
+	{
+		if(r.exceptions[i]>=count)
+			return false;
+	}
+	return true;
+}
+
+bool MethodCache::readRecords(const string& fileName, unordered_map<uint64_t, method_record>& out)
+{
+	ifstream in(fileName.c_str(),ios::in|ios::binary);
+	if(!in)
+		return false;
+	char fileMagic[4];
+	uint32_t version;
+	uint32_t count;
+	in.read(fileMagic,4);
+	if(!readValue(in,version) || memcmp(fileMagic,magic,4)!=0 || version!=formatVersion || !readValue(in,count))
+	{
+		LOG(LOG_NO_INFO,_("Ignoring outdated method cache ") << fileName);
+		return false;
+	}
+	for(uint32_t i=0;i<count && i<maxRecords;i++)
+	{
+		uint64_t key;
+		method_record r;
+		if(!readValue(in,key) || !readValue(in,r.tier) || !readVector(in,r.code) ||
+			!readVector(in,r.switch_targets) || !readVector(in,r.exceptions) || !readValue(in,r.cacheCount))
+		{
+			LOG(LOG_ERROR,_("Truncated method cache ") << fileName);
+			break;
+		}
+		if(validate(r))
+			out.insert(make_pair(key,r));
+	}
+	return true;
+}
+
+void MethodCache::readFile()
+{
+	loaded=true;
+	const string fileName=getFileName();
+	if(fileName.empty())
+	{
+		LOG(LOG_NO_INFO,_("No directory for the method cache"));
+		enabled=false;
+		return;
+	}
+	if(readRecords(fileName,records))
+		LOG(LOG_NO_INFO,_("Method cache: ") << records.size() << _(" methods loaded"));
+}
+
+bool MethodCache::load(method_info* mi)
+{
+	if(!enabled)
+		return false;
+	if(!loaded)
+		readFile();
+	if(records.empty())
+		return false;
+	method_body_info* body=mi->body;
+	unordered_map<uint64_t, method_record>::const_iterator it=records.find(computeKey(mi));
+	if(it==records.end())
+		return false;
+	const method_record& r=it->second;
+	if(r.exceptions.size()!=body->exceptions.size()*3)
+		return false;
+
+	body->decoded_code.clear();
+	body->decoded_code.reserve(r.code.size()/4);
+	for(uint32_t i=0;i<r.code.size();i+=4)
+	{
+		decoded_instruction instr(r.code[i]);
+		instr.arg1=r.code[i+1];
+		instr.arg2=r.code[i+2];
+		instr.cache=r.code[i+3];
+		body->decoded_code.push_back(instr);
+	}
+	body->switch_targets=r.switch_targets;
+	body->decoded_exceptions=body->exceptions;
+	for(unsigned int i=0;i<body->decoded_exceptions.size();i++)
+	{
+		exception_info& exc=body->decoded_exceptions[i];
+		exc.from=r.exceptions[i*3];
+		exc.to=r.exceptions[i*3+1];
+		exc.target=r.exceptions[i*3+2];
+	}
+	body->inline_caches.resize(r.cacheCount);
+	mi->profiledTier=(JIT_TIER)r.tier;
+	body->decoded=true;
+	hits++;
+	return true;
+}
+
+void MethodCache::store(const method_info* mi)
+{
+	if(!enabled)
+		return;
+	if(!loaded)
+		readFile();
+	//Reading may have disabled the cache
+	if(!enabled)
+		return;
+	const method_body_info* body=mi->body;
+	assert(body->decoded);
+	const uint64_t key=computeKey(mi);
+	unordered_map<uint64_t, method_record>::iterator it=records.find(key);
+	if(it!=records.end())
+	{
+		//Only the tier can be different
+		if(it->second.tier<uint32_t(mi->requestedTier))
+		{
+			it->second.tier=mi->requestedTier;
+			dirty=true;
+		}
+		return;
+	}
+	if(records.size()>=maxRecords)
+		return;
+
+	method_record& r=records[key];
+	r.tier=mi->requestedTier;
+	r.code.reserve(body->decoded_code.size()*4);
+	for(unsigned int i=0;i<body->decoded_code.size();i++)
+	{
+		const decoded_instruction& instr=body->decoded_code[i];
+		r.code.push_back(instr.opcode);
+		r.code.push_back(instr.arg1);
+		r.code.push_back(instr.arg2);
+		r.code.push_back(instr.cache);
+	}
+	r.switch_targets=body->switch_targets;
+	for(unsigned int i=0;i<body->decoded_exceptions.size();i++)
+	{
+		r.exceptions.push_back(body->decoded_exceptions[i].from);
+		r.exceptions.push_back(body->decoded_exceptions[i].to);
+		r.exceptions.push_back(body->decoded_exceptions[i].target);
+	}
+	r.cacheCount=body->inline_caches.size();
+	dirty=true;
+}
+
+void MethodCache::save()
+{
+	if(!enabled || !dirty)
+		return;
+	const string fileName=getFileName();
+	//Create the missing directories
+	for(size_t pos=fileName.find('/',1);pos!=string::npos;pos=fileName.find('/',pos+1))
+		makeDirectory(fileName.substr(0,pos));
+
+	//Other instances may have saved since the file was loaded, keep what they recorded
+	unordered_map<uint64_t, method_record> onDisk;
+	readRecords(fileName,onDisk);
+	unordered_map<uint64_t, method_record>::iterator diskIt=onDisk.begin();
+	for(;diskIt!=onDisk.end();++diskIt)
+	{
+		unordered_map<uint64_t, method_record>::iterator it=records.find(diskIt->first);
+		if(it!=records.end())
+		{
+			if(it->second.tier<diskIt->second.tier)
+				it->second.tier=diskIt->second.tier;
+		}
+		else if(records.size()<maxRecords)
+			records.insert(*diskIt);
+	}
+
+	//Other instances may be using the cache, so it's written aside and then replaced
+	stringstream tmpName;
+#ifdef WIN32
+	tmpName << fileName << '.' << _getpid();
+#else
+	tmpName << fileName << '.' << getpid();
+#endif
+	ofstream out(tmpName.str().c_str(),ios::out|ios::binary|ios::trunc);
+	out.write(magic,4);
+	writeValue(out,formatVersion);
+	writeValue<uint32_t>(out,records.size());
+	unordered_map<uint64_t, method_record>::const_iterator it=records.begin();
+	for(;it!=records.end();++it)
+	{
+		const method_record& r=it->second;
+		writeValue(out,it->first);
+		writeValue(out,r.tier);
+		writeVector(out,r.code);
+		writeVector(out,r.switch_targets);
+		writeVector(out,r.exceptions);
+		writeValue(out,r.cacheCount);
+	}
+	out.close();
+	if(!out || rename(tmpName.str().c_str(),fileName.c_str())!=0)
+	{
+		LOG(LOG_ERROR,_("Cannot write the method cache ") << fileName);
+		remove(tmpName.str().c_str());
+		return;
+	}
+	dirty=false;
+	LOG(LOG_NO_INFO,_("Method cache: ") << hits << _(" hits, ") << records.size() << _(" methods saved"));
+}
@@ -0,0 +1,87 @@
+/**************************************************************************
+    Lightspark, a free flash player implementation
+
+    Copyright (C) 2009,2010  Alessandro Pignotti (a.pignotti@sssup.it)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#ifndef _METHOD_CACHE_H
+#define _METHOD_CACHE_H
+
+#include "compat.h"
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+namespace lightspark
+{
+
+class method_info;
+struct cpool_info;
+
+/*
+	Persistent cache of the hot methods, shared by all the runs of the player. Records are keyed on
+	a hash of the method body, of its exception ranges and of the constant pool data the decoded
+	code depends on, so the same code found in any SWF is a hit. A record holds the decoded form
+	of the method and the JIT tier it reached: a warm start skips decoding, and methods that were
+	optimized before are sent to the optimizing compiler on the first call, skipping the warm up.
+	The machine code is not cached, so those methods are still compiled on each run: caching it
+	would need the code generator to emit relocatable IR, and the bitcode to be keyed on the LLVM
+	version as well, which the LLVM 2.x API used by the JIT does not allow.
+	Used only by the VM thread
+*/
+class MethodCache
+{
+private:
+	struct method_record
+	{
+		uint32_t tier;
+		//Decoded instructions as opcode, arg1, arg2, cache
+		std::vector<uint32_t> code;
+		std::vector<uint32_t> switch_targets;
+		//Exception ranges as from, to, target
+		std::vector<uint32_t> exceptions;
+		uint32_t cacheCount;
+	};
+	std::unordered_map<uint64_t, method_record> records;
+	bool loaded;
+	bool dirty;
+	uint32_t hits;
+	std::string getFileName() const;
+	void readFile();
+	//Returns false if the file is missing or has another format
+	static bool readRecords(const std::string& fileName, std::unordered_map<uint64_t, method_record>& out);
+	static bool validate(const method_record& r);
+	static uint64_t computeKey(const method_info* mi);
+public:
+	//Set from the command line
+	static bool enabled;
+	static std::string directory;
+	MethodCache();
+	/**
+		Fills the decoded code of the method from the cache
+
+		@return true if the method was found
+	*/
+	bool load(method_info* mi);
+	//Records a method which is being compiled, the method must be decoded
+	void store(const method_info* mi);
+	//Writes the cache to disk if new methods were recorded
+	void save();
+	static uint64_t hashConstantPool(const cpool_info& pool);
+};
+
+};
+#endif
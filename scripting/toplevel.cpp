@@ -34,6 +34,7 @@
 #include "swf.h"
 #include "compat.h"
 #include "class.h"
+#include "gc.h"
 #include "exceptions.h"
 #include "backends/urlutils.h"
 
@@ -825,6 +826,27 @@ Array::~Array()
 	}
 }
 
+bool Array::enumerateRefs(std::vector<ASObject*>& refs)
+{
+	for(unsigned int i=0;i<data.size();i++)
+	{
+		if(data[i].type==DATA_OBJECT && data[i].data)
+			refs.push_back(data[i].data);
+	}
+	return ASObject::enumerateRefs(refs);
+}
+
+void Array::clearRefs()
+{
+	for(unsigned int i=0;i<data.size();i++)
+	{
+		if(data[i].type==DATA_OBJECT && data[i].data)
+			data[i].data->decRef();
+	}
+	data.clear();
+	ASObject::clearRefs();
+}
+
 ASFUNCTIONBODY(ASString,search)
 {
 	ASString* th=static_cast<ASString*>(obj);
@@ -1584,6 +1606,30 @@ IFunction::IFunction():closure_this(NULL),closure_level(-1),bound(false)
 	type=T_FUNCTION;
 }
 
+IFunction::~IFunction()
+{
+	//The bound object is owned by the closure
+	if(closure_this && !sys->finalizingDestruction)
+		closure_this->decRef();
+}
+
+bool IFunction::enumerateRefs(std::vector<ASObject*>& refs)
+{
+	if(closure_this)
+		refs.push_back(closure_this);
+	return ASObject::enumerateRefs(refs);
+}
+
+void IFunction::clearRefs()
+{
+	if(closure_this)
+	{
+		closure_this->decRef();
+		closure_this=NULL;
+	}
+	ASObject::clearRefs();
+}
+
 ASFUNCTIONBODY(IFunction,apply)
 {
 	IFunction* th=static_cast<IFunction*>(obj);
@@ -1638,26 +1684,66 @@ ASFUNCTIONBODY(IFunction,_call)
 	return ret;
 }
 
-SyntheticFunction::SyntheticFunction(method_info* m):hit_count(0),mi(m),val(NULL)
+SyntheticFunction::SyntheticFunction(method_info* m):mi(m),val(NULL),ownedScope(0)
 {
 //	class_index=-2;
 }
 
+SyntheticFunction::~SyntheticFunction()
+{
+	if(!sys->finalizingDestruction)
+	{
+		for(unsigned int i=0;i<ownedScope;i++)
+			func_scope[i]->decRef();
+	}
+}
+
+SyntheticFunction* SyntheticFunction::clone()
+{
+	SyntheticFunction* ret=new SyntheticFunction(*this);
+	//The copy owns the scope as well
+	for(unsigned int i=0;i<ownedScope;i++)
+		func_scope[i]->incRef();
+	return ret;
+}
+
+bool SyntheticFunction::enumerateRefs(std::vector<ASObject*>& refs)
+{
+	refs.insert(refs.end(),func_scope.begin(),func_scope.begin()+ownedScope);
+	return IFunction::enumerateRefs(refs);
+}
+
+void SyntheticFunction::clearRefs()
+{
+	for(unsigned int i=0;i<ownedScope;i++)
+		func_scope[i]->decRef();
+	func_scope.erase(func_scope.begin(),func_scope.begin()+ownedScope);
+	ownedScope=0;
+	IFunction::clearRefs();
+}
+
 ASObject* SyntheticFunction::call(ASObject* obj, ASObject* const* args, uint32_t numArgs, bool thisOverride)
 {
-	const int hit_threshold=10;
 	if(mi->body==NULL)
 	{
 //		LOG(LOG_NOT_IMPLEMENTED,_("Not initialized function"));
 		return NULL;
 	}
 
-	//Temporarily disable JITting
-	if(sys->useJit && (hit_count==hit_threshold || sys->useInterpreter==false))
+	//The decoded code is also needed to handle exceptions
+	if(!mi->body->decoded)
+		mi->decode();
+
+	if(sys->useJit)
 	{
-		//We passed the hot function threshold, synt the function
-		val=mi->synt_method();
-		assert_and_throw(val);
+		//Hot methods are compiled in background, meanwhile they are interpreted
+		if(sys->useInterpreter)
+			val=getVm()->compiler.enterMethod(mi);
+		else
+		{
+			val=getVm()->compiler.compileNow(mi);
+			assert_and_throw(val);
+		}
 	}
 
 	//Prepare arguments
@@ -1668,7 +1754,6 @@ ASObject* SyntheticFunction::call(ASObject* obj, ASObject* const* args, uint32_t
 	int realLevel=(closure_level!=-1)?closure_level:obj->getLevel();
 
 	call_context* cc=new call_context(mi,realLevel,args,passedToLocals);
-	cc->code=new stringstream(mi->body->code);
 	uint32_t i=passedToLocals;
 	cc->scope_stack=func_scope;
 	for(unsigned int i=0;i<func_scope.size();i++)
@@ -1735,6 +1820,10 @@ ASObject* SyntheticFunction::call(ASObject* obj, ASObject* const* args, uint32_t
 	//Set the current level
 	obj->setLevel(realLevel);
 
+	//The types seen until the method is compiled are used to specialize the code
+	if(val==NULL && sys->useJit && mi->requestedTier==TIER_INTERPRETER)
+		mi->profileArguments(cc->locals+1);
+
 	ASObject* ret;
 
 	while (true)
@@ -1747,23 +1836,32 @@ ASObject* SyntheticFunction::call(ASObject* obj, ASObject* const* args, uint32_t
 				ret=ABCVm::executeFunction(this,cc);
 			}
 			else
+			{
 				ret=val(cc);
+				if(ret==JIT_DEOPTIMIZED)
+				{
+					//The compiled code did not change anything, the interpreter can run the method
+					getVm()->compiler.deoptimize(mi,false);
+					val=NULL;
+					ret=ABCVm::executeFunction(this,cc);
+				}
+			}
 		}
 		catch (ASObject* obj) // Doesn't have to be an ASError at all.
 		{
-			unsigned int pos = cc->code->tellg();
+			unsigned int pos = cc->exec_pos;
 			bool no_handler = true;
 
 			LOG(LOG_TRACE, "got an " << obj->toString());
 			LOG(LOG_TRACE, "pos=" << pos);
 			for (unsigned int i=0;i<mi->body->exception_count;i++) {
-				exception_info exc=mi->body->exceptions[i];
+				exception_info exc=mi->body->decoded_exceptions[i];
 				multiname* name=mi->context->getMultiname(exc.exc_type, cc);
 				LOG(LOG_TRACE, "f=" << exc.from << " t=" << exc.to);
 				if (pos > exc.from && pos <= exc.to && ABCContext::isinstance(obj, name))
 				{
 					no_handler = false;
-					cc->code->seekg((uint32_t)exc.target);
+					cc->exec_pos=exc.target;
 					cc->runtime_stack_clear();
 					cc->runtime_stack_push(obj);
 					cc->scope_stack.clear();
@@ -1789,7 +1887,6 @@ ASObject* SyntheticFunction::call(ASObject* obj, ASObject* const* args, uint32_t
 	tl.cur_this->setLevel(tl.cur_level);
 
 	delete cc;
-	hit_count++;
 	return ret;
 }
 
@@ -2601,14 +2698,19 @@ void VerifyError::buildTraits(ASObject* o)
 {
 }
 
+ATOMIC_INT32(Class_base::traitsVersion);
+
 Class_base::Class_base(const QName& name):use_protected(false),protected_ns("",NAMESPACE),constructor(NULL),referencedObjectsMutex("referencedObjects"),
-	super(NULL),context(NULL),class_name(name),class_index(-1),max_level(0)
+	instanceShape(NULL),super(NULL),context(NULL),class_name(name),class_index(-1),max_level(0)
 {
 	type=T_CLASS;
+	CycleCollector::registerClass(this);
 }
 
 Class_base::~Class_base()
 {
+	CycleCollector::unregisterClass(this);
+	ATOMIC_INCREMENT(traitsVersion);
 	if(constructor)
 		constructor->decRef();
 
@@ -2623,7 +2725,7 @@ Class_base::~Class_base()
 		for(;it!=referencedObjects.end();it++)
 			delete *it;
 	}
-	
+	delete instanceShape;
 }
 
 ASObject* Class_base::generator(ASObject* const* args, const unsigned int argslen)
@@ -2742,6 +2844,7 @@ void Class_base::handleConstruction(ASObject* target, ASObject* const* args, uns
 		//And restore it
 		target->implEnable=bak;
 		assert_and_throw(target->getLevel()==max_level);
+		adoptShape(target);
 	#ifndef NDEBUG
 		target->initialized=true;
 	#endif
@@ -2758,6 +2861,29 @@ void Class_base::handleConstruction(ASObject* target, ASObject* const* args, uns
 	}
 }
 
+void Class_base::adoptShape(ASObject* target)
+{
+	//The shape lives as long as the class, which is kept alive by its instances
+	if(target->prototype!=this)
+		return;
+	const instance_shape* shape=instanceShape;
+	if(shape==NULL)
+	{
+		//Instances may be built by more than one thread
+		Locker l(referencedObjectsMutex);
+		if(instanceShape==NULL)
+			instanceShape=new instance_shape(target->Variables);
+		shape=instanceShape;
+	}
+	//Instances that were built the same way share the layout
+	if(!shape->matches(target->Variables))
+	{
+		LOG(LOG_CALLS,_("Instance of ") << class_name << _(" does not match the class shape"));
+		return;
+	}
+	target->Variables.share(shape);
+}
+
 void Class_base::acquireObject(ASObject* ob)
 {
 	Locker l(referencedObjectsMutex);
@@ -2777,6 +2903,7 @@ void Class_base::abandonObject(ASObject* ob)
 
 void Class_base::cleanUp()
 {
+	ATOMIC_INCREMENT(traitsVersion);
 	Variables.destroyContents();
 	if(constructor)
 	{
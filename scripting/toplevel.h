@@ -45,6 +45,7 @@ class Class_base: public ASObject
 {
 friend class ABCVm;
 friend class ABCContext;
+friend class CycleCollector;
 private:
 	mutable std::vector<multiname> interfaces;
 	mutable std::vector<Class_base*> interfaces_added;
@@ -55,10 +56,19 @@ private:
 		return max_level;
 	}
 	void recursiveBuild(ASObject* target);
+	//Classes are rooted in the SystemState, they are never collected
+	bool enumerateRefs(std::vector<ASObject*>& refs)
+	{
+		return false;
+	}
 	IFunction* constructor;
-	//Naive garbage collection until reference cycles are detected
+	//Instances of this class, the cycle collector picks its candidates from here
 	Mutex referencedObjectsMutex;
 	std::set<ASObject*> referencedObjects;
+	//Layout shared by the instances, created when the first one is built. The
+	//referencedObjectsMutex is held to create it
+	ATOMIC_PTR(instance_shape,instanceShape);
+	void adoptShape(ASObject* target);
 
 public:
 	Class_base* super;
@@ -67,6 +77,8 @@ public:
 	QName class_name;
 	int class_index;
 	int max_level;
+	//Incremented when borrowed traits are added or destroyed, it invalidates the inline caches
+	static ATOMIC_INT32(traitsVersion);
 	void handleConstruction(ASObject* target, ASObject* const* args, unsigned int argslen, bool buildAndLink);
 	void setConstructor(IFunction* c);
 	Class_base(const QName& name);
@@ -111,7 +123,7 @@ public:
 	tiny_string toString(bool debugMsg);
 	virtual ASObject* generator(ASObject* const* args, const unsigned int argslen);
 	
-	//DEPRECATED: naive garbage collector
+	//Instance registry, leftovers are deleted with the class
 	void abandonObject(ASObject* ob);
 	void acquireObject(ASObject* ob);
 	void cleanUp();
@@ -187,7 +199,10 @@ class IFunction: public ASObject
 CLASSBUILDABLE(IFunction);
 protected:
 	IFunction();
+	virtual ~IFunction();
 	virtual IFunction* clone()=0;
+	bool enumerateRefs(std::vector<ASObject*>& refs);
+	void clearRefs();
 	ASObject* closure_this;
 	int closure_level;
 	bool bound;
@@ -264,14 +279,15 @@ friend class Class<IFunction>;
 public:
 	typedef ASObject* (*synt_function)(call_context* cc);
 private:
-	int hit_count;
 	method_info* mi;
 	synt_function val;
+	//The first ownedScope entries of func_scope are owned, the others are borrowed
+	uint32_t ownedScope;
 	SyntheticFunction(method_info* m);
-	SyntheticFunction* clone()
-	{
-		return new SyntheticFunction(*this);
-	}
+	~SyntheticFunction();
+	SyntheticFunction* clone();
+	bool enumerateRefs(std::vector<ASObject*>& refs);
+	void clearRefs();
 public:
 	ASObject* call(ASObject* obj, ASObject* const* args, uint32_t num_args, bool thisOverride=false);
 	IFunction* toFunction();
@@ -289,6 +305,7 @@ public:
 		func_scope=scope;
 		for(unsigned int i=0;i<func_scope.size();i++)
 			func_scope[i]->incRef();
+		ownedScope=func_scope.size();
 	}
 	void addToScope(ASObject* s)
 	{
@@ -456,6 +473,8 @@ protected:
 	std::vector<data_slot> data;
 	void outofbounds() const;
 	Array();
+	bool enumerateRefs(std::vector<ASObject*>& refs);
+	void clearRefs();
 private:
 	enum SORTTYPE { CASEINSENSITIVE=1, DESCENDING=2, UNIQUESORT=4, RETURNINDEXEDARRAY=8, NUMERIC=16 };
 	class sortComparatorDefault
@@ -25,6 +25,7 @@
 #include "scripting/flashevents.h"
 #include "scripting/flashutils.h"
 #include "swf.h"
+#include "frame_scheduler.h"
 #include "logger.h"
 #include "parsing/streams.h"
 #include "asobject.h"
@@ -168,7 +169,8 @@ void SystemState::staticDeinit()
 SystemState::SystemState(ParseThread* p):RootMovieClip(NULL,true),parseThread(p),renderRate(0),error(false),shutdown(false),
 	renderThread(NULL),inputThread(NULL),engine(NONE),fileDumpAvailable(0),waitingForDump(false),vmVersion(VMNONE),childPid(0),
 	useGnashFallback(false),showProfilingData(false),showInteractiveMap(false),showDebug(false),xOffset(0),yOffset(0),currentVm(NULL),
-	finalizingDestruction(false),useInterpreter(true),useJit(false),downloadManager(NULL),scaleMode(SHOW_ALL)
+	finalizingDestruction(false),useInterpreter(true),useJit(false),useThreadedDispatch(true),countInstructions(false),
+	jitQuickThreshold(10),jitOptimizedThreshold(1000),downloadManager(NULL),scaleMode(SHOW_ALL)
 {
 	cookiesFileName[0]=0;
 	//Create the thread pool
@@ -180,6 +182,7 @@ SystemState::SystemState(ParseThread* p):RootMovieClip(NULL,true),parseThread(p)
 		parseThread->root=this;
 	threadPool=new ThreadPool(this);
 	timerThread=new TimerThread(this);
+	frameScheduler=new FrameScheduler(this);
 	pluginManager = new PluginManager;
 	audioManager=new AudioManager(pluginManager);
 	intervalManager=new IntervalManager();
@@ -311,12 +314,16 @@ void SystemState::stopEngines()
 		threadPool->stop();
 	if(timerThread)
 		timerThread->wait();
+	if(frameScheduler)
+		frameScheduler->wait();
 	delete downloadManager;
 	downloadManager=NULL;
 	if(currentVm)
 		currentVm->shutdown();
 	delete timerThread;
 	timerThread=NULL;
+	delete frameScheduler;
+	frameScheduler=NULL;
 }
 
 SystemState::~SystemState()
@@ -399,12 +406,10 @@ void SystemState::setError(const string& c)
 		error=true;
 		errorCause=c;
 		timerThread->stop();
+		//Disable timed rendering
+		frameScheduler->stop();
 		if(renderThread)
-		{
-			//Disable timed rendering
-			removeJob(renderThread);
 			renderThread->draw();
-		}
 	}
 }
 
@@ -450,8 +455,7 @@ void SystemState::startRenderTicks()
 {
 	assert(renderThread);
 	assert(renderRate);
-	removeJob(renderThread);
-	addTick(1000/renderRate,renderThread);
+	frameScheduler->setRenderRate(renderRate);
 }
 
 void SystemState::EngineCreator::execute()
@@ -666,21 +670,24 @@ void SystemState::setRenderRate(float rate)
 	sem_post(&mutex);
 }
 
-void SystemState::tick()
+void SystemState::dispatchEnterFrame()
+{
+	RootMovieClip::dispatchEnterFrame();
+	if(stage->hasEventListener(ET_ENTER_FRAME))
+	{
+		Event* e=Event::getPooled<Event>(getVm()->event_manager,ET_ENTER_FRAME);
+		getVm()->addEvent(stage,e);
+		e->decRef();
+	}
+}
+
+void SystemState::tickProfilingData()
 {
-	RootMovieClip::tick();
  	sem_wait(&mutex);
 	list<ThreadProfile>::iterator it=profilingData.begin();
 	for(;it!=profilingData.end();it++)
 		it->tick();
 	sem_post(&mutex);
-	//Enter frame should be sent to the stage too
-	if(stage->hasEventListener("enterFrame"))
-	{
-		Event* e=Class<Event>::getInstanceS("enterFrame");
-		getVm()->addEvent(stage,e);
-		e->decRef();
-	}
 }
 
 void SystemState::addJob(IThreadJob* j)
@@ -807,17 +814,239 @@ void ThreadProfile::plot(uint32_t maxTime, FTFont* font)
 	}
 }
 
+namespace lightspark
+{
+/*
+	A dictionary tag whose body has been sliced from the file and is decoded on the thread pool.
+	It is shared by the ParseThread and the decoding job, the last one releasing it destroys it
+*/
+class PendingTag
+{
+private:
+	Mutex mutex;
+	//Both ref_count and claimed are protected by mutex
+	int ref_count;
+	//Set by the first thread that starts decoding
+	bool claimed;
+	Semaphore decoded;
+	RECORDHEADER header;
+	//The body points directly to the input when it's in memory, otherwise to a copy
+	const uint8_t* body;
+	std::vector<uint8_t> bodyCopy;
+	Tag* tag;
+	std::string error;
+public:
+	PendingTag(const RECORDHEADER& h, istream& in);
+	~PendingTag();
+	void decode();
+	//Returns the decoded tag, decoding it now if no job has started yet
+	Tag* get();
+	//Prevents the decoding, or waits for it if it has already started
+	void cancel();
+	void release();
+};
+
+class TagDecodeJob: public IThreadJob
+{
+private:
+	PendingTag* pending;
+	void execute()
+	{
+		pending->decode();
+		pending->release();
+		pending=NULL;
+	}
+	void threadAbort()
+	{
+	}
+public:
+	TagDecodeJob(PendingTag* p):pending(p)
+	{
+		destroyMe=true;
+	}
+	//The pool deletes the jobs that never ran when it's stopped
+	~TagDecodeJob()
+	{
+		if(pending)
+			pending->release();
+	}
+};
+};
+
+PendingTag::PendingTag(const RECORDHEADER& h, istream& in):mutex("PendingTag"),ref_count(2),claimed(false),decoded(0),
+	header(h),body(NULL),tag(NULL)
+{
+	const uint32_t len=h.getLength();
+	memory_buf* mem=dynamic_cast<memory_buf*>(in.rdbuf());
+	if(mem && mem->remaining()>=len)
+	{
+		body=mem->current();
+		mem->skip(len);
+		return;
+	}
+	bodyCopy.resize(len);
+	in.read((char*)&bodyCopy[0],len);
+	if(in.fail())
+		throw ParseException("Malformed SWF file");
+	body=&bodyCopy[0];
+}
+
+PendingTag::~PendingTag()
+{
+	//The tag has not been taken by the ParseThread
+	delete tag;
+}
+
+void PendingTag::decode()
+{
+	{
+		Locker l(mutex);
+		if(claimed)
+			return;
+		claimed=true;
+	}
+
+	try
+	{
+		memory_buf buf(body,header.getLength());
+		istream s(&buf);
+		TagFactory factory(s,false);
+		tag=factory.readTag(header);
+	}
+	catch(LightsparkException& e)
+	{
+		error=e.cause;
+	}
+	decoded.signal();
+}
+
+Tag* PendingTag::get()
+{
+	decode();
+	decoded.wait();
+	if(tag==NULL)
+		throw ParseException(error);
+	Tag* ret=tag;
+	tag=NULL;
+	return ret;
+}
+
+void PendingTag::cancel()
+{
+	{
+		Locker l(mutex);
+		if(!claimed)
+		{
+			claimed=true;
+			decoded.signal();
+		}
+	}
+	//The body may point to the input, which is not guaranteed to be valid after parsing
+	decoded.wait();
+}
+
+void PendingTag::release()
+{
+	bool last;
+	{
+		Locker l(mutex);
+		ref_count--;
+		last=(ref_count==0);
+	}
+	if(last)
+		delete this;
+}
+
 ParseThread::ParseThread(RootMovieClip* r,istream& in):f(in),isEnded(false),root(NULL),version(0),useAVM2(false)
 {
 	root=r;
 	sem_init(&ended,0,0);
+	//Parsing waits for data from the input
+	blocking=true;
 }
 
 ParseThread::~ParseThread()
 {
+	discardPendingTags();
 	sem_destroy(&ended);
 }
 
+bool ParseThread::isParallelTag(const RECORDHEADER& h)
+{
+	//Small tags are cheaper to decode than to hand over to another thread
+	if(h.getLength()<1024)
+		return false;
+	switch(h.getTagType())
+	{
+		case 2: //DefineShape
+		case 10: //DefineFont
+		case 20: //DefineBitsLossless
+		case 22: //DefineShape2
+		case 32: //DefineShape3
+		case 36: //DefineBitsLossless2
+		case 46: //DefineMorphShape
+		case 48: //DefineFont2
+		case 75: //DefineFont3
+		case 83: //DefineShape4
+			return true;
+		default:
+			return false;
+	}
+}
+
+bool ParseThread::needsDictionary(const RECORDHEADER& h)
+{
+	switch(h.getTagType())
+	{
+		case 0: //End
+		case 1: //ShowFrame
+			//The frame may be executed as soon as it's committed
+			return true;
+		case 56: //ExportAssets
+			//Looks up the exported characters while it's parsed
+			return true;
+		default:
+			//The other tags only use the dictionary when the frame is executed or rendered
+			return false;
+	}
+}
+
+void ParseThread::commitPendingTags()
+{
+	//Tags are added to the dictionary in file order
+	while(!pendingTags.empty())
+	{
+		PendingTag* p=pendingTags.front();
+		pendingTags.pop_front();
+		Tag* tag;
+		try
+		{
+			tag=p->get();
+		}
+		catch(LightsparkException&)
+		{
+			p->release();
+			throw;
+		}
+		p->release();
+		sys->tagsStorage.push_back(tag);
+		assert_and_throw(tag->getType()==DICT_TAG);
+		DictionaryTag* d=static_cast<DictionaryTag*>(tag);
+		d->setLoadedFrom(root);
+		root->addToDictionary(d);
+	}
+}
+
+void ParseThread::discardPendingTags()
+{
+	while(!pendingTags.empty())
+	{
+		pendingTags.front()->cancel();
+		pendingTags.front()->release();
+		pendingTags.pop_front();
+	}
+}
+
 void ParseThread::execute()
 {
 	pt=this;
@@ -842,9 +1071,24 @@ void ParseThread::execute()
 		TagFactory factory(f, true);
 		bool done=false;
 		bool empty=true;
+		bool firstTag=true;
 		while(!done)
 		{
-			Tag* tag=factory.readTag();
+			//Heavy dictionary tags are only sliced here and decoded on the thread pool
+			RECORDHEADER h;
+			f >> h;
+			if(!firstTag && isParallelTag(h))
+			{
+				PendingTag* p=new PendingTag(h,f);
+				pendingTags.push_back(p);
+				sys->addJob(new TagDecodeJob(p));
+				continue;
+			}
+			firstTag=false;
+
+			if(needsDictionary(h))
+				commitPendingTags();
+			Tag* tag=factory.readTag(h);
 			sys->tagsStorage.push_back(tag);
 			switch(tag->getType())
 			{
@@ -896,6 +1140,7 @@ void ParseThread::execute()
 		root->parsingFailed();
 		sys->setError(e.cause);
 	}
+	discardPendingTags();
 	pt=NULL;
 
 	sem_post(&ended);
@@ -1050,7 +1295,10 @@ void RootMovieClip::commitFrame(bool another)
 		//Now the bindings are effective
 
 		//When the first frame is committed the frame rate is known
-		sys->addTick(1000/frameRate,this);
+		if(this==sys)
+			sys->getFrameScheduler()->setFrameRate(frameRate);
+		else
+			sys->addTick(1000/frameRate,this);
 	}
 	sem_post(&new_frame);
 }
@@ -1094,33 +1342,52 @@ DictionaryTag* RootMovieClip::dictionaryLookup(int id)
 	return ret;
 }
 
+void RootMovieClip::getChildrenClips(vector<MovieClip*>& curChildren)
+{
+	Locker l(mutexChildrenClips);
+	curChildren.reserve(childrenClips.size());
+	curChildren.insert(curChildren.end(),childrenClips.begin(),childrenClips.end());
+	for(uint32_t i=0;i<curChildren.size();i++)
+		curChildren[i]->incRef();
+}
+
+void RootMovieClip::dispatchEnterFrame()
+{
+	Event* e=Event::getPooled<Event>(getVm()->event_manager,ET_ENTER_FRAME);
+	if(hasEventListener(ET_ENTER_FRAME))
+		getVm()->addEvent(this,e);
+	vector<MovieClip*> curChildren;
+	getChildrenClips(curChildren);
+	for(uint32_t i=0;i<curChildren.size();i++)
+	{
+		if(curChildren[i]->hasEventListener(ET_ENTER_FRAME))
+			getVm()->addEvent(curChildren[i],e);
+		curChildren[i]->decRef();
+	}
+	e->decRef();
+}
+
+void RootMovieClip::advanceFrames()
+{
+	advanceFrame();
+	vector<MovieClip*> curChildren;
+	getChildrenClips(curChildren);
+	//Advance all the children, and release the reference
+	for(uint32_t i=0;i<curChildren.size();i++)
+	{
+		curChildren[i]->advanceFrame();
+		curChildren[i]->decRef();
+	}
+}
+
 void RootMovieClip::tick()
 {
 	//Frame advancement may cause exceptions
 	try
 	{
-		advanceFrame();
-		Event* e=Class<Event>::getInstanceS("enterFrame");
-		if(hasEventListener("enterFrame"))
-			getVm()->addEvent(this,e);
-		//Get a copy of the current childs
-		vector<MovieClip*> curChildren;
-		{
-			Locker l(mutexChildrenClips);
-			curChildren.reserve(childrenClips.size());
-			curChildren.insert(curChildren.end(),childrenClips.begin(),childrenClips.end());
-			for(uint32_t i=0;i<curChildren.size();i++)
-				curChildren[i]->incRef();
-		}
-		//Advance all the children, and release the reference
-		for(uint32_t i=0;i<curChildren.size();i++)
-		{
-			curChildren[i]->advanceFrame();
-			if(curChildren[i]->hasEventListener("enterFrame"))
-				getVm()->addEvent(curChildren[i],e);
-			curChildren[i]->decRef();
-		}
-		e->decRef();
+		//Like for the main movie, enterFrame comes before the frame is constructed
+		dispatchEnterFrame();
+		advanceFrames();
 	}
 	catch(LightsparkException& e)
 	{
@@ -25,6 +25,7 @@
 #include <fstream>
 #include <list>
 #include <map>
+#include <deque>
 #include <semaphore.h>
 #include <string>
 #include "swftypes.h"
@@ -56,8 +57,10 @@ class DictionaryTag;
 class ABCVm;
 class InputThread;
 class RenderThread;
+class FrameScheduler;
 class ParseThread;
 class Tag;
+class PendingTag;
 
 class SWF_HEADER
 {
@@ -83,6 +86,11 @@ protected:
 	bool initialized;
 	URLInfo origin;
 	void tick();
+public:
+	//Sends enterFrame to the clip and to the children clips
+	virtual void dispatchEnterFrame();
+	//Moves the clip and the children clips to the next frame, laying out their display lists
+	void advanceFrames();
 private:
 	//Semaphore to wait for new frames to be available
 	sem_t new_frame;
@@ -98,6 +106,8 @@ private:
 	tiny_string bindName;
 	Mutex mutexChildrenClips;
 	std::set<MovieClip*> childrenClips;
+	//The children clips are returned with an added reference
+	void getChildrenClips(std::vector<MovieClip*>& curChildren);
 public:
 	RootMovieClip(LoaderInfo* li, bool isSys=false);
 	~RootMovieClip();
@@ -167,6 +177,7 @@ private:
 		EngineCreator()
 		{
 			destroyMe=true;
+			blocking=true;
 		}
 		void execute();
 		void threadAbort();
@@ -174,6 +185,7 @@ private:
 	friend class SystemState::EngineCreator;
 	ThreadPool* threadPool;
 	TimerThread* timerThread;
+	FrameScheduler* frameScheduler;
 	ParseThread* parseThread;
 	sem_t terminated;
 	float renderRate;
@@ -232,9 +244,12 @@ public:
 	bool isShuttingDown() const DLL_PUBLIC;
 	bool isOnError() const;
 	void setShutdownFlag() DLL_PUBLIC;
-	void tick();
+	//The stage gets enterFrame too
+	void dispatchEnterFrame();
+	void tickProfilingData();
 	void wait() DLL_PUBLIC;
 	RenderThread* getRenderThread() const { return renderThread; }
+	FrameScheduler* getFrameScheduler() const { return frameScheduler; }
 	InputThread* getInputThread() const { return inputThread; }
 	void setParamsAndEngine(ENGINE e, NPAPI_params* p) DLL_PUBLIC;
 	void setDownloadedPath(const tiny_string& p) DLL_PUBLIC;
@@ -267,6 +282,12 @@ public:
 	//Flags for command line options
 	bool useInterpreter;
 	bool useJit;
+	bool useThreadedDispatch;
+	//The interpreter counts the executed instructions, only used by benchmarks
+	bool countInstructions;
+	//Calls and loop iterations after which a method is compiled by the quick and the optimized JIT tiers
+	uint32_t jitQuickThreshold;
+	uint32_t jitOptimizedThreshold;
 
 	void parseParametersFromFile(const char* f) DLL_PUBLIC;
 	void parseParametersFromFlashvars(const char* vars) DLL_PUBLIC;
@@ -303,6 +324,13 @@ private:
 	std::istream& f;
 	sem_t ended;
 	bool isEnded;
+	//Dictionary tags being decoded on the thread pool, in file order
+	std::deque<PendingTag*> pendingTags;
+	static bool isParallelTag(const RECORDHEADER& h);
+	//The tag uses the dictionary before the next frame is committed, so the pending tags must be there
+	static bool needsDictionary(const RECORDHEADER& h);
+	void commitPendingTags();
+	void discardPendingTags();
 	void execute();
 	void threadAbort();
 public:
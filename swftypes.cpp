@@ -26,6 +26,8 @@
 #include <algorithm>
 #include <stdlib.h>
 #include <math.h>
+#include <unordered_map>
+#include <atomic>
 #include "swf.h"
 #include "backends/geometry.h"
 #include "backends/rendering.h"
@@ -40,6 +42,210 @@ extern TLSDATA SystemState* sys;
 extern TLSDATA RenderThread* rt;
 extern TLSDATA ParseThread* pt;
 
+namespace
+{
+/*
+	The strings are stored in chunks that are never moved or freed, so they can be read by
+	getString without locking. Ids are published under the mutex, before any other thread can
+	know them
+*/
+class AtomChunks
+{
+private:
+	static const uint32_t CHUNK_BITS=12;
+	static const uint32_t CHUNK_SIZE=1<<CHUNK_BITS;
+	static const uint32_t MAX_CHUNKS=4096;
+	const char** chunks[MAX_CHUNKS];
+public:
+	AtomChunks()
+	{
+		memset(chunks,0,sizeof(chunks));
+	}
+	const char* get(uint32_t id) const
+	{
+		const char* const* chunk=chunks[id>>CHUNK_BITS];
+		assert_and_throw(chunk);
+		return chunk[id&(CHUNK_SIZE-1)];
+	}
+	void set(uint32_t id, const char* s)
+	{
+		assert_and_throw((id>>CHUNK_BITS)<MAX_CHUNKS);
+		const char**& chunk=chunks[id>>CHUNK_BITS];
+		if(chunk==NULL)
+			chunk=new const char*[CHUNK_SIZE];
+		chunk[id&(CHUNK_SIZE-1)]=s;
+	}
+};
+
+class AtomTable
+{
+public:
+	Mutex mutex;
+	std::unordered_map<std::string, uint32_t> ids;
+	//Points to the keys of ids, which are never moved
+	AtomChunks strings;
+	uint32_t count;
+	uint64_t bytes;
+	//Names built at runtime, the ids are the indexes without the RUNTIME bit
+	std::unordered_map<std::string, uint32_t> runtimeIds;
+	AtomChunks runtimeStrings;
+	std::vector<uint32_t> runtimeRefCounts;
+	std::vector<uint32_t> freeIds;
+	uint32_t runtimeCount;
+	uint64_t runtimeBytes;
+	std::atomic<uint64_t> lookupsByAtom;
+	uint64_t lookupsByContent;
+	AtomTable():mutex("Atoms"),count(0),bytes(0),runtimeCount(0),runtimeBytes(0),lookupsByAtom(0),lookupsByContent(0)
+	{
+		//Reserve atom 0 for the empty string
+		add("");
+	}
+	uint32_t add(const char* s)
+	{
+		std::unordered_map<std::string, uint32_t>::const_iterator it=ids.find(s);
+		if(it!=ids.end())
+			return it->second;
+		//Variables may already use the runtime atom of the name, so it is kept for good
+		it=runtimeIds.find(s);
+		if(it!=runtimeIds.end())
+		{
+			runtimeRefCounts[it->second]++;
+			const uint32_t ret=it->second|Atoms::RUNTIME;
+			ids.insert(std::make_pair(std::string(s),ret));
+			return ret;
+		}
+		std::pair<std::unordered_map<std::string, uint32_t>::iterator, bool> ret=
+			ids.insert(std::make_pair(std::string(s),count));
+		strings.set(count,ret.first->first.c_str());
+		count++;
+		bytes+=ret.first->first.size()+1;
+		return ret.first->second;
+	}
+};
+
+AtomTable& getAtomTable()
+{
+	//The table is never destroyed, as atoms may be used until the very end
+	static AtomTable* table=new AtomTable;
+	return *table;
+}
+};
+
+bool Atoms::countLookups=false;
+
+uint32_t Atoms::intern(const char* s)
+{
+	if(s[0]==0)
+		return EMPTY;
+	AtomTable& table=getAtomTable();
+	Locker l(table.mutex);
+	return table.add(s);
+}
+
+uint32_t Atoms::find(const tiny_string& s)
+{
+	if(s.raw_buf()[0]==0)
+		return EMPTY;
+	AtomTable& table=getAtomTable();
+	Locker l(table.mutex);
+	table.lookupsByContent++;
+	std::unordered_map<std::string, uint32_t>::const_iterator it=table.ids.find(s.raw_buf());
+	if(it!=table.ids.end())
+		return it->second;
+	it=table.runtimeIds.find(s.raw_buf());
+	return (it==table.runtimeIds.end())?INVALID:(it->second|RUNTIME);
+}
+
+uint32_t Atoms::acquire(const tiny_string& s)
+{
+	if(s.raw_buf()[0]==0)
+		return EMPTY;
+	AtomTable& table=getAtomTable();
+	Locker l(table.mutex);
+	table.lookupsByContent++;
+	std::unordered_map<std::string, uint32_t>::const_iterator it=table.ids.find(s.raw_buf());
+	if(it!=table.ids.end())
+	{
+		if(it->second&RUNTIME)
+			table.runtimeRefCounts[it->second&~RUNTIME]++;
+		return it->second;
+	}
+	it=table.runtimeIds.find(s.raw_buf());
+	if(it!=table.runtimeIds.end())
+	{
+		table.runtimeRefCounts[it->second]++;
+		return it->second|RUNTIME;
+	}
+	uint32_t id;
+	if(table.freeIds.empty())
+	{
+		id=table.runtimeRefCounts.size();
+		table.runtimeRefCounts.push_back(0);
+	}
+	else
+	{
+		id=table.freeIds.back();
+		table.freeIds.pop_back();
+	}
+	it=table.runtimeIds.insert(std::make_pair(std::string(s.raw_buf()),id)).first;
+	table.runtimeStrings.set(id,it->first.c_str());
+	table.runtimeRefCounts[id]=1;
+	table.runtimeCount++;
+	table.runtimeBytes+=it->first.size()+1;
+	return id|RUNTIME;
+}
+
+void Atoms::runtimeIncRef(uint32_t atom)
+{
+	AtomTable& table=getAtomTable();
+	Locker l(table.mutex);
+	const uint32_t id=atom&~RUNTIME;
+	assert_and_throw(id<table.runtimeRefCounts.size() && table.runtimeRefCounts[id]);
+	table.runtimeRefCounts[id]++;
+}
+
+void Atoms::runtimeDecRef(uint32_t atom)
+{
+	AtomTable& table=getAtomTable();
+	Locker l(table.mutex);
+	const uint32_t id=atom&~RUNTIME;
+	assert_and_throw(id<table.runtimeRefCounts.size() && table.runtimeRefCounts[id]);
+	table.runtimeRefCounts[id]--;
+	if(table.runtimeRefCounts[id])
+		return;
+	const char* s=table.runtimeStrings.get(id);
+	table.runtimeCount--;
+	table.runtimeBytes-=strlen(s)+1;
+	table.runtimeStrings.set(id,NULL);
+	table.runtimeIds.erase(s);
+	table.freeIds.push_back(id);
+}
+
+const char* Atoms::getString(uint32_t atom)
+{
+	const AtomTable& table=getAtomTable();
+	const char* ret=(atom&RUNTIME)?table.runtimeStrings.get(atom&~RUNTIME):table.strings.get(atom);
+	assert_and_throw(ret);
+	return ret;
+}
+
+void Atoms::countLookupByAtom()
+{
+	getAtomTable().lookupsByAtom.fetch_add(1,std::memory_order_relaxed);
+}
+
+void Atoms::getStats(atom_stats& stats)
+{
+	AtomTable& table=getAtomTable();
+	Locker l(table.mutex);
+	stats.count=table.count;
+	stats.bytes=table.bytes;
+	stats.runtimeCount=table.runtimeCount;
+	stats.runtimeBytes=table.runtimeBytes;
+	stats.lookupsByAtom=table.lookupsByAtom.load(std::memory_order_relaxed);
+	stats.lookupsByContent=table.lookupsByContent;
+}
+
 tiny_string multiname::qualifiedString() const
 {
 	assert_and_throw(ns.size()==1);
@@ -310,9 +516,49 @@ std::istream& lightspark::operator>>(std::istream& s, MORPHFILLSTYLEARRAY& v)
 	return s;
 }
 
-std::istream& lightspark::operator>>(std::istream& s, SHAPE& v)
+unsigned int BitStream::readBitsSlow(unsigned int num)
+{
+	if(num>32)
+	{
+		//Only the lower 32 bits are kept
+		readBitsSlow(num-32);
+		num=32;
+	}
+	if(f)
+	{
+		//Read only the bytes that are needed, the stream is shared with the caller
+		uint8_t tmp[5]={0};
+		unsigned int count=(num-pos+7)/8;
+		f->read((char*)tmp,count);
+		for(unsigned int i=0;i<count;i++)
+			buffer=(buffer<<8)|tmp[i];
+		pos+=count*8;
+	}
+	else
+	{
+		while(pos<=56 && cur<end)
+		{
+			buffer=(buffer<<8)|*cur;
+			cur++;
+			pos+=8;
+		}
+		if(pos<num)
+			throw ParseException("Unexpected end of bit stream");
+	}
+	pos-=num;
+	return (buffer>>pos)&((1ULL<<num)-1);
+}
+
+void BitStream::align()
+{
+	//Whole bytes buffered from memory are given back
+	if(f==NULL)
+		cur-=pos/8;
+	pos=0;
+}
+
+static void readShapeRecords(SHAPE& v, BitStream& bs)
 {
-	BitStream bs(s);
 	v.NumFillBits=UB(4,bs);
 	v.NumLineBits=UB(4,bs);
 	do
@@ -322,6 +568,12 @@ std::istream& lightspark::operator>>(std::istream& s, SHAPE& v)
 	while(v.ShapeRecords.back().TypeFlag || v.ShapeRecords.back().StateNewStyles || v.ShapeRecords.back().StateLineStyle || 
 			v.ShapeRecords.back().StateFillStyle1 || v.ShapeRecords.back().StateFillStyle0 || 
 			v.ShapeRecords.back().StateMoveTo);
+}
+
+std::istream& lightspark::operator>>(std::istream& s, SHAPE& v)
+{
+	BitStream bs(s);
+	readShapeRecords(v,bs);
 	return s;
 }
 
@@ -331,18 +583,24 @@ std::istream& lightspark::operator>>(std::istream& s, SHAPEWITHSTYLE& v)
 	v.LineStyles.version=v.version;
 	s >> v.FillStyles >> v.LineStyles;
 	BitStream bs(s);
-	v.NumFillBits=UB(4,bs);
-	v.NumLineBits=UB(4,bs);
-	do
-	{
-		v.ShapeRecords.push_back(SHAPERECORD(&v,bs));
-	}
-	while(v.ShapeRecords.back().TypeFlag || v.ShapeRecords.back().StateNewStyles || v.ShapeRecords.back().StateLineStyle || 
-			v.ShapeRecords.back().StateFillStyle1 || v.ShapeRecords.back().StateFillStyle0 || 
-			v.ShapeRecords.back().StateMoveTo);
+	readShapeRecords(v,bs);
 	return s;
 }
 
+void lightspark::readShapeWithStyle(SHAPEWITHSTYLE& v, const uint8_t* data, uint32_t len)
+{
+	v.FillStyles.version=v.version;
+	v.LineStyles.version=v.version;
+	memory_buf buf(data,len);
+	std::istream s(&buf);
+	s >> v.FillStyles >> v.LineStyles;
+	if(s.fail())
+		throw ParseException("Malformed SWF file");
+	uint32_t consumed=buf.consumed();
+	BitStream bs(data+consumed,len-consumed);
+	readShapeRecords(v,bs);
+}
+
 istream& lightspark::operator>>(istream& s, LINESTYLE2& v)
 {
 	s >> v.Width;
@@ -469,8 +727,10 @@ std::istream& lightspark::operator>>(std::istream& s, FOCALGRADIENT& v)
 		v.GradientRecords.push_back(gr);
 	}
 	sort(v.GradientRecords.begin(),v.GradientRecords.end());
-	//TODO: support FocalPoint
-	s.read((char*)&v.FocalPoint,2);
+	//Signed 8.8 fixed point, the position of the focal point on the horizontal radius
+	SI16 focal;
+	s >> focal;
+	v.FocalPoint=int16_t(focal)/256.0f;
 	return s;
 }
 
@@ -771,16 +1031,15 @@ SHAPERECORD::SHAPERECORD(SHAPE* p,BitStream& bs):parent(p),TypeFlag(false),State
 			SHAPEWITHSTYLE* ps=dynamic_cast<SHAPEWITHSTYLE*>(parent);
 			if(ps==NULL)
 				throw ParseException("Malformed SWF file");
-			bs.pos=0;
 			FILLSTYLEARRAY a;
 			a.version=ps->FillStyles.version;
-			bs.f >> a;
+			bs.readAligned(a);
 			p->fillOffset=ps->FillStyles.FillStyleCount;
 			ps->FillStyles.appendStyles(a);
 
 			LINESTYLEARRAY b;
 			b.version=ps->LineStyles.version;
-			bs.f >> b;
+			bs.readAligned(b);
 			p->lineOffset=ps->LineStyles.LineStyleCount;
 			ps->LineStyles.appendStyles(b);
 
@@ -813,6 +1072,19 @@ std::istream& lightspark::operator>>(std::istream& stream, CXFORMWITHALPHA& v)
 	return stream;
 }
 
+void CXFORMWITHALPHA::getTerms(float mult[4], float add[4]) const
+{
+	//Multiplicative terms are 8.8 fixed point
+	mult[0]=HasMultTerms?RedMultTerm/256.0f:1;
+	mult[1]=HasMultTerms?GreenMultTerm/256.0f:1;
+	mult[2]=HasMultTerms?BlueMultTerm/256.0f:1;
+	mult[3]=HasMultTerms?AlphaMultTerm/256.0f:1;
+	add[0]=HasAddTerms?RedAddTerm:0;
+	add[1]=HasAddTerms?GreenAddTerm:0;
+	add[2]=HasAddTerms?BlueAddTerm:0;
+	add[3]=HasAddTerms?AlphaAddTerm:0;
+}
+
 std::istream& lightspark::operator>>(std::istream& stream, MATRIX& v)
 {
 	BitStream bs(stream);
@@ -32,6 +32,7 @@
 #include <string.h>
 #include <assert.h>
 #include "exceptions.h"
+#include "parsing/streams.h"
 #ifndef WIN32
 // TODO: Proper CMake check
 #include <arpa/inet.h>
@@ -238,18 +239,86 @@ public:
 	}
 };
 
+/*
+	Process wide table of names. Each distinct string gets a numeric id, so names are compared
+	and looked up by id instead of by content. The table has two parts:
+	- The strings of the ABC constant pools and the names of the classes are interned for good
+	  when they are loaded, so they are bounded by the code that has been loaded
+	- Names built at runtime, e.g. dynamic or numeric property names, are reference counted by
+	  the variables using them, and their ids are reused once they are released
+	getString does not lock, the other operations do
+*/
+struct atom_stats
+{
+	uint32_t count;
+	uint64_t bytes;
+	uint32_t runtimeCount;
+	uint64_t runtimeBytes;
+	uint64_t lookupsByAtom;
+	uint64_t lookupsByContent;
+};
+
+class Atoms
+{
+private:
+	static void runtimeIncRef(uint32_t atom);
+	static void runtimeDecRef(uint32_t atom);
+	static void countLookupByAtom();
+public:
+	static const uint32_t INVALID=0xffffffff;
+	//Set in the ids of the names built at runtime
+	static const uint32_t RUNTIME=0x80000000;
+	//The empty string is always atom 0
+	static const uint32_t EMPTY=0;
+	//Only set by benchmarks, as the counter of the lookups by atom is shared by all the threads
+	static bool countLookups;
+	//Returns the atom of s, adding it to the table for good if needed. Used when loading code
+	static uint32_t intern(const char* s);
+	static uint32_t intern(const tiny_string& s)
+	{
+		return intern(s.raw_buf());
+	}
+	//Returns the atom of s or INVALID if s is not in the table, which is not modified
+	static uint32_t find(const tiny_string& s);
+	//Returns the atom of s with a reference, s is added as a runtime name if needed
+	static uint32_t acquire(const tiny_string& s);
+	//Only names built at runtime are counted, the others are never removed
+	static void incRef(uint32_t atom)
+	{
+		if(atom&RUNTIME)
+			runtimeIncRef(atom);
+	}
+	static void decRef(uint32_t atom)
+	{
+		if(atom&RUNTIME)
+			runtimeDecRef(atom);
+	}
+	//The returned buffer is valid as long as the atom is
+	static const char* getString(uint32_t atom);
+	static void lookupByAtom()
+	{
+		if(countLookups)
+			countLookupByAtom();
+	}
+	static void getStats(atom_stats& stats);
+};
+
 class QName
 {
 public:
 	tiny_string ns;
 	tiny_string name;
-	QName(const tiny_string& _name, const tiny_string& _ns):ns(_ns),name(_name){}
+	//QNames are immutable and name classes, so they are interned for good
+	uint32_t ns_atom;
+	uint32_t name_atom;
+	QName(const tiny_string& _name, const tiny_string& _ns):ns(_ns),name(_name),
+		ns_atom(Atoms::intern(_ns)),name_atom(Atoms::intern(_name)){}
 	bool operator<(const QName& r) const
 	{
-		if(ns==r.ns)
-			return name<r.name;
+		if(ns_atom==r.ns_atom)
+			return name_atom<r.name_atom;
 		else
-			return ns<r.ns;
+			return ns_atom<r.ns_atom;
 	}
 };
 
@@ -375,16 +444,25 @@ enum NS_KIND { NAMESPACE=0x08, PACKAGE_NAMESPACE=0x16, PACKAGE_INTERNAL_NAMESPAC
 
 struct nsNameAndKind
 {
+	//The name must not be modified, as the atom would not match anymore
 	tiny_string name;
+	//Atom of the name for namespaces of the constant pool, INVALID for the ones built at runtime
+	uint32_t atom;
 	NS_KIND kind;
-	nsNameAndKind(const tiny_string& _name, NS_KIND _kind):name(_name),kind(_kind){}
-	nsNameAndKind(const char* _name, NS_KIND _kind):name(_name),kind(_kind){}
+	nsNameAndKind(const tiny_string& _name, NS_KIND _kind):name(_name),atom(Atoms::INVALID),kind(_kind){}
+	nsNameAndKind(const char* _name, NS_KIND _kind):name(_name),atom(Atoms::INVALID),kind(_kind){}
+	nsNameAndKind(const tiny_string& _name, uint32_t _atom, NS_KIND _kind):name(_name),atom(_atom),kind(_kind){}
 	bool operator<(const nsNameAndKind& r) const
 	{
+		if(atom!=Atoms::INVALID && atom==r.atom)
+			return false;
 		return name < r.name;
 	}
 	bool operator==(const nsNameAndKind& r) const
   	{
+		//Atoms are unique, so they decide when both are known
+		if(atom!=Atoms::INVALID && r.atom!=Atoms::INVALID)
+			return /*kind==r.kind &&*/ atom==r.atom;
 		return /*kind==r.kind &&*/ name==r.name;
   	}
 };
@@ -394,6 +472,10 @@ struct multiname
 	enum NAME_TYPE {NAME_STRING,NAME_INT,NAME_NUMBER,NAME_OBJECT};
 	NAME_TYPE name_type;
 	tiny_string name_s;
+	//Atom of name_s for the names of the constant pool, INVALID otherwise.
+	//It must be reset if name_s is changed
+	uint32_t name_atom;
+	multiname():name_atom(Atoms::INVALID){}
 	union
 	{
 		int32_t name_i;
@@ -562,30 +644,49 @@ inline std::istream& operator>>(std::istream& s, RECORDHEADER& v)
 	return s;
 }
 
+/*
+	Bits are accumulated in a 64 bit buffer and extracted with shifts and masks.
+	On a std::istream only the bytes actually needed are read, as the stream is also
+	used directly by the callers. When reading from memory the buffer is refilled
+	a word at a time.
+*/
 class BitStream
 {
+private:
+	//NULL when reading from memory
+	std::istream* f;
+	const uint8_t* cur;
+	const uint8_t* end;
+	uint64_t buffer;
+	//Count of valid bits in the buffer
+	unsigned int pos;
+	unsigned int readBitsSlow(unsigned int num);
 public:
-	std::istream& f;
-	unsigned char buffer;
-	unsigned char pos;
-public:
-	BitStream(std::istream& in):f(in),pos(0){};
+	BitStream(std::istream& in):f(&in),cur(NULL),end(NULL),buffer(0),pos(0){};
+	BitStream(const uint8_t* data, uint32_t len):f(NULL),cur(data),end(data+len),buffer(0),pos(0){};
 	unsigned int readBits(unsigned int num)
 	{
-		unsigned int ret=0;
-		while(num)
+		if(pos<num)
+			return readBitsSlow(num);
+		pos-=num;
+		return (buffer>>pos)&((1ULL<<num)-1);
+	}
+	//Discards the bits up to the next byte boundary
+	void align();
+	//Reads a byte aligned structure in the middle of the bit fields
+	template<class T>
+	void readAligned(T& v)
+	{
+		align();
+		if(f)
 		{
-			if(!pos)
-			{
-				pos=8;
-				f.read((char*)&buffer,1);
-			}
-			ret<<=1;
-			ret|=(buffer>>(pos-1))&1;
-			pos--;
-			num--;
+			(*f) >> v;
+			return;
 		}
-		return ret;
+		memory_buf buf(cur,end-cur);
+		std::istream s(&buf);
+		s >> v;
+		cur+=buf.consumed();
 	}
 };
 
@@ -755,6 +856,7 @@ class FILLSTYLE
 	friend class DefineShape3Tag;
 	friend class GeomShape;
 	friend class Graphics;
+	friend class SoftwareRenderer;
 private:
 	int version;
 	UI8 FillStyleType;
@@ -969,6 +1071,10 @@ private:
 	SB GreenAddTerm;
 	SB BlueAddTerm;
 	SB AlphaAddTerm;
+public:
+	bool isIdentity() const { return !HasAddTerms && !HasMultTerms; }
+	//Multiplicative terms are 1 based, additive terms are in the [0,255] range. Order is RGBA
+	void getTerms(float mult[4], float add[4]) const;
 };
 
 class CXFORM
@@ -1185,6 +1291,8 @@ std::istream& operator>>(std::istream& s, RGB& v);
 std::istream& operator>>(std::istream& s, RGBA& v);
 std::istream& operator>>(std::istream& stream, SHAPEWITHSTYLE& v);
 std::istream& operator>>(std::istream& stream, SHAPE& v);
+//Parses a SHAPEWITHSTYLE from a tag body already in memory
+void readShapeWithStyle(SHAPEWITHSTYLE& v, const uint8_t* data, uint32_t len);
 std::istream& operator>>(std::istream& stream, FILLSTYLEARRAY& v);
 std::istream& operator>>(std::istream& stream, MORPHFILLSTYLEARRAY& v);
 std::istream& operator>>(std::istream& stream, LINESTYLEARRAY& v);
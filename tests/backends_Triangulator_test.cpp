@@ -0,0 +1,261 @@
+/**************************************************************************
+    Lightspark, a free flash player implementation
+
+    Copyright (C) 2009,2010  Alessandro Pignotti (a.pignotti@sssup.it)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**************************************************************************/
+
+#include "scripting/abc.h"
+#include "backends/geometry.h"
+#include "compat.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+using namespace std;
+using namespace lightspark;
+
+TLSDATA DLL_PUBLIC SystemState* sys=NULL;
+TLSDATA DLL_PUBLIC RenderThread* rt=NULL;
+TLSDATA DLL_PUBLIC ParseThread* pt=NULL;
+
+//New vertices of the triangulation are rounded to twips, so points closer than this to an edge are not checked
+static const double edgeTolerance=1.5;
+
+static int failures=0;
+
+static void check(bool condition, const char* name)
+{
+	if(!condition)
+	{
+		printf("FAIL %s\n",name);
+		failures++;
+	}
+	else
+		printf("PASS %s\n",name);
+}
+
+static double polygonArea(const vector<double>& x, const vector<double>& y)
+{
+	double ret=0;
+	for(unsigned int i=0;i<x.size();i++)
+	{
+		const unsigned int j=(i+1)%x.size();
+		ret+=x[i]*y[j]-x[j]*y[i];
+	}
+	return fabs(ret)/2;
+}
+
+static double triangulatedArea(const vector<Vector2>& vertices, const vector<uint32_t>& indices)
+{
+	double ret=0;
+	for(unsigned int i=0;i+2<indices.size();i+=3)
+	{
+		const Vector2& a=vertices[indices[i]];
+		const Vector2& b=vertices[indices[i+1]];
+		const Vector2& c=vertices[indices[i+2]];
+		ret+=fabs(double(b.x-a.x)*(c.y-a.y)-double(c.x-a.x)*(b.y-a.y))/2;
+	}
+	return ret;
+}
+
+//How many triangles contain the point
+static int coverage(double px, double py, const vector<Vector2>& vertices, const vector<uint32_t>& indices)
+{
+	int ret=0;
+	for(unsigned int i=0;i+2<indices.size();i+=3)
+	{
+		const Vector2& a=vertices[indices[i]];
+		const Vector2& b=vertices[indices[i+1]];
+		const Vector2& c=vertices[indices[i+2]];
+		const double d1=(b.x-a.x)*(py-a.y)-(b.y-a.y)*(px-a.x);
+		const double d2=(c.x-b.x)*(py-b.y)-(c.y-b.y)*(px-b.x);
+		const double d3=(a.x-c.x)*(py-c.y)-(a.y-c.y)*(px-c.x);
+		const bool hasNegative=(d1<0 || d2<0 || d3<0);
+		const bool hasPositive=(d1>0 || d2>0 || d3>0);
+		if(!(hasNegative && hasPositive))
+			ret++;
+	}
+	return ret;
+}
+
+static bool isFilled(double px, double py, const vector<vector<Vector2> >& outlines, FILL_RULE rule)
+{
+	int winding=0;
+	for(unsigned int i=0;i<outlines.size();i++)
+	{
+		for(unsigned int j=1;j<outlines[i].size();j++)
+		{
+			const Vector2& a=outlines[i][j-1];
+			const Vector2& b=outlines[i][j];
+			if((a.y<=py)==(b.y<=py))
+				continue;
+			const double x=a.x+(py-a.y)*(b.x-a.x)/double(b.y-a.y);
+			if(x>px)
+				winding+=(a.y<b.y)?1:-1;
+		}
+	}
+	return (rule==FILL_EVEN_ODD)?((winding&1)!=0):(winding!=0);
+}
+
+static bool isNearEdge(double px, double py, const vector<vector<Vector2> >& outlines)
+{
+	for(unsigned int i=0;i<outlines.size();i++)
+	{
+		for(unsigned int j=1;j<outlines[i].size();j++)
+		{
+			const Vector2& a=outlines[i][j-1];
+			const Vector2& b=outlines[i][j];
+			const double dx=b.x-a.x;
+			const double dy=b.y-a.y;
+			const double len=dx*dx+dy*dy;
+			double t=(len>0)?(((px-a.x)*dx+(py-a.y)*dy)/len):0;
+			t=dmax(0,dmin(1,t));
+			const double ex=a.x+t*dx-px;
+			const double ey=a.y+t*dy-py;
+			if(ex*ex+ey*ey<edgeTolerance*edgeTolerance)
+				return true;
+		}
+	}
+	return false;
+}
+
+//Returns the number of sampled points whose coverage does not match the fill rule
+static int sampleMismatches(const vector<vector<Vector2> >& outlines, FILL_RULE rule, int size, int samples,
+		const vector<Vector2>& vertices, const vector<uint32_t>& indices)
+{
+	int ret=0;
+	for(int i=0;i<samples;i++)
+	{
+		//Triangles are closed, so points on the rows of the vertices would be counted by the trapezoids on both sides
+		const double px=rand()%size+0.37;
+		const double py=rand()%size+0.61;
+		if(isNearEdge(px,py,outlines))
+			continue;
+		const int count=coverage(px,py,vertices,indices);
+		if(count!=(isFilled(px,py,outlines,rule)?1:0))
+			ret++;
+	}
+	return ret;
+}
+
+//The star is drawn by joining every second vertex of a regular pentagon
+static void testPentagram(Triangulator& triangulator)
+{
+	const double radius=10000;
+	const double center=12000;
+	vector<double> px,py;
+	for(int i=0;i<5;i++)
+	{
+		const double angle=M_PI/2+i*2*M_PI/5;
+		px.push_back(lrint(center+radius*cos(angle)));
+		py.push_back(lrint(center+radius*sin(angle)));
+	}
+	vector<vector<Vector2> > outlines(1);
+	for(int i=0;i<=5;i++)
+		outlines[0].push_back(Vector2(px[(i*2)%5],py[(i*2)%5]));
+
+	//The inner pentagon is made by the crossings of the edges
+	vector<double> innerX,innerY;
+	for(int i=0;i<5;i++)
+	{
+		const double ax=px[i],ay=py[i];
+		const double bx=px[(i+2)%5],by=py[(i+2)%5];
+		const double cx=px[(i+1)%5],cy=py[(i+1)%5];
+		const double dx=px[(i+4)%5],dy=py[(i+4)%5];
+		const double den=(bx-ax)*(dy-cy)-(by-ay)*(dx-cx);
+		const double t=((cx-ax)*(dy-cy)-(cy-ay)*(dx-cx))/den;
+		innerX.push_back(ax+t*(bx-ax));
+		innerY.push_back(ay+t*(by-ay));
+	}
+	const double innerArea=polygonArea(innerX,innerY);
+	//The outline of the whole star alternates the tips and the crossings
+	vector<double> starX,starY;
+	for(int i=0;i<5;i++)
+	{
+		starX.push_back(px[i]);
+		starY.push_back(py[i]);
+		//The crossing between tip i and tip i+1
+		for(int j=0;j<5;j++)
+		{
+			const double mx=(px[i]+px[(i+1)%5])/2-innerX[j];
+			const double my=(py[i]+py[(i+1)%5])/2-innerY[j];
+			if(mx*mx+my*my<radius*radius/4)
+			{
+				starX.push_back(innerX[j]);
+				starY.push_back(innerY[j]);
+				break;
+			}
+		}
+	}
+	check(starX.size()==10,"Pentagram crossings");
+	const double starArea=polygonArea(starX,starY);
+	//Rounding the new vertices moves the edges by less than a twip
+	double perimeter=0;
+	for(unsigned int i=0;i<starX.size();i++)
+	{
+		const unsigned int j=(i+1)%starX.size();
+		perimeter+=sqrt((starX[j]-starX[i])*(starX[j]-starX[i])+(starY[j]-starY[i])*(starY[j]-starY[i]));
+	}
+	const double tolerance=perimeter;
+
+	vector<Vector2> vertices;
+	vector<uint32_t> indices;
+	triangulator.triangulate(outlines,FILL_EVEN_ODD,vertices,indices);
+	check(fabs(triangulatedArea(vertices,indices)-(starArea-innerArea))<tolerance,"Pentagram even-odd area");
+	check(sampleMismatches(outlines,FILL_EVEN_ODD,24000,5000,vertices,indices)==0,"Pentagram even-odd coverage");
+
+	vertices.clear();
+	indices.clear();
+	triangulator.triangulate(outlines,FILL_NON_ZERO,vertices,indices);
+	check(fabs(triangulatedArea(vertices,indices)-starArea)<tolerance,"Pentagram non-zero area");
+	check(sampleMismatches(outlines,FILL_NON_ZERO,24000,5000,vertices,indices)==0,"Pentagram non-zero coverage");
+}
+
+//Self intersecting outlines with random vertices, the same triangulator is reused for all of them
+static void testRandomOutlines(Triangulator& triangulator)
+{
+	const int size=2000;
+	int mismatches[2]={0,0};
+	for(int i=0;i<200;i++)
+	{
+		vector<vector<Vector2> > outlines(1+rand()%3);
+		for(unsigned int j=0;j<outlines.size();j++)
+		{
+			const int count=3+rand()%12;
+			for(int k=0;k<count;k++)
+				outlines[j].push_back(Vector2(rand()%size,rand()%size));
+			outlines[j].push_back(outlines[j].front());
+		}
+		for(int rule=FILL_EVEN_ODD;rule<=FILL_NON_ZERO;rule++)
+		{
+			vector<Vector2> vertices;
+			vector<uint32_t> indices;
+			triangulator.triangulate(outlines,(FILL_RULE)rule,vertices,indices);
+			mismatches[rule]+=sampleMismatches(outlines,(FILL_RULE)rule,size,500,vertices,indices);
+		}
+	}
+	check(mismatches[FILL_EVEN_ODD]==0,"Random outlines even-odd coverage");
+	check(mismatches[FILL_NON_ZERO]==0,"Random outlines non-zero coverage");
+}
+
+int main(int argc, char* argv[])
+{
+	srand(1);
+	Triangulator triangulator;
+	testPentagram(triangulator);
+	testRandomOutlines(triangulator);
+	return (failures==0)?0:1;
+}
@@ -0,0 +1,65 @@
+// Tight loops used to measure the cost of instruction dispatch in the interpreter.
+// Compile with:
+// java -jar $FLEX_ROOT/lib/asc.jar -import $FLEX_ROOT/lib/builtin.abc interpreter_loops.as
+// and run with the benchmark script in this directory
+// Each loop is timed on its own, so the setup of the VM and the parsing of the code are not measured
+
+package
+{
+	public class Point3
+	{
+		public var x:int;
+		public var y:int;
+		public var z:int;
+		public function Point3(a:int, b:int, c:int)
+		{
+			x=a;
+			y=b;
+			z=c;
+		}
+		public function sum():int
+		{
+			return x+y+z;
+		}
+	}
+}
+
+import flash.utils.getTimer;
+
+function integerLoop(n:int):int
+{
+	var acc:int=0;
+	for(var i:int=0;i<n;i++)
+		acc+=i&7;
+	return acc;
+}
+
+function propertyLoop(n:int):int
+{
+	var p:Point3=new Point3(1,2,3);
+	var acc:int=0;
+	for(var i:int=0;i<n;i++)
+		acc+=p.x+p.y+p.z;
+	return acc;
+}
+
+function callLoop(n:int):int
+{
+	var p:Point3=new Point3(1,2,3);
+	var acc:int=0;
+	for(var i:int=0;i<n;i++)
+		acc+=p.sum();
+	return acc;
+}
+
+function run(name:String, loop:Function, n:int):void
+{
+	var start:int=getTimer();
+	loop(n);
+	var elapsed:int=getTimer()-start;
+	trace(name+": "+n+" iterations in "+elapsed+" ms, "+(elapsed*1000000/n)+" ns/op");
+}
+
+run("integerLoop",integerLoop,5000000);
+run("propertyLoop",propertyLoop,2000000);
+run("callLoop",callLoop,1000000);
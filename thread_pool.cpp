@@ -17,6 +17,9 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 **************************************************************************/
 #include <assert.h>
+#ifndef WIN32
+#include <unistd.h>
+#endif
 
 #include "thread_pool.h"
 #include "exceptions.h"
@@ -29,106 +32,291 @@ using namespace lightspark;
 extern TLSDATA SystemState* sys;
 TLSDATA lightspark::IThreadJob* thisJob=NULL;
 
-ThreadPool::ThreadPool(SystemState* s):stopFlag(false)
+namespace lightspark
+{
+struct pool_worker
+{
+	ThreadPool* pool;
+	pthread_t thread;
+	IThreadJob* curJob;
+	uint32_t index;
+	//Jobs queued to this worker, the owner pops from the back and thieves from the front
+	Mutex mutex;
+	std::deque<IThreadJob*> jobs;
+	pool_worker(ThreadPool* p, uint32_t i):pool(p),curJob(NULL),index(i),mutex("pool_worker"){}
+};
+};
+
+//Worker running on the current thread, jobs added by workers are queued to themselves
+static TLSDATA pool_worker* curWorker=NULL;
+
+uint32_t ThreadPool::workerCount=0;
+uint32_t ThreadPool::maxIoWorkers=64;
+
+ThreadPool::ThreadPool(SystemState* s):mutex("ThreadPool"),idleIoWorkers(0),waitingIoJobs(0),nextWorker(0),steals(0),m_sys(s),stopFlag(false)
 {
-	m_sys=s;
-	sem_init(&mutex,0,1);
 	sem_init(&num_jobs,0,0);
-	for(int i=0;i<NUM_THREADS;i++)
+	sem_init(&num_io_jobs,0,0);
+
+	uint32_t count=workerCount;
+#ifndef WIN32
+	if(count==0)
+	{
+		long cores=sysconf(_SC_NPROCESSORS_ONLN);
+		count=(cores>0)?cores:1;
+	}
+#endif
+	if(count==0)
+		count=2;
+	LOG(LOG_NO_INFO,_("Thread pool with ") << count << _(" workers"));
+
+	//The workers vector is not modified after the threads are started
+	for(uint32_t i=0;i<count;i++)
+		cpuWorkers.push_back(new pool_worker(this,i));
+	for(uint32_t i=0;i<count;i++)
 	{
-		curJobs[i]=NULL;
 #ifndef NDEBUG
 		int ret=
 #endif
-		pthread_create(&threads[i],NULL,job_worker,this);
+		pthread_create(&cpuWorkers[i]->thread,NULL,job_worker,cpuWorkers[i]);
 		assert(ret==0);
 	}
 }
 
 void ThreadPool::stop()
 {
+	Locker l(mutex);
+	if(stopFlag)
+		return;
 	stopFlag=true;
 	//Signal an event for all the threads
-	for(int i=0;i<NUM_THREADS;i++)
+	for(uint32_t i=0;i<cpuWorkers.size();i++)
 		sem_post(&num_jobs);
-
+	for(uint32_t i=0;i<ioWorkers.size();i++)
+		sem_post(&num_io_jobs);
 }
 
 ThreadPool::~ThreadPool()
 {
 	stop();
 	//Now abort any job that is still executing
-	sem_wait(&mutex);
-	for(int i=0;i<NUM_THREADS;i++)
+	mutex.lock();
+	for(uint32_t i=0;i<cpuWorkers.size();i++)
 	{
-		if(curJobs[i])
-			curJobs[i]->stop();
+		if(cpuWorkers[i]->curJob)
+			cpuWorkers[i]->curJob->stop();
 	}
-	sem_post(&mutex);
+	for(uint32_t i=0;i<ioWorkers.size();i++)
+	{
+		if(ioWorkers[i]->curJob)
+			ioWorkers[i]->curJob->stop();
+	}
+	mutex.unlock();
 
-	for(int i=0;i<NUM_THREADS;i++)
+	//No more blocking workers are added after stop
+	for(uint32_t i=0;i<cpuWorkers.size();i++)
+	{
+		if(pthread_join(cpuWorkers[i]->thread,NULL)!=0)
+			LOG(LOG_ERROR,_("pthread_join failed in ~ThreadPool"));
+		//Jobs that never ran are deleted if the pool owns them, so they can release their resources
+		deleteJobs(cpuWorkers[i]->jobs);
+		delete cpuWorkers[i];
+	}
+	for(uint32_t i=0;i<ioWorkers.size();i++)
 	{
-		if(pthread_join(threads[i],NULL)!=0)
+		if(pthread_join(ioWorkers[i]->thread,NULL)!=0)
 			LOG(LOG_ERROR,_("pthread_join failed in ~ThreadPool"));
+		delete ioWorkers[i];
 	}
+	deleteJobs(ioJobs);
+	LOG(LOG_NO_INFO,_("Thread pool: ") << ioWorkers.size() << _(" blocking workers, ") << steals << _(" jobs stolen"));
 
 	sem_destroy(&num_jobs);
-	sem_destroy(&mutex);
+	sem_destroy(&num_io_jobs);
+}
+
+void ThreadPool::deleteJobs(std::deque<IThreadJob*>& queue)
+{
+	for(uint32_t i=0;i<queue.size();i++)
+	{
+		if(queue[i]->destroyMe)
+			delete queue[i];
+	}
+	queue.clear();
+}
+
+IThreadJob* ThreadPool::getJob(pool_worker* w)
+{
+	{
+		//The most recent job of our own queue is the most likely to be still in cache
+		Locker l(w->mutex);
+		if(!w->jobs.empty())
+		{
+			IThreadJob* ret=w->jobs.back();
+			w->jobs.pop_back();
+			return ret;
+		}
+	}
+
+	//Steal the oldest job of another worker
+	const uint32_t count=cpuWorkers.size();
+	for(uint32_t i=1;i<count;i++)
+	{
+		pool_worker* victim=cpuWorkers[(w->index+i)%count];
+		Locker l(victim->mutex);
+		if(!victim->jobs.empty())
+		{
+			IThreadJob* ret=victim->jobs.front();
+			victim->jobs.pop_front();
+			ATOMIC_INCREMENT(steals);
+			return ret;
+		}
+	}
+	return NULL;
+}
+
+void ThreadPool::runJob(pool_worker* w, IThreadJob* myJob)
+{
+	mutex.lock();
+	w->curJob=myJob;
+	myJob->executing=true;
+	mutex.unlock();
+
+	assert(thisJob==NULL);
+	thisJob=myJob;
+	try
+	{
+		myJob->run();
+	}
+	catch(LightsparkException& e)
+	{
+		LOG(LOG_ERROR,_("Exception in ThreadPool ") << e.what());
+		sys->setError(e.cause);
+	}
+	thisJob=NULL;
+
+	mutex.lock();
+	myJob->executing=false;
+	w->curJob=NULL;
+	if(myJob->destroyMe)
+		delete myJob;
+	mutex.unlock();
 }
 
 void* ThreadPool::job_worker(void* t)
 {
-	ThreadPool* th=static_cast<ThreadPool*>(t);
+	pool_worker* w=static_cast<pool_worker*>(t);
+	ThreadPool* th=w->pool;
 	sys=th->m_sys;
+	curWorker=w;
 
-	//Let's find out index (slow, but it's done only once)
-	uint32_t index=0;
-	for(;index<NUM_THREADS;index++)
+	while(1)
 	{
-		if(pthread_equal(th->threads[index],pthread_self()))
-			break;
+		sem_wait(&th->num_jobs);
+		if(th->stopFlag)
+			pthread_exit(0);
+		//Each post of the semaphore matches a queued job, so one is surely available somewhere
+		IThreadJob* myJob=NULL;
+		while(myJob==NULL)
+			myJob=th->getJob(w);
+		th->runJob(w,myJob);
 	}
+	return NULL;
+}
+
+void* ThreadPool::io_worker(void* t)
+{
+	pool_worker* w=static_cast<pool_worker*>(t);
+	ThreadPool* th=w->pool;
+	sys=th->m_sys;
 
 	while(1)
 	{
-		sem_wait(&th->num_jobs);
+		sem_wait(&th->num_io_jobs);
 		if(th->stopFlag)
 			pthread_exit(0);
-		sem_wait(&th->mutex);
-		IThreadJob* myJob=th->jobs.front();
-		th->jobs.pop_front();
-		th->curJobs[index]=myJob;
-		myJob->executing=true;
-		sem_post(&th->mutex);
-
-		assert(thisJob==NULL);
-		thisJob=myJob;
-		try
-		{
-			myJob->run();
-		}
-		catch(LightsparkException& e)
-		{
-			LOG(LOG_ERROR,_("Exception in ThreadPool ") << e.what());
-			sys->setError(e.cause);
-		}
-		thisJob=NULL;
+		th->mutex.lock();
+		IThreadJob* myJob=th->ioJobs.front();
+		th->ioJobs.pop_front();
+		th->mutex.unlock();
 
-		sem_wait(&th->mutex);
-		myJob->executing=false;
-		th->curJobs[index]=NULL;
-		if(myJob->destroyMe)
-			delete myJob;
-		sem_post(&th->mutex);
+		th->runJob(w,myJob);
+
+		th->mutex.lock();
+		//The post of a queued job is already pending, so this worker is reserved for it
+		if(th->waitingIoJobs)
+			th->waitingIoJobs--;
+		else
+			th->idleIoWorkers++;
+		th->mutex.unlock();
 	}
 	return NULL;
 }
 
+void ThreadPool::addIoWorker()
+{
+	//Called with the mutex held
+	pool_worker* w=new pool_worker(this,ioWorkers.size());
+	ioWorkers.push_back(w);
+#ifndef NDEBUG
+	int ret=
+#endif
+	pthread_create(&w->thread,NULL,io_worker,w);
+	assert(ret==0);
+}
+
 void ThreadPool::addJob(IThreadJob* j)
 {
-	sem_wait(&mutex);
-	jobs.push_back(j);
-	sem_post(&mutex);
+	if(j->blocking)
+	{
+		Locker l(mutex);
+		if(stopFlag)
+		{
+			if(j->destroyMe)
+				delete j;
+			return;
+		}
+		ioJobs.push_back(j);
+		//Reserve an idle worker for this job, or add one if all are busy and the limit allows it
+		if(idleIoWorkers)
+			idleIoWorkers--;
+		else if(maxIoWorkers==0 || ioWorkers.size()<maxIoWorkers)
+			addIoWorker();
+		else
+			waitingIoJobs++;
+		sem_post(&num_io_jobs);
+		return;
+	}
+
+	pool_worker* w=curWorker;
+	if(w==NULL || w->pool!=this)
+	{
+		uint32_t next=ATOMIC_INCREMENT(nextWorker);
+		w=cpuWorkers[next%cpuWorkers.size()];
+	}
+	//Workers don't look for jobs after stop, so the job would never run
+	Locker l(mutex);
+	if(stopFlag)
+	{
+		if(j->destroyMe)
+			delete j;
+		return;
+	}
+	w->mutex.lock();
+	w->jobs.push_back(j);
+	w->mutex.unlock();
 	sem_post(&num_jobs);
 }
 
+uint32_t ThreadPool::getQueueDepth()
+{
+	uint32_t ret=0;
+	for(uint32_t i=0;i<cpuWorkers.size();i++)
+	{
+		Locker l(cpuWorkers[i]->mutex);
+		ret+=cpuWorkers[i]->jobs.size();
+	}
+	Locker l(mutex);
+	ret+=ioJobs.size();
+	return ret;
+}
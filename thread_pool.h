@@ -22,6 +22,7 @@
 
 #include "compat.h"
 #include <deque>
+#include <vector>
 #include <pthread.h>
 #include <semaphore.h>
 #include <stdlib.h>
@@ -32,26 +33,55 @@ extern TLSDATA lightspark::IThreadJob* thisJob;
 namespace lightspark
 {
 
-#define NUM_THREADS 5
-
 class SystemState;
+struct pool_worker;
 
+/*
+	Jobs that only use the CPU are spread over one worker per core. Each worker has its own queue
+	and steals from the others when it runs out of jobs. Blocking jobs (downloads, parsing from the
+	network, streams) have a lane of their own, which grows so that they never wait behind each other,
+	up to a limit past which they are queued until a blocking worker is free
+*/
 class ThreadPool
 {
+friend struct pool_worker;
 private:
-	sem_t mutex;
-	pthread_t threads[NUM_THREADS];
-	IThreadJob* curJobs[NUM_THREADS];
-	std::deque<IThreadJob*> jobs;
+	Mutex mutex;
+	std::vector<pool_worker*> cpuWorkers;
+	std::vector<pool_worker*> ioWorkers;
+	std::deque<IThreadJob*> ioJobs;
+	//Blocking workers waiting for a job and not yet reserved by addJob
+	uint32_t idleIoWorkers;
+	//Blocking jobs queued when all the blocking workers were busy and no more could be added
+	uint32_t waitingIoJobs;
 	sem_t num_jobs;
+	sem_t num_io_jobs;
+	ATOMIC_INT32(nextWorker);
+	ATOMIC_INT32(steals);
 	static void* job_worker(void*);
+	static void* io_worker(void*);
+	IThreadJob* getJob(pool_worker* w);
+	void runJob(pool_worker* w, IThreadJob* j);
+	void addIoWorker();
+	static void deleteJobs(std::deque<IThreadJob*>& queue);
 	SystemState* m_sys;
 	bool stopFlag;
 public:
+	//Count of workers for CPU jobs, 0 means one for each core
+	static uint32_t workerCount;
+	//Maximum count of workers for blocking jobs, 0 means no limit
+	static uint32_t maxIoWorkers;
 	ThreadPool(SystemState* s);
 	~ThreadPool();
 	void addJob(IThreadJob* j);
 	void stop();
+	//Jobs waiting to be executed
+	uint32_t getQueueDepth();
+	//Jobs executed by a worker other than the one they were queued to
+	uint32_t getStealCount() const
+	{
+		return steals;
+	}
 };
 
 };
@@ -18,6 +18,10 @@
 **************************************************************************/
 
 #include <assert.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <sstream>
 
 #include "threading.h"
 #include "exceptions.h"
@@ -27,7 +31,7 @@
 using namespace lightspark;
 
 //NOTE: thread jobs can be run only once
-IThreadJob::IThreadJob():destroyMe(false),executing(false),aborting(false)
+IThreadJob::IThreadJob():destroyMe(false),executing(false),aborting(false),blocking(false)
 {
 	sem_init(&terminated, 0, 0);
 }
@@ -63,36 +67,114 @@ void IThreadJob::stop()
 	}
 }
 
+namespace
+{
+//Wait statistics of all the mutexes sharing a name
+struct mutex_profile
+{
+	//Waits are bucketed by the power of two of their length in microseconds
+	enum { BUCKETS=24 };
+	uint64_t waits;
+	uint64_t totalTime;
+	uint64_t maxTime;
+	uint64_t histogram[BUCKETS];
+	mutex_profile():waits(0),totalTime(0),maxTime(0)
+	{
+		memset(histogram,0,sizeof(histogram));
+	}
+	void record(uint64_t t)
+	{
+		waits++;
+		totalTime+=t;
+		if(t>maxTime)
+			maxTime=t;
+		unsigned int bucket=0;
+		while(t && bucket<BUCKETS-1)
+		{
+			t>>=1;
+			bucket++;
+		}
+		histogram[bucket]++;
+	}
+};
+
+//Not a Mutex, as it's used while profiling them
+pthread_mutex_t profilesMutex=PTHREAD_MUTEX_INITIALIZER;
+//Never destroyed, mutexes may be locked during static destruction
+std::map<std::string, mutex_profile>* profiles=NULL;
+};
+
+bool Mutex::profilingEnabled=false;
+
 Mutex::Mutex(const char* n):name(n),foundBusy(0)
 {
-	sem_init(&sem,0,1);
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+#ifdef PTHREAD_ADAPTIVE_MUTEX_INITIALIZER_NP
+	//Spin for a while before sleeping, critical sections are usually short
+	pthread_mutexattr_settype(&attr,PTHREAD_MUTEX_ADAPTIVE_NP);
+#endif
+	pthread_mutex_init(&mutex,&attr);
+	pthread_mutexattr_destroy(&attr);
 }
 
 Mutex::~Mutex()
 {
 	if(name)
 		LOG(LOG_TRACE,_("Mutex ") << name << _(" waited ") << foundBusy << _(" times"));
-	sem_destroy(&sem);
+	pthread_mutex_destroy(&mutex);
 }
 
-void Mutex::lock()
+void Mutex::lockContended()
 {
-	if(name)
+	if(name==NULL)
 	{
-		//If the semaphore can be acquired immediately just return
-		if(sem_trywait(&sem)==0)
-			return;
+		pthread_mutex_lock(&mutex);
+		return;
+	}
 
-		//Otherwise log the busy event and do a real wait
+	if(!profilingEnabled)
+	{
+		pthread_mutex_lock(&mutex);
 		foundBusy++;
+		return;
 	}
 
-	sem_wait(&sem);
+	uint64_t start=compat_get_monotonic_time_us();
+	pthread_mutex_lock(&mutex);
+	uint64_t waited=compat_get_monotonic_time_us()-start;
+	//The counter is protected by the mutex itself
+	foundBusy++;
+
+	pthread_mutex_lock(&profilesMutex);
+	if(profiles==NULL)
+		profiles=new std::map<std::string, mutex_profile>;
+	(*profiles)[name].record(waited);
+	pthread_mutex_unlock(&profilesMutex);
 }
 
-void Mutex::unlock()
+void Mutex::dumpProfile()
 {
-	sem_post(&sem);
+	pthread_mutex_lock(&profilesMutex);
+	if(profiles==NULL || profiles->empty())
+		LOG(LOG_NO_INFO,_("No mutex contention recorded"));
+	else
+	{
+		std::map<std::string, mutex_profile>::const_iterator it=profiles->begin();
+		for(;it!=profiles->end();++it)
+		{
+			const mutex_profile& p=it->second;
+			std::ostringstream hist;
+			for(unsigned int i=0;i<mutex_profile::BUCKETS;i++)
+			{
+				if(p.histogram[i])
+					hist << " <" << (1ULL<<i) << "us:" << p.histogram[i];
+			}
+			LOG(LOG_NO_INFO,_("Mutex ") << it->first << _(": ") << p.waits << _(" waits, ") << p.totalTime << _("us total, ") <<
+					p.maxTime << _("us max,") << hist.str());
+		}
+	}
+	pthread_mutex_unlock(&profilesMutex);
 }
 
 Semaphore::Semaphore(uint32_t init)//:blocked(0),maxBlocked(max)
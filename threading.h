@@ -35,14 +35,27 @@ class Mutex
 {
 friend class Locker;
 private:
-	sem_t sem;
+	pthread_mutex_t mutex;
 	const char* name;
 	uint32_t foundBusy;
+	void lockContended();
 public:
+	//When enabled the time spent waiting on named mutexes is recorded
+	static bool profilingEnabled;
 	Mutex(const char* name);
 	~Mutex();
-	void lock();
-	void unlock();
+	void lock()
+	{
+		//Fast path, the mutex is free
+		if(pthread_mutex_trylock(&mutex)!=0)
+			lockContended();
+	}
+	void unlock()
+	{
+		pthread_mutex_unlock(&mutex);
+	}
+	//Logs the wait time histograms of the named mutexes
+	static void dumpProfile() DLL_PUBLIC;
 };
 
 class IThreadJob
@@ -55,6 +68,8 @@ protected:
 	bool destroyMe;
 	bool executing;
 	bool aborting;
+	//Blocking jobs (I/O, waits on other threads) are run on a separate lane of the ThreadPool
+	bool blocking;
 	virtual void execute()=0;
 	virtual void threadAbort()=0;
 public:
@@ -181,6 +196,67 @@ public:
 
 };
 
+/*
+	Unbounded lock free queue with many producers and a single consumer. Producers only swap
+	the head pointer and link the previous node, the consumer owns the tail, which is always a
+	dummy node. A producer preempted between the swap and the link hides the values pushed after
+	its own until it resumes, so the queue may look empty for a moment while it is not
+*/
+template<class T>
+class MPSCQueue
+{
+private:
+	struct node
+	{
+		ATOMIC_PTR(node,next);
+		T value;
+	};
+	ATOMIC_PTR(node,head);
+	node* tail;
+public:
+	MPSCQueue()
+	{
+		node* n=new node;
+		n->next=NULL;
+		head=n;
+		tail=n;
+	}
+	//Values still in the queue are dropped
+	~MPSCQueue()
+	{
+		while(tail)
+		{
+			node* next=tail->next;
+			delete tail;
+			tail=next;
+		}
+	}
+	//Can be called from any thread
+	void push(const T& v)
+	{
+		node* n=new node;
+		n->value=v;
+		n->next=NULL;
+		node* prev=ATOMIC_EXCHANGE_PTR(head,n);
+		prev->next=n;
+	}
+	//Only the consumer thread can call pop and isEmpty
+	bool pop(T& v)
+	{
+		node* next=tail->next;
+		if(next==NULL)
+			return false;
+		v=next->value;
+		delete tail;
+		tail=next;
+		return true;
+	}
+	bool isEmpty() const
+	{
+		return tail->next==NULL;
+	}
+};
+
 };
 
 extern TLSDATA lightspark::IThreadJob* thisJob;
@@ -41,6 +41,8 @@ int main(int argc, char* argv[])
 	std::vector<char*> fileNames;
 	bool useInterpreter=true;
 	bool useJit=false;
+	bool useThreadedDispatch=true;
+	bool benchmark=false;
 	LOG_LEVEL log_level=LOG_NOT_IMPLEMENTED;
 	bool error=false;
 
@@ -56,6 +58,16 @@ int main(int argc, char* argv[])
 		{
 			useJit=true;
 		}
+		else if(strcmp(argv[i],"-nt")==0 || 
+			strcmp(argv[i],"--disable-threaded-dispatch")==0)
+		{
+			useThreadedDispatch=false;
+		}
+		else if(strcmp(argv[i],"-b")==0 || 
+			strcmp(argv[i],"--benchmark")==0)
+		{
+			benchmark=true;
+		}
 		else if(strcmp(argv[i],"-l")==0 || 
 			strcmp(argv[i],"--log-level")==0)
 		{
@@ -78,7 +90,8 @@ int main(int argc, char* argv[])
 
 	if(fileNames.empty() || error)
 	{
-		cout << "Usage: " << argv[0] << " [--disable-interpreter|-ni] [--enable-jit|-j] [--log-level|-l 0-4] <file.abc> [<file2.abc>]" << endl;
+		cout << "Usage: " << argv[0] << " [--disable-interpreter|-ni] [--enable-jit|-j] [--disable-threaded-dispatch|-nt] [--benchmark|-b]"
+			" [--log-level|-l 0-4] <file.abc> [<file2.abc>]" << endl;
 		exit(-1);
 	}
 
@@ -96,6 +109,9 @@ int main(int argc, char* argv[])
 	}
 	sys->useInterpreter=useInterpreter;
 	sys->useJit=useJit;
+	sys->useThreadedDispatch=useThreadedDispatch;
+	sys->countInstructions=benchmark;
+	Atoms::countLookups=benchmark;
 
 	sys->setOrigin(tiny_string("file://") + tiny_string(fileNames[0]));
 
@@ -122,6 +138,18 @@ int main(int argc, char* argv[])
 	}
 	sys->setShutdownFlag();
 	sys->wait();
+	if(benchmark)
+	{
+		//The benchmarks time their own loops, only the totals of the run are reported here
+		cout << "Dispatch: " << (useThreadedDispatch?"threaded":"switch") << endl;
+		cout << "Interpreted instructions: " << vm->interpretedInstructions << endl;
+		//Names are shared by all the contexts
+		atom_stats atoms;
+		Atoms::getStats(atoms);
+		cout << "Atoms: " << atoms.count << " (" << atoms.bytes << " bytes), runtime names: " <<
+			atoms.runtimeCount << " (" << atoms.runtimeBytes << " bytes)" << endl;
+		cout << "Name lookups: " << atoms.lookupsByAtom << " by atom, " << atoms.lookupsByContent << " by content" << endl;
+	}
 	delete sys;
 	//Clean up (mostly useful to clean up valgrind logs)
 	for(unsigned int i=0;i<contexts.size();i++)
@@ -20,7 +20,9 @@
 #include "swf.h"
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <algorithm>
 
 #include "timer.h"
 #include "compat.h"
@@ -55,10 +57,47 @@ timespec lightspark::msecsToTimespec(uint64_t time)
 	return ret;
 }
 
-TimerThread::TimerThread(SystemState* s):m_sys(s),currentJob(NULL),stopped(false)
+timespec lightspark::usecsToTimespec(uint64_t time)
+{
+	timespec ret;
+	ret.tv_sec=time/1000000LL;
+	ret.tv_nsec=(time%1000000LL)*1000LL;
+	return ret;
+}
+
+bool TimerThread::offloadHeavyTicks=false;
+uint32_t TimerThread::heavyTickTime=2000;
+
+namespace lightspark
+{
+//Runs a heavy tick job on the ThreadPool
+class TickRunner: public IThreadJob
+{
+private:
+	TimerThread* timer;
+	ITickJob* job;
+	uint64_t due;
+	void execute()
+	{
+		timer->runTick(job,due,true);
+	}
+	void threadAbort()
+	{
+	}
+public:
+	TickRunner(TimerThread* t, ITickJob* j, uint64_t d):timer(t),job(j),due(d)
+	{
+		destroyMe=true;
+	}
+};
+};
+
+TimerThread::TimerThread(SystemState* s):mutex("TimerThread"),overflowEvents(NULL),m_sys(s),currentJob(NULL),stopped(false)
 {
-	sem_init(&mutex,0,1);
 	sem_init(&newEvent,0,0);
+	memset(wheel,0,sizeof(wheel));
+	memset(levelCount,0,sizeof(levelCount));
+	wheelTime=compat_get_current_time_ms();
 
 	pthread_create(&t,NULL,(thread_worker)timer_worker,this);
 }
@@ -76,56 +115,204 @@ void TimerThread::wait()
 {
 	stop();
 	pthread_join(t,NULL);
+	dumpTickStats();
 }
 
 TimerThread::~TimerThread()
 {
 	stop();
-	list<TimingEvent*>::iterator it=pendingEvents.begin();
-	for(;it!=pendingEvents.end();it++)
-		delete *it;
-	sem_destroy(&mutex);
+	unordered_multimap<ITickJob*,TimingEvent*>::iterator it=jobEvents.begin();
+	for(;it!=jobEvents.end();it++)
+		delete it->second;
+	//Canceled events are not in the map anymore
+	for(uint32_t i=0;i<expiredEvents.size();i++)
+	{
+		if(expiredEvents[i]->job==NULL)
+			delete expiredEvents[i];
+	}
 	sem_destroy(&newEvent);
 }
 
-void TimerThread::insertNewEvent_nolock(TimingEvent* e)
+void TimerThread::linkEvent(TimingEvent* e)
 {
-	list<TimingEvent*>::iterator it=pendingEvents.begin();
-	//If there are no events pending, or this is earlier than the first, signal newEvent
-	if(pendingEvents.empty() || (*it)->timing > e->timing)
+	uint64_t delta=(e->timing>wheelTime)?(e->timing-wheelTime):1;
+	//Late events run at the next millisecond
+	uint64_t timing=wheelTime+delta;
+	e->level=OVERFLOW_LIST;
+	e->slot=&overflowEvents;
+	for(uint32_t l=0;l<WHEEL_LEVELS;l++)
 	{
-		pendingEvents.insert(it, e);
+		//A slot is reached again after a whole turn, so a delta of exactly one turn is fine
+		if(delta<=(1ULL<<(WHEEL_BITS*(l+1))))
+		{
+			e->level=l;
+			e->slot=&wheel[l][(timing>>(WHEEL_BITS*l))&(WHEEL_SIZE-1)];
+			break;
+		}
+	}
+	e->prev=NULL;
+	e->next=*e->slot;
+	if(e->next)
+		e->next->prev=e;
+	*e->slot=e;
+	levelCount[e->level]++;
+}
+
+void TimerThread::unlinkEvent(TimingEvent* e)
+{
+	if(e->prev)
+		e->prev->next=e->next;
+	else
+		*e->slot=e->next;
+	if(e->next)
+		e->next->prev=e->prev;
+	levelCount[e->level]--;
+}
+
+void TimerThread::insertNewEvent_nolock(TimingEvent* e)
+{
+	//Without pending events the wheel is not kept up to date
+	if(jobEvents.empty() && expiredEvents.empty())
+		wheelTime=std::max<uint64_t>(wheelTime,compat_get_current_time_ms());
+	uint64_t oldWakeUp;
+	bool wasEmpty=!getNextWakeUp(oldWakeUp);
+	linkEvent(e);
+	jobEvents.insert(make_pair(e->job,e));
+	//Wake up the worker if the event is earlier than what it waits for
+	if(wasEmpty || e->timing<oldWakeUp)
 		sem_post(&newEvent);
-		return;
+}
+
+void TimerThread::insertNewEvent(TimingEvent* e)
+{
+	Locker l(mutex);
+	insertNewEvent_nolock(e);
+}
+
+void TimerThread::cascade(TimingEvent** slot)
+{
+	TimingEvent* e=*slot;
+	while(e)
+	{
+		TimingEvent* next=e->next;
+		unlinkEvent(e);
+		linkEvent(e);
+		e=next;
 	}
-	++it;
+}
 
-	for(;it!=pendingEvents.end();++it)
+void TimerThread::advance(uint64_t now)
+{
+	while(wheelTime<now)
 	{
-		if((*it)->timing > e->timing)
+		//Skip the turns of the levels without events
+		uint32_t empty=0;
+		while(empty<=WHEEL_LEVELS && levelCount[empty]==0)
+			empty++;
+		if(empty>WHEEL_LEVELS)
 		{
-			pendingEvents.insert(it, e);
+			wheelTime=now;
 			return;
 		}
+		if(empty>0)
+		{
+			//Overflowed events are checked at each turn of the last level
+			const uint32_t shift=WHEEL_BITS*std::min<uint32_t>(empty,WHEEL_LEVELS-1);
+			const uint64_t boundary=((wheelTime>>shift)+1)<<shift;
+			if(boundary>now)
+			{
+				wheelTime=now;
+				return;
+			}
+			wheelTime=boundary-1;
+		}
+
+		const uint64_t t=wheelTime+1;
+		//Move down the slots reached by the wheel, starting from the highest level
+		for(uint32_t l=WHEEL_LEVELS-1;l>0;l--)
+		{
+			if((t&((1ULL<<(WHEEL_BITS*l))-1))!=0)
+				continue;
+			if(l==WHEEL_LEVELS-1)
+				cascade(&overflowEvents);
+			cascade(&wheel[l][(t>>(WHEEL_BITS*l))&(WHEEL_SIZE-1)]);
+		}
+		TimingEvent** slot=&wheel[0][t&(WHEEL_SIZE-1)];
+		while(*slot)
+		{
+			TimingEvent* e=*slot;
+			unlinkEvent(e);
+			e->level=EXPIRED_LIST;
+			expiredEvents.push_back(e);
+		}
+		wheelTime=t;
 	}
-	//Event has to be inserted after all the others
-	pendingEvents.insert(pendingEvents.end(), e);
 }
 
-void TimerThread::insertNewEvent(TimingEvent* e)
+bool TimerThread::getNextWakeUp(uint64_t& time) const
 {
-	sem_wait(&mutex);
-	insertNewEvent_nolock(e);
-	sem_post(&mutex);
+	if(!expiredEvents.empty())
+	{
+		time=wheelTime;
+		return true;
+	}
+	bool found=false;
+	for(uint32_t l=0;l<WHEEL_LEVELS;l++)
+	{
+		if(levelCount[l]==0)
+			continue;
+		//The first slot with events, slots of the higher levels are due when they must be moved down
+		const uint32_t shift=WHEEL_BITS*l;
+		const uint64_t base=wheelTime>>shift;
+		for(uint32_t i=1;i<=WHEEL_SIZE;i++)
+		{
+			if(wheel[l][(base+i)&(WHEEL_SIZE-1)])
+			{
+				if(!found || ((base+i)<<shift)<time)
+					time=(base+i)<<shift;
+				found=true;
+				break;
+			}
+		}
+	}
+	if(levelCount[OVERFLOW_LIST])
+	{
+		const uint32_t shift=WHEEL_BITS*(WHEEL_LEVELS-1);
+		const uint64_t turn=((wheelTime>>shift)+1)<<shift;
+		if(!found || turn<time)
+			time=turn;
+		found=true;
+	}
+	return found;
 }
 
 //Unsafe debugging routine
 void TimerThread::dumpJobs()
 {
-	list<TimingEvent*>::iterator it=pendingEvents.begin();
-	//Find if the job is in the list
-	for(;it!=pendingEvents.end();it++)
-		cout << (*it)->job << endl;
+	unordered_multimap<ITickJob*,TimingEvent*>::iterator it=jobEvents.begin();
+	for(;it!=jobEvents.end();it++)
+		cout << it->first << ' ' << it->second->timing << endl;
+}
+
+void TimerThread::runTick(ITickJob* job, uint64_t due, bool offloaded)
+{
+	const uint64_t start=compat_get_current_time_us();
+	job->tick();
+	const uint64_t end=compat_get_current_time_us();
+
+	Locker l(mutex);
+	tick_stats& s=stats[job];
+	const uint64_t lateness=(start>due*1000)?(start-due*1000):0;
+	s.fires++;
+	s.totalLateness+=lateness;
+	if(lateness>s.maxLateness)
+		s.maxLateness=lateness;
+	s.lastDuration=end-start;
+	if(offloaded)
+		s.offloaded--;
+	//Forget the jobs which are not scheduled anymore
+	if(s.offloaded==0 && jobEvents.find(job)==jobEvents.end())
+		stats.erase(job);
 }
 
 void* TimerThread::timer_worker(TimerThread* th)
@@ -133,63 +320,80 @@ void* TimerThread::timer_worker(TimerThread* th)
 	sys=th->m_sys;
 	while(1)
 	{
-		//Wait until a time expires
-		sem_wait(&th->mutex);
-		//Check if there is any event
-		while(th->pendingEvents.empty())
+		Locker l(th->mutex);
+		th->advance(compat_get_current_time_ms());
+		if(th->expiredEvents.empty())
 		{
-			sem_post(&th->mutex);
-			sem_wait(&th->newEvent);
+			uint64_t timing;
+			bool pending=th->getNextWakeUp(timing);
+			l.unlock();
+			//Wait for the absolute time, or a newEvent signal
+			int ret;
+			if(pending)
+			{
+				timespec tmpt=msecsToTimespec(timing);
+				ret=sem_timedwait(&th->newEvent, &tmpt);
+			}
+			else
+				ret=sem_wait(&th->newEvent);
 			if(th->stopped)
 				pthread_exit(0);
-			sem_wait(&th->mutex);
+			if(ret!=0 && errno!=ETIMEDOUT && errno!=EINTR)
+				LOG(LOG_ERROR,_("Unexpected failure of sem_timedwait.. Trying to go on. errno=") << errno);
+			continue;
 		}
 
-		//Get expiration of first event
-		uint64_t timing=th->pendingEvents.front()->timing;
-		//Wait for the absolute time, or a newEvent signal
-		timespec tmpt=msecsToTimespec(timing);
-		sem_post(&th->mutex);
-		int ret=sem_timedwait(&th->newEvent, &tmpt);
-		if(th->stopped)
-			pthread_exit(0);
-
-		if(ret==0)
+		//Events expired in the same millisecond are run one after the other without waiting again
+		TimingEvent* e=th->expiredEvents.front();
+		th->expiredEvents.pop_front();
+		//Canceled events are only flagged while they wait to run
+		if(e->job==NULL)
+		{
+			delete e;
 			continue;
-
-		//The first event has expired
-		int err=errno;
-		if(err!=ETIMEDOUT)
+		}
+		ITickJob* job=e->job;
+		const uint64_t due=e->timing;
+		tick_stats& s=th->stats[job];
+		if(s.offloaded && !e->isTick)
 		{
-			LOG(LOG_ERROR,_("Unexpected failure of sem_timedwait.. Trying to go on. errno=") << err);
+			//Waits must not be lost, try again when the run on the ThreadPool is over
+			th->linkEvent(e);
 			continue;
 		}
-
-		//Note: it may happen that between the sem_timewait and this code another event gets inserted in the front. In this 
-		//case it's not an error to execute it now, as it's expiration time is the first anyway and before the one expired
-		sem_wait(&th->mutex);
-		TimingEvent* e=th->pendingEvents.front();
-		th->pendingEvents.pop_front();
-
-		th->currentJob=e->job;
-
 		bool destroyEvent=true;
 		if(e->isTick) //Let's schedule the event again
 		{
 			e->timing+=e->tickTime;
-			th->insertNewEvent_nolock(e); //newEvent may be signaled, and will be waited by sem_timedwait
+			th->linkEvent(e);
 			destroyEvent=false;
 		}
+		else
+		{
+			unordered_multimap<ITickJob*,TimingEvent*>::iterator it=th->jobEvents.equal_range(job).first;
+			while(it->second!=e)
+				++it;
+			th->jobEvents.erase(it);
+		}
 
-		sem_post(&th->mutex);
-
-		//Now execute the job
-		//NOTE: jobs may be invalid if they has been cancelled in the meantime
-		assert(e->job || !e->isTick);
-		if(e->job)
-			e->job->tick();
-
-		th->currentJob=NULL;
+		if(s.offloaded)
+		{
+			//The previous run is still going on, this fire is merged with it
+			s.skipped++;
+		}
+		else if(offloadHeavyTicks && s.lastDuration>heavyTickTime)
+		{
+			s.offloaded++;
+			th->m_sys->addJob(new TickRunner(th,job,due));
+		}
+		else
+		{
+			th->currentJob=job;
+			l.unlock();
+			th->runTick(job,due,false);
+			l.lock();
+			th->currentJob=NULL;
+		}
 
 		//Cleanup
 		if(destroyEvent)
@@ -219,46 +423,65 @@ void TimerThread::addWait(uint32_t waitTime, ITickJob* job)
 
 bool TimerThread::removeJob(ITickJob* job)
 {
-	sem_wait(&mutex);
-
-	list<TimingEvent*>::iterator it=pendingEvents.begin();
-	bool first=true;
-	//Find if the job is in the list
-	for(;it!=pendingEvents.end();it++)
+	Locker l(mutex);
+	//Wait until the job ends (per design should be very short). The lock is released meanwhile
+	//as the job may add itself again
+	while(1)
 	{
-		if((*it)->job==job)
+		unordered_map<ITickJob*,tick_stats>::const_iterator s=stats.find(job);
+		if(currentJob!=job && (s==stats.end() || s->second.offloaded==0))
 			break;
-		first=false;
+		l.unlock();
+		compat_msleep(0);
+		l.lock();
 	}
-
-	//Spin wait until the job ends (per design should be very short)
-	//As we hold the mutex and currentJob is not NULL we are surely executing a job
-	while(currentJob==job);
 	//The job ended
 
-	if(it==pendingEvents.end())
+	pair<unordered_multimap<ITickJob*,TimingEvent*>::iterator,unordered_multimap<ITickJob*,TimingEvent*>::iterator>
+		range=jobEvents.equal_range(job);
+	const bool found=range.first!=range.second;
+	for(unordered_multimap<ITickJob*,TimingEvent*>::iterator it=range.first;it!=range.second;++it)
 	{
-		sem_post(&mutex);
-		return false;
+		TimingEvent* e=it->second;
+		//Expired events are in the queue of the worker, flag them so that they are not run
+		if(e->level==EXPIRED_LIST)
+		{
+			e->job=NULL;
+			e->isTick=false;
+		}
+		else
+		{
+			unlinkEvent(e);
+			delete e;
+		}
 	}
+	jobEvents.erase(range.first,range.second);
+	stats.erase(job);
+	return found;
+}
 
-	//If we are waiting of this event it's not safe to remove it
-	//so we flag it has invalid and the worker thread will remove it
-	//this is equivalent, as the event is not going to be fired
-	TimingEvent* e=*it;
-	if(first)
-	{
-		e->job=NULL;
-		e->isTick=false;
-	}
-	else
+bool TimerThread::getTickStats(ITickJob* job, tick_stats& ret)
+{
+	Locker l(mutex);
+	unordered_map<ITickJob*,tick_stats>::const_iterator it=stats.find(job);
+	if(it==stats.end())
+		return false;
+	ret=it->second;
+	return true;
+}
+
+void TimerThread::dumpTickStats()
+{
+	Locker l(mutex);
+	unordered_map<ITickJob*,tick_stats>::const_iterator it=stats.begin();
+	for(;it!=stats.end();++it)
 	{
-		pendingEvents.erase(it);
-		delete e;
+		const tick_stats& s=it->second;
+		if(s.fires==0)
+			continue;
+		LOG(LOG_NO_INFO,_("Tick job ") << it->first << _(": ") << s.fires << _(" fires, average lateness ")
+			<< s.totalLateness/s.fires << _(" us, max ") << s.maxLateness << _(" us, ") << s.skipped << _(" skipped"));
 	}
-
-	sem_post(&mutex);
-	return true;
 }
 
 Chronometer::Chronometer()
@@ -21,7 +21,8 @@
 #define _TIMER_H
 
 #include "compat.h"
-#include <list>
+#include <deque>
+#include <unordered_map>
 #include <pthread.h>
 #include <time.h>
 #include <semaphore.h>
@@ -43,11 +44,38 @@ public:
 uint64_t timespecToUsecs(timespec t);
 uint64_t timespecToMsecs(timespec t);
 timespec msecsToTimespec(uint64_t time);
+timespec usecsToTimespec(uint64_t time);
 
 typedef void* (*thread_worker)(void*);
+
+//Statistics of the runs of a tick job, times are in microseconds
+struct tick_stats
+{
+	uint32_t fires;
+	//How much later than due the runs started
+	uint64_t totalLateness;
+	uint64_t maxLateness;
+	uint32_t lastDuration;
+	//Fires dropped because the previous run on the ThreadPool was not over yet
+	uint32_t skipped;
+	//Runs executing on the ThreadPool
+	uint32_t offloaded;
+	tick_stats():fires(0),totalLateness(0),maxLateness(0),lastDuration(0),skipped(0),offloaded(0){}
+};
+
+/*
+	Jobs are kept in a hierarchical timing wheel with millisecond resolution, so adding and
+	canceling are O(1) whatever the number of jobs. Each slot of level 0 holds the jobs due in a
+	given millisecond, which are run together; each slot of the next levels spans a whole turn
+	of the level below and is moved down when the wheel reaches it
+*/
 class TimerThread
 {
+friend class TickRunner;
 private:
+	enum { WHEEL_BITS=6, WHEEL_SIZE=1<<WHEEL_BITS, WHEEL_LEVELS=4 };
+	//Jobs past the range of the wheel, and expired jobs waiting to run
+	enum { OVERFLOW_LIST=WHEEL_LEVELS, EXPIRED_LIST };
 	class TimingEvent
 	{
 	public:
@@ -56,19 +84,43 @@ private:
 		//Timing are in milliseconds
 		uint64_t timing;
 		uint32_t tickTime;
+		//Links of the slot list
+		TimingEvent* prev;
+		TimingEvent* next;
+		TimingEvent** slot;
+		uint32_t level;
 	};
-	sem_t mutex;
+	Mutex mutex;
 	sem_t newEvent;
 	pthread_t t;
-	std::list<TimingEvent*> pendingEvents;
+	TimingEvent* wheel[WHEEL_LEVELS][WHEEL_SIZE];
+	TimingEvent* overflowEvents;
+	//Events in each level and in the overflow list
+	uint32_t levelCount[WHEEL_LEVELS+1];
+	//Every event due up to this time has expired
+	uint64_t wheelTime;
+	std::deque<TimingEvent*> expiredEvents;
+	std::unordered_multimap<ITickJob*,TimingEvent*> jobEvents;
+	std::unordered_map<ITickJob*,tick_stats> stats;
 	SystemState* m_sys;
 	ITickJob* volatile currentJob;
 	bool stopped;
 	static void* timer_worker(TimerThread*);
 	void insertNewEvent(TimingEvent* e);
 	void insertNewEvent_nolock(TimingEvent* e);
+	void linkEvent(TimingEvent* e);
+	void unlinkEvent(TimingEvent* e);
+	void cascade(TimingEvent** slot);
+	//Moves the wheel up to now, the events due meanwhile are appended to expiredEvents
+	void advance(uint64_t now);
+	//The earliest time at which the wheel has something to do, false if it is empty
+	bool getNextWakeUp(uint64_t& time) const;
+	void runTick(ITickJob* job, uint64_t due, bool offloaded);
 	void dumpJobs();
 public:
+	//Jobs whose last run took longer than heavyTickTime microseconds are run on the ThreadPool
+	static bool offloadHeavyTicks;
+	static uint32_t heavyTickTime;
 	TimerThread(SystemState* s);
 	void stop();
 	void wait();
@@ -78,6 +130,9 @@ public:
 	//Returns if the job has been found or not
 	//If the canceled job is currently executing this waits for it to complete
 	bool removeJob(ITickJob* job);
+	bool getTickStats(ITickJob* job, tick_stats& ret);
+	//Logs the lateness of the fires of every job
+	void dumpTickStats();
 };
 
 class Chronometer